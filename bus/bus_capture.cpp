@@ -0,0 +1,103 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <libsk.h>
+#include "bus_capture.h"
+#include "bus_message.h"
+
+bus_capture::bus_capture()
+    : fd_(-1),
+      size_(0),
+      header_(nullptr),
+      drop_count_(0) {}
+
+bus_capture::~bus_capture() {
+    close();
+}
+
+int bus_capture::open(const std::string& path, size_t max_size) {
+    assert_retval(!opened(), -EINVAL);
+
+    if (max_size < sizeof(capture_header) + sizeof(capture_record)) {
+        sk_error("capture size %lu is too small.", max_size);
+        return -EINVAL;
+    }
+
+    int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd == -1) {
+        sk_error("cannot open capture file %s: %s", path.c_str(), strerror(errno));
+        return -errno;
+    }
+
+    // the file is sparse, disk space is only used by the records written
+    if (ftruncate(fd, max_size) != 0) {
+        int err = errno;
+        sk_error("cannot truncate capture file %s: %s", path.c_str(), strerror(err));
+        ::close(fd);
+        return -err;
+    }
+
+    void *addr = mmap(nullptr, max_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (addr == MAP_FAILED) {
+        int err = errno;
+        sk_error("cannot map capture file %s: %s", path.c_str(), strerror(err));
+        ::close(fd);
+        return -err;
+    }
+
+    fd_ = fd;
+    path_ = path;
+    size_ = max_size;
+    drop_count_ = 0;
+    header_ = cast_ptr(capture_header, addr);
+    header_->magic = CAPTURE_MAGIC;
+    header_->version = CAPTURE_VERSION;
+    header_->start_time = sk::time::realtime_ns();
+    header_->count = 0;
+    __atomic_store_n(&header_->used_size, sizeof(capture_header), __ATOMIC_RELEASE);
+
+    sk_info("capture started, file<%s>, max size<%lu>.", path.c_str(), max_size);
+    return 0;
+}
+
+void bus_capture::close() {
+    if (!opened()) return;
+
+    size_t used = header_->used_size;
+    sk_info("capture stopped, file<%s>, records<%lu>, size<%lu>, dropped<%lu>.",
+            path_.c_str(), header_->count, used, drop_count_);
+
+    munmap(header_, size_);
+    if (ftruncate(fd_, used) != 0)
+        sk_warn("cannot truncate capture file %s: %s", path_.c_str(), strerror(errno));
+
+    ::close(fd_);
+    fd_ = -1;
+    size_ = 0;
+    header_ = nullptr;
+}
+
+void bus_capture::append(const bus_message *msg) {
+    capture_record r;
+    r.length = msg->length;
+    r.priority = msg->priority;
+    r.src_busid = msg->src_busid;
+    r.dst_busid = msg->dst_busid;
+    r.ctime = msg->ctime;
+
+    size_t used = header_->used_size;
+    if (unlikely(r.total_length() > size_ - used)) {
+        if (drop_count_++ == 0)
+            sk_warn("capture file %s is full, records<%lu>.", path_.c_str(), header_->count);
+
+        return;
+    }
+
+    r.rtime = sk::time::realtime_ns();
+    char *p = char_ptr(header_) + used;
+    memcpy(p, &r, sizeof(r));
+    memcpy(p + sizeof(r), msg->data, msg->length);
+
+    header_->count += 1;
+    __atomic_store_n(&header_->used_size, used + r.total_length(), __ATOMIC_RELEASE);
+}
@@ -0,0 +1,81 @@
+#ifndef BUS_CAPTURE_H
+#define BUS_CAPTURE_H
+
+#include <string>
+#include "utility/types.h"
+
+struct bus_message;
+
+/*
+ * the capture file written by busd and read by busreplay, it starts with
+ * a capture_header, and then records back to back, each record is a
+ * capture_record followed by the message data, and padded to 8 bytes,
+ * the file is written through a shared mapping, used_size is published
+ * after a record is complete, so a live capture can be read safely
+ */
+static const u32 CAPTURE_MAGIC   = 0x50414342; // "BCAP"
+static const u32 CAPTURE_VERSION = 1;
+
+struct capture_header {
+    u32 magic;
+    u32 version;
+    u64 start_time; // when the capture starts, in nanoseconds
+    u64 used_size;  // size of the header & the complete records
+    u64 count;      // count of the complete records
+};
+
+struct capture_record {
+    u32 length;     // length of the message data
+    u32 priority;   // which lane the message goes to
+    s32 src_busid;
+    s32 dst_busid;
+    u64 ctime;      // creation time of the message, set by the sender
+    u64 rtime;      // when busd routes the message, replay is paced by this
+    char data[0];
+
+    size_t total_length() const {
+        return (sizeof(*this) + length + 7) & ~static_cast<size_t>(7);
+    }
+};
+static_assert(sizeof(capture_record) % 8 == 0, "capture_record must be 8 bytes aligned");
+
+/*
+ * append-only writer of a capture file, the file is created with the
+ * max size as a sparse file, and mapped at once, so capturing a message
+ * costs a memcpy, messages are dropped after the file is full
+ */
+class bus_capture {
+public:
+    MAKE_NONCOPYABLE(bus_capture);
+
+    bus_capture();
+    ~bus_capture();
+
+    /**
+     * @brief create the capture file, an existing file is truncated
+     * @param path: the capture file
+     * @param max_size: max size of the file, in bytes
+     * @return 0 if succeeds, error code otherwise
+     */
+    int open(const std::string& path, size_t max_size);
+
+    // the file is truncated to the size actually used
+    void close();
+
+    bool opened() const { return header_ != nullptr; }
+    const std::string& path() const { return path_; }
+
+    void append(const bus_message *msg);
+
+    u64 count() const { return header_ ? header_->count : 0; }
+    u64 drop_count() const { return drop_count_; }
+
+private:
+    int fd_;
+    std::string path_;
+    size_t size_;            // size of the mapping
+    capture_header *header_; // the mapping, NULL if not opened
+    u64 drop_count_;         // messages dropped as the file is full
+};
+
+#endif // BUS_CAPTURE_H
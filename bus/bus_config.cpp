@@ -62,6 +62,70 @@ static int load_from_xml_node(bus_config& value, const pugi::xml_node& node, con
     if (ret != 0)
         return ret;
 
+    if (node.child("queue_limit")) {
+        ret = load_from_xml_node(value.queue_limit, node.child("queue_limit"), "queue_limit");
+        if (ret != 0)
+            return ret;
+    } else {
+        value.queue_limit = 0;
+    }
+
+    if (node.child("queue_expiry")) {
+        ret = load_from_xml_node(value.queue_expiry, node.child("queue_expiry"), "queue_expiry");
+        if (ret != 0)
+            return ret;
+    } else {
+        value.queue_expiry = 0;
+    }
+
+    if (node.child("queue_drop_oldest")) {
+        ret = load_from_xml_node(value.queue_drop_oldest, node.child("queue_drop_oldest"), "queue_drop_oldest");
+        if (ret != 0)
+            return ret;
+    } else {
+        value.queue_drop_oldest = 0;
+    }
+
+    if (node.child("worker_count")) {
+        ret = load_from_xml_node(value.worker_count, node.child("worker_count"), "worker_count");
+        if (ret != 0)
+            return ret;
+    } else {
+        value.worker_count = 1;
+    }
+
+    if (node.child("conn_per_host")) {
+        ret = load_from_xml_node(value.conn_per_host, node.child("conn_per_host"), "conn_per_host");
+        if (ret != 0)
+            return ret;
+    } else {
+        value.conn_per_host = 1;
+    }
+
+    if (node.child("compress_size")) {
+        ret = load_from_xml_node(value.compress_size, node.child("compress_size"), "compress_size");
+        if (ret != 0)
+            return ret;
+    } else {
+        value.compress_size = 0;
+    }
+
+    if (node.child("capture")) {
+        ret = load_from_xml_node(value.capture, node.child("capture"), "capture");
+        if (ret != 0)
+            return ret;
+    } else {
+        value.capture = "";
+    }
+
+    if (node.child("capture_size")) {
+        ret = load_from_xml_node(value.capture_size, node.child("capture_size"), "capture_size");
+        if (ret != 0)
+            return ret;
+    } else {
+        value.capture_size = 0;
+    }
+
     ret = load_from_xml_node(value.consul_addr_list, node.children("consul_addr_list"), "consul_addr_list");
     if (ret != 0)
         return ret;
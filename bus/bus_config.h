@@ -14,6 +14,17 @@ DEF_CONFIG bus_config {
     size_t shm_size;        // size of the shm segment used by the process itself
     size_t bus_shm_size;    // size of the shm segment used by bus channels
     size_t report_interval; // how many runs between two channel reports
+
+    // the fields below are optional, the default values keep the old behaviour
+    size_t queue_limit = 0;         // max bytes of cached messages of one unresolved destination, 0 means no limit
+    int queue_expiry = 0;           // cached messages older than this(ms) are dropped, 0 means never
+    int queue_drop_oldest = 0;      // drop the oldest(1) or the new(0) message if a queue is full
+    int worker_count = 1;           // how many threads send messages to remote hosts
+    int conn_per_host = 1;          // how many connections to a remote host
+    size_t compress_size = 0;       // compress a batch to remote hosts if it's larger than this, 0 disables,
+                                    // enable it after all the hosts are upgraded, an old busd cannot parse the hello
+    std::string capture = "";       // file to capture routed messages into, see busreplay, empty disables
+    size_t capture_size = 0;        // max size of the capture file
     std::vector<std::string> consul_addr_list;
 
     int load_from_xml_file(const char *filename);
@@ -0,0 +1,118 @@
+#ifndef BUS_MESSAGE_H
+#define BUS_MESSAGE_H
+
+#include <libsk.h>
+
+#define MURMURHASH_SEED 77
+
+/*
+ * besides the normal messages, there are two kinds of control frames,
+ * both are framed as a bus_message with a different magic and zero
+ * src/dst/seq, so they are skipped by the same parsing loop:
+ *   1. hello: sent by the connecting side right after it's connected,
+ *      the data is a u32 mask of the codecs supported by the sender,
+ *      the accepting side replies with its own mask, compression is
+ *      enabled on a connection only after the reply is received
+ *   2. frame: a compressed batch of messages, the data is a u32 codec,
+ *      a u32 length of the decompressed data, then the compressed data
+ * all u32 fields in the data are in network byte order
+ */
+#define BUS_HELLO_MAGIC (MAGIC + 1)
+#define BUS_FRAME_MAGIC (MAGIC + 2)
+
+enum bus_codec {
+    BUS_CODEC_NONE = 0,
+    BUS_CODEC_LZ4  = 1
+};
+
+static const u32 BUS_CODEC_MASK           = 1u << BUS_CODEC_LZ4; // codecs this busd can decode
+static const size_t BUS_FRAME_HEADER_SIZE = 2 * sizeof(u32);     // codec & decompressed length
+static const size_t BUS_MAX_FRAME_SIZE    = 64 * 1024 * 1024;    // max decompressed size of a frame
+
+/*
+ * the message forwarded between busd processes, the header is
+ * transferred in network byte order, see hton() & ntoh()
+ */
+struct bus_message {
+    s32 magic;
+    u32 seq;
+    u32 hash;
+    s32 src_busid;
+    s32 dst_busid;
+    u32 length;
+    u32 priority;  // which lane the message comes from & goes to
+    u64 ctime;
+    char data[0];
+
+    void init(size_t capacity) {
+        this->magic = MAGIC;
+        this->seq = 0;
+        this->hash = 0;
+        this->src_busid = 0;
+        this->dst_busid = 0;
+        this->length = static_cast<u32>(capacity);
+        this->priority = sk::bus::BUS_PRIORITY_NORMAL;
+        this->ctime = 0;
+    }
+
+    void reset(size_t capacity) {
+        length = static_cast<u32>(capacity);
+    }
+
+    size_t total_length() const {
+        return sizeof(*this) + length;
+    }
+
+    void calc_hash() {
+        sk::murmurhash3_x86_32(data, length, MURMURHASH_SEED, &hash);
+    }
+
+    bool verify_hash() const {
+        u32 h = 0;
+        sk::murmurhash3_x86_32(data, length, MURMURHASH_SEED, &h);
+        return h == hash;
+    }
+
+    void ntoh() {
+        magic = ntohs32(magic);
+        seq = ntohu32(seq);
+        hash = ntohu32(hash);
+        src_busid = ntohs32(src_busid);
+        dst_busid = ntohs32(dst_busid);
+        length = ntohu32(length);
+        priority = ntohu32(priority);
+        ctime = ntohu64(ctime);
+    }
+
+    void hton() {
+        magic = htons32(magic);
+        seq = htonu32(seq);
+        hash = htonu32(hash);
+        src_busid = htons32(src_busid);
+        dst_busid = htons32(dst_busid);
+        length = htonu32(length);
+        priority = htonu32(priority);
+        ctime = htonu64(ctime);
+    }
+};
+static_assert(std::is_pod<bus_message>::value, "bus_message must be a POD type.");
+
+static const size_t BUS_HELLO_SIZE = sizeof(bus_message) + sizeof(u32);
+
+/*
+ * fill a hello frame into buf, which is at least BUS_HELLO_SIZE bytes,
+ * the frame is in network byte order, and ready to be sent
+ */
+inline void bus_make_hello(char *buf, u32 codec_mask) {
+    bus_message msg;
+    u32 mask = htonu32(codec_mask);
+    msg.init(sizeof(mask));
+    msg.magic = BUS_HELLO_MAGIC;
+    sk::murmurhash3_x86_32(&mask, sizeof(mask), MURMURHASH_SEED, &msg.hash);
+    msg.hton();
+
+    memcpy(buf, &msg, sizeof(msg));
+    memcpy(buf + sizeof(msg), &mask, sizeof(mask));
+}
+
+#endif // BUS_MESSAGE_H
@@ -1,84 +1,19 @@
+#include <limits>
 #include <libsk.h>
 #include <ifaddrs.h>
 #include <arpa/inet.h>
 #include "bus_config.h"
 #include "bus_router.h"
+#include "bus_worker.h"
+#include "bus_message.h"
+#include "message_queue.h"
 #include <bus/detail/channel_mgr.h>
 #include <shm/detail/shm_segment.h>
 
 #define BUS_KV_PREFIX   "bus/"
-#define MURMURHASH_SEED 77
 
 using namespace std::placeholders;
 
-struct bus_message {
-    s32 magic;
-    u32 seq;
-    u32 hash;
-    s32 src_busid;
-    s32 dst_busid;
-    u32 length;
-    u64 ctime;
-    char data[0];
-
-    void init(size_t capacity) {
-        this->magic = MAGIC;
-        this->seq = 0;
-        this->hash = 0;
-        this->src_busid = 0;
-        this->dst_busid = 0;
-        this->length = static_cast<u32>(capacity);
-        this->ctime = 0;
-    }
-
-    void reset(size_t capacity) {
-        length = static_cast<u32>(capacity);
-    }
-
-    size_t total_length() const {
-        return sizeof(*this) + length;
-    }
-
-    bus_message *dup() const {
-        size_t len = total_length();
-        bus_message *msg = cast_ptr(bus_message, malloc(len));
-        if (likely(msg)) mempcpy(msg, this, len);
-
-        return msg;
-    }
-
-    void calc_hash() {
-        sk::murmurhash3_x86_32(data, length, MURMURHASH_SEED, &hash);
-    }
-
-    bool verify_hash() const {
-        u32 h = 0;
-        sk::murmurhash3_x86_32(data, length, MURMURHASH_SEED, &h);
-        return h == hash;
-    }
-
-    void ntoh() {
-        magic = ntohs32(magic);
-        seq = ntohu32(seq);
-        hash = ntohu32(hash);
-        src_busid = ntohs32(src_busid);
-        dst_busid = ntohs32(dst_busid);
-        length = ntohu32(length);
-        ctime = ntohu64(ctime);
-    }
-
-    void hton() {
-        magic = htons32(magic);
-        seq = htonu32(seq);
-        hash = htonu32(hash);
-        src_busid = htons32(src_busid);
-        dst_busid = htons32(dst_busid);
-        length = htonu32(length);
-        ctime = htonu64(ctime);
-    }
-};
-static_assert(std::is_pod<bus_message>::value, "bus_message must be a POD type.");
-
 static int retrieve_local_address(std::string& ip) {
     ip.clear();
 
@@ -106,47 +41,38 @@ static int retrieve_local_address(std::string& ip) {
     return 0;
 }
 
-bus_router::endpoint::endpoint(bus_router *r, const std::string& host, u16 port)
-    : seed_(0),
-      host_(host),
-      client_(r->loop_, host, port,
-              std::bind(&bus_router::on_server_connected, r, this, _1, _2)) {
-    client_.set_read_callback(std::bind(&bus_router::on_server_message_received, r, this, _1, _2, _3));
-    client_.set_write_callback(std::bind(&bus_router::on_server_message_sent, r, this, _1, _2));
-}
-
-int bus_router::endpoint::init() {
-    if (connection_) return 0;
-    return client_.connect();
-}
-
-void bus_router::endpoint::stop() {
-    client_.stop();
-    connection_.reset();
-}
-
-int bus_router::endpoint::send(bus_message *msg) {
-    sk_assert(connection_);
-
-    size_t len = msg->total_length();
-    msg->magic = MAGIC;
-    msg->seq = ++seed_;
-    msg->calc_hash();
-    msg->hton();
-    ssize_t nbytes = connection_->send(msg, len);
-    if (unlikely(nbytes == -1)) return -errno;
-
-    return 0;
-}
-
 int bus_router::init(uv_loop_t *loop, sk::signal_watcher *watcher,
                      const bus_config& cfg, bool resume_mode) {
     int ret = 0;
 
     loop_ = loop;
+    remote_latency_.clear();
+    remote_raw_bytes_ = 0;
+    remote_wire_bytes_ = 0;
+    remote_frame_count_ = 0;
     listen_port_ = static_cast<u16>(cfg.listen_port);
     loop_rate_ = (cfg.msg_per_run > 0) ? cfg.msg_per_run : 200;
 
+    // no limit by default, like the queues before the limit is introduced
+    queue_size_limit_ = cfg.queue_limit > 0 ? cfg.queue_limit : std::numeric_limits<size_t>::max();
+    queue_expiry_ = static_cast<u64>(cfg.queue_expiry > 0 ? cfg.queue_expiry : 0) * 1000000;
+    queue_drop_oldest_ = cfg.queue_drop_oldest != 0;
+    conn_per_host_ = cfg.conn_per_host > 0 ? cfg.conn_per_host : 1;
+
+    pool_ = new message_pool(MAX_POOLED_CHUNKS);
+    if (!pool_) return -ENOMEM;
+
+    int worker_count = cfg.worker_count > 0 ? cfg.worker_count : 1;
+    for (int i = 0; i < worker_count; ++i) {
+        bus_worker *w = new bus_worker(i, listen_port_, queue_size_limit_, queue_expiry_,
+                                       queue_drop_oldest_, cfg.compress_size);
+        if (!w) return -ENOMEM;
+
+        workers_.push_back(w);
+        ret = w->start();
+        if (ret != 0) return ret;
+    }
+
     buffer_capacity_ = 2 * 1024 * 1024; // 2MB
     size_t total_len = sizeof(bus_message) + buffer_capacity_;
     msg_ = cast_ptr(bus_message, malloc(total_len));
@@ -160,6 +86,9 @@ int bus_router::init(uv_loop_t *loop, sk::signal_watcher *watcher,
     mgr_ = cast_ptr(sk::detail::channel_mgr, seg.address());
     ret = mgr_->init(seg.shmid, cfg.bus_shm_size, resume_mode);
 
+    rebuild_routes();
+    reload_capture(cfg);
+
     consul_ = new sk::consul_client();
     if (!consul_) return -ENOMEM;
 
@@ -189,6 +118,15 @@ int bus_router::init(uv_loop_t *loop, sk::signal_watcher *watcher,
     ret = retrieve_local_address(localhost_);
     if (ret != 0) return ret;
 
+    ret = uv_prepare_init(loop_, &prepare_);
+    if (ret != 0) return ret;
+
+    prepare_.data = this;
+    ret = uv_prepare_start(&prepare_, [](uv_prepare_t *handle) {
+        static_cast<bus_router *>(handle->data)->on_loop_prepare();
+    });
+    if (ret != 0) return ret;
+
     seg.release();
     return 0;
 }
@@ -197,24 +135,38 @@ int bus_router::stop() {
     consul_->stop();
     server_->stop();
 
-    for (const auto& it : host2endpoints_)
-        it.second->stop();
+    // the workers flush what they have got, and exit
+    for (auto w : workers_) {
+        w->notify();
+        w->stop();
+    }
+
+    uv_handle_t *handle = reinterpret_cast<uv_handle_t *>(&prepare_);
+    if (uv_is_active(handle)) {
+        uv_prepare_stop(&prepare_);
+        uv_close(handle, nullptr);
+    }
 
     return 0;
 }
 
 void bus_router::fini() {
-    for (const auto& it : busid2queue_) {
-        for (const auto& msg : it.second)
-            free(msg);
+    for (auto w : workers_) {
+        w->join();
+        delete w;
     }
+    workers_.clear();
+    host2remote_.clear();
+    capture_.close();
+
+    for (const auto& it : busid2queue_)
+        delete it.second;
     busid2queue_.clear();
 
-    for (const auto& it : host2queue_) {
-        for (const auto& msg : it.second)
-            free(msg);
+    if (pool_) {
+        delete pool_;
+        pool_ = nullptr;
     }
-    host2queue_.clear();
 
     if (msg_) {
         free(msg_);
@@ -244,10 +196,37 @@ void bus_router::reload(const bus_config& cfg) {
         sk_warn("listening port hotfix is not supported.");
 
     loop_rate_ = (cfg.msg_per_run > 0) ? cfg.msg_per_run : 200;
+
+    // the new limit only applies to the queues created later
+    queue_size_limit_ = cfg.queue_limit > 0 ? cfg.queue_limit : std::numeric_limits<size_t>::max();
+    queue_expiry_ = static_cast<u64>(cfg.queue_expiry > 0 ? cfg.queue_expiry : 0) * 1000000;
+    queue_drop_oldest_ = cfg.queue_drop_oldest != 0;
+
+    int worker_count = cfg.worker_count > 0 ? cfg.worker_count : 1;
+    if (worker_count != static_cast<int>(workers_.size()))
+        sk_warn("worker count hotfix is not supported.");
+
+    // the workers keep the queue & compression settings they are started with,
+    // and the new connection count applies to new hosts only
+    conn_per_host_ = cfg.conn_per_host > 0 ? cfg.conn_per_host : 1;
+
+    reload_capture(cfg);
+}
+
+void bus_router::reload_capture(const bus_config& cfg) {
+    // the capture can be started or stopped by reloading
+    if (capture_.opened() && capture_.path() == cfg.capture) return;
+
+    capture_.close();
+    if (cfg.capture.empty()) return;
+
+    int ret = capture_.open(cfg.capture, cfg.capture_size);
+    if (ret != 0) sk_error("cannot start capture: %d", ret);
 }
 
 void bus_router::report() const {
     sk_info("========== bus report ==========");
+    sk_info("routes: %lu, table size: %lu", route_count_, routes_.size());
     sk_info("active endpoints: ");
     for (const auto& it : active_endpoints_) {
         std::string str_busid = sk::bus::to_string(it.first);
@@ -260,70 +239,233 @@ void bus_router::report() const {
     info.append("]");
     sk_info("%s", info.c_str());
 
-    sk_info("host -> endpoints: ");
-    for (const auto& it : host2endpoints_)
-        sk_info("host(%s) : %s", it.first.c_str(),
-                it.second->connected() ? "connected" : "not connected");
+    sk_info("host -> connections: ");
+    for (const auto& it : host2remote_)
+        sk_info("host(%s) : %lu", it.first.c_str(), it.second.size());
 
     sk_info("busid -> queue: ");
     for (const auto& it : busid2queue_) {
         std::string str_busid = sk::bus::to_string(it.first);
-        sk_info("busid(%s) -> queue size(%lu)", str_busid.c_str(), it.second.size());
+        sk_info("busid(%s) -> queue count(%lu), size(%lu), drop(%lu)", str_busid.c_str(),
+                it.second->count(), it.second->size(), it.second->drop_count());
     }
 
-    sk_info("host -> queue: ");
-    for (const auto& it : host2queue_)
-        sk_info("host(%s) -> queue size(%lu)", it.first.c_str(), it.second.size());
+    sk_info("queue pool: used chunks(%lu), free chunks(%lu)", pool_->used_count(), pool_->free_count());
+
+    u64 raw_bytes = 0, wire_bytes = 0, frame_count = 0;
+    for (auto w : workers_) {
+        raw_bytes += w->raw_bytes();
+        wire_bytes += w->wire_bytes();
+        frame_count += w->frame_count();
+    }
+
+    sk_info("remote out: raw bytes(%lu), wire bytes(%lu), frames(%lu), ratio(%.3f)",
+            raw_bytes, wire_bytes, frame_count, raw_bytes > 0 ? wire_bytes * 1.0 / raw_bytes : 1.0);
+    sk_info("remote in: raw bytes(%lu), wire bytes(%lu), frames(%lu), ratio(%.3f)",
+            remote_raw_bytes_, remote_wire_bytes_, remote_frame_count_,
+            remote_raw_bytes_ > 0 ? remote_wire_bytes_ * 1.0 / remote_raw_bytes_ : 1.0);
+
+    sk_info("remote latency(ns): count(%lu), p50(%lu), p99(%lu), p999(%lu), max(%lu)",
+            remote_latency_.count, remote_latency_.value_at(50), remote_latency_.value_at(99),
+            remote_latency_.value_at(99.9), remote_latency_.max);
+
+    if (capture_.opened())
+        sk_info("capture: file(%s), records(%lu), dropped(%lu)", capture_.path().c_str(),
+                capture_.count(), capture_.drop_count());
 
     mgr_->report();
     sk_info("========== bus report ==========");
 }
 
-int bus_router::handle_message(bus_message *msg) {
-    // if the destination gets deregistered, just ignore the message
-    if (inactive_endpoints_.find(msg->dst_busid) != inactive_endpoints_.end()) {
-        sk_warn("busid %x is inactive.", msg->dst_busid);
-        return -EINVAL;
+size_t bus_router::route_hash(int busid) {
+    // the bytes of a bus id are not evenly distributed, mix them up
+    u32 h = static_cast<u32>(busid);
+    h ^= h >> 16;
+    h *= 0x85ebca6b;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35;
+    h ^= h >> 16;
+    return static_cast<size_t>(h);
+}
+
+bus_router::route *bus_router::find_route(int busid) {
+    const size_t mask = routes_.size() - 1;
+    for (size_t i = route_hash(busid) & mask; ; i = (i + 1) & mask) {
+        route& r = routes_[i];
+        if (r.busid == busid) return &r;
+        if (r.busid == 0) return nullptr;
     }
+}
+
+void bus_router::rebuild_routes() {
+    // keep the load factor below 0.5, so probing stops quickly
+    size_t count = active_endpoints_.size() + inactive_endpoints_.size();
+    size_t size = 16;
+    while (size < count * 2) size <<= 1;
+
+    std::map<int, int> busid2fd;
+    for (int i = 0; i < mgr_->descriptor_count; ++i)
+        busid2fd[mgr_->descriptor(i)->owner] = i;
+
+    std::vector<route> routes(size);
+    for (auto& r : routes) r.busid = 0;
+
+    auto insert = [&routes, size](int busid) -> route& {
+        size_t i = route_hash(busid) & (size - 1);
+        while (routes[i].busid != 0) i = (i + 1) & (size - 1);
+
+        route& r = routes[i];
+        r.busid = busid;
+        r.kind = ROUTE_INACTIVE;
+        r.fd = -1;
+        r.remote = nullptr;
+        r.host = nullptr;
+        return r;
+    };
+
+    for (int busid : inactive_endpoints_) {
+        assert_continue(busid != 0);
+        insert(busid);
+    }
+
+    for (const auto& it : active_endpoints_) {
+        assert_continue(it.first != 0);
+        route& r = insert(it.first);
+        r.host = &it.second;
+
+        if (it.second == localhost_) {
+            auto fit = busid2fd.find(it.first);
+            r.kind = ROUTE_LOCAL;
+            r.fd = fit != busid2fd.end() ? fit->second : -1;
+            continue;
+        }
+
+        auto rit = host2remote_.find(it.second);
+        r.kind = ROUTE_REMOTE;
+        r.remote = rit != host2remote_.end() ? &rit->second : nullptr;
+    }
+
+    routes_.swap(routes);
+    route_count_ = count;
+    groups_.clear();
+}
+
+const bus_router::group_route& bus_router::fetch_group(int group) {
+    auto it = groups_.find(group);
+    if (likely(it != groups_.end())) return it->second;
 
-    const std::string *host = find_host(msg->dst_busid);
+    group_route& g = groups_[group];
+    std::set<std::string> hosts;
+    for (const auto& e : active_endpoints_) {
+        check_continue(sk::bus::group_match(group, e.first));
 
-    // if host cannot be found, it must be the destination has not been
+        if (e.second == localhost_) {
+            g.locals.push_back(e.first);
+            continue;
+        }
+
+        if (hosts.insert(e.second).second)
+            g.remotes.push_back(e.first);
+    }
+
+    sk_info("group<%s> expanded, local members<%lu>, remote hosts<%lu>.",
+            sk::bus::to_string(group).c_str(), g.locals.size(), g.remotes.size());
+    return g;
+}
+
+int bus_router::handle_group_message(const bus_message *msg, bool from_remote) {
+    const group_route& g = fetch_group(msg->dst_busid);
+    if (unlikely(g.locals.empty() && (from_remote || g.remotes.empty()))) {
+        sk_debug("no member in group %x.", msg->dst_busid);
+        return 0;
+    }
+
+    int ret = 0;
+    for (int busid : g.locals) {
+        // the sender does not receive its own message
+        check_continue(busid != msg->src_busid);
+
+        route *r = find_route(busid);
+        assert_continue(r && r->kind == ROUTE_LOCAL);
+
+        int rc = send_local_message(msg, r->fd, busid);
+        if (rc != 0) ret = rc;
+    }
+
+    // a message from another busd is fanned out locally only,
+    // or it would be bounced between the hosts forever
+    if (from_remote) return ret;
+
+    for (int busid : g.remotes) {
+        route *r = find_route(busid);
+        assert_continue(r && r->kind == ROUTE_REMOTE);
+
+        if (unlikely(!r->remote)) {
+            r->remote = fetch_remote(*r->host);
+            if (unlikely(!r->remote)) {
+                sk_error("cannot fetch remote host: %s", r->host->c_str());
+                ret = -ENOENT;
+                continue;
+            }
+        }
+
+        int rc = send_remote_message(r->remote, msg);
+        if (rc != 0) ret = rc;
+    }
+
+    return ret;
+}
+
+int bus_router::handle_message(bus_message *msg, bool from_remote) {
+    if (unlikely(sk::bus::is_group(msg->dst_busid)))
+        return handle_group_message(msg, from_remote);
+
+    route *r = find_route(msg->dst_busid);
+
+    // if route cannot be found, it must be the destination has not been
     // registered to consul, so we cache the message to send it later
-    if (unlikely(!host)) {
+    if (unlikely(!r)) {
         sk_info("host not found for %x, cache the message.", msg->dst_busid);
         enqueue(msg->dst_busid, msg);
         return 0;
     }
 
-    // destination is on local host, send directly
-    if (*host == localhost_) return send_local_message(msg);
-
-    // the destination is not localhost
-    endpoint *p = fetch_endpoint(*host);
-    if (unlikely(!p)) {
-        sk_error("cannot fetch endpoint: %s", host->c_str());
-        return -ENOENT;
+    // if the destination gets deregistered, just ignore the message
+    if (unlikely(r->kind == ROUTE_INACTIVE)) {
+        sk_warn("busid %x is inactive.", msg->dst_busid);
+        return -EINVAL;
     }
 
-    // if the remote host is connected, just send the message
-    if (likely(p->connected())) {
-        sk_assert(host2queue_.find(*host) == host2queue_.end());
-        return p->send(msg);
+    // destination is on local host, send directly
+    if (r->kind == ROUTE_LOCAL) return send_local_message(msg, r->fd);
+
+    // the destination is not localhost, the connections are
+    // created on the first message, and then cached in the route
+    if (unlikely(!r->remote)) {
+        r->remote = fetch_remote(*r->host);
+        if (unlikely(!r->remote)) {
+            sk_error("cannot fetch remote host: %s", r->host->c_str());
+            return -ENOENT;
+        }
     }
 
-    // the remote is not connected, cache the message, send it later
-    sk_info("endpoint %s not connected, cache the message, bus: %x",
-            host->c_str(), msg->dst_busid);
-    enqueue(*host, msg);
-    return 0;
+    return send_remote_message(r->remote, msg);
 }
 
-int bus_router::send_local_message(const bus_message *msg) {
-    int fd = -1;
-    sk::detail::channel *rc = mgr_->find_read_channel(msg->dst_busid, fd);
+int bus_router::send_local_message(const bus_message *msg, int& fd, int dst_busid) {
+    if (dst_busid == 0) dst_busid = msg->dst_busid;
+
+    // the descriptor cached by the caller might be stale, verify it,
+    // the one found is written back, so the lookup is not repeated
+    sk::detail::channel *rc = nullptr;
+    if (likely(fd >= 0 && fd < mgr_->descriptor_count &&
+               mgr_->descriptor(fd)->owner == dst_busid))
+        rc = mgr_->get_read_channel(fd);
+    else
+        rc = mgr_->find_read_channel(dst_busid, fd);
+
     if (unlikely(!rc)) {
-        sk_error("cannot get channel<%x>.", msg->dst_busid);
+        sk_error("cannot get channel<%x>.", dst_busid);
         return -EINVAL;
     }
 
@@ -332,58 +474,102 @@ int bus_router::send_local_message(const bus_message *msg) {
         return -EINVAL;
     }
 
-    int ret = rc->push(msg->src_busid, msg->dst_busid, msg->ctime, msg->data, msg->length);
+    // the owner resized the channel, busd is the producer of the read
+    // channel, so it's busd who switches to the new ring
+    if (unlikely(!rc->legacy() && rc->next_offset != 0)) {
+        rc = mgr_->switch_read_channel(fd);
+        assert_retval(rc, -EINVAL);
+    }
+
+    // the message goes to the same lane as it comes from, so the order of
+    // messages with the same priority is kept, even across hosts
+    sk::detail::channel *lane = rc->lane(static_cast<int>(msg->priority));
+    int ret = lane->push(msg->src_busid, msg->dst_busid, msg->ctime, msg->data, msg->length);
     if (unlikely(ret != 0)) {
-        sk_error("push message error<%d>, bus<%x>.", ret, msg->dst_busid);
+        // busd never retries, so the message is given up here
+        if (ret == -ENOMEM) lane->record_drop();
+        sk_error("push message error<%d>, bus<%x>.", ret, dst_busid);
         return ret;
     }
 
+    // the process is polling the channel, no need to wake it up
+    if (rc->polled()) return 0;
+
     sigval value;
     memset(&value, 0x00, sizeof(value));
     value.sival_int = fd;
-    ret = sigqueue(mgr_->descriptors[fd].pid, sk::bus::BUS_INCOMING_SIGNO, value);
+    ret = sigqueue(mgr_->descriptor(fd)->pid, sk::bus::BUS_INCOMING_SIGNO, value);
     if (ret != 0) sk_warn("cannot send signal: %s", strerror(errno));
 
     return 0;
 }
 
-const std::string *bus_router::find_host(int busid) const {
-    auto it = active_endpoints_.find(busid);
-    if (it != active_endpoints_.end())
-        return &(it->second);
+int bus_router::send_remote_message(const remote_host *remote, const bus_message *msg) {
+    assert_retval(!remote->empty(), -EINVAL);
 
-    return nullptr;
+    // the same (src, dst) pair always goes through the same connection
+    u32 h = (static_cast<u32>(msg->src_busid) * 0x9e3779b1) ^ static_cast<u32>(msg->dst_busid);
+    const remote_endpoint& e = (*remote)[route_hash(static_cast<int>(h)) % remote->size()];
+    return e.worker->post(e.id, msg);
 }
 
-void bus_router::enqueue(int busid, const bus_message *msg) {
-    bus_message *m = msg->dup();
-    busid2queue_[busid].push_back(m);
+message_queue *bus_router::create_queue() {
+    return new message_queue(pool_, queue_size_limit_, queue_drop_oldest_);
 }
 
-void bus_router::enqueue(const std::string& host, const bus_message *msg) {
-    bus_message *m = msg->dup();
-    host2queue_[host].push_back(m);
+void bus_router::expire(message_queue *q) {
+    if (queue_expiry_ <= 0) return;
+
+    u64 now = sk::time::realtime_ns();
+    size_t count = q->expire(now > queue_expiry_ ? now - queue_expiry_ : 0);
+    if (count > 0) sk_warn("%lu cached messages expired.", count);
 }
 
-bus_router::endpoint *bus_router::fetch_endpoint(const std::string& host) {
-    assert_retval(host != localhost_, nullptr);
+int bus_router::enqueue(message_queue *q, const bus_message *msg) {
+    expire(q);
+
+    int ret = q->push(msg, msg->total_length(), msg->ctime);
+    if (ret != 0)
+        sk_warn("cannot cache message: %d, dst: %x, queue size: %lu",
+                ret, msg->dst_busid, q->size());
 
-    auto it = host2endpoints_.find(host);
-    if (it != host2endpoints_.end())
-        return it->second;
+    return ret;
+}
 
-    endpoint *p = new endpoint(this, host, listen_port_);
-    assert_retval(p, nullptr);
+void bus_router::enqueue(int busid, const bus_message *msg) {
+    message_queue *&q = busid2queue_[busid];
+    if (!q) q = create_queue();
+    assert_retnone(q);
 
-    int ret = p->init();
-    if (ret != 0) {
-        sk_error("endpoint init error: %d", ret);
-        delete p;
-        return nullptr;
+    enqueue(q, msg);
+}
+
+bus_router::remote_host *bus_router::fetch_remote(const std::string& host) {
+    assert_retval(host != localhost_, nullptr);
+
+    auto it = host2remote_.find(host);
+    if (it != host2remote_.end())
+        return &it->second;
+
+    // the connections of different hosts start from different workers,
+    // so the connections are spread evenly even if there are few hosts
+    remote_host remote;
+    size_t first = host2remote_.size();
+    for (int i = 0; i < conn_per_host_; ++i) {
+        bus_worker *w = workers_[(first + i) % workers_.size()];
+        int id = w->add_endpoint(host);
+        if (id < 0) {
+            sk_error("cannot add endpoint: %d, host: %s", id, host.c_str());
+            return nullptr;
+        }
+
+        remote_endpoint e;
+        e.worker = w;
+        e.id = id;
+        remote.push_back(e);
     }
 
-    host2endpoints_.insert(std::make_pair(host, p));
-    return p;
+    return &host2remote_.insert(std::make_pair(host, remote)).first->second;
 }
 
 void bus_router::on_client_connected(int error, const sk::tcp_connection_ptr& conn) {
@@ -392,9 +578,8 @@ void bus_router::on_client_connected(int error, const sk::tcp_connection_ptr& co
         return;
     }
 
-    auto it = host2seq_.find(conn->remote_address().host());
-    if (it != host2seq_.end()) host2seq_.erase(it);
-    host2seq_[conn->remote_address().host()] = 0;
+    // a host may connect several times, the sequence is kept per connection
+    conn2seq_[conn->remote_address().as_string()] = 0;
 
     sk_info("client %s connected.", conn->remote_address().as_string().c_str());
     conn->recv();
@@ -405,9 +590,9 @@ void bus_router::on_client_message_received(int error, const sk::tcp_connection_
         sk_info("get eof, client: %s", conn->remote_address().as_string().c_str());
         conn->close();
 
-        auto it = host2seq_.find(conn->remote_address().host());
-        sk_assert(it != host2seq_.end());
-        host2seq_.erase(it);
+        auto it = conn2seq_.find(conn->remote_address().as_string());
+        sk_assert(it != conn2seq_.end());
+        if (it != conn2seq_.end()) conn2seq_.erase(it);
 
         return;
     }
@@ -416,27 +601,48 @@ void bus_router::on_client_message_received(int error, const sk::tcp_connection_
         sk_error("cannot read: %s", strerror(error));
         conn->close();
 
-        auto it = host2seq_.find(conn->remote_address().host());
-        sk_assert(it != host2seq_.end());
-        host2seq_.erase(it);
+        auto it = conn2seq_.find(conn->remote_address().as_string());
+        sk_assert(it != conn2seq_.end());
+        if (it != conn2seq_.end()) conn2seq_.erase(it);
 
         return;
     }
 
+    // look up the sequence once for all the messages in the buffer
+    auto it = conn2seq_.find(conn->remote_address().as_string());
+    if (it == conn2seq_.end()) {
+        sk_assert(0);
+        it = conn2seq_.insert(std::make_pair(conn->remote_address().as_string(), 0)).first;
+    }
+
+    size_t len = handle_messages(conn, it->second, cast_ptr(char, buf->mutable_peek()), buf->size(), false);
+    remote_wire_bytes_ += len;
+    buf->consume(len);
+
+    conn->recv();
+}
+
+size_t bus_router::handle_messages(const sk::tcp_connection_ptr& conn, u32& seq,
+                                   char *data, size_t length, bool nested) {
     const static size_t min_size = sizeof(bus_message);
+    size_t offset = 0;
+
+    // the messages in the buffer arrive together, one timestamp is enough
+    const u64 now = sk::time::realtime_ns();
+
     // NOTE: the logic in this while(...) loop is tricky, BE CAREFUL!!
-    while (buf->size() >= min_size) {
-        bus_message *msg = cast_ptr(bus_message, buf->mutable_peek());
+    while (length - offset >= min_size) {
+        bus_message *msg = cast_ptr(bus_message, data + offset);
         // ntoh length only, if the message is complete, then ntoh entire header
         msg->length = ntohu32(msg->length);
 
-        if (buf->size() < msg->total_length()) {
+        if (length - offset < msg->total_length()) {
             if (sk_trace_enabled())
                 sk_trace("partial msg, src: %x, dst: %x, size: %lu, total: %lu",
                          htons32(msg->src_busid), htons32(msg->dst_busid),
-                         buf->size(), msg->total_length());
+                         length - offset, msg->total_length());
             msg->length = htonu32(msg->length); // don't forget to set it back
-            return;
+            break;
         }
 
         // hton length back, then ntoh entire header
@@ -444,88 +650,102 @@ void bus_router::on_client_message_received(int error, const sk::tcp_connection_
         msg->ntoh();
 
         do {
+            // control frames are never nested in a compressed frame
+            if (!nested && msg->magic == BUS_HELLO_MAGIC) {
+                handle_hello(conn, msg);
+                break;
+            }
+
+            if (!nested && msg->magic == BUS_FRAME_MAGIC) {
+                handle_frame(conn, seq, msg);
+                break;
+            }
+
             // if the magic and hash does not match, the message must be invalid
             assert_break(msg->magic == MAGIC);
             assert_break(msg->verify_hash());
 
-            auto it = host2seq_.find(conn->remote_address().host());
-            if (it == host2seq_.end()) {
-                sk_assert(0);
-                host2seq_[conn->remote_address().host()] = msg->seq - 1;
-                it = host2seq_.find(conn->remote_address().host());
-            }
+            sk_assert(msg->seq == seq + 1);
+            seq = msg->seq;
 
-            sk_assert(msg->seq == it->second + 1);
-            it->second = msg->seq;
+            remote_latency_.record(now > msg->ctime ? now - msg->ctime : 0);
+            remote_raw_bytes_ += msg->total_length();
 
-            int ret = handle_message(msg);
+            if (unlikely(capture_.opened())) capture_.append(msg);
+
+            int ret = handle_message(msg, true);
             if (ret != 0) sk_error("handle message error: %d, dst_busid: %x", ret, msg->dst_busid);
         } while (0);
 
         // no matter the message is invalid or not, we consume it
-        buf->consume(msg->total_length());
+        offset += msg->total_length();
     }
 
-    conn->recv();
+    return offset;
 }
 
-void bus_router::on_client_message_sent(int, const sk::tcp_connection_ptr& conn) {
-    sk_assert(0);
-    sk_fatal("this function should never be called: %s", conn->remote_address().as_string().c_str());
-}
-
-void bus_router::on_server_connected(endpoint *p, int error,
-                                     const sk::tcp_connection_ptr& conn) {
-    sk_assert(host2endpoints_.find(p->host()) != host2endpoints_.end());
+void bus_router::handle_hello(const sk::tcp_connection_ptr& conn, const bus_message *msg) {
+    assert_retnone(msg->verify_hash());
+    assert_retnone(msg->length >= sizeof(u32));
 
-    if (error != 0) {
-        sk_fatal("cannot connect: %s, host: %s", strerror(error), p->host().c_str());
-        return; // TODO: shouldn't we retry here??
-    }
+    u32 mask = 0;
+    memcpy(&mask, msg->data, sizeof(mask));
+    sk_info("hello from client: %s, codecs: %x",
+            conn->remote_address().as_string().c_str(), ntohu32(mask));
 
-    sk_debug("connected to remote: %s", p->host().c_str());
-    sk_assert(!p->connected());
-    p->set_connection(conn);
+    // decompression is always available, reply with all the codecs supported
+    char hello[BUS_HELLO_SIZE];
+    bus_make_hello(hello, BUS_CODEC_MASK);
 
-    auto it = host2queue_.find(p->host());
-    assert_retnone(it != host2queue_.end());
+    int ret = conn->send(hello, sizeof(hello));
+    if (ret != 0) sk_error("cannot reply hello: %d, client: %s", ret,
+                           conn->remote_address().as_string().c_str());
+}
 
-    message_queue& q = it->second;
-    sk_debug("process queue: %s, size: %lu", p->host().c_str(), q.size());
+void bus_router::handle_frame(const sk::tcp_connection_ptr& conn, u32& seq, const bus_message *msg) {
+    assert_retnone(msg->verify_hash());
+    assert_retnone(msg->length >= BUS_FRAME_HEADER_SIZE);
 
-    sk_assert(!q.empty());
-    while (!q.empty()) {
-        std::unique_ptr<bus_message, void(*)(void*)> msg(q.front(), ::free);
-        q.pop_front();
+    u32 header[2];
+    memcpy(header, msg->data, sizeof(header));
+    u32 codec = ntohu32(header[0]);
+    size_t raw_size = ntohu32(header[1]);
 
-        int ret = p->send(msg.get());
-        if (ret != 0) // TODO: more robust handling here??
-            sk_error("cannot send msg: %d, host: %s", ret, p->host().c_str());
+    if (codec != BUS_CODEC_LZ4 || raw_size > BUS_MAX_FRAME_SIZE) {
+        sk_error("invalid frame, codec: %u, size: %lu, client: %s", codec, raw_size,
+                 conn->remote_address().as_string().c_str());
+        return;
     }
 
-    host2queue_.erase(it);
-}
-
-void bus_router::on_server_message_received(endpoint *p, int error, const sk::tcp_connection_ptr& conn, sk::buffer *buf) {
-    sk_assert(host2endpoints_.find(p->host()) != host2endpoints_.end());
-
-    if (error != sk::tcp_connection::READ_EOF) {
-        sk_assert(0);
-        sk_fatal("this function can only be called by EOF, host: %s", p->host().c_str());
+    char *raw = cast_ptr(char, frame_.prepare(raw_size));
+    int ret = sk::lz4_decompress(msg->data + BUS_FRAME_HEADER_SIZE,
+                                 msg->length - BUS_FRAME_HEADER_SIZE, raw, raw_size);
+    if (ret != static_cast<int>(raw_size)) {
+        sk_error("cannot decompress frame: %d, size: %lu, client: %s", ret, raw_size,
+                 conn->remote_address().as_string().c_str());
         return;
     }
 
-    sk_info("get eof, server: %s", conn->remote_address().as_string().c_str());
-    // TODO: handle eof here, reconnect??
+    ++remote_frame_count_;
+
+    // a batch is always compressed as a whole, no partial message inside
+    size_t len = handle_messages(conn, seq, raw, raw_size, true);
+    if (len != raw_size)
+        sk_error("partial message in frame, size: %lu, handled: %lu, client: %s", raw_size,
+                 len, conn->remote_address().as_string().c_str());
 }
 
-void bus_router::on_server_message_sent(endpoint *p, int error, const sk::tcp_connection_ptr& conn) {
-    sk_assert(host2endpoints_.find(p->host()) != host2endpoints_.end());
+void bus_router::on_client_message_sent(int error, const sk::tcp_connection_ptr& conn) {
+    // only hello replies are sent to the clients
+    if (error != 0)
+        sk_error("send error: %s, client: %s", strerror(error), conn->remote_address().as_string().c_str());
+}
 
-    if (error != 0) {
-        sk_error("send error: %s, host: %s", strerror(error), p->host().c_str());
-        return; // TODO: more robust handling here??
-    }
+void bus_router::on_loop_prepare() {
+    // all messages handled in this loop iteration are posted, wake up
+    // the workers once, so they send the messages in large batches
+    for (auto w : workers_)
+        w->notify();
 }
 
 void bus_router::on_signal(const signalfd_siginfo *info) {
@@ -544,28 +764,82 @@ void bus_router::on_local_message(int fd) {
         return;
     }
 
-    const sk::detail::channel_descriptor& desc = mgr_->descriptors[fd];
+    const sk::detail::channel_descriptor& desc = *mgr_->descriptor(fd);
     if (desc.closed) {
         sk_error("channel<%x> closed.", desc.owner);
         return;
     }
 
-    sk::detail::channel *wc = mgr_->get_write_channel(fd);
+    sk::detail::channel *head = mgr_->get_write_channel(fd);
+    assert_retnone(head);
+
+    // lanes are drained by strict priority, and the count is shared
+    // by all lanes, to avoid other channels getting starved, messages
+    // in the ring retired by resizing go before the ones in the head
+    int count = 0;
+    sk::detail::channel *retired = mgr_->get_retired_channel(head);
+    if (unlikely(retired)) {
+        for (int i = 0; i < sk::detail::CHANNEL_LANE_COUNT && count < loop_rate_; ++i) {
+            check_continue(retired->has_lane(i));
+            count += pop_local_messages(retired->lane(i), desc.owner, i, loop_rate_ - count);
+        }
+
+        bool empty = true;
+        for (int i = 0; i < sk::detail::CHANNEL_LANE_COUNT; ++i) {
+            check_continue(retired->has_lane(i));
+            if (retired->lane(i)->message_count() > 0) empty = false;
+        }
+
+        // the owner never signals for the retired ring again, so busd
+        // signals itself to come back for the messages left
+        if (!empty) {
+            sigval value;
+            memset(&value, 0x00, sizeof(value));
+            value.sival_int = fd;
+            int ret = sigqueue(mgr_->pid, sk::bus::BUS_OUTGOING_SIGNO, value);
+            if (ret != 0) sk_warn("cannot send signal: %s", strerror(errno));
+            return;
+        }
+
+        mgr_->release_retired_channel(head);
+    }
+
+    for (int i = 0; i < sk::detail::CHANNEL_LANE_COUNT && count < loop_rate_; ++i) {
+        check_continue(head->has_lane(i));
+        count += pop_local_messages(head->lane(i), desc.owner, i, loop_rate_ - count);
+    }
+
+    // the process failed to send a message because the channel was full,
+    // now it has enough space, notify the process to send again
+    bool writable = false;
+    for (int i = 0; i < sk::detail::CHANNEL_LANE_COUNT; ++i) {
+        check_continue(head->has_lane(i));
+        if (head->lane(i)->test_writable()) writable = true;
+    }
+
+    if (writable) {
+        sigval value;
+        memset(&value, 0x00, sizeof(value));
+        value.sival_int = fd;
+        int ret = sigqueue(desc.pid, sk::bus::BUS_WRITABLE_SIGNO, value);
+        if (ret != 0) sk_warn("cannot send signal: %s", strerror(errno));
+    }
+}
 
-    // limit the count here to avoid other channels
-    // getting starved if this channel is super busy
+int bus_router::pop_local_messages(sk::detail::channel *wc, int owner, int priority, int limit) {
     int count = 0;
-    while (count < loop_rate_) {
+    while (count < limit) {
         msg_->reset(buffer_capacity_);
         size_t len = msg_->length;
         int ret = wc->pop(msg_->data, len, &msg_->src_busid, &msg_->dst_busid, &msg_->ctime);
         if (ret == 0) break;
 
         msg_->length = static_cast<u32>(len);
+        msg_->priority = static_cast<u32>(priority);
 
         if (unlikely(ret < 0)) {
             if (ret != -E2BIG) {
-                sk_error("pop message error, ret<%d>, process<%d>.", ret, desc.owner);
+                sk_error("pop message error, ret<%d>, process<%d>.", ret, owner);
                 continue;
             }
 
@@ -583,18 +857,23 @@ void bus_router::on_local_message(int fd) {
             assert_continue(ret != 0);
 
             msg_->length = static_cast<u32>(len);
+            msg_->priority = static_cast<u32>(priority);
 
             if (unlikely(ret < 0)) {
                 sk_assert(ret != -E2BIG);
-                sk_error("pop message error, ret<%d>, process<%x>.", ret, desc.owner);
+                sk_error("pop message error, ret<%d>, process<%x>.", ret, owner);
                 continue;
             }
         }
 
         if (likely(ret == 1)) {
             count += 1;
-            if (msg_->src_busid != desc.owner)
-                sk_warn("bus mismatch, message<%x>, channel<%x>.", msg_->src_busid, desc.owner);
+            if (msg_->src_busid != owner)
+                sk_warn("bus mismatch, message<%x>, channel<%x>.", msg_->src_busid, owner);
+
+            // messages are captured where they enter busd, so a message
+            // cached for an unresolved destination is captured only once
+            if (unlikely(capture_.opened())) capture_.append(msg_);
 
             int rc = handle_message(msg_);
             if (rc != 0)
@@ -606,6 +885,8 @@ void bus_router::on_local_message(int fd) {
         // it should NOT get here
         sk_assert(0);
     }
+
+    return count;
 }
 
 void bus_router::on_descriptor_change(int fd) {
@@ -614,13 +895,26 @@ void bus_router::on_descriptor_change(int fd) {
         return;
     }
 
-    const sk::detail::channel_descriptor& desc = mgr_->descriptors[fd];
+    const sk::detail::channel_descriptor& desc = *mgr_->descriptor(fd);
+
+    // the channel might be resized, switch to the new read channel now,
+    // or the messages sent before resizing wait for the next message
+    if (!desc.closed) mgr_->switch_read_channel(fd);
+
     bool active = active_endpoints_.find(desc.owner) != active_endpoints_.end();
     bool inactive = inactive_endpoints_.find(desc.owner) != inactive_endpoints_.end();
     sk_assert((!active && !inactive) || // not registered at all
               (active  && !inactive) || // registered
               (!active && inactive));   // deretistered
 
+    // the process registers again with the consul key still there, the
+    // route is kept, but it goes to the new descriptor from now on
+    if (active && !desc.closed) {
+        route *r = find_route(desc.owner);
+        if (r && r->kind == ROUTE_LOCAL) r->fd = fd;
+        return;
+    }
+
     // channel registered, but not added to consul
     if (!active && !desc.closed) {
         std::string key(BUS_KV_PREFIX + sk::bus::to_string(desc.owner));
@@ -680,6 +974,7 @@ void bus_router::on_route_watch(int ret, int index,
         }
     }
     active_endpoints_.swap(active);
+    rebuild_routes();
 
     for (const auto& it : active_endpoints_) {
         int busid = it.first;
@@ -687,18 +982,19 @@ void bus_router::on_route_watch(int ret, int index,
         if (sit == busid2queue_.end())
             continue;
 
-        message_queue& q = sit->second;
-        sk_debug("process queue: %x, size: %lu", busid, q.size());
-        while (!q.empty()) {
-            std::unique_ptr<bus_message, void(*)(void*)> msg(q.front(), ::free);
-            q.pop_front();
+        std::unique_ptr<message_queue> q(sit->second);
+        busid2queue_.erase(sit);
+        expire(q.get());
+        sk_debug("process queue: %x, count: %lu", busid, q->count());
 
-            int ret = handle_message(msg.get());
+        size_t len = 0;
+        while (bus_message *msg = cast_ptr(bus_message, q->front(len))) {
+            int ret = handle_message(msg);
             if (ret != 0)
                 sk_error("handle message error: %d, dst: %x", ret, msg->dst_busid);
-        }
 
-        busid2queue_.erase(sit);
+            q->pop();
+        }
     }
 
     ret = consul_->watch(BUS_KV_PREFIX, index,
@@ -725,23 +1021,26 @@ void bus_router::on_route_set(int ret, const std::string& key, const std::string
 
     active_endpoints_[busid] = value;
     inactive_endpoints_.erase(busid);
+    rebuild_routes();
 
     auto it = busid2queue_.find(busid);
     if (existing) sk_assert(it == busid2queue_.end());
     if (it == busid2queue_.end()) return;
 
-    message_queue& q = it->second;
-    sk_debug("process queue: %x, size: %lu", busid, q.size());
-    while (!q.empty()) {
-        std::unique_ptr<bus_message, void(*)(void*)> msg(q.front(), ::free);
-        q.pop_front();
+    std::unique_ptr<message_queue> q(it->second);
+    busid2queue_.erase(it);
+    expire(q.get());
+    sk_debug("process queue: %x, count: %lu", busid, q->count());
 
-        int ret = send_local_message(msg.get());
+    int fd = -1;
+    size_t len = 0;
+    while (bus_message *msg = cast_ptr(bus_message, q->front(len))) {
+        int ret = send_local_message(msg, fd);
         if (ret != 0)
             sk_error("cannot send local message: %d, dst: %x", ret, msg->dst_busid);
-    }
 
-    busid2queue_.erase(it);
+        q->pop();
+    }
 }
 
 void bus_router::on_route_del(int ret, bool recursive, const std::string& key) {
@@ -761,4 +1060,5 @@ void bus_router::on_route_del(int ret, bool recursive, const std::string& key) {
     int busid = sk::bus::from_string(str_busid.c_str());
     active_endpoints_.erase(busid);
     inactive_endpoints_.insert(busid);
+    rebuild_routes();
 }
@@ -5,17 +5,21 @@
 #include <set>
 #include <list>
 #include <string>
+#include <vector>
 #include <core/tcp_server.h>
-#include <core/tcp_client.h>
 #include <core/tcp_connection.h>
+#include <bus/detail/channel_stats.h>
+#include "bus_capture.h"
 
 struct bus_config;
 struct bus_message;
-class  bus_endpoint;
+class  bus_worker;
+class  message_pool;
+class  message_queue;
 struct signalfd_siginfo;
 
 namespace sk { class signal_watcher; class consul_client;
-namespace detail { struct channel_mgr; }}
+namespace detail { struct channel_mgr; struct channel; }}
 
 class bus_router {
 public:
@@ -28,40 +32,75 @@ public:
     void on_signal(const signalfd_siginfo *info);
 
 private:
-    class endpoint {
-    public:
-        endpoint(bus_router *r, const std::string& host, u16 port);
-        int init();
-        void stop();
-
-        const std::string& host() const { return host_; }
-        void set_connection(const sk::tcp_connection_ptr& conn) {
-            this->connection_ = conn;
-        }
-
-        bool connected() const {
-            bool yes = !!connection_;
-            if (yes) sk_assert(!client_.connecting() && !client_.disconnected());
-            return yes;
-        }
-
-        int send(bus_message *msg);
-
-    private:
-        u32 seed_; // sequence generator
-        std::string host_;
-        sk::tcp_client client_;
-        sk::tcp_connection_ptr connection_;
+    /*
+     * a remote host is served by several connections, which are spread
+     * over the workers, a message goes through the connection picked by
+     * the hash of its (src, dst) pair, so the messages between the same
+     * pair of processes are still sent in order
+     */
+    struct remote_endpoint {
+        bus_worker *worker;
+        int id; // endpoint id in the worker
+    };
+
+    typedef std::vector<remote_endpoint> remote_host;
+
+private:
+    /*
+     * routes are compiled from active_endpoints_ & inactive_endpoints_ into
+     * an open addressing hash table keyed by bus id, so routing a message
+     * costs a probe or two, the table is rebuilt whenever routes change
+     */
+    enum route_kind {
+        ROUTE_INACTIVE = 0, // destination is deregistered
+        ROUTE_LOCAL    = 1, // destination is on localhost
+        ROUTE_REMOTE   = 2  // destination is on a remote host
+    };
+
+    struct route {
+        int busid;     // 0 if the slot is empty, as bus id 0 is invalid
+        int kind;      // route_kind
+        int fd;        // descriptor of a local destination, -1 if unknown
+        remote_host *remote; // connections of a remote destination, created lazily
+        const std::string *host; // host of a remote destination
+    };
+
+    static size_t route_hash(int busid);
+    void rebuild_routes();
+    route *find_route(int busid);
+
+    /*
+     * members of a group destination, see BUS_ANY_ID in bus.h, a group is
+     * expanded on the first message sent to it, and the result is cached
+     * until the routes get rebuilt, only one member is kept for a remote
+     * host, as the busd there fans the message out to its local members
+     */
+    struct group_route {
+        std::vector<int> locals;  // local members
+        std::vector<int> remotes; // a member per remote host
     };
 
+    const group_route& fetch_group(int group);
+
 private:
     void report() const;
-    int  handle_message(bus_message *msg);
-    int  send_local_message(const bus_message *msg);
-    const std::string *find_host(int busid) const;
+    void reload_capture(const bus_config& cfg);
+    // from_remote: the message is received from another busd
+    int  handle_message(bus_message *msg, bool from_remote = false);
+    int  handle_group_message(const bus_message *msg, bool from_remote);
+    /*
+     * dst_busid: the process to deliver to, 0 means msg->dst_busid
+     * fd: the descriptor of the process cached by the caller, -1 if
+     * unknown, it's updated if it's stale, so it's looked up only once
+     */
+    int  send_local_message(const bus_message *msg, int& fd, int dst_busid = 0);
+    int  pop_local_messages(sk::detail::channel *wc, int owner, int priority, int limit);
+    int  send_remote_message(const remote_host *remote, const bus_message *msg);
     void enqueue(int busid, const bus_message *msg);
-    void enqueue(const std::string& host, const bus_message *msg);
-    endpoint *fetch_endpoint(const std::string& host);
+    int  enqueue(message_queue *q, const bus_message *msg);
+    message_queue *create_queue();
+    void expire(message_queue *q);
+    remote_host *fetch_remote(const std::string& host);
 
 private:
     // tcp server callbacks
@@ -71,14 +110,18 @@ private:
                                     sk::buffer *buf);
     void on_client_message_sent(int error, const sk::tcp_connection_ptr& conn);
 
-    // tcp client callbacks
-    void on_server_connected(endpoint *p, int error,
-                             const sk::tcp_connection_ptr& conn);
-    void on_server_message_received(endpoint *p, int error,
-                                    const sk::tcp_connection_ptr& conn,
-                                    sk::buffer *buf);
-    void on_server_message_sent(endpoint *p,
-                                int error, const sk::tcp_connection_ptr& conn);
+    /*
+     * handle the complete messages received from a client, returns how
+     * many bytes are consumed, "nested" is true if the messages are
+     * decompressed from a frame, see bus_message.h for the frames
+     */
+    size_t handle_messages(const sk::tcp_connection_ptr& conn, u32& seq,
+                           char *data, size_t length, bool nested);
+    void handle_hello(const sk::tcp_connection_ptr& conn, const bus_message *msg);
+    void handle_frame(const sk::tcp_connection_ptr& conn, u32& seq, const bus_message *msg);
+
+    // loop callbacks
+    void on_loop_prepare();
 
     // signal callbacks
     void on_local_message(int fd);
@@ -92,6 +135,7 @@ private:
 
 private:
     static const int MAX_BACKLOG = 512;
+    static const size_t MAX_POOLED_CHUNKS = 64;      // max free chunks kept by pool_
 
     u16 listen_port_;
     int loop_rate_;          // how many messages will be processed in one loop
@@ -101,6 +145,7 @@ private:
     sk::detail::channel_mgr *mgr_;
 
     uv_loop_t *loop_;
+    uv_prepare_t prepare_; // wakes up the workers before the loop blocks
     sk::tcp_server *server_;
     sk::consul_client *consul_;
 
@@ -108,18 +153,39 @@ private:
     std::map<int, std::string> active_endpoints_;
     std::set<int> inactive_endpoints_;
 
-    std::map<std::string, endpoint*> host2endpoints_;
-    std::map<std::string, u32> host2seq_;  // host -> last received sequence
+    std::vector<bus_worker*> workers_;
+    int conn_per_host_;
+    std::map<std::string, remote_host> host2remote_;
+    std::vector<route> routes_; // size is always 2 ^ N
+    size_t route_count_;
+    std::map<int, group_route> groups_; // cleared when routes_ is rebuilt
+    std::map<std::string, u32> conn2seq_;  // connection -> last received sequence
+
+    // age of the messages received from remote hosts, the latency of the
+    // local hops are recorded in the channel statistics in shm
+    sk::detail::latency_histogram remote_latency_;
+
+    // traffic received from remote hosts, see bus_worker for the outgoing
+    u64 remote_raw_bytes_;   // messages, after decompression
+    u64 remote_wire_bytes_;  // bytes read from the connections
+    u64 remote_frame_count_; // compressed frames
+    sk::buffer frame_;       // where frames are decompressed into
+
+    // all routed messages are captured here if it's opened, see busreplay
+    bus_capture capture_;
 
     /*
      * messages whose destination does not exist in
      * busid2host_ will be stored here temporarily,
      * will be sent later when destination is fetched
-     * from the consul service
+     * from the consul service, the queues are bounded
+     * and their memory comes from pool_
      */
-    using message_queue = std::list<bus_message*>;
-    std::map<int, message_queue> busid2queue_;
-    std::map<std::string, message_queue> host2queue_;
+    message_pool *pool_;
+    size_t queue_size_limit_;
+    u64 queue_expiry_; // in nanoseconds, 0 means never
+    bool queue_drop_oldest_;
+    std::map<int, message_queue*> busid2queue_;
 };
 
 #endif // BUS_ROUTER_H
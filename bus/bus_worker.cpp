@@ -0,0 +1,554 @@
+#include <libsk.h>
+#include "bus_worker.h"
+#include "bus_message.h"
+#include "message_queue.h"
+#include <bus/detail/channel.h>
+
+using namespace std::placeholders;
+
+bus_worker::endpoint::endpoint(bus_worker *w, const std::string& host, u16 port)
+    : worker_(w),
+      seed_(0),
+      codec_(BUS_CODEC_NONE),
+      batch_time_(0),
+      batch_(MAX_BATCH_SIZE),
+      frame_(MAX_BATCH_SIZE),
+      host_(host),
+      client_(&w->loop_, host, port,
+              std::bind(&bus_worker::on_server_connected, w, this, _1, _2)),
+      pending_(new message_queue(w->pool_, w->queue_size_limit_, w->queue_drop_oldest_)) {
+    client_.set_read_callback(std::bind(&bus_worker::on_server_message_received, w, this, _1, _2, _3));
+    client_.set_write_callback(std::bind(&bus_worker::on_server_message_sent, w, this, _1, _2));
+    client_.set_close_callback(std::bind(&bus_worker::on_server_closed, w, this, _1));
+}
+
+bus_worker::endpoint::~endpoint() {
+    delete pending_;
+}
+
+int bus_worker::endpoint::init() {
+    if (connection_) return 0;
+    return client_.connect();
+}
+
+void bus_worker::endpoint::stop() {
+    client_.stop();
+    connection_.reset();
+}
+
+void bus_worker::endpoint::reset() {
+    if (!connection_) return;
+
+    // the batch is in wire format already, it cannot be cached again
+    if (!batch_.empty()) {
+        sk_warn("connection lost, %lu bytes dropped, host: %s", batch_.size(), host_.c_str());
+        batch_.consume(batch_.size());
+    }
+
+    // the hello is sent again on the new connection
+    codec_ = BUS_CODEC_NONE;
+    stop();
+}
+
+int bus_worker::endpoint::send(bus_message *msg) {
+    sk_assert(connection_);
+
+    size_t len = msg->total_length();
+    msg->magic = MAGIC;
+    msg->seq = ++seed_;
+    msg->calc_hash();
+    msg->hton();
+
+    u64 now = sk::time::monotonic_ns();
+    if (batch_.empty()) batch_time_ = now;
+
+    // the message is copied into the batch, so the caller can reuse it
+    memcpy(batch_.prepare(len), msg, len);
+    batch_.commit(len);
+
+    if (batch_.size() >= MAX_BATCH_SIZE || now - batch_time_ >= MAX_BATCH_DELAY)
+        return flush();
+
+    return 0;
+}
+
+int bus_worker::endpoint::flush() {
+    if (batch_.empty()) return 0;
+    if (!connection_) return -ENOTCONN;
+
+    size_t raw_size = batch_.size();
+    worker_->raw_bytes_.fetch_add(raw_size, std::memory_order_relaxed);
+
+    if (codec_ != BUS_CODEC_NONE && raw_size > worker_->compress_size_ && compress()) {
+        worker_->wire_bytes_.fetch_add(frame_.size(), std::memory_order_relaxed);
+        worker_->frame_count_.fetch_add(1, std::memory_order_relaxed);
+
+        // the frame is dropped along with the batch if it's not sent,
+        // or the next one is appended to it
+        batch_.consume(raw_size);
+        int ret = connection_->send(&frame_);
+        if (unlikely(ret != 0)) frame_.consume(frame_.size());
+
+        return ret;
+    }
+
+    worker_->wire_bytes_.fetch_add(raw_size, std::memory_order_relaxed);
+
+    // the content of batch_ is taken over by the connection, and batch_
+    // gets the empty space of a completed write, which is large enough
+    // for the next batch already, except for the first few flushes
+    int ret = connection_->send(&batch_);
+    if (unlikely(ret != 0)) {
+        // it's counted as sent already, so it's dropped like the frame
+        batch_.consume(batch_.size());
+        return ret;
+    }
+
+    batch_.prepare(MAX_BATCH_SIZE);
+    return 0;
+}
+
+bool bus_worker::endpoint::compress() {
+    size_t raw_size = batch_.size();
+    if (raw_size > BUS_MAX_FRAME_SIZE) return false;
+
+    size_t capacity = sk::lz4_compress_bound(raw_size);
+    size_t space = sizeof(bus_message) + BUS_FRAME_HEADER_SIZE + capacity;
+    bus_message *frame = cast_ptr(bus_message, frame_.prepare(space));
+
+    int ret = sk::lz4_compress(batch_.peek(), raw_size,
+                               frame->data + BUS_FRAME_HEADER_SIZE, capacity);
+    if (ret < 0) {
+        sk_error("cannot compress batch: %d, host: %s", ret, host_.c_str());
+        return false;
+    }
+
+    // the data is not compressible, send it as is
+    size_t length = BUS_FRAME_HEADER_SIZE + ret;
+    if (sizeof(bus_message) + length >= raw_size) return false;
+
+    u32 header[2] = { htonu32(codec_), htonu32(static_cast<u32>(raw_size)) };
+    memcpy(frame->data, header, sizeof(header));
+
+    frame->init(length);
+    frame->magic = BUS_FRAME_MAGIC;
+    frame->calc_hash();
+    frame->hton();
+
+    frame_.commit(sizeof(bus_message) + length);
+    return true;
+}
+
+bus_worker::bus_worker(int index, u16 port, size_t queue_limit, u64 queue_expiry,
+                       bool queue_drop_oldest, size_t compress_size)
+    : index_(index),
+      port_(port),
+      queue_size_limit_(queue_limit),
+      queue_expiry_(queue_expiry),
+      queue_drop_oldest_(queue_drop_oldest),
+      compress_size_(compress_size),
+      stopping_(false),
+      inbox_(nullptr),
+      raw_bytes_(0),
+      wire_bytes_(0),
+      frame_count_(0),
+      posted_(false),
+      endpoint_count_(0),
+      msg_(nullptr),
+      buffer_capacity_(0),
+      pool_(nullptr),
+      reconnect_timer_(nullptr) {
+    memset(&loop_, 0x00, sizeof(loop_));
+    memset(&async_, 0x00, sizeof(async_));
+}
+
+bus_worker::~bus_worker() {
+    sk_assert(!thread_.joinable());
+
+    for (auto p : endpoints_)
+        delete p;
+    endpoints_.clear();
+
+    if (pool_) {
+        delete pool_;
+        pool_ = nullptr;
+    }
+
+    if (reconnect_timer_) {
+        delete reconnect_timer_;
+        reconnect_timer_ = nullptr;
+    }
+
+    if (msg_) {
+        free(msg_);
+        msg_ = nullptr;
+        buffer_capacity_ = 0;
+    }
+
+    if (inbox_) {
+        free(inbox_);
+        inbox_ = nullptr;
+    }
+}
+
+int bus_worker::start() {
+    pool_ = new message_pool(MAX_POOLED_CHUNKS);
+    if (!pool_) return -ENOMEM;
+
+    buffer_capacity_ = 2 * 1024 * 1024; // 2MB
+    msg_ = cast_ptr(bus_message, malloc(sizeof(bus_message) + buffer_capacity_));
+    if (!msg_) return -ENOMEM;
+    msg_->init(buffer_capacity_);
+
+    // the producer & consumer parts of a channel sit in different
+    // cache lines, the channel itself must be aligned to keep that
+    void *addr = nullptr;
+    size_t space = sk::detail::channel::calc_space(1, INBOX_SIZE);
+    if (posix_memalign(&addr, sk::detail::CACHELINE_SIZE, space) != 0) return -ENOMEM;
+
+    inbox_ = cast_ptr(sk::detail::channel, addr);
+    int ret = inbox_->init(1, INBOX_SIZE);
+    if (ret != 0) return ret;
+
+    ret = uv_loop_init(&loop_);
+    if (ret != 0) return ret;
+
+    async_.data = this;
+    ret = uv_async_init(&loop_, &async_, [](uv_async_t *handle) {
+        static_cast<bus_worker *>(handle->data)->on_async();
+    });
+    if (ret != 0) {
+        uv_loop_close(&loop_);
+        return ret;
+    }
+
+    reconnect_timer_ = new sk::heap_timer(&loop_, std::bind(&bus_worker::reconnect, this));
+    thread_ = std::thread(&bus_worker::run, this);
+    sk_info("bus worker %d started.", index_);
+    return 0;
+}
+
+void bus_worker::stop() {
+    if (!thread_.joinable()) return;
+
+    // the worker drains the inbox before it stops, so nothing posted is lost
+    stopping_.store(true, std::memory_order_release);
+    uv_async_send(&async_);
+}
+
+void bus_worker::join() {
+    if (!thread_.joinable()) return;
+
+    thread_.join();
+    sk_info("bus worker %d stopped.", index_);
+}
+
+int bus_worker::add_endpoint(const std::string& host) {
+    int id = endpoint_count_;
+
+    // the control record is ordered before all messages of this endpoint
+    int ret = inbox_->push(id, 0, 0, host.data(), host.length());
+    if (ret != 0) {
+        sk_error("cannot add endpoint: %d, host: %s", ret, host.c_str());
+        return ret;
+    }
+
+    ++endpoint_count_;
+    posted_ = true;
+    return id;
+}
+
+int bus_worker::post(int endpoint_id, const bus_message *msg) {
+    assert_retval(endpoint_id >= 0 && endpoint_id < endpoint_count_, -EINVAL);
+    // bus id 0 is invalid, so it marks the control records
+    assert_retval(msg->dst_busid != 0, -EINVAL);
+
+    size_t len = msg->total_length();
+    int ret = inbox_->push(endpoint_id, msg->dst_busid, msg->ctime, msg, len);
+    if (likely(ret == 0)) {
+        posted_ = true;
+        return 0;
+    }
+
+    // the inbox is full, wake up the worker and wait a little for it,
+    // if the worker cannot catch up, the message has to be dropped
+    notify();
+    for (int i = 0; i < MAX_POST_RETRY && ret == -ENOMEM; ++i) {
+        sched_yield();
+        ret = inbox_->push(endpoint_id, msg->dst_busid, msg->ctime, msg, len);
+    }
+
+    if (ret != 0) {
+        sk_error("cannot post message: %d, worker: %d, dst: %x", ret, index_, msg->dst_busid);
+        return ret;
+    }
+
+    posted_ = true;
+    return 0;
+}
+
+void bus_worker::notify() {
+    // the async handle might have been closed by the worker after stop()
+    if (!posted_ || stopping_.load(std::memory_order_relaxed)) return;
+
+    posted_ = false;
+    uv_async_send(&async_);
+}
+
+void bus_worker::run() {
+    int ret = uv_run(&loop_, UV_RUN_DEFAULT);
+    if (ret != 0) sk_warn("bus worker %d exits with active handles.", index_);
+
+    ret = uv_loop_close(&loop_);
+    if (ret != 0) sk_error("cannot close loop of bus worker %d: %d", index_, ret);
+}
+
+void bus_worker::on_async() {
+    drain_inbox();
+
+    // all messages drained in this round are sent here, so
+    // a single write request carries many messages to a remote host
+    for (auto p : endpoints_) {
+        check_continue(p->connected());
+
+        int ret = p->flush();
+        if (ret != 0) sk_error("cannot flush messages: %d, host: %s", ret, p->host().c_str());
+    }
+
+    if (!stopping_.load(std::memory_order_acquire)) return;
+
+    reconnect_timer_->stop();
+    reconnect_timer_->close(nullptr);
+
+    // closing a connection cancels its writes, the endpoints still
+    // writing are stopped by on_server_message_sent(...) once they are
+    // done, and the loop exits after all the handles are closed
+    for (auto p : endpoints_) {
+        if (!p->writing()) p->stop();
+    }
+
+    uv_close(reinterpret_cast<uv_handle_t *>(&async_), nullptr);
+}
+
+void bus_worker::drain_inbox() {
+    while (true) {
+        msg_->reset(buffer_capacity_);
+        size_t len = msg_->total_length();
+        int id = -1;
+        int dst = 0;
+        int ret = inbox_->pop(msg_, len, &id, &dst, nullptr);
+        if (ret == 0) break;
+
+        if (unlikely(ret == -E2BIG)) {
+            sk_warn("big message, size<%lu>, buffer size<%lu>.", len, buffer_capacity_);
+            bus_message *buf = cast_ptr(bus_message, malloc(len));
+            if (!buf) {
+                sk_error("cannot allocate buffer, size<%lu>, drop the message.", len);
+                inbox_->pop(nullptr, len, nullptr, nullptr, nullptr);
+                continue;
+            }
+
+            buffer_capacity_ = len - sizeof(bus_message);
+            free(msg_);
+            msg_ = buf;
+            continue;
+        }
+
+        if (unlikely(ret < 0)) {
+            sk_error("pop message error<%d>, worker<%d>.", ret, index_);
+            continue;
+        }
+
+        if (dst == 0)
+            create_endpoint(cast_ptr(char, msg_), len);
+        else
+            send_message(id, msg_);
+    }
+}
+
+void bus_worker::create_endpoint(const char *host, size_t length) {
+    std::string str(host, length);
+    endpoint *p = new endpoint(this, str, port_);
+
+    // the endpoint stays in endpoints_ even if it fails, as the ids of
+    // the endpoints must match the ones assigned by the router thread
+    endpoints_.push_back(p);
+
+    int ret = p->init();
+    if (ret != 0) {
+        sk_error("endpoint init error: %d, host: %s", ret, str.c_str());
+        schedule_reconnect();
+    }
+}
+
+void bus_worker::send_message(int endpoint_id, bus_message *msg) {
+    if (unlikely(endpoint_id < 0 || endpoint_id >= static_cast<int>(endpoints_.size()))) {
+        sk_error("invalid endpoint<%d>, worker<%d>.", endpoint_id, index_);
+        return;
+    }
+
+    // if the remote host is connected, just send the message
+    endpoint *p = endpoints_[endpoint_id];
+    if (likely(p->connected())) {
+        sk_assert(p->pending()->empty());
+        int ret = p->send(msg);
+        if (ret != 0) sk_error("cannot send msg: %d, host: %s", ret, p->host().c_str());
+        return;
+    }
+
+    // the remote is not connected, cache the message, send it later
+    sk_info("endpoint %s not connected, cache the message, bus: %x",
+            p->host().c_str(), msg->dst_busid);
+
+    message_queue *q = p->pending();
+    expire(q);
+
+    int ret = q->push(msg, msg->total_length(), msg->ctime);
+    if (ret != 0)
+        sk_warn("cannot cache message: %d, dst: %x, queue size: %lu",
+                ret, msg->dst_busid, q->size());
+}
+
+void bus_worker::expire(message_queue *q) {
+    if (queue_expiry_ <= 0) return;
+
+    u64 now = sk::time::realtime_ns();
+    size_t count = q->expire(now > queue_expiry_ ? now - queue_expiry_ : 0);
+    if (count > 0) sk_warn("%lu cached messages expired.", count);
+}
+
+void bus_worker::schedule_reconnect() {
+    // the timer is closed once the worker is stopping
+    if (stopping_.load(std::memory_order_relaxed)) return;
+    if (!reconnect_timer_->stopped()) return;
+
+    reconnect_timer_->start_once(RECONNECT_DELAY);
+}
+
+void bus_worker::reconnect() {
+    bool failed = false;
+    for (auto p : endpoints_) {
+        check_continue(p->disconnected());
+
+        sk_info("reconnect to remote: %s, worker: %d", p->host().c_str(), index_);
+        int ret = p->init();
+        if (ret != 0) {
+            sk_error("endpoint init error: %d, host: %s", ret, p->host().c_str());
+            failed = true;
+        }
+    }
+
+    if (failed) schedule_reconnect();
+}
+
+void bus_worker::on_server_connected(endpoint *p, int error,
+                                     const sk::tcp_connection_ptr& conn) {
+    if (error != 0) {
+        // the messages are cached in the meantime, until they expire
+        sk_error("cannot connect: %s, host: %s", uv_strerror(error), p->host().c_str());
+        schedule_reconnect();
+        return;
+    }
+
+    sk_debug("connected to remote: %s, worker: %d", p->host().c_str(), index_);
+    sk_assert(!p->connected());
+    p->set_connection(conn);
+
+    // the hello goes before any message, the batches are sent
+    // uncompressed until the remote host replies the hello, a busd
+    // older than the hello cannot parse it, so it's sent only if
+    // compression is enabled, see "compress_size" in bus_config.h
+    if (compress_size_ > 0) {
+        char hello[BUS_HELLO_SIZE];
+        bus_make_hello(hello, BUS_CODEC_MASK);
+
+        int ret = conn->send(hello, sizeof(hello));
+        if (ret != 0) sk_error("cannot send hello: %d, host: %s", ret, p->host().c_str());
+    }
+
+    // the remote host only replies the hello, but reading also detects eof
+    conn->recv();
+
+    // the messages go into the batch of the endpoint, and
+    // get flushed together when the batch is full or the
+    // inbox is drained next time
+    message_queue *q = p->pending();
+    expire(q);
+    sk_debug("process queue: %s, count: %lu", p->host().c_str(), q->count());
+
+    size_t len = 0;
+    while (bus_message *msg = cast_ptr(bus_message, q->front(len))) {
+        int ret = p->send(msg);
+        if (ret != 0) // TODO: more robust handling here??
+            sk_error("cannot send msg: %d, host: %s", ret, p->host().c_str());
+
+        q->pop();
+    }
+
+    int ret = p->flush();
+    if (ret != 0) sk_error("cannot flush messages: %d, host: %s", ret, p->host().c_str());
+}
+
+void bus_worker::on_server_message_received(endpoint *p, int error, const sk::tcp_connection_ptr& conn, sk::buffer *buf) {
+    // the connection is reconnected after it's closed, see on_server_closed(...)
+    if (error == sk::tcp_connection::READ_EOF) {
+        sk_info("get eof, server: %s", conn->remote_address().as_string().c_str());
+        p->reset();
+        return;
+    }
+
+    if (error != 0) {
+        sk_error("cannot read: %s, host: %s", uv_strerror(error), p->host().c_str());
+        p->reset();
+        return;
+    }
+
+    // only hello frames are sent back by the remote host
+    while (buf->size() >= sizeof(bus_message)) {
+        bus_message header;
+        memcpy(&header, buf->peek(), sizeof(header));
+        header.ntoh();
+        if (buf->size() < header.total_length()) break;
+
+        bus_message *msg = cast_ptr(bus_message, buf->mutable_peek());
+        msg->ntoh();
+
+        do {
+            if (msg->magic != BUS_HELLO_MAGIC || msg->length < sizeof(u32) || !msg->verify_hash()) {
+                sk_error("invalid message from server: %s", p->host().c_str());
+                break;
+            }
+
+            u32 mask = 0;
+            memcpy(&mask, msg->data, sizeof(mask));
+            mask = ntohu32(mask);
+
+            // LZ4 is the only codec for now
+            if (compress_size_ > 0 && (mask & (1u << BUS_CODEC_LZ4))) {
+                sk_info("compression enabled, host: %s, worker: %d", p->host().c_str(), index_);
+                p->set_codec(BUS_CODEC_LZ4);
+            }
+        } while (0);
+
+        buf->consume(header.total_length());
+    }
+
+    conn->recv();
+}
+
+void bus_worker::on_server_message_sent(endpoint *p, int error, const sk::tcp_connection_ptr& conn) {
+    if (error != 0) {
+        sk_error("send error: %s, host: %s", uv_strerror(error), p->host().c_str());
+        p->reset();
+        return;
+    }
+
+    // the last write is done, the endpoint can be stopped now, see on_async()
+    if (stopping_.load(std::memory_order_relaxed) && conn->outgoing_buffer_empty())
+        p->stop();
+}
+
+void bus_worker::on_server_closed(endpoint *p, const sk::tcp_connection_ptr& conn) {
+    sk_info("connection closed: %s, host: %s", conn->name().c_str(), p->host().c_str());
+    schedule_reconnect();
+}
@@ -0,0 +1,201 @@
+#ifndef BUS_WORKER_H
+#define BUS_WORKER_H
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+#include <core/tcp_client.h>
+#include <core/tcp_connection.h>
+
+struct bus_message;
+class  message_pool;
+class  message_queue;
+
+namespace sk { class heap_timer; }
+namespace sk { namespace detail { struct channel; }}
+
+/*
+ * a bus worker runs its own loop in its own thread, and owns a set of
+ * connections to remote hosts, the router thread hands messages over
+ * through inbox_, which is a SPSC channel: the router thread is the
+ * only producer and the worker thread is the only consumer, so no lock
+ * is needed on either side, and the worker writes to the network in
+ * parallel with the router draining the local channels
+ */
+class bus_worker {
+public:
+    MAKE_NONCOPYABLE(bus_worker);
+
+    /**
+     * @param index: index of this worker, for logging only
+     * @param port: the port of remote busd
+     * @param queue_limit: max bytes of cached messages of one endpoint
+     * @param queue_expiry: cached messages older than this(ns) are dropped, 0 means never
+     * @param queue_drop_oldest: drop the oldest or the new message if a queue is full
+     * @param compress_size: compress a batch larger than this, 0 disables compression
+     */
+    bus_worker(int index, u16 port, size_t queue_limit, u64 queue_expiry,
+               bool queue_drop_oldest, size_t compress_size);
+    ~bus_worker();
+
+    int  start();
+    void stop();
+    void join();
+
+    /*
+     * the functions below can only be called by the router thread
+     */
+
+    /**
+     * @brief create an endpoint connecting to the host, the endpoint is
+     * created in the worker thread asynchronously, but the returned id
+     * can be used to post messages immediately
+     * @return id of the endpoint, or negative error code
+     */
+    int add_endpoint(const std::string& host);
+
+    /**
+     * @brief hand over a message to the endpoint, the message is copied
+     * @return 0 if succeeds, -ENOMEM if the inbox is full for a while
+     */
+    int post(int endpoint_id, const bus_message *msg);
+
+    // wake up the worker if anything is posted since last call
+    void notify();
+
+    /*
+     * traffic statistics, can be read by any thread, raw bytes are the
+     * messages before compression, wire bytes are what's actually sent
+     */
+    u64 raw_bytes() const { return raw_bytes_.load(std::memory_order_relaxed); }
+    u64 wire_bytes() const { return wire_bytes_.load(std::memory_order_relaxed); }
+    u64 frame_count() const { return frame_count_.load(std::memory_order_relaxed); }
+
+private:
+    class endpoint {
+    public:
+        endpoint(bus_worker *w, const std::string& host, u16 port);
+        ~endpoint();
+
+        int init();
+        void stop();
+
+        /*
+         * drop the broken connection along with the batch not sent yet,
+         * the endpoint gets reconnected after the connection is closed
+         */
+        void reset();
+
+        const std::string& host() const { return host_; }
+        void set_connection(const sk::tcp_connection_ptr& conn) {
+            // busd counts the sequence from zero on every new connection
+            this->connection_ = conn;
+            this->seed_ = 0;
+        }
+
+        bool connected() const {
+            bool yes = !!connection_;
+            if (yes) sk_assert(!client_.connecting() && !client_.disconnected());
+            return yes;
+        }
+
+        // neither connected nor connecting, the old connection is closed
+        bool disconnected() const { return client_.disconnected(); }
+
+        // any write still in flight
+        bool writing() const {
+            return connection_ && !connection_->outgoing_buffer_empty();
+        }
+
+        // the codec agreed with the remote host, see bus_message.h
+        void set_codec(u32 codec) { codec_ = codec; }
+
+        /*
+         * messages are coalesced into batch_, and written in one write
+         * request by flush(), the batch is flushed when it's too large
+         * or too old, or after the inbox is drained, a batch is sent
+         * as a compressed frame if a codec is agreed and it's large
+         * enough, and the compressed one is really smaller
+         */
+        int send(bus_message *msg);
+        int flush();
+
+        // messages posted before the connection is established
+        message_queue *pending() const { return pending_; }
+
+    private:
+        bool compress();
+
+    private:
+        bus_worker *worker_;
+        u32 seed_; // sequence generator
+        u32 codec_; // BUS_CODEC_NONE until the hello reply arrives
+        u64 batch_time_; // when the first message in batch_ is added
+        sk::buffer batch_;
+        sk::buffer frame_; // the compressed batch
+        std::string host_;
+        sk::tcp_client client_;
+        sk::tcp_connection_ptr connection_;
+        message_queue *pending_;
+    };
+
+private:
+    void run();
+    void on_async();
+    void drain_inbox();
+    void create_endpoint(const char *host, size_t length);
+    void send_message(int endpoint_id, bus_message *msg);
+    void expire(message_queue *q);
+
+    // reconnect the disconnected endpoints after RECONNECT_DELAY
+    void schedule_reconnect();
+    void reconnect();
+
+    // tcp client callbacks
+    void on_server_connected(endpoint *p, int error,
+                             const sk::tcp_connection_ptr& conn);
+    void on_server_message_received(endpoint *p, int error,
+                                    const sk::tcp_connection_ptr& conn,
+                                    sk::buffer *buf);
+    void on_server_message_sent(endpoint *p,
+                                int error, const sk::tcp_connection_ptr& conn);
+    void on_server_closed(endpoint *p, const sk::tcp_connection_ptr& conn);
+
+private:
+    static const size_t INBOX_SIZE = 16 * 1024 * 1024;  // capacity of inbox_
+    static const int MAX_POST_RETRY = 1024;              // retries if the inbox is full
+    static const size_t MAX_POOLED_CHUNKS = 16;          // max free chunks kept by pool_
+    static const size_t MAX_BATCH_SIZE = 64 * 1024;      // flush a batch if it exceeds this size
+    static const u64 MAX_BATCH_DELAY = 1000 * 1000;      // flush a batch if it's older than this, in ns
+    static const u64 RECONNECT_DELAY = 1000;             // reconnect a lost endpoint after this, in ms
+
+    int index_;
+    u16 port_;
+    size_t queue_size_limit_;
+    u64 queue_expiry_; // in nanoseconds, 0 means never
+    bool queue_drop_oldest_;
+    size_t compress_size_;
+
+    uv_loop_t loop_;
+    uv_async_t async_;   // posted messages & stop request arrive here
+    std::thread thread_;
+    std::atomic<bool> stopping_;
+    sk::detail::channel *inbox_;
+    std::atomic<u64> raw_bytes_;
+    std::atomic<u64> wire_bytes_;
+    std::atomic<u64> frame_count_;
+
+    // router thread only
+    bool posted_;        // anything posted since last notify()
+    int endpoint_count_; // ids assigned by add_endpoint()
+
+    // worker thread only
+    bus_message *msg_;
+    size_t buffer_capacity_;
+    message_pool *pool_;
+    sk::heap_timer *reconnect_timer_;
+    std::vector<endpoint*> endpoints_; // indexed by endpoint id
+};
+
+#endif // BUS_WORKER_H
@@ -0,0 +1,220 @@
+#include <time.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <bus/bus.h>
+#include <server/option_parser.h>
+#include <utility/time_helper.h>
+#include "bus_capture.h"
+
+/*
+ * busreplay: send the messages captured by busd (see "capture" in the
+ * config of busd) through the bus again, at the captured rate or faster,
+ * the replayer registers itself with the given bus id, so the messages
+ * are sent from it, and the replies sent back to it are dropped
+ *
+ * usage: busreplay --id x.x.x.x --file FILE [--bus-shm-path PATH]
+ *                  [--dst x.x.x.x] [--to x.x.x.x] [--speed PCT] [--loop N]
+ */
+
+// sleep if the next message is due later than this, spin otherwise
+static const u64 MIN_SLEEP_NS = 200 * 1000;
+
+struct replay_options {
+    std::string id;       // bus id of the replayer
+    std::string file;     // the capture file
+    std::string shm_path; // shm object path of bus
+    std::string dst;      // only replay the messages to this bus id (or group)
+    std::string to;       // send the messages to this bus id instead
+    s32 speed;            // rate in percentage of the captured one, 0 means no pacing
+    s32 loop;             // how many times the capture is replayed
+    s32 timeout;          // send timeout(ms) if the channel is full
+
+    replay_options() : speed(100), loop(1), timeout(1000) {}
+};
+
+struct replay_stats {
+    u64 sent;
+    u64 failed;
+    u64 skipped;
+    u64 received;
+
+    replay_stats() : sent(0), failed(0), skipped(0), received(0) {}
+};
+
+static void drain(void *buf, size_t capacity, replay_stats& stats) {
+    while (true) {
+        int src_busid = 0;
+        size_t len = capacity;
+        int ret = sk::bus::recv(src_busid, buf, len);
+        if (ret == 1) {
+            ++stats.received;
+            continue;
+        }
+
+        // a reply larger than the buffer is dropped as well
+        if (ret == -E2BIG) {
+            ++stats.received;
+            continue;
+        }
+
+        break;
+    }
+}
+
+static void wait_until(u64 due, void *buf, size_t capacity, replay_stats& stats) {
+    while (true) {
+        drain(buf, capacity, stats);
+
+        u64 now = sk::time::monotonic_ns();
+        if (now >= due) return;
+
+        u64 ns = due - now;
+        if (ns < MIN_SLEEP_NS) continue;
+
+        struct timespec ts;
+        ns -= MIN_SLEEP_NS / 2;
+        ts.tv_sec = static_cast<time_t>(ns / 1000000000);
+        ts.tv_nsec = static_cast<long>(ns % 1000000000);
+        nanosleep(&ts, nullptr);
+    }
+}
+
+static int replay(const replay_options& opt, const capture_header *header, replay_stats& stats) {
+    int dst = opt.dst.empty() ? 0 : sk::bus::from_string(opt.dst.c_str());
+    int to = opt.to.empty() ? 0 : sk::bus::from_string(opt.to.c_str());
+    if (dst == -1 || to == -1) {
+        fprintf(stderr, "invalid bus id: %s %s\n", opt.dst.c_str(), opt.to.c_str());
+        return -EINVAL;
+    }
+
+    const size_t capacity = 1024 * 1024;
+    char *buf = static_cast<char *>(malloc(capacity));
+    if (!buf) return -ENOMEM;
+
+    const char *base = reinterpret_cast<const char *>(header);
+    size_t used = __atomic_load_n(&header->used_size, __ATOMIC_ACQUIRE);
+    for (int round = 0; round < opt.loop; ++round) {
+        u64 start = sk::time::monotonic_ns();
+        u64 first = 0;
+        for (size_t offset = sizeof(capture_header); offset < used; ) {
+            const capture_record *r = reinterpret_cast<const capture_record *>(base + offset);
+            if (used - offset < sizeof(capture_record) || used - offset < r->total_length()) {
+                fprintf(stderr, "truncated record at %lu.\n", offset);
+                break;
+            }
+
+            offset += r->total_length();
+
+            bool match = dst == 0 || r->dst_busid == dst ||
+                         (sk::bus::is_group(dst) && sk::bus::group_match(dst, r->dst_busid));
+            if (!match) {
+                ++stats.skipped;
+                continue;
+            }
+
+            if (first == 0) first = r->rtime;
+            if (opt.speed > 0 && r->rtime > first)
+                wait_until(start + (r->rtime - first) * 100 / opt.speed, buf, capacity, stats);
+
+            int priority = static_cast<int>(r->priority);
+            if (priority < 0 || priority >= sk::bus::BUS_PRIORITY_COUNT)
+                priority = sk::bus::BUS_PRIORITY_NORMAL;
+
+            int ret = sk::bus::send(to != 0 ? to : r->dst_busid, r->data, r->length,
+                                    opt.timeout, priority);
+            if (ret == 0)
+                ++stats.sent;
+            else
+                ++stats.failed;
+        }
+
+        drain(buf, capacity, stats);
+    }
+
+    free(buf);
+    return 0;
+}
+
+int main(int argc, const char **argv) {
+    replay_options opt;
+    sk::option_parser p;
+    p.register_option(0, "id", "bus id of the replayer", "x.x.x.x", true, &opt.id);
+    p.register_option(0, "file", "the capture file", "FILE", true, &opt.file);
+    p.register_option(0, "bus-shm-path", "bus shm object location", "PATH", false, &opt.shm_path);
+    p.register_option(0, "dst", "only replay messages to this bus id or group", "x.x.x.x", false, &opt.dst);
+    p.register_option(0, "to", "send messages to this bus id instead", "x.x.x.x", false, &opt.to);
+    p.register_option(0, "speed", "rate in percentage of the captured, 0 means no pacing", "PCT", false, &opt.speed);
+    p.register_option(0, "loop", "how many times to replay, 1 by default", "N", false, &opt.loop);
+    p.register_option(0, "timeout", "send timeout(ms) if bus is full, 1000 by default", "MS", false, &opt.timeout);
+
+    int ret = p.parse(argc, argv, nullptr);
+    if (ret != 0) return ret;
+
+    if (opt.shm_path.empty()) opt.shm_path = sk::bus::DEFAULT_BUS_SHM_PATH;
+    if (opt.speed < 0 || opt.loop <= 0) {
+        fprintf(stderr, "invalid speed %d or loop %d.\n", opt.speed, opt.loop);
+        return -EINVAL;
+    }
+
+    int busid = sk::bus::from_string(opt.id.c_str());
+    if (busid == -1) {
+        fprintf(stderr, "invalid bus id %s.\n", opt.id.c_str());
+        return -EINVAL;
+    }
+
+    int fd = open(opt.file.c_str(), O_RDONLY);
+    if (fd == -1) {
+        fprintf(stderr, "cannot open %s: %s\n", opt.file.c_str(), strerror(errno));
+        return -errno;
+    }
+
+    struct stat st;
+    void *addr = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && static_cast<size_t>(st.st_size) >= sizeof(capture_header))
+        addr = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (addr == MAP_FAILED) {
+        fprintf(stderr, "cannot map %s.\n", opt.file.c_str());
+        return -1;
+    }
+
+    const capture_header *header = static_cast<const capture_header *>(addr);
+    if (header->magic != CAPTURE_MAGIC || header->version != CAPTURE_VERSION ||
+        header->used_size > static_cast<size_t>(st.st_size)) {
+        fprintf(stderr, "%s is not a valid capture file.\n", opt.file.c_str());
+        munmap(addr, st.st_size);
+        return -EINVAL;
+    }
+
+    // busd does not notify a polling process, and the signals are ignored
+    // anyway, the replies are drained while waiting for the next message
+    signal(sk::bus::BUS_INCOMING_SIGNO, SIG_IGN);
+    signal(sk::bus::BUS_WRITABLE_SIGNO, SIG_IGN);
+
+    ret = sk::bus::register_bus(opt.shm_path.c_str(), busid);
+    if (ret != 0) {
+        fprintf(stderr, "cannot register bus %s: %d\n", opt.id.c_str(), ret);
+        munmap(addr, st.st_size);
+        return ret;
+    }
+
+    sk::bus::set_busy_poll(true);
+
+    replay_stats stats;
+    u64 start = sk::time::monotonic_ns();
+    ret = replay(opt, header, stats);
+    double seconds = (sk::time::monotonic_ns() - start) / 1e9;
+
+    printf("records %lu, sent %lu, failed %lu, skipped %lu, replies %lu, %.3fs, %.0f msgs/s\n",
+           header->count, stats.sent, stats.failed, stats.skipped, stats.received, seconds,
+           seconds > 0 ? stats.sent / seconds : 0.0);
+
+    sk::bus::deregister_bus();
+    munmap(addr, st.st_size);
+    return ret;
+}
@@ -0,0 +1,103 @@
+#include <stdio.h>
+#include <unistd.h>
+#include <bus/bus.h>
+#include <bus/detail/channel.h>
+#include <shm/detail/shm_object.h>
+#include <bus/detail/channel_mgr.h>
+#include <utility/math_helper.h>
+
+/*
+ * busstat: print the statistics of all bus channels, the statistics
+ * are read from the bus shm directly, so busd does not need to stop
+ *
+ * usage: busstat [shm path]
+ */
+
+static void print_latency(const char *name, const sk::detail::latency_histogram& h) {
+    printf("    %-4s latency(us): samples %lu, avg %.1f, p50 %.1f, p90 %.1f, "
+           "p99 %.1f, p999 %.1f, max %.1f\n", name, h.count,
+           h.count > 0 ? h.sum / 1000.0 / h.count : 0.0,
+           h.value_at(50) / 1000.0, h.value_at(90) / 1000.0,
+           h.value_at(99) / 1000.0, h.value_at(99.9) / 1000.0, h.max / 1000.0);
+}
+
+static void print_channel(const char *name, const sk::detail::channel *c) {
+    if (c->magic != SK_MAGIC) {
+        printf("  %s: invalid channel\n", name);
+        return;
+    }
+
+    printf("  %s: version %u, capacity %lu, pending %lu\n",
+           name, c->version, c->capacity(), c->message_count());
+
+    if (!c->has_stats()) {
+        printf("    no statistics\n");
+        return;
+    }
+
+    const sk::detail::channel_stats& in = c->producer_stats();
+    const sk::detail::channel_stats& out = c->consumer_stats();
+    printf("    in %lu msgs/%lu bytes, out %lu msgs/%lu bytes, drop %lu, high water %lu (%.1f%%)\n",
+           in.msg_count, in.byte_count, out.msg_count, out.byte_count, in.drop_count,
+           in.high_water, in.high_water * 100.0 / c->capacity());
+    print_latency("in", in.latency);
+    print_latency("out", out.latency);
+}
+
+int main(int argc, const char **argv) {
+    const char *path = argc > 1 ? argv[1] : sk::bus::DEFAULT_BUS_SHM_PATH;
+
+    size_t shm_size = 0;
+    int shmfd = sk::detail::shm_object_attach(path, &shm_size);
+    if (shmfd == -1) {
+        fprintf(stderr, "cannot attach shm %s.\n", path);
+        return -1;
+    }
+
+    void *addr = sk::detail::shm_object_map(shmfd, &shm_size, 0);
+    close(shmfd);
+    if (!addr) {
+        fprintf(stderr, "cannot map shm %s.\n", path);
+        return -1;
+    }
+
+    const sk::detail::channel_mgr *mgr = cast_ptr(sk::detail::channel_mgr, addr);
+    if (mgr->magic != SK_MAGIC) {
+        fprintf(stderr, "bus shm %s is not initialized.\n", path);
+        sk::detail::shm_object_unmap(addr, shm_size);
+        return -1;
+    }
+
+    printf("bus shm %s, busd pid %d, used %lu/%lu, descriptors %d, free blocks %d, numa node %d\n",
+           path, mgr->pid, mgr->used_size, mgr->shm_size, mgr->descriptor_count,
+           mgr->extensible() ? mgr->free_block_count : 0, mgr->extensible() ? mgr->numa_node : -1);
+
+    for (int i = 0; i < mgr->descriptor_count; ++i) {
+        const sk::detail::channel_descriptor& desc = *mgr->descriptor(i);
+        const sk::detail::channel *rc = sk::byte_offset<sk::detail::channel>(mgr, desc.r_offset);
+        const sk::detail::channel *wc = sk::byte_offset<sk::detail::channel>(mgr, desc.w_offset);
+        bool resizing = !rc->legacy() && !wc->legacy() &&
+                        (rc->next_offset != 0 || rc->retired_offset != 0 || wc->retired_offset != 0);
+        printf("channel %s, pid %d%s%s\n", sk::bus::to_string(desc.owner).c_str(),
+               desc.pid, desc.closed ? ", closed" : "", resizing ? ", resizing" : "");
+
+        // see channel_mgr::report() for the placement of channels
+        int r_node = rc->numa_node();
+        int w_node = wc->numa_node();
+        int p_node = desc.closed ? -1 : sk::detail::numa_node_of_process(desc.pid);
+        if (r_node >= 0 || w_node >= 0)
+            printf("  numa: read node %d, write node %d, process node %d%s%s\n", r_node, w_node, p_node,
+                   r_node >= 0 && w_node >= 0 && r_node != w_node ? ", cross-node" : "",
+                   r_node >= 0 && p_node >= 0 && r_node != p_node ? ", misplaced" : "");
+
+        static const char *r_names[sk::detail::CHANNEL_LANE_COUNT] = {"r/control", "r/normal", "r/bulk"};
+        static const char *w_names[sk::detail::CHANNEL_LANE_COUNT] = {"w/control", "w/normal", "w/bulk"};
+        for (int k = 0; k < sk::detail::CHANNEL_LANE_COUNT; ++k) {
+            if (rc->has_lane(k)) print_channel(r_names[k], rc->lane(k));
+            if (wc->has_lane(k)) print_channel(w_names[k], wc->lane(k));
+        }
+    }
+
+    sk::detail::shm_object_unmap(addr, shm_size);
+    return 0;
+}
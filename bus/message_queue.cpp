@@ -0,0 +1,174 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "message_queue.h"
+#include "utility/math_helper.h"
+#include "utility/assert_helper.h"
+
+message_pool::message_pool(size_t max_free_count)
+    : free_list_(nullptr),
+      free_count_(0),
+      used_count_(0),
+      max_free_count_(max_free_count) {}
+
+message_pool::~message_pool() {
+    sk_assert(used_count_ == 0);
+
+    while (free_list_) {
+        chunk *c = free_list_;
+        free_list_ = c->next;
+        ::free(c);
+    }
+
+    free_count_ = 0;
+}
+
+message_pool::chunk *message_pool::alloc(size_t size) {
+    chunk *c = nullptr;
+    if (size <= CHUNK_SIZE && free_list_) {
+        c = free_list_;
+        free_list_ = c->next;
+        --free_count_;
+    } else {
+        size_t capacity = size <= CHUNK_SIZE ? CHUNK_SIZE : size;
+        c = cast_ptr(chunk, malloc(sizeof(chunk) + capacity));
+        if (!c) return nullptr;
+
+        c->capacity = capacity;
+    }
+
+    c->next = nullptr;
+    c->rindex = 0;
+    c->windex = 0;
+    ++used_count_;
+    return c;
+}
+
+void message_pool::free(chunk *c) {
+    assert_retnone(c);
+    sk_assert(used_count_ > 0);
+    --used_count_;
+
+    // big chunks are not pooled, and the pool itself is bounded
+    if (c->capacity != CHUNK_SIZE || free_count_ >= max_free_count_) {
+        ::free(c);
+        return;
+    }
+
+    c->next = free_list_;
+    free_list_ = c;
+    ++free_count_;
+}
+
+message_queue::message_queue(message_pool *pool, size_t size_limit, bool drop_oldest)
+    : pool_(pool),
+      head_(nullptr),
+      tail_(nullptr),
+      size_(0),
+      count_(0),
+      drop_count_(0),
+      size_limit_(size_limit),
+      drop_oldest_(drop_oldest) {}
+
+message_queue::~message_queue() {
+    while (head_) {
+        message_pool::chunk *c = head_;
+        head_ = c->next;
+        pool_->free(c);
+    }
+
+    tail_ = nullptr;
+    size_ = 0;
+    count_ = 0;
+}
+
+size_t message_queue::record_size(size_t length) {
+    // records are aligned, so the messages inside can be accessed directly
+    return sk::align_up(sizeof(record) + length, sizeof(u64));
+}
+
+int message_queue::push(const void *data, size_t length, u64 ctime) {
+    assert_retval(data, -EINVAL);
+
+    if (length > size_limit_) {
+        ++drop_count_;
+        return -ENOSPC;
+    }
+
+    if (size_ + length > size_limit_) {
+        if (!drop_oldest_) {
+            ++drop_count_;
+            return -ENOSPC;
+        }
+
+        while (!empty() && size_ + length > size_limit_) {
+            pop();
+            ++drop_count_;
+        }
+    }
+
+    const size_t required = record_size(length);
+    if (!tail_ || tail_->capacity - tail_->windex < required) {
+        message_pool::chunk *c = pool_->alloc(required);
+        if (!c) return -ENOMEM;
+
+        if (tail_)
+            tail_->next = c;
+        else
+            head_ = c;
+
+        tail_ = c;
+    }
+
+    record *r = sk::byte_offset<record>(tail_->data, tail_->windex);
+    r->ctime = ctime;
+    r->length = length;
+    memcpy(r->data, data, length);
+    tail_->windex += required;
+
+    size_ += length;
+    ++count_;
+    return 0;
+}
+
+void *message_queue::front(size_t& length) {
+    if (empty()) return nullptr;
+
+    sk_assert(head_ && head_->rindex < head_->windex);
+    record *r = sk::byte_offset<record>(head_->data, head_->rindex);
+    length = r->length;
+    return r->data;
+}
+
+void message_queue::pop() {
+    assert_retnone(!empty());
+    sk_assert(head_ && head_->rindex < head_->windex);
+
+    record *r = sk::byte_offset<record>(head_->data, head_->rindex);
+    head_->rindex += record_size(r->length);
+    size_ -= r->length;
+    --count_;
+
+    // all messages in the head chunk are consumed, recycle it
+    if (head_->rindex >= head_->windex) {
+        message_pool::chunk *c = head_;
+        head_ = c->next;
+        if (!head_) tail_ = nullptr;
+
+        pool_->free(c);
+    }
+}
+
+size_t message_queue::expire(u64 deadline) {
+    size_t count = 0;
+    while (!empty()) {
+        record *r = sk::byte_offset<record>(head_->data, head_->rindex);
+        if (r->ctime >= deadline) break;
+
+        pop();
+        ++count;
+    }
+
+    drop_count_ += count;
+    return count;
+}
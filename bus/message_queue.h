@@ -0,0 +1,110 @@
+#ifndef MESSAGE_QUEUE_H
+#define MESSAGE_QUEUE_H
+
+#include "utility/types.h"
+
+/*
+ * a pool of fixed-size chunks, shared by all message queues, a chunk
+ * is recycled into the pool when all messages in it are consumed, so
+ * caching a message costs a memcpy instead of a malloc
+ */
+class message_pool {
+public:
+    static const size_t CHUNK_SIZE = 64 * 1024;
+
+    struct chunk {
+        chunk *next;
+        size_t capacity; // size of data
+        size_t rindex;   // read position in data
+        size_t windex;   // write position in data
+        char data[0];
+    };
+
+    MAKE_NONCOPYABLE(message_pool);
+
+    explicit message_pool(size_t max_free_count);
+    ~message_pool();
+
+    /**
+     * @brief allocate a chunk which can hold at least size bytes, a chunk
+     * larger than CHUNK_SIZE is allocated directly, and never pooled
+     */
+    chunk *alloc(size_t size);
+    void free(chunk *c);
+
+    size_t free_count() const { return free_count_; }
+    size_t used_count() const { return used_count_; }
+
+private:
+    chunk *free_list_;
+    size_t free_count_;
+    size_t used_count_;
+    size_t max_free_count_;
+};
+
+/*
+ * a FIFO queue of messages, messages are stored back to back in chunks
+ * allocated from the pool, the total size of the messages is bounded,
+ * if the queue is full, either the oldest or the new message is dropped
+ */
+class message_queue {
+public:
+    MAKE_NONCOPYABLE(message_queue);
+
+    /**
+     * @param pool: where chunks are allocated from
+     * @param size_limit: max total size of messages in this queue, in bytes
+     * @param drop_oldest: drop the oldest messages or the new message if full
+     */
+    message_queue(message_pool *pool, size_t size_limit, bool drop_oldest);
+    ~message_queue();
+
+    /**
+     * @brief append a message to the queue
+     * @param data: the message
+     * @param length: length of the message
+     * @param ctime: creation time of the message, used for expiry
+     * @return 0 if succeeds, -ENOSPC if the message is dropped
+     */
+    int push(const void *data, size_t length, u64 ctime);
+
+    /**
+     * @brief the oldest message, the pointer is valid until pop() is called
+     * @param length: stores the length of the message
+     * @return the message, or NULL if the queue is empty
+     */
+    void *front(size_t& length);
+    void pop();
+
+    /**
+     * @brief drop the messages created before deadline
+     * @return how many messages are dropped
+     */
+    size_t expire(u64 deadline);
+
+    bool empty() const { return count_ <= 0; }
+    size_t size() const { return size_; }
+    size_t count() const { return count_; }
+    size_t drop_count() const { return drop_count_; }
+
+private:
+    struct record {
+        u64 ctime;
+        size_t length;
+        char data[0];
+    };
+
+    static size_t record_size(size_t length);
+
+private:
+    message_pool *pool_;
+    message_pool::chunk *head_;
+    message_pool::chunk *tail_;
+    size_t size_;       // total size of messages, records & chunk overheads excluded
+    size_t count_;      // message count
+    size_t drop_count_; // messages dropped because of full queue or expiry
+    size_t size_limit_;
+    bool drop_oldest_;
+};
+
+#endif // MESSAGE_QUEUE_H
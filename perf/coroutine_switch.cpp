@@ -0,0 +1,134 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "libsk.h"
+#include "coroutine/detail/context.h"
+
+/*
+ * switches per second of:
+ *   1. the raw context switch, with & without the fpu control words
+ *   2. two coroutines yielding to each other
+ *   3. two coroutines passing values through a channel
+ * 2 & 3 are measured with the direct switch on & off, with it off, each
+ * switch goes through coroutine_schedule()
+ */
+
+#define LOOP_COUNT 1000000
+#define STACK_SIZE (64 * 1024)
+
+using namespace sk;
+
+static void *main_ctx = nullptr;
+static void *ping_ctx = nullptr;
+static int jump_mode = 0;
+
+static intptr_t jump(void **from, void *to) {
+    switch (jump_mode) {
+        case 0:  return detail::jump_context(from, to, 0, true);
+        case 1:  return detail::jump_context(from, to, 0, false);
+        default: return detail::jump_context_fast(from, to, 0);
+    }
+}
+
+static void ping(intptr_t) {
+    while (true) {
+        jump(&ping_ctx, main_ctx);
+    }
+}
+
+void print_result(const char *test_type, u64 switches, u64 begin_ns, u64 end_ns) {
+    const double seconds = (end_ns - begin_ns) / 1e9;
+    printf("test type: %-32s switches: %lu,\t time cost: %.3f ms,\t %.2f M switches/s,\t %.1f ns/switch.\n",
+           test_type, switches, seconds * 1000, switches / seconds / 1e6, (end_ns - begin_ns) / double(switches));
+}
+
+void test_raw_switch(int mode, const char *test_type) {
+    char *stack = static_cast<char*>(malloc(STACK_SIZE));
+    jump_mode = mode;
+    ping_ctx = detail::make_context(stack + STACK_SIZE, STACK_SIZE, ping);
+
+    u64 begin = time::monotonic_ns();
+    for (int i = 0; i < LOOP_COUNT; ++i) {
+        jump(&main_ctx, ping_ctx);
+    }
+    u64 end = time::monotonic_ns();
+
+    // the ping context is never finished, just drop its stack
+    free(stack);
+    print_result(test_type, LOOP_COUNT * 2, begin, end);
+}
+
+// coroutine_schedule() returns once, so each test has a fresh scheduler
+void init_scheduler(bool direct) {
+    coroutine_init(uv_default_loop());
+    coroutine_set_direct_switch(direct);
+}
+
+void fini_scheduler() {
+    coroutine_fini();
+
+    // run the close callbacks of the handles
+    uv_run(uv_default_loop(), UV_RUN_DEFAULT);
+}
+
+void test_yield(bool direct, bool preserve_fpu, const char *test_type) {
+    init_scheduler(direct);
+
+    auto fn = [] () {
+        for (int i = 0; i < LOOP_COUNT / 2; ++i) {
+            coroutine_yield();
+        }
+    };
+
+    coroutine_create("yield-a", fn, STACK_SIZE, preserve_fpu);
+    coroutine_create("yield-b", fn, STACK_SIZE, preserve_fpu);
+
+    u64 begin = time::monotonic_ns();
+    coroutine_schedule();
+    u64 end = time::monotonic_ns();
+
+    fini_scheduler();
+    print_result(test_type, LOOP_COUNT, begin, end);
+}
+
+void test_channel(bool direct, const char *test_type) {
+    init_scheduler(direct);
+
+    coroutine_channel<int> *ch = new coroutine_channel<int>(1);
+
+    coroutine_create("producer", [ch] () {
+        for (int i = 0; i < LOOP_COUNT / 2; ++i) {
+            ch->push(i);
+        }
+
+        ch->close();
+    }, STACK_SIZE);
+
+    coroutine_create("consumer", [ch] () {
+        int v = 0;
+        while (ch->pop(v)) {}
+    }, STACK_SIZE);
+
+    u64 begin = time::monotonic_ns();
+    coroutine_schedule();
+    u64 end = time::monotonic_ns();
+
+    delete ch;
+    fini_scheduler();
+    print_result(test_type, LOOP_COUNT, begin, end);
+}
+
+int main() {
+    test_raw_switch(0, "raw, preserve fpu");
+    test_raw_switch(1, "raw, no fpu");
+    test_raw_switch(2, "raw, fast");
+
+    test_yield(false, true,  "yield, scheduled, preserve fpu");
+    test_yield(false, false, "yield, scheduled");
+    test_yield(true,  false, "yield, direct");
+
+    test_channel(false, "channel, scheduled");
+    test_channel(true,  "channel, direct");
+
+    return 0;
+}
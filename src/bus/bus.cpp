@@ -1,6 +1,9 @@
+#include <time.h>
+#include <algorithm>
 #include <bus/bus.h>
 #include <log/log.h>
 #include <bus/detail/channel.h>
+#include <utility/time_helper.h>
 #include <utility/assert_helper.h>
 #include <shm/detail/shm_object.h>
 #include <bus/detail/channel_mgr.h>
@@ -10,8 +13,24 @@ NS_BEGIN(bus)
 
 static int fd = -1;
 static int busid = -1;
+static int send_timeout = 0;
+static bool recv_weighted = false;
+static int recv_weights[BUS_PRIORITY_COUNT] = {0};
+static int recv_lane = BUS_PRIORITY_COUNT - 1; // current lane of weighted round-robin
+static int recv_credit = 0; // messages can still be received from current lane
+static writable_callback writable_cb;
 static detail::channel_mgr *mgr = nullptr;
 
+// spin this many times before sleeping when the write channel is full
+static const int SEND_SPIN_COUNT = 128;
+
+// the sleep interval grows from MIN to MAX when waiting for space
+static const u64 SEND_MIN_SLEEP_NS = 10 * 1000;
+static const u64 SEND_MAX_SLEEP_NS = 1000 * 1000;
+
+static_assert(BUS_PRIORITY_COUNT == detail::CHANNEL_LANE_COUNT, "lane count mismatch");
+static_assert(BUS_PRIORITY_NORMAL == detail::CHANNEL_LANE_DEFAULT, "default lane mismatch");
+
 union busid_format {
     int busid;
     struct {
@@ -23,13 +42,6 @@ union busid_format {
 };
 static_assert(sizeof(busid_format) == sizeof(int), "invalid type: busid_format");
 
-static u64 time_ns() {
-    struct timespec t;
-    int ret = clock_gettime(CLOCK_MONOTONIC, &t);
-    if (unlikely(ret != 0)) return 0;
-    return static_cast<u64>(t.tv_sec) * 1000000000 + static_cast<u64>(t.tv_nsec);
-}
-
 int from_string(const char *str, int *area_id, int *zone_id, int *func_id, int *inst_id) {
     assert_retval(str, -1);
 
@@ -61,6 +73,28 @@ int from_subid(int area_id, int zone_id, int func_id, int inst_id) {
     return f.busid;
 }
 
+bool is_group(int bus_id) {
+    busid_format f;
+    f.busid = bus_id;
+
+    // all sub ids are BUS_ANY_ID, it's -1, which is the error code of from_string(...)
+    if (bus_id == -1) return false;
+
+    return f.area_id == BUS_ANY_ID || f.zone_id == BUS_ANY_ID ||
+           f.func_id == BUS_ANY_ID || f.inst_id == BUS_ANY_ID;
+}
+
+bool group_match(int group, int bus_id) {
+    busid_format g, f;
+    g.busid = group;
+    f.busid = bus_id;
+
+    return (g.area_id == BUS_ANY_ID || g.area_id == f.area_id) &&
+           (g.zone_id == BUS_ANY_ID || g.zone_id == f.zone_id) &&
+           (g.func_id == BUS_ANY_ID || g.func_id == f.func_id) &&
+           (g.inst_id == BUS_ANY_ID || g.inst_id == f.inst_id);
+}
+
 std::string to_string(int bus_id) {
     busid_format f;
     f.busid = bus_id;
@@ -131,12 +165,19 @@ int inst_id(int bus_id) {
     return f.inst_id;
 }
 
-int register_bus(const char *shm_path, int busid, size_t node_size, size_t node_count) {
+int register_bus(const char *shm_path, int busid, size_t node_size, size_t node_count,
+                 bool drop_oldest, size_t control_capacity, size_t bulk_capacity, bool stats) {
     if (fd != -1) {
         sk_error("bus<%x> already registered.", busid);
         return -EINVAL;
     }
 
+    // a sub id of BUS_ANY_ID makes it a group, -1 has all of them so
+    if (is_group(busid) || busid == -1) {
+        sk_error("bus<%x> has a sub id of BUS_ANY_ID.", busid);
+        return -EINVAL;
+    }
+
     int ret = 0;
     size_t shm_size = 0;
 
@@ -153,15 +194,41 @@ int register_bus(const char *shm_path, int busid, size_t node_size, size_t node_
     mgr = cast_ptr(detail::channel_mgr, addr);
 
     pid_t pid = getpid();
-    ret = mgr->register_channel(busid, pid, node_size, node_count, fd);
+    u32 flags = 0;
+    if (drop_oldest) flags |= detail::CHANNEL_FLAG_DROP_OLDEST;
+    if (stats) flags |= detail::CHANNEL_FLAG_STATS;
+    size_t capacity[BUS_PRIORITY_COUNT] = {0};
+    capacity[BUS_PRIORITY_CONTROL] = control_capacity;
+    capacity[BUS_PRIORITY_NORMAL] = node_size * node_count;
+    capacity[BUS_PRIORITY_BULK] = bulk_capacity;
+    ret = mgr->register_channel(busid, pid, capacity, flags, fd);
     if (ret != 0) return ret;
 
+    // the previous instance might exit (e.g. hotfix) while polling
+    set_busy_poll(false);
+
     sk::bus::busid = busid;
 
     sk_info("bus registered, bus id<%x>, fd<%d>.", busid, fd);
     return 0;
 }
 
+int resize_bus(size_t node_size, size_t node_count,
+               size_t control_capacity, size_t bulk_capacity) {
+    assert_retval(fd != -1, -1);
+    assert_retval(mgr, -1);
+
+    size_t capacity[BUS_PRIORITY_COUNT] = {0};
+    capacity[BUS_PRIORITY_CONTROL] = control_capacity;
+    capacity[BUS_PRIORITY_NORMAL] = node_size * node_count;
+    capacity[BUS_PRIORITY_BULK] = bulk_capacity;
+    int ret = mgr->resize_channel(fd, capacity);
+    if (ret != 0) return ret;
+
+    sk_info("bus resized, bus id<%x>, fd<%d>.", busid, fd);
+    return 0;
+}
+
 void deregister_bus() {
     if (fd == -1) sk_warn("bus<%x> seems to be deregistered.", busid);
 
@@ -175,42 +242,127 @@ void deregister_bus() {
     sk_info("bus deregistered, bus id<%x>.", busid);
 }
 
+static void notify_outgoing() {
+    // NOTE: no memory barrier is needed here, channel::push(...) publishes
+    // the message with release semantics before the bus gets notified
+    sigval value;
+    memset(&value, 0x00, sizeof(value));
+    value.sival_int = fd;
+    int ret = sigqueue(mgr->pid, BUS_OUTGOING_SIGNO, value);
+    if (ret != 0) sk_warn("cannot send signal: %s", strerror(errno));
+}
+
+// it blocks the calling thread, see the NOTE of send(...) in bus.h
+static int wait_push(detail::channel *wc, int src_busid, int dst_busid,
+                     u64 ctime, const void *data, size_t length, int timeout_ms) {
+    // make sure busd is draining the channel while we are waiting
+    notify_outgoing();
+
+    int ret = 0;
+    for (int i = 0; i < SEND_SPIN_COUNT; ++i) {
+        ret = wc->push(src_busid, dst_busid, ctime, data, length);
+        if (ret != -ENOMEM) return ret;
+    }
+
+    u64 interval = SEND_MIN_SLEEP_NS;
+    u64 deadline = sk::time::monotonic_ns() + static_cast<u64>(timeout_ms) * 1000000;
+    while (true) {
+        u64 now = sk::time::monotonic_ns();
+        if (now >= deadline) return -ETIMEDOUT;
+
+        u64 ns = std::min(interval, deadline - now);
+        struct timespec ts;
+        ts.tv_sec = static_cast<time_t>(ns / 1000000000);
+        ts.tv_nsec = static_cast<long>(ns % 1000000000);
+        nanosleep(&ts, nullptr);
+
+        ret = wc->push(src_busid, dst_busid, ctime, data, length);
+        if (ret != -ENOMEM) return ret;
+
+        interval = std::min(interval * 2, SEND_MAX_SLEEP_NS);
+    }
+}
+
 int send(int dst_busid, const void *data, size_t length) {
+    return send(dst_busid, data, length, send_timeout);
+}
+
+int send(int dst_busid, const void *data, size_t length, int timeout_ms, int priority) {
     assert_retval(fd != -1, -1);
     assert_retval(mgr, -1);
     assert_retval(data, -1);
 
-    if (unlikely(dst_busid <= 0)) {
+    // a group with BUS_ANY_ID as the instance id is negative
+    if (unlikely(dst_busid <= 0 && !is_group(dst_busid))) {
         sk_error("invalid bus id<%x>.", dst_busid);
         return -EINVAL;
     }
 
-    detail::channel *wc = mgr->get_write_channel(fd);
-    assert_retval(wc, -1);
+    if (unlikely(priority < 0 || priority >= BUS_PRIORITY_COUNT)) {
+        sk_error("invalid priority<%d>.", priority);
+        return -EINVAL;
+    }
+
+    detail::channel *head = mgr->get_write_channel(fd);
+    assert_retval(head, -1);
+
+    detail::channel *wc = head->lane(priority);
 
     int src_busid = mgr->get_owner_busid(fd);
     assert_retval(src_busid > 0, -1);
 
-    u64 now = time_ns();
-    int retry = 3;
-    while (retry-- > 0) {
-        int ret = wc->push(src_busid, dst_busid, now, data, length);
-        if (likely(ret == 0)) break;
+    // ctime is based on CLOCK_REALTIME, so the latency statistics are
+    // still meaningful after the message is forwarded to another host
+    u64 now = sk::time::realtime_ns();
+    int ret = wc->push(src_busid, dst_busid, now, data, length);
+
+    // the channel is full, a lossy channel never gets here as the
+    // oldest messages are dropped to make room for the new one
+    if (unlikely(ret == -ENOMEM)) {
+        if (timeout_ms <= 0) {
+            wc->record_drop();
+            notify_outgoing();
+            return -EAGAIN;
+        }
+
+        ret = wait_push(wc, src_busid, dst_busid, now, data, length, timeout_ms);
+        if (ret == -ETIMEDOUT) {
+            wc->record_drop();
+            sk_warn("bus channel full, send timed out, dst<%x>, timeout<%d>.", dst_busid, timeout_ms);
+            return ret;
+        }
+    }
 
-        sk_error("failed to write data to bus, ret<%d>, retry<%d>.", ret, retry);
+    if (unlikely(ret != 0)) {
+        sk_error("failed to write data to bus, ret<%d>.", ret);
+        return ret;
     }
 
-    // we start a full memory barrier here to make sure the data is ready
-    // before we notify the bus
-    __sync_synchronize();
+    notify_outgoing();
+    return 0;
+}
 
-    sigval value;
-    memset(&value, 0x00, sizeof(value));
-    value.sival_int = fd;
-    int ret = sigqueue(mgr->pid, BUS_OUTGOING_SIGNO, value);
-    if (ret != 0) sk_warn("cannot send signal: %s", strerror(errno));
+void set_send_timeout(int timeout_ms) {
+    send_timeout = timeout_ms;
+}
 
-    return 0;
+void set_writable_callback(const writable_callback& cb) {
+    writable_cb = cb;
+}
+
+void on_writable() {
+    if (writable_cb) writable_cb();
+}
+
+static int recv_lane_message(detail::channel *rc, int& src_busid, void *data, size_t& length) {
+    // the end-to-end latency is recorded by the channel itself,
+    // see channel::consumer_stats()
+    int count = rc->pop(data, length, &src_busid, nullptr, nullptr);
+    if (count == 0 || count == 1)
+        return count;
+
+    sk_error("failed to read data from bus, error<%d>.", count);
+    return count;
 }
 
 int recv(int& src_busid, void *data, size_t& length) {
@@ -218,18 +370,86 @@ int recv(int& src_busid, void *data, size_t& length) {
     assert_retval(mgr, -1);
     assert_retval(data, -1);
 
-    detail::channel *rc = mgr->get_read_channel(fd);
-    assert_retval(rc, -1);
+    detail::channel *head = mgr->get_read_channel(fd);
+    assert_retval(head, -1);
 
-    int dst_busid = 0;
-    u64 send_time = 0;
-    int count = rc->pop(data, length, &src_busid, &dst_busid, &send_time);
-    // TODO: do some performance counter with send_time here
-    if (count == 0 || count == 1)
-        return count;
+    // messages in the ring retired by resizing are older than
+    // any message in the head, so they are received first
+    detail::channel *retired = mgr->get_retired_channel(head);
+    if (unlikely(retired)) {
+        for (int i = 0; i < BUS_PRIORITY_COUNT; ++i) {
+            check_continue(retired->has_lane(i));
 
-    sk_error("failed to read data from bus, error<%d>.", count);
-    return count;
+            int count = recv_lane_message(retired->lane(i), src_busid, data, length);
+            if (count != 0) return count;
+        }
+
+        mgr->release_retired_channel(head);
+    }
+
+    if (!recv_weighted) {
+        for (int i = 0; i < BUS_PRIORITY_COUNT; ++i) {
+            check_continue(head->has_lane(i));
+
+            int count = recv_lane_message(head->lane(i), src_busid, data, length);
+            if (count != 0) return count;
+        }
+
+        return 0;
+    }
+
+    // an empty lane gives up its credit, so a round ends after
+    // all lanes are tried and none of them has any message
+    int tried = 0;
+    while (tried < BUS_PRIORITY_COUNT) {
+        if (recv_credit <= 0) {
+            recv_lane = (recv_lane + 1) % BUS_PRIORITY_COUNT;
+            recv_credit = recv_weights[recv_lane];
+        }
+
+        if (!head->has_lane(recv_lane)) {
+            recv_credit = 0;
+            ++tried;
+            continue;
+        }
+
+        int count = recv_lane_message(head->lane(recv_lane), src_busid, data, length);
+        if (count == 1) --recv_credit;
+        if (count != 0) return count;
+
+        recv_credit = 0;
+        ++tried;
+    }
+
+    return 0;
+}
+
+void set_busy_poll(bool polling) {
+    assert_retnone(fd != -1);
+    assert_retnone(mgr);
+
+    detail::channel *head = mgr->get_read_channel(fd);
+    assert_retnone(head);
+
+    head->set_polling(polling);
+}
+
+void set_recv_weights(const int *weights) {
+    recv_lane = BUS_PRIORITY_COUNT - 1;
+    recv_credit = 0;
+    recv_weighted = false;
+    if (!weights) return;
+
+    for (int i = 0; i < BUS_PRIORITY_COUNT; ++i) {
+        if (weights[i] <= 0) {
+            sk_error("invalid weight<%d> of lane<%d>.", weights[i], i);
+            return;
+        }
+
+        recv_weights[i] = weights[i];
+    }
+
+    recv_weighted = true;
 }
 
 NS_END(bus)
@@ -3,6 +3,7 @@
 
 #include <string>
 #include <signal.h>
+#include <functional>
 #include <utility/types.h>
 
 NS_BEGIN(sk)
@@ -14,6 +15,34 @@ static const size_t       DEFAULT_BUS_NODE_COUNT = 102400;
 static const s32          BUS_INCOMING_SIGNO     = SIGRTMIN + 7;
 static const s32          BUS_OUTGOING_SIGNO     = SIGRTMIN + 8;
 static const s32          BUS_REGISTRATION_SIGNO = SIGRTMIN + 9;
+static const s32          BUS_WRITABLE_SIGNO     = SIGRTMIN + 10;
+
+/*
+ * priorities of bus messages, each priority has its own lane (an
+ * independent channel), so bulk messages will not delay control
+ * messages, if the lane of a priority is not allocated, messages
+ * with this priority go to the normal lane
+ */
+static const int BUS_PRIORITY_CONTROL = 0;
+static const int BUS_PRIORITY_NORMAL  = 1;
+static const int BUS_PRIORITY_BULK    = 2;
+static const int BUS_PRIORITY_COUNT   = 3;
+
+/*
+ * a sub id of BUS_ANY_ID matches any sub id, a bus id with such a sub id
+ * is a group, e.g. from_subid(1, 2, 3, BUS_ANY_ID) stands for all the
+ * instances of function 3 in zone 2 of area 1, a message sent to a group
+ * is written into the channel once, and busd delivers it to all the
+ * members, but at least one sub id of a group must not be BUS_ANY_ID,
+ * so a real process must not use 255 as any of its sub ids
+ */
+static const int BUS_ANY_ID = 0xFF;
+
+/*
+ * a callback which will be called when the write channel becomes
+ * writable again, after a send failed because the channel was full
+ */
+typedef std::function<void()> writable_callback;
 
 /**
  * @brief parse a bus id from string
@@ -38,6 +67,21 @@ int from_string(const char *str,
  */
 int from_subid(int area_id, int zone_id, int func_id, int inst_id);
 
+/**
+ * @brief check if a bus id is a group, see BUS_ANY_ID
+ * @param bus_id
+ * @return true if any sub id of bus_id is BUS_ANY_ID, and bus_id is valid
+ */
+bool is_group(int bus_id);
+
+/**
+ * @brief check if a bus id is a member of a group
+ * @param group: the group bus id
+ * @param bus_id: a non-group bus id
+ * @return true if every sub id of bus_id matches the one of group
+ */
+bool group_match(int group, int bus_id);
+
 /**
  * @brief convert a bus id to string
  * @param bus_id
@@ -106,14 +150,48 @@ int inst_id(int bus_id);
 /**
  * @brief register bus for process whose bus id is busid
  * @param shm_path: shm object path of bus
- * @param busid: bus id of current process
+ * @param busid: bus id of current process, none of its sub ids can be BUS_ANY_ID
  * @param node_size: size of a single data node
  * @param node_count: total count of data nodes
+ * @param drop_oldest: if the write channel is full, drop the oldest messages
+ *                     instead of failing the send, it's useful for channels
+ *                     carrying telemetry-like messages, where the latest
+ *                     message matters more than the complete history
+ * @param control_capacity: capacity in bytes of the control lane, the lane
+ *                          is not allocated if it's 0
+ * @param bulk_capacity: capacity in bytes of the bulk lane, the lane is not
+ *                       allocated if it's 0
+ * @param stats: keep statistics (counters & latency histograms) in the
+ *               channels, see busstat, the space of them is only allocated
+ *               if it's true
+ *
  * @return 0 if succeeds, error code otherwise
+ *
+ * NOTE: node_size * node_count is the capacity of the normal lane in bytes,
+ * messages are stored as variable-length records, so node_size is only
+ * a sizing unit, it does not need to be 2 ^ N
  */
 int register_bus(const char *shm_path, int busid,
                  size_t node_size = DEFAULT_BUS_NODE_SIZE,
-                 size_t node_count = DEFAULT_BUS_NODE_COUNT);
+                 size_t node_count = DEFAULT_BUS_NODE_COUNT,
+                 bool drop_oldest = false,
+                 size_t control_capacity = 0,
+                 size_t bulk_capacity = 0,
+                 bool stats = true);
+
+/**
+ * @brief resize the channels of current process online, the messages
+ * already in the channels are not lost, they are consumed before the
+ * messages sent after resizing, the arguments are the same as the ones
+ * of register_bus(...), a channel can only be resized again after the
+ * previous rings are drained
+ * @return 0 if succeeds, error code otherwise:
+ *         1. -EBUSY: the previous resizing is still in progress
+ *         2. -ENOTSUP: the channels are created by an old version
+ *         3. -ENOMEM: there is no enough space in the shm segment
+ */
+int resize_bus(size_t node_size, size_t node_count,
+               size_t control_capacity = 0, size_t bulk_capacity = 0);
 
 /**
  * @brief deregister bus for current process
@@ -121,16 +199,66 @@ int register_bus(const char *shm_path, int busid,
 void deregister_bus();
 
 /**
- * @brief send message through bus
+ * @brief send message through bus, the default send timeout is used
  * @param dst_busid: destination bus id of this message
  * @param data: message data
  * @param length: message length
- * @return 0 if succeeds, error code otherwise
+ * @return 0 if succeeds, error code otherwise, see the function below
  */
 int send(int dst_busid, const void *data, size_t length);
 
 /**
- * @brief recv one message from bus
+ * @brief send message through bus
+ * @param dst_busid: destination bus id of this message, it can be a group,
+ *                   see BUS_ANY_ID, the message is delivered to the members
+ *                   registered when busd routes it, and is dropped silently
+ *                   if there is no member at that time
+ * @param data: message data
+ * @param length: message length
+ * @param timeout_ms: how long to wait if the write channel is full, if
+ *                    it's 0, the function returns -EAGAIN immediately,
+ *                    otherwise it spins for a while, then sleeps and
+ *                    retries until the channel has enough space
+ * @param priority: BUS_PRIORITY_XXX, which lane the message goes to
+ * @return 0 if succeeds, error code otherwise:
+ *         1. -EAGAIN: the channel is full and timeout_ms is 0
+ *         2. -ETIMEDOUT: the channel is still full after timeout_ms
+ *
+ * NOTE: if the send fails because the channel is full, the writable
+ * callback will be called once the channel is writable again
+ *
+ * NOTE: a positive timeout_ms blocks the calling thread, nothing else
+ * runs in it meanwhile, so a thread running an event loop (e.g. a uv
+ * loop or the coroutine scheduler) MUST use 0, and retry in the
+ * writable callback instead
+ */
+int send(int dst_busid, const void *data, size_t length,
+         int timeout_ms, int priority = BUS_PRIORITY_NORMAL);
+
+/**
+ * @brief set the default timeout of send(...), it's 0 by default, keep
+ * it 0 in the processes sending from an event loop, see send(...)
+ * @param timeout_ms: see send(...)
+ */
+void set_send_timeout(int timeout_ms);
+
+/**
+ * @brief set the callback which will be called when the write channel
+ * becomes writable again, after a send failed because the channel was full
+ * @param cb: the callback
+ */
+void set_writable_callback(const writable_callback& cb);
+
+/**
+ * @brief this function should be called when the BUS_WRITABLE_SIGNO
+ * signal is received, it calls the writable callback if there is one
+ */
+void on_writable();
+
+/**
+ * @brief recv one message from bus, if there are several lanes, lanes
+ * are drained by strict priority, or by weighted round-robin if the
+ * weights are set by set_recv_weights(...)
  * @param src_busid: stores the source bus id of this message
  * @param data: buffer to store message, must NOT be null
  * @param length: length of the buffer, also stores the length of the message
@@ -138,6 +266,23 @@ int send(int dst_busid, const void *data, size_t length);
  */
 int recv(int& src_busid, void *data, size_t& length);
 
+/**
+ * @brief tell busd whether current process is polling its read channel,
+ * busd does not send BUS_INCOMING_SIGNO while the process is polling,
+ * after polling is turned off, the process must call recv(...) again,
+ * as the messages arrived just before that are not notified
+ * @param polling: true if the process calls recv(...) continuously
+ */
+void set_busy_poll(bool polling);
+
+/**
+ * @brief set the weights of lanes for weighted round-robin receiving
+ * @param weights: how many messages can be received from a lane in one
+ *                 round, it must have BUS_PRIORITY_COUNT elements, each
+ *                 element must be positive, or NULL to use strict priority
+ */
+void set_recv_weights(const int *weights);
+
 NS_END(bus)
 NS_END(sk)
 
@@ -3,6 +3,7 @@
 #include <common/murmurhash3.h>
 #include <bus/detail/channel.h>
 #include <utility/math_helper.h>
+#include <utility/time_helper.h>
 #include <utility/assert_helper.h>
 #include <shm/detail/shm_object.h>
 
@@ -11,25 +12,147 @@
 NS_BEGIN(sk)
 NS_BEGIN(detail)
 
-int channel::init(size_t node_size, size_t node_count) {
-    // node_count should > 1 because there will be an empty
-    // node to distinguish a full channel or an empty channel:
+// bump the move count in the high bits, it wraps around silently
+static inline size_t next_read_word(size_t read_word, size_t new_read_pos) {
+    return (((read_word >> READ_POS_BITS) + 1) << READ_POS_BITS) | new_read_pos;
+}
+
+static size_t encode_varint(char *buf, size_t value) {
+    size_t n = 0;
+    while (value >= 0x80) {
+        buf[n++] = static_cast<char>((value & 0x7F) | 0x80);
+        value >>= 7;
+    }
+
+    buf[n++] = static_cast<char>(value);
+    return n;
+}
+
+static size_t decode_varint(const char *buf, size_t len, size_t& value) {
+    value = 0;
+    for (size_t n = 0, shift = 0; n < len && shift < sizeof(size_t) * 8; ++n, shift += 7) {
+        u8 byte = static_cast<u8>(buf[n]);
+        value |= static_cast<size_t>(byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0)
+            return n + 1;
+    }
+
+    return 0;
+}
+
+size_t channel_record::encode(char *buf) const {
+    u8 flags = RECORD_TAG;
+    if (src_busid != 0) flags |= RECORD_FLAG_SRC;
+    if (dst_busid != 0) flags |= RECORD_FLAG_DST;
+    if (ctime != 0)     flags |= RECORD_FLAG_CTIME;
+
+    size_t n = 0;
+    buf[n++] = static_cast<char>(flags);
+    n += encode_varint(buf + n, length);
+
+    if (flags & RECORD_FLAG_SRC) {
+        memcpy(buf + n, &src_busid, sizeof(src_busid));
+        n += sizeof(src_busid);
+    }
+
+    if (flags & RECORD_FLAG_DST) {
+        memcpy(buf + n, &dst_busid, sizeof(dst_busid));
+        n += sizeof(dst_busid);
+    }
+
+    if (flags & RECORD_FLAG_CTIME) {
+        memcpy(buf + n, &ctime, sizeof(ctime));
+        n += sizeof(ctime);
+    }
+
+    memcpy(buf + n, &hash, sizeof(hash));
+    n += sizeof(hash);
+
+    sk_assert(n <= MAX_HEADER_SIZE);
+    return n;
+}
+
+size_t channel_record::decode(const char *buf, size_t len) {
+    check_retval(len > 0, 0);
+
+    u8 flags = static_cast<u8>(buf[0]);
+    check_retval((flags & RECORD_TAG_MASK) == RECORD_TAG, 0);
+
+    size_t n = 1;
+    size_t ret = decode_varint(buf + n, len - n, length);
+    check_retval(ret > 0, 0);
+    n += ret;
+
+    src_busid = 0;
+    if (flags & RECORD_FLAG_SRC) {
+        check_retval(n + sizeof(src_busid) <= len, 0);
+        memcpy(&src_busid, buf + n, sizeof(src_busid));
+        n += sizeof(src_busid);
+    }
+
+    dst_busid = 0;
+    if (flags & RECORD_FLAG_DST) {
+        check_retval(n + sizeof(dst_busid) <= len, 0);
+        memcpy(&dst_busid, buf + n, sizeof(dst_busid));
+        n += sizeof(dst_busid);
+    }
+
+    ctime = 0;
+    if (flags & RECORD_FLAG_CTIME) {
+        check_retval(n + sizeof(ctime) <= len, 0);
+        memcpy(&ctime, buf + n, sizeof(ctime));
+        n += sizeof(ctime);
+    }
+
+    check_retval(n + sizeof(hash) <= len, 0);
+    memcpy(&hash, buf + n, sizeof(hash));
+    n += sizeof(hash);
+
+    return n;
+}
+
+int channel::init(size_t node_size, size_t node_count, u32 flags) {
+    const size_t capacity = calc_capacity(node_size, node_count);
+
+    // there should be at least two nodes because there will be an
+    // empty node to distinguish a full channel or an empty channel:
     // 1. if it's an empty channel, then read_pos == write_pos
     // 2. if it's a full channel, then write_pos + 1 == read_pos
-    assert_retval(node_count > 1, -1);
-    assert_retval((node_size & (node_size - 1)) == 0, -1);
-    assert_retval(node_size >= sizeof(channel_message), -1);
+    assert_retval(capacity >= channel_record::MAX_HEADER_SIZE + CHANNEL_ALIGNMENT, -1);
 
     this->magic = SK_MAGIC;
-    this->node_count = node_count;
-    this->node_size  = node_size;
-    this->push_count = 0;
-    this->pop_count  = 0;
-    this->read_pos   = 0;
-    this->write_pos  = 0;
-    this->node_offset = sizeof(channel);
+    this->version = CHANNEL_VERSION;
+    this->node_count = capacity / CHANNEL_ALIGNMENT;
+    this->node_size  = CHANNEL_ALIGNMENT;
+    this->v0_push_count = 0;
+    this->v0_pop_count  = 0;
+    this->v0_read_pos   = 0;
+    this->v0_write_pos  = 0;
+    this->node_offset = sizeof(channel) + calc_stats_space(flags);
+    this->flags = flags;
+    this->lane_mask = 0;
+    memset(this->lane_offsets, 0x00, sizeof(this->lane_offsets));
+    this->next_offset = 0;
+    this->retired_offset = 0;
+    this->retired_size = 0;
+
+    this->producer.write_pos.store(0, std::memory_order_relaxed);
+    this->producer.push_count.store(0, std::memory_order_relaxed);
+    this->producer.cached_read_pos = 0;
+    this->producer.blocked.store(0, std::memory_order_relaxed);
+    this->consumer.read_pos.store(0, std::memory_order_relaxed);
+    this->consumer.pop_count.store(0, std::memory_order_relaxed);
+    this->consumer.cached_write_pos = 0;
+    this->consumer.polling.store(0, std::memory_order_relaxed);
+    this->consumer.numa_node = 0;
+
+    if (has_stats()) {
+        this->producer_stats().clear();
+        this->consumer_stats().clear();
+    }
 
     this->node_size_shift = 0;
+    node_size = this->node_size;
     while (node_size > 1) {
         node_size = node_size >> 1;
         ++this->node_size_shift;
@@ -41,10 +164,40 @@ int channel::init(size_t node_size, size_t node_count) {
 void channel::clear() {
     assert_retnone(magic == SK_MAGIC);
 
-    this->push_count = 0;
-    this->pop_count  = 0;
-    this->read_pos   = 0;
-    this->write_pos  = 0;
+    if (unlikely(legacy())) {
+        this->v0_push_count = 0;
+        this->v0_pop_count  = 0;
+        this->v0_read_pos   = 0;
+        this->v0_write_pos  = 0;
+        return;
+    }
+
+    this->producer.write_pos.store(0, std::memory_order_relaxed);
+    this->producer.push_count.store(0, std::memory_order_relaxed);
+    this->producer.cached_read_pos = 0;
+    this->producer.blocked.store(0, std::memory_order_relaxed);
+    this->consumer.read_pos.store(0, std::memory_order_relaxed);
+    this->consumer.pop_count.store(0, std::memory_order_relaxed);
+    this->consumer.cached_write_pos = 0;
+    this->consumer.polling.store(0, std::memory_order_relaxed);
+}
+
+void channel::set_polling(bool polling) {
+    assert_retnone(magic == SK_MAGIC);
+    if (unlikely(legacy())) return;
+
+    consumer.polling.store(polling ? 1 : 0, std::memory_order_relaxed);
+
+    // pairs with the fence in polled(), either the producer sees the
+    // flag cleared, or the consumer sees the message in the next check
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+}
+
+bool channel::polled() const {
+    if (unlikely(legacy())) return false;
+
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    return consumer.polling.load(std::memory_order_relaxed) != 0;
 }
 
 int channel::push(int src_busid, int dst_busid, u64 ctime, const void *data, size_t length) {
@@ -53,125 +206,124 @@ int channel::push(int src_busid, int dst_busid, u64 ctime, const void *data, siz
     if (!data || length <= 0)
         return 0;
 
-    const size_t required_count = __calc_node_count(length);
-    assert_retval(length + sizeof(channel_message) <= required_count * node_size, -1);
+    if (unlikely(!compact()))
+        return __push_node(src_busid, dst_busid, ctime, data, length);
 
-    // reserve a node to distinguish a full channel from an empty channel, so minus 1 here
-    const size_t available_count = (read_pos - write_pos + node_count - 1) % node_count;
-    const size_t new_write_pos = (write_pos + required_count) % node_count;
+    channel_record record;
+    record.src_busid = src_busid;
+    record.dst_busid = dst_busid;
+    record.ctime = ctime;
+    record.length = length;
+    sk::murmurhash3_x86_32(data, length, MURMURHASH_SEED, &record.hash);
 
-    if (required_count > available_count) {
-        sk_error("no enough space for incoming message, required<%lu>, available<%lu>.",
-                 required_count, available_count);
-        return -ENOMEM;
-    }
+    char header[channel_record::MAX_HEADER_SIZE];
+    const size_t header_len = record.encode(header);
+    const size_t required_count = __calc_node_count(header_len + length);
 
-    channel_message *head = __channel_message(write_pos);
+    size_t write_pos = 0;
+    size_t available_count = __producer_space(required_count, write_pos);
 
-    // loop back
-    if (new_write_pos > 0 && new_write_pos < write_pos) {
-        void *addr0 = void_ptr(head->data);
-        size_t sz0 = (node_count - write_pos) * node_size - sizeof(*head);
-        void *addr1 = sk::byte_offset<void>(this, node_offset);
-        size_t sz1 = new_write_pos * node_size;
-
-        // this should NOT happen, if it happens, then function
-        // __calc_node_count(...) must have a bug
-        if (sz0 >= length) {
-            sk_assert(0);
-            memcpy(addr0, data, length);
-        } else {
-            sk_assert(length - sz0 <= sz1);
-            memcpy(addr0, data, sz0);
-            memcpy(addr1, sk::byte_offset<void>(data, sz0), length - sz0);
-        }
-    } else {
-        void *addr = void_ptr(head->data);
-        memcpy(addr, data, length);
+    // make room for the new message in lossy channels
+    if (required_count > available_count && lossy() && required_count < node_count) {
+        while (required_count > available_count && __drop_oldest(write_pos))
+            available_count = __producer_space(required_count, write_pos);
     }
 
-    head->magic = SK_MAGIC;
-    head->src_busid = src_busid;
-    head->dst_busid = dst_busid;
-    head->length = length;
-    head->ctime = ctime;
-    sk::murmurhash3_x86_32(data, length, MURMURHASH_SEED, &head->hash);
+    if (required_count > available_count) {
+        // the caller decides how to handle a full channel, so just debug here
+        sk_debug("no enough space for incoming message, required<%lu>, available<%lu>.",
+                 required_count << node_size_shift, available_count << node_size_shift);
+        producer.blocked.store(1, std::memory_order_relaxed);
+        return -ENOMEM;
+    }
+
+    const size_t offset = write_pos << node_size_shift;
+    __ring_write(offset, header, header_len);
+    __ring_write((offset + header_len) % capacity(), data, length);
 
-    // start a full memory barrier here
-    __sync_synchronize();
+    const size_t new_write_pos = (write_pos + required_count) % node_count;
+    __producer_commit(new_write_pos);
 
-    write_pos = new_write_pos;
-    push_count += 1;
+    if (has_stats()) __stat_push(new_write_pos, ctime, length);
     return 0;
 }
 
 int channel::pop(void *data, size_t& length, int *src_busid, int *dst_busid, u64 *ctime) {
     assert_retval(magic == SK_MAGIC, -1);
 
-    // no data
-    if (read_pos == write_pos) return 0;
+    if (unlikely(!compact()))
+        return __pop_node(data, length, src_busid, dst_busid, ctime);
+
+    // in lossy channels, the producer might drop the message we are reading,
+    // so everything read must be verified by __consumer_moved(...) or the CAS
+    // in __consumer_commit(...) before it's trusted, if the message has been
+    // dropped, just try the next one
+    while (true) {
+        size_t read_pos = 0;
+        size_t write_pos = 0;
+        size_t read_word = 0;
+        if (!__consumer_peek(read_pos, write_pos, &read_word))
+            return 0;
+
+        channel_record record;
+        size_t used_count = 0;
+        const size_t header_len = __peek_record(read_pos, write_pos, record, used_count);
+        if (unlikely(header_len <= 0)) {
+            if (lossy() && __consumer_moved(read_word)) continue;
 
-    const channel_message *head = __channel_message(read_pos);
-    assert_retval(head->magic == SK_MAGIC, -1);
-    assert_retval(head->length > 0, -1);
+            sk_assert(0);
+            return -1;
+        }
 
-    const size_t used_count = __calc_node_count(head->length);
-    const size_t new_read_pos = (read_pos + used_count) % node_count;
-    if (new_read_pos != write_pos) {
-        const channel_message *h = __channel_message(new_read_pos);
-        sk_assert(h->magic == SK_MAGIC);
-        sk_assert(h->length > 0);
-    }
+        if (data) {
+            if (record.length > length) {
+                if (lossy() && __consumer_moved(read_word)) continue;
 
-    if (data) {
-        if (head->length > length) {
-            length = head->length;
+                length = record.length;
 
-            sk_error("buffer too small, required size<%lu>.", head->length);
-            return -E2BIG;
-        }
+                sk_error("buffer too small, required size<%lu>.", record.length);
+                return -E2BIG;
+            }
 
-        // loop back
-        if (new_read_pos > 0 && new_read_pos < read_pos) {
-            void *addr0 = void_ptr(const_cast<char*>(head->data));
-            size_t sz0 = (node_count - read_pos) * node_size - sizeof(*head);
-            void *addr1 = sk::byte_offset<void>(this, node_offset);
-            size_t sz1 = new_read_pos * node_size;
+            const size_t offset = (read_pos << node_size_shift) + header_len;
+            __ring_read(offset % capacity(), data, record.length);
+
+            u32 hash = 0;
+            sk::murmurhash3_x86_32(data, record.length, MURMURHASH_SEED, &hash);
+            if (unlikely(hash != record.hash)) {
+                if (lossy() && __consumer_moved(read_word)) continue;
 
-            // this should NOT happen
-            if (sz0 >= head->length) {
                 sk_assert(0);
-                memcpy(data, addr0, head->length);
-            } else {
-                sk_assert(head->length - sz0 <= sz1);
-                memcpy(data, addr0, sz0);
-                memcpy(sk::byte_offset<void>(data, sz0), addr1, head->length - sz0);
+                return -1;
             }
-        } else {
-            void *addr = void_ptr(const_cast<char*>(head->data));
-            memcpy(data, addr, head->length);
         }
 
-        length = head->length;
-
-        u32 hash = 0;
-        sk::murmurhash3_x86_32(data, length, MURMURHASH_SEED, &hash);
-        assert_retval(hash == head->hash, -1);
-    }
+        if (!__consumer_commit(read_word, (read_pos + used_count) % node_count))
+            continue;
 
-    if (src_busid) *src_busid = head->src_busid;
-    if (dst_busid) *dst_busid = head->dst_busid;
-    if (ctime)     *ctime     = head->ctime;
+        if (data) length = record.length;
 
-    // start a full memory barrier here
-    __sync_synchronize();
+        if (src_busid) *src_busid = record.src_busid;
+        if (dst_busid) *dst_busid = record.dst_busid;
+        if (ctime)     *ctime     = record.ctime;
 
-    read_pos = new_read_pos;
-    pop_count += 1;
-    return 1;
+        if (has_stats()) __stat_pop(record.ctime, record.length);
+        return 1;
+    }
 }
 
 size_t channel::message_count() const {
+    size_t push_count = 0;
+    size_t pop_count = 0;
+
+    if (unlikely(legacy())) {
+        push_count = v0_push_count;
+        pop_count = v0_pop_count;
+    } else {
+        push_count = producer.push_count.load(std::memory_order_relaxed);
+        pop_count = consumer.pop_count.load(std::memory_order_relaxed);
+    }
+
     if (push_count >= pop_count)
         return push_count - pop_count;
 
@@ -182,12 +334,25 @@ size_t channel::message_count() const {
     // however, for both situations, we do not need to care much and do
     // not need any "fix", as this function is just a helper function,
     // a warning log should be enough
-    sk_warn("incorrect push count<%d>, pop count<%d>.", push_count, pop_count);
+    sk_warn("incorrect push count<%lu>, pop count<%lu>.", push_count, pop_count);
     return 0;
 }
 
+bool channel::test_writable() {
+    if (unlikely(legacy())) return false;
+    if (likely(producer.blocked.load(std::memory_order_relaxed) == 0)) return false;
+
+    const size_t read_pos = consumer.read_pos.load(std::memory_order_relaxed) & READ_POS_MASK;
+    const size_t write_pos = producer.write_pos.load(std::memory_order_acquire);
+    const size_t used_count = (write_pos + node_count - read_pos) % node_count;
+    if (used_count > node_count / 2) return false;
+
+    return producer.blocked.exchange(0, std::memory_order_relaxed) != 0;
+}
+
 size_t channel::__calc_node_count(size_t data_len) const {
-    size_t total_len = sizeof(channel_message) + data_len;
+    // in compact channels, data_len already includes the record header
+    size_t total_len = compact() ? data_len : sizeof(channel_message) + data_len;
     return ((total_len - 1) >> node_size_shift) + 1;
 }
 
@@ -199,5 +364,265 @@ channel_message *channel::__channel_message(size_t pos) {
     return cast_ptr(channel_message, addr);
 }
 
+size_t channel::__producer_space(size_t required_count, size_t& write_pos) {
+    // reserve a node to distinguish a full channel from an empty channel, so minus 1 here
+    if (unlikely(legacy())) {
+        write_pos = v0_write_pos;
+        return (v0_read_pos - write_pos + node_count - 1) % node_count;
+    }
+
+    // only the producer writes write_pos, so a relaxed load is enough
+    write_pos = producer.write_pos.load(std::memory_order_relaxed);
+
+    // the cached read position is checked first to avoid touching the consumer's cache line
+    size_t available_count = (producer.cached_read_pos - write_pos + node_count - 1) % node_count;
+    if (required_count > available_count) {
+        size_t read_pos = consumer.read_pos.load(std::memory_order_acquire) & READ_POS_MASK;
+        producer.cached_read_pos = read_pos;
+        available_count = (read_pos - write_pos + node_count - 1) % node_count;
+    }
+
+    return available_count;
+}
+
+void channel::__producer_commit(size_t new_write_pos) {
+    if (unlikely(legacy())) {
+        // start a full memory barrier here
+        __sync_synchronize();
+
+        v0_write_pos = new_write_pos;
+        v0_push_count += 1;
+        return;
+    }
+
+    // the release store guarantees the message is visible before the new index
+    producer.write_pos.store(new_write_pos, std::memory_order_release);
+    producer.push_count.store(producer.push_count.load(std::memory_order_relaxed) + 1,
+                              std::memory_order_relaxed);
+}
+
+bool channel::__consumer_peek(size_t& read_pos, size_t& write_pos, size_t *read_word) {
+    if (unlikely(legacy())) {
+        read_pos = v0_read_pos;
+        write_pos = v0_write_pos;
+        if (read_word) *read_word = read_pos;
+        return read_pos != write_pos;
+    }
+
+    // only the consumer writes read_pos, so a relaxed load is enough,
+    // except in lossy channels, where the producer moves it as well
+    const size_t word = consumer.read_pos.load(lossy() ? std::memory_order_acquire : std::memory_order_relaxed);
+    read_pos = word & READ_POS_MASK;
+    if (read_word) *read_word = word;
+
+    // the cached write position is checked first to avoid touching the producer's cache line,
+    // in lossy channels, read_pos might have been moved beyond the cached one, so always reload
+    write_pos = consumer.cached_write_pos;
+    if (read_pos == write_pos || lossy())
+        write_pos = consumer.cached_write_pos = producer.write_pos.load(std::memory_order_acquire);
+
+    return read_pos != write_pos;
+}
+
+bool channel::__consumer_commit(size_t read_word, size_t new_read_pos) {
+    if (unlikely(legacy())) {
+        // start a full memory barrier here
+        __sync_synchronize();
+
+        v0_read_pos = new_read_pos;
+        v0_pop_count += 1;
+        return true;
+    }
+
+    if (lossy()) {
+        // the producer might have dropped this message already, the move
+        // count fails the CAS even if it has come back to the same position
+        const size_t new_word = next_read_word(read_word, new_read_pos);
+        if (!consumer.read_pos.compare_exchange_strong(read_word, new_word,
+                                                       std::memory_order_acq_rel))
+            return false;
+
+        consumer.pop_count.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    // the release store guarantees the message has been consumed before the producer reuses the nodes
+    consumer.read_pos.store(new_read_pos, std::memory_order_release);
+    consumer.pop_count.store(consumer.pop_count.load(std::memory_order_relaxed) + 1,
+                             std::memory_order_relaxed);
+    return true;
+}
+
+bool channel::__consumer_moved(size_t read_word) const {
+    return consumer.read_pos.load(std::memory_order_acquire) != read_word;
+}
+
+bool channel::__drop_oldest(size_t write_pos) {
+    // the consumer has drained the channel meanwhile, there is room now
+    size_t read_word = consumer.read_pos.load(std::memory_order_acquire);
+    const size_t read_pos = read_word & READ_POS_MASK;
+    if (read_pos == write_pos) return true;
+
+    // the records are written by the producer itself, so they must be valid
+    channel_record record;
+    size_t used_count = 0;
+    const size_t header_len = __peek_record(read_pos, write_pos, record, used_count);
+    assert_retval(header_len > 0, false);
+
+    // if CAS fails, the consumer has popped the message, which also makes room
+    const size_t new_read_pos = (read_pos + used_count) % node_count;
+    const size_t new_word = next_read_word(read_word, new_read_pos);
+    if (consumer.read_pos.compare_exchange_strong(read_word, new_word, std::memory_order_acq_rel)) {
+        consumer.pop_count.fetch_add(1, std::memory_order_relaxed);
+        record_drop();
+    }
+
+    return true;
+}
+
+size_t channel::__peek_record(size_t pos, size_t write_pos, channel_record& record, size_t& used_count) {
+    // the header may be shorter than MAX_HEADER_SIZE, so do not read beyond write_pos
+    const size_t used_size = ((write_pos + node_count - pos) % node_count) << node_size_shift;
+    char header[channel_record::MAX_HEADER_SIZE];
+    const size_t peek_size = sk::min(used_size, sizeof(header));
+    __ring_read(pos << node_size_shift, header, peek_size);
+
+    const size_t header_len = record.decode(header, peek_size);
+    check_retval(header_len > 0, 0);
+    check_retval(record.length > 0, 0);
+
+    used_count = __calc_node_count(header_len + record.length);
+    check_retval(used_count <= (used_size >> node_size_shift), 0);
+
+    return header_len;
+}
+
+void channel::__ring_write(size_t offset, const void *data, size_t length) {
+    char *base = sk::byte_offset<char>(this, node_offset);
+    const size_t sz0 = sk::min(length, capacity() - offset);
+
+    memcpy(base + offset, data, sz0);
+
+    // loop back
+    if (sz0 < length)
+        memcpy(base, sk::byte_offset<void>(data, sz0), length - sz0);
+}
+
+void channel::__ring_read(size_t offset, void *data, size_t length) {
+    const char *base = sk::byte_offset<char>(this, node_offset);
+    const size_t sz0 = sk::min(length, capacity() - offset);
+
+    memcpy(data, base + offset, sz0);
+
+    // loop back
+    if (sz0 < length)
+        memcpy(sk::byte_offset<void>(data, sz0), base, length - sz0);
+}
+
+void channel::__stat_push(size_t new_write_pos, u64 ctime, size_t length) {
+    channel_stats& producer_stats = this->producer_stats();
+    if (producer_stats.sample_latency()) {
+        const u64 now = sk::time::realtime_ns();
+        producer_stats.latency.record(now > ctime ? now - ctime : 0);
+    }
+
+    producer_stats.msg_count += 1;
+    producer_stats.byte_count += length;
+
+    // the used size calculated with the cached read position is an upper
+    // bound, only refresh the read position if it exceeds the high water,
+    // so the consumer's cache line is touched once per "high water" bytes
+    size_t used_size = ((new_write_pos + node_count - producer.cached_read_pos) % node_count) << node_size_shift;
+    if (used_size <= producer_stats.high_water)
+        return;
+
+    producer.cached_read_pos = consumer.read_pos.load(std::memory_order_acquire) & READ_POS_MASK;
+    used_size = ((new_write_pos + node_count - producer.cached_read_pos) % node_count) << node_size_shift;
+    if (used_size > producer_stats.high_water)
+        producer_stats.high_water = used_size;
+}
+
+void channel::__stat_pop(u64 ctime, size_t length) {
+    channel_stats& consumer_stats = this->consumer_stats();
+    if (consumer_stats.sample_latency()) {
+        const u64 now = sk::time::realtime_ns();
+        consumer_stats.latency.record(now > ctime ? now - ctime : 0);
+    }
+
+    consumer_stats.msg_count += 1;
+    consumer_stats.byte_count += length;
+}
+
+int channel::__push_node(int src_busid, int dst_busid, u64 ctime, const void *data, size_t length) {
+    const size_t required_count = __calc_node_count(length);
+    assert_retval(length + sizeof(channel_message) <= required_count * node_size, -1);
+
+    size_t write_pos = 0;
+    const size_t available_count = __producer_space(required_count, write_pos);
+    if (required_count > available_count) {
+        sk_debug("no enough space for incoming message, required<%lu>, available<%lu>.",
+                 required_count, available_count);
+        if (!legacy()) producer.blocked.store(1, std::memory_order_relaxed);
+        return -ENOMEM;
+    }
+
+    // the header always fits in the first node, only the data may loop back
+    channel_message *head = __channel_message(write_pos);
+    const size_t offset = (write_pos << node_size_shift) + sizeof(*head);
+    __ring_write(offset % capacity(), data, length);
+
+    head->magic = SK_MAGIC;
+    head->src_busid = src_busid;
+    head->dst_busid = dst_busid;
+    head->length = length;
+    head->ctime = ctime;
+    sk::murmurhash3_x86_32(data, length, MURMURHASH_SEED, &head->hash);
+
+    __producer_commit((write_pos + required_count) % node_count);
+    return 0;
+}
+
+int channel::__pop_node(void *data, size_t& length, int *src_busid, int *dst_busid, u64 *ctime) {
+    size_t read_pos = 0;
+    size_t write_pos = 0;
+    if (!__consumer_peek(read_pos, write_pos))
+        return 0;
+
+    const channel_message *head = __channel_message(read_pos);
+    assert_retval(head->magic == SK_MAGIC, -1);
+    assert_retval(head->length > 0, -1);
+
+    const size_t new_read_pos = (read_pos + __calc_node_count(head->length)) % node_count;
+    if (new_read_pos != write_pos) {
+        const channel_message *h = __channel_message(new_read_pos);
+        sk_assert(h->magic == SK_MAGIC);
+        sk_assert(h->length > 0);
+    }
+
+    if (data) {
+        if (head->length > length) {
+            length = head->length;
+
+            sk_error("buffer too small, required size<%lu>.", head->length);
+            return -E2BIG;
+        }
+
+        const size_t offset = (read_pos << node_size_shift) + sizeof(*head);
+        __ring_read(offset % capacity(), data, head->length);
+        length = head->length;
+
+        u32 hash = 0;
+        sk::murmurhash3_x86_32(data, length, MURMURHASH_SEED, &hash);
+        assert_retval(hash == head->hash, -1);
+    }
+
+    if (src_busid) *src_busid = head->src_busid;
+    if (dst_busid) *dst_busid = head->dst_busid;
+    if (ctime)     *ctime     = head->ctime;
+
+    __consumer_commit(read_pos, new_read_pos);
+    return 1;
+}
+
 NS_END(sk)
 NS_END(detail)
@@ -1,11 +1,69 @@
 #ifndef CHANNEL_H
 #define CHANNEL_H
 
+#include <atomic>
+#include <stddef.h>
 #include "utility/types.h"
+#include "utility/math_helper.h"
+#include "bus/detail/channel_stats.h"
 
 NS_BEGIN(sk)
 NS_BEGIN(detail)
 
+/*
+ * layout version of the channel:
+ *   0. the legacy layout, all indices are adjacent volatile fields
+ *      and published with full memory barriers
+ *   1. producer & consumer indices are separated into different
+ *      cache lines and published with acquire/release semantics
+ *   2. same indices as version 1, but messages are stored as compact
+ *      variable-length records instead of fixed-size nodes
+ */
+static const u32 CHANNEL_VERSION_LEGACY  = 0;
+static const u32 CHANNEL_VERSION_ATOMIC  = 1;
+static const u32 CHANNEL_VERSION_COMPACT = 2;
+static const u32 CHANNEL_VERSION         = CHANNEL_VERSION_COMPACT;
+static const size_t CACHELINE_SIZE       = 64;
+
+/*
+ * in compact channels, node size is fixed to CHANNEL_ALIGNMENT, every
+ * record starts at a node boundary and occupies as many nodes as needed
+ */
+static const size_t CHANNEL_ALIGNMENT = 8;
+
+/*
+ * if a channel is full, the producer drops the oldest messages to make
+ * room for the new one, only available in compact channels, and as the
+ * producer also moves read_pos, the consumer must update it with CAS
+ */
+static const u32 CHANNEL_FLAG_DROP_OLDEST = 0x1;
+
+/*
+ * the channel keeps statistics (see channel_stats), the producer's and the
+ * consumer's ones are placed between the header and the first node, so the
+ * channels without this flag do not pay for them, only available in compact
+ * channels, and never changes once the channel is initialized
+ */
+static const u32 CHANNEL_FLAG_STATS = 0x2;
+
+/*
+ * in lossy channels, the high bits of read_pos count the moves of it, so
+ * a CAS on a position the producer has lapped meanwhile (ABA) fails, the
+ * low READ_POS_BITS bits are the position, which is always the case in
+ * the other channels
+ */
+static const int READ_POS_BITS = 40;
+static const size_t READ_POS_MASK = (static_cast<size_t>(1) << READ_POS_BITS) - 1;
+
+/*
+ * a bus descriptor can have several channels (lanes) in one direction, the
+ * lane with a lower index has a higher priority, the default lane is the
+ * head channel which the descriptor points to, it always exists, others
+ * are optional, the head channel records where the other lanes are
+ */
+static const int CHANNEL_LANE_COUNT   = 3;
+static const int CHANNEL_LANE_DEFAULT = 1;
+
 struct channel_message {
     u32 magic;
     u32 hash;       // hash value of the data block, for verification
@@ -16,22 +74,104 @@ struct channel_message {
     char data[0];   // real message follows this struct
 };
 
+/*
+ * the decoded header of a record in compact channels, the encoded
+ * header follows the format below, and then the message data:
+ *   u8  RECORD_TAG | flags
+ *   varint length
+ *   s32 src_busid, if flags & RECORD_FLAG_SRC
+ *   s32 dst_busid, if flags & RECORD_FLAG_DST
+ *   u64 ctime,     if flags & RECORD_FLAG_CTIME
+ *   u32 hash
+ * the encoded header never exceeds MAX_HEADER_SIZE bytes
+ */
+struct channel_record {
+    static const u8 RECORD_TAG        = 0xA0;
+    static const u8 RECORD_TAG_MASK   = 0xF0;
+    static const u8 RECORD_FLAG_SRC   = 0x01;
+    static const u8 RECORD_FLAG_DST   = 0x02;
+    static const u8 RECORD_FLAG_CTIME = 0x04;
+    static const size_t MAX_HEADER_SIZE = 32;
+
+    s32 src_busid;
+    s32 dst_busid;
+    u64 ctime;
+    size_t length;
+    u32 hash;
+
+    size_t encode(char *buf) const;
+    size_t decode(const char *buf, size_t len);
+};
+
 struct channel {
+    /*
+     * the fields before cache lines keep the same offsets as the legacy
+     * layout, the "version" field occupies the padding after "magic",
+     * which is always zero in the legacy layout, so a resumed busd can
+     * still recognize & operate the channels created by an older version
+     */
     u32 magic;
-    size_t node_count;          // total node count of this channel
-    size_t node_size;           // the size of a node
-    size_t node_size_shift;     // 2 ^ node_size_shift = node_size
-    volatile size_t push_count; // total message count pushed to this channel
-    volatile size_t pop_count;  // total message count popped from this channel
-    volatile size_t read_pos;   // current read position
-    volatile size_t write_pos;  // current write position
-    size_t node_offset;         // offset of the first node
-
-    static size_t calc_space(size_t node_size, size_t node_count) {
-        return sizeof(channel) + node_size * node_count;
+    u32 version;                   // layout version of this channel
+    size_t node_count;             // total node count of this channel
+    size_t node_size;              // the size of a node, CHANNEL_ALIGNMENT in compact channels
+    size_t node_size_shift;        // 2 ^ node_size_shift = node_size
+    volatile size_t v0_push_count; // legacy layout only, see CHANNEL_VERSION_LEGACY
+    volatile size_t v0_pop_count;  // legacy layout only
+    volatile size_t v0_read_pos;   // legacy layout only
+    volatile size_t v0_write_pos;  // legacy layout only
+    size_t node_offset;            // offset of the first node
+    u32 flags;                     // CHANNEL_FLAG_XXX, it's padding(zero) in old channels
+    u32 lane_mask;                 // head channel only, bit N is set if lane N exists
+    size_t lane_offsets[CHANNEL_LANE_COUNT]; // head channel only, offsets of lanes to the head
+
+    /*
+     * head channel only, the offsets here are relative to channel_mgr, when
+     * a channel is resized, the new ring is linked to the old one through
+     * next_offset, then the producer switches to the new ring, which links
+     * back to the old one through retired_offset, the consumer drains the
+     * retired ring before the new one, and then releases it
+     */
+    size_t next_offset;            // the ring which replaces this one, 0 if none
+    size_t retired_offset;         // the ring replaced by this one, 0 if none
+    size_t retired_size;           // space of the retired ring
+
+    // only written by the producer
+    struct alignas(CACHELINE_SIZE) {
+        std::atomic<size_t> write_pos;  // current write position
+        std::atomic<size_t> push_count; // total message count pushed to this channel
+        size_t cached_read_pos;         // last read position seen by producer
+        std::atomic<u32> blocked;       // set if a push failed, cleared by the consumer
+    } producer;
+
+    // only written by the consumer
+    struct alignas(CACHELINE_SIZE) {
+        std::atomic<size_t> read_pos;   // current read position, see READ_POS_BITS
+        std::atomic<size_t> pop_count;  // total message count popped from this channel
+        size_t cached_write_pos;        // last write position seen by consumer
+        std::atomic<u32> polling;       // head channel only, set while the consumer busy polls
+        u32 numa_node;                  // head channel only, NUMA node + 1 of the rings, 0 if unknown
+    } consumer;
+
+    /*
+     * node_size * node_count is the capacity of the channel in bytes,
+     * node_size does not need to be 2 ^ N any more, as the channel is
+     * byte-granular (aligned to CHANNEL_ALIGNMENT) since version 2
+     */
+    static size_t calc_capacity(size_t node_size, size_t node_count) {
+        return (node_size * node_count + CHANNEL_ALIGNMENT - 1) & ~(CHANNEL_ALIGNMENT - 1);
+    }
+
+    // each of the two is on its own cache lines
+    static size_t calc_stats_space(u32 flags) {
+        if (!(flags & CHANNEL_FLAG_STATS)) return 0;
+        return 2 * sk::align_up(sizeof(channel_stats), CACHELINE_SIZE);
     }
 
-    int init(size_t node_size, size_t node_count);
+    static size_t calc_space(size_t node_size, size_t node_count, u32 flags = 0) {
+        return sizeof(channel) + calc_stats_space(flags) + calc_capacity(node_size, node_count);
+    }
+
+    int init(size_t node_size, size_t node_count, u32 flags = 0);
 
     void clear();
 
@@ -63,10 +203,124 @@ struct channel {
 
     size_t message_count() const;
 
+    /*
+     * producer only, count a message given up as the channel is full, a
+     * failed push is not a drop by itself, as the caller might retry it
+     */
+    void record_drop() {
+        if (has_stats()) producer_stats().drop_count += 1;
+    }
+
+    /**
+     * @brief check if the producer should be notified that the channel is
+     * writable again, this function should be called by the consumer after
+     * it popped messages
+     * @return true if a push of the producer failed before, and now at least
+     * half of the channel is free, the blocked mark is cleared at the same time
+     */
+    bool test_writable();
+
+    /*
+     * head channel only, a consumer polling the channel needs no notification
+     * after a push, to avoid losing a wakeup, the producer checks polled()
+     * after the push is published, and the consumer checks the channel
+     * again after it calls set_polling(false)
+     */
+    void set_polling(bool polling);
+    bool polled() const;
+
+    /*
+     * head channel only, the NUMA node the rings are placed on, which
+     * is the node of the consumer when the channel is created, or -1
+     */
+    int numa_node() const {
+        return legacy() ? -1 : static_cast<int>(consumer.numa_node) - 1;
+    }
+
+    size_t capacity() const { return node_size * node_count; }
+
+    bool legacy() const { return version == CHANNEL_VERSION_LEGACY; }
+    bool compact() const { return version >= CHANNEL_VERSION_COMPACT; }
+    bool lossy() const { return !legacy() && (flags & CHANNEL_FLAG_DROP_OLDEST) != 0; }
+
+    /*
+     * lanes are only available in the head channel, the channels created
+     * before lanes are introduced have only the default lane (themselves)
+     */
+    bool has_lane(int index) const {
+        if (index == CHANNEL_LANE_DEFAULT) return true;
+        if (legacy() || index < 0 || index >= CHANNEL_LANE_COUNT) return false;
+        return (lane_mask & (1u << index)) != 0;
+    }
+
+    // return the default lane if the given lane does not exist
+    channel *lane(int index) {
+        if (index == CHANNEL_LANE_DEFAULT || !has_lane(index)) return this;
+        return sk::byte_offset<channel>(this, lane_offsets[index]);
+    }
+
+    const channel *lane(int index) const {
+        return const_cast<channel *>(this)->lane(index);
+    }
+
+    bool has_stats() const { return !legacy() && (flags & CHANNEL_FLAG_STATS) != 0; }
+
+    // statistics, only available if has_stats() returns true
+    channel_stats& producer_stats() {
+        return *sk::byte_offset<channel_stats>(this, sizeof(channel));
+    }
+
+    channel_stats& consumer_stats() {
+        return *sk::byte_offset<channel_stats>(this, sizeof(channel) + calc_stats_space(flags) / 2);
+    }
+
+    const channel_stats& producer_stats() const {
+        return const_cast<channel *>(this)->producer_stats();
+    }
+
+    const channel_stats& consumer_stats() const {
+        return const_cast<channel *>(this)->consumer_stats();
+    }
+
     size_t __calc_node_count(size_t data_len) const;
 
     channel_message *__channel_message(size_t pos);
+
+    /*
+     * index helpers, hide the difference between the legacy indices
+     * and the atomic indices, "pos" here is always a node index
+     */
+    size_t __producer_space(size_t required_count, size_t& write_pos);
+    void   __producer_commit(size_t new_write_pos);
+    bool   __consumer_peek(size_t& read_pos, size_t& write_pos, size_t *read_word = NULL);
+    bool   __consumer_commit(size_t read_word, size_t new_read_pos);
+    bool   __consumer_moved(size_t read_word) const;
+
+    // producer only, drop the oldest message in a lossy channel
+    bool __drop_oldest(size_t write_pos);
+
+    // decode the record header at node "pos", returns header length
+    size_t __peek_record(size_t pos, size_t write_pos, channel_record& record, size_t& used_count);
+
+    /*
+     * copy data into/out of the ring, "offset" is in bytes, the
+     * copy wraps around to the beginning of the ring if needed
+     */
+    void __ring_write(size_t offset, const void *data, size_t length);
+    void __ring_read(size_t offset, void *data, size_t length);
+
+    void __stat_push(size_t new_write_pos, u64 ctime, size_t length);
+    void __stat_pop(u64 ctime, size_t length);
+
+    /*
+     * push/pop a message stored in fixed-size nodes, which is used
+     * by the channels created before CHANNEL_VERSION_COMPACT
+     */
+    int __push_node(int src_busid, int dst_busid, u64 ctime, const void *data, size_t length);
+    int __pop_node(void *data, size_t& length, int *src_busid, int *dst_busid, u64 *ctime);
 };
+static_assert(offsetof(channel, node_offset) == 64, "incompatible channel layout");
+static_assert(offsetof(channel, producer) == 128, "incompatible channel layout");
 
 NS_END(detail)
 NS_END(sk)
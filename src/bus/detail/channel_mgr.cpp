@@ -1,6 +1,10 @@
+#include <stdio.h>
 #include <signal.h>
 #include <string.h>
 #include <errno.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
 #include <bus/bus.h>
 #include <log/log.h>
 #include <common/lock_guard.h>
@@ -20,6 +24,64 @@ static int notify_channel_change(int bus_pid, int fd) {
     return sigqueue(bus_pid, sk::bus::BUS_REGISTRATION_SIGNO, value);
 }
 
+// the NUMA node the calling thread is running on, -1 if unknown
+static int current_numa_node() {
+    unsigned int cpu = 0, node = 0;
+    if (syscall(SYS_getcpu, &cpu, &node, nullptr) != 0) return -1;
+
+    return static_cast<int>(node);
+}
+
+/*
+ * the policy is set on the shm object, so it applies to all processes
+ * mapping it, the pages not touched yet are allocated on the node when
+ * they are touched, and the touched ones are moved if possible, it is
+ * only a preference, the pages still go to other nodes if it's full
+ */
+static void bind_numa_node(void *addr, size_t size, int node) {
+    static bool warned = false;
+    if (node < 0 || node >= static_cast<int>(sizeof(unsigned long) * 8)) return;
+
+    unsigned long mask = 1UL << node;
+    long ret = syscall(SYS_mbind, addr, size, MPOL_PREFERRED, &mask,
+                       sizeof(mask) * 8, MPOL_MF_MOVE);
+    if (ret != 0 && !warned) {
+        warned = true;
+        sk_warn("cannot place channel on NUMA node %d: %s", node, strerror(errno));
+    }
+}
+
+int numa_node_of_process(pid_t pid) {
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+    FILE *fp = fopen(path, "r");
+    if (!fp) return -1;
+
+    char buf[1024] = {0};
+    size_t len = fread(buf, 1, sizeof(buf) - 1, fp);
+    fclose(fp);
+    buf[len] = 0;
+
+    // "processor" is the 39th field, count from the end of "comm",
+    // which is the 2nd field and might contain spaces
+    const char *p = strrchr(buf, ')');
+    if (!p) return -1;
+
+    int field = 2;
+    while (*p && field < 39)
+        if (*p++ == ' ') ++field;
+
+    int cpu = -1;
+    if (sscanf(p, "%d", &cpu) != 1 || cpu < 0) return -1;
+
+    for (int node = 0; node < 1024; ++node) {
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/node%d", cpu, node);
+        if (access(path, F_OK) == 0) return node;
+    }
+
+    return -1;
+}
+
 int channel_mgr::init(int shmid, size_t shm_size, bool resume) {
     if (resume) {
         assert_retval(this->magic == SK_MAGIC, -1);
@@ -28,17 +90,44 @@ int channel_mgr::init(int shmid, size_t shm_size, bool resume) {
 
         // reset pid here as it must have been changed
         this->pid = getpid();
+
+        if (!extensible())
+            sk_warn("bus segment is using legacy layout, descriptors are limited to %d.",
+                    MAX_DESCRIPTOR_COUNT);
+
+        // busd might be restarted on another node, the new channels are
+        // placed on the new node, but the existing ones are not moved
+        if (extensible()) numa_node = current_numa_node();
+
+        // channels created by an older busd are still operated with
+        // the legacy layout, until they are created again
+        for (int i = 0; i < descriptor_count; ++i) {
+            const channel_descriptor *desc = descriptor(i);
+            const channel *rc = sk::byte_offset<channel>(this, desc->r_offset);
+            const channel *wc = sk::byte_offset<channel>(this, desc->w_offset);
+            if (rc->legacy() || wc->legacy())
+                sk_warn("channel<%x> is using legacy layout, r<%u>, w<%u>.",
+                        desc->owner, rc->version, wc->version);
+        }
     } else {
         this->pid = getpid();
         this->shmid = shmid;
+        this->version = CHANNEL_MGR_VERSION;
         this->shm_size = shm_size;
-        // TODO: may do some alignment job here
-        this->used_size = sizeof(channel_mgr);
+        // channels are aligned to cache line, as the producer & consumer
+        // indices in the channel header must not share a cache line
+        this->used_size = sk::align_up(sizeof(channel_mgr), CACHELINE_SIZE);
 
         lock.init();
         descriptor_count = 0;
         memset(descriptors, 0x00, sizeof(descriptors));
 
+        descriptor_capacity = MAX_DESCRIPTOR_COUNT;
+        free_block_count = 0;
+        ext_offset = 0;
+        memset(free_blocks, 0x00, sizeof(free_blocks));
+        numa_node = current_numa_node();
+
         // start a full memory barrier to make sure magic is set at the last step
         __sync_synchronize();
 
@@ -49,62 +138,499 @@ int channel_mgr::init(int shmid, size_t shm_size, bool resume) {
     return 0;
 }
 
+static void report_stats(int owner, const char *name, const channel *c) {
+    if (!c || !c->has_stats()) return;
+
+    const channel_stats& in = c->producer_stats();
+    const channel_stats& out = c->consumer_stats();
+    sk_info("channel<%x:%s>, in<%lu msgs, %lu bytes>, out<%lu msgs, %lu bytes>, "
+            "drop<%lu>, high water<%lu/%lu>.", owner, name,
+            in.msg_count, in.byte_count, out.msg_count, out.byte_count,
+            in.drop_count, in.high_water, c->capacity());
+    sk_info("channel<%x:%s>, latency(ns) in<p50: %lu, p99: %lu, max: %lu>, "
+            "out<p50: %lu, p99: %lu, p999: %lu, max: %lu>.", owner, name,
+            in.latency.value_at(50), in.latency.value_at(99), in.latency.max,
+            out.latency.value_at(50), out.latency.value_at(99),
+            out.latency.value_at(99.9), out.latency.max);
+}
+
 void channel_mgr::report() const {
     sk_info("===================================");
+    sk_info("segment used<%lu/%lu>, descriptors<%d>, free blocks<%d>.", used_size, shm_size,
+            descriptor_count, extensible() ? free_block_count : 0);
     for (int i = 0; i < descriptor_count; ++i) {
-        const channel_descriptor& desc = descriptors[i];
+        const channel_descriptor& desc = *descriptor(i);
         const channel *rc = get_read_channel(i);
         const channel *wc = get_write_channel(i);
         sk_info("channel<%x>, r<%lu>, w<%lu>, closed<%s>.",
                 desc.owner, rc ? rc->message_count() : 0,
                 wc ? wc->message_count() : 0, desc.closed ? "true" : "false");
+
+        // the read channel is placed on the node of the process, and the write
+        // channel on the node of busd, if they differ, either side of a channel
+        // accesses remote memory, if the process has moved, both sides do
+        int r_node = rc ? rc->numa_node() : -1;
+        int w_node = wc ? wc->numa_node() : -1;
+        int p_node = desc.closed ? -1 : numa_node_of_process(desc.pid);
+        if (r_node >= 0 && w_node >= 0 && r_node != w_node)
+            sk_warn("channel<%x> is cross-node, read node<%d>, write node<%d>.",
+                    desc.owner, r_node, w_node);
+        if (r_node >= 0 && p_node >= 0 && r_node != p_node)
+            sk_warn("channel<%x> is misplaced, read node<%d>, process node<%d>.",
+                    desc.owner, r_node, p_node);
+
+        static const char *r_names[CHANNEL_LANE_COUNT] = {"r/control", "r/normal", "r/bulk"};
+        static const char *w_names[CHANNEL_LANE_COUNT] = {"w/control", "w/normal", "w/bulk"};
+        for (int k = 0; k < CHANNEL_LANE_COUNT; ++k) {
+            if (rc && rc->has_lane(k)) report_stats(desc.owner, r_names[k], rc->lane(k));
+            if (wc && wc->has_lane(k)) report_stats(desc.owner, w_names[k], wc->lane(k));
+        }
     }
     sk_info("===================================");
 }
 
-int channel_mgr::register_channel(int busid, pid_t pid, size_t node_size, size_t node_count, int& fd) {
+/*
+ * allocate the lanes of one direction, the default lane is allocated
+ * first as it's the head channel, which the descriptor points to
+ */
+static size_t calc_lanes_space(const size_t *capacity, u32 flags) {
+    size_t space = 0;
+    for (int i = 0; i < CHANNEL_LANE_COUNT; ++i) {
+        check_continue(capacity[i] > 0);
+        space += sk::align_up(channel::calc_space(1, capacity[i], flags), CACHELINE_SIZE);
+    }
+
+    return space;
+}
+
+/*
+ * node: the NUMA node of the consumer, the rings are placed on it before
+ * they are touched, -1 if unknown or the space is not aligned to pages
+ */
+static int init_lanes(channel *head, const size_t *capacity, u32 flags, int node) {
+    if (node >= 0) bind_numa_node(head, calc_lanes_space(capacity, flags), node);
+
+    int ret = head->init(1, capacity[CHANNEL_LANE_DEFAULT], flags);
+    if (ret != 0) return ret;
+
+    head->consumer.numa_node = static_cast<u32>(node + 1);
+
+    size_t offset = sk::align_up(channel::calc_space(1, capacity[CHANNEL_LANE_DEFAULT], flags), CACHELINE_SIZE);
+    for (int i = 0; i < CHANNEL_LANE_COUNT; ++i) {
+        check_continue(i != CHANNEL_LANE_DEFAULT);
+        check_continue(capacity[i] > 0);
+
+        channel *c = sk::byte_offset<channel>(head, offset);
+        ret = c->init(1, capacity[i], flags);
+        if (ret != 0) return ret;
+
+        head->lane_mask |= 1u << i;
+        head->lane_offsets[i] = offset;
+        offset += sk::align_up(channel::calc_space(1, capacity[i], flags), CACHELINE_SIZE);
+    }
+
+    return 0;
+}
+
+static void clear_lanes(channel *head, u32 flags) {
+    for (int i = 0; i < CHANNEL_LANE_COUNT; ++i) {
+        check_continue(head->has_lane(i));
+
+        channel *c = head->lane(i);
+        c->clear();
+
+        // the channel is empty now, so it's safe to change the flags, except
+        // CHANNEL_FLAG_STATS, as the space of statistics is fixed at init
+        if (!c->legacy()) c->flags = (c->flags & CHANNEL_FLAG_STATS) | (flags & ~CHANNEL_FLAG_STATS);
+    }
+}
+
+// the space occupied by the lanes of an existing head channel
+static size_t calc_lanes_space(const channel *head) {
+    size_t space = 0;
+    for (int i = 0; i < CHANNEL_LANE_COUNT; ++i) {
+        check_continue(head->has_lane(i));
+        const channel *c = head->lane(i);
+        space += sk::align_up(c->node_offset + c->capacity(), CACHELINE_SIZE);
+    }
+
+    return space;
+}
+
+static bool same_capacity(const channel *head, const size_t *capacity) {
+    for (int i = 0; i < CHANNEL_LANE_COUNT; ++i) {
+        size_t old_capacity = head->has_lane(i) ? head->lane(i)->capacity() : 0;
+        size_t new_capacity = capacity[i] > 0 ? channel::calc_capacity(1, capacity[i]) : 0;
+        if (old_capacity != new_capacity) return false;
+    }
+
+    return true;
+}
+
+static int check_capacity(const size_t *capacity) {
+    assert_retval(capacity, -EINVAL);
+    for (int i = 0; i < CHANNEL_LANE_COUNT; ++i) {
+        // lanes other than the default one can be disabled
+        if (capacity[i] == 0 && i != CHANNEL_LANE_DEFAULT) continue;
+
+        if (capacity[i] < channel_record::MAX_HEADER_SIZE + CHANNEL_ALIGNMENT) {
+            sk_error("channel capacity %lu of lane %d is too small.", capacity[i], i);
+            return -EINVAL;
+        }
+    }
+
+    return 0;
+}
+
+size_t channel_mgr::allocate(size_t size) {
+    size_t alignment = extensible() ? ALLOC_ALIGNMENT : CACHELINE_SIZE;
+    size = sk::align_up(size, alignment);
+
+    // first fit in the free blocks, the rest of the block is kept
+    for (int i = 0; extensible() && i < free_block_count; ++i) {
+        channel_block& b = free_blocks[i];
+        check_continue(b.size >= size);
+
+        size_t offset = b.offset;
+        b.offset += size;
+        b.size -= size;
+        if (b.size <= 0) free_blocks[i] = free_blocks[--free_block_count];
+
+        return offset;
+    }
+
+    size_t offset = sk::align_up(used_size, alignment);
+    if (shm_size < offset || shm_size - offset < size) return 0;
+
+    used_size = offset + size;
+    return offset;
+}
+
+void channel_mgr::deallocate(size_t offset, size_t size) {
+    if (offset <= 0 || size <= 0) return;
+
+    // the same as allocate(...)
+    size = sk::align_up(size, extensible() ? ALLOC_ALIGNMENT : CACHELINE_SIZE);
+
+    // the block at the end goes back to the unused space directly
+    if (offset + size == used_size) {
+        used_size = offset;
+        return;
+    }
+
+    if (!extensible()) {
+        sk_warn("space<%lu:%lu> cannot be reused in legacy segment.", offset, size);
+        return;
+    }
+
+    // merge the adjacent blocks on both sides into this one, so the
+    // free blocks never touch each other
+    for (int i = 0; i < free_block_count; ) {
+        channel_block& b = free_blocks[i];
+        if (b.offset + b.size != offset && offset + size != b.offset) {
+            ++i;
+            continue;
+        }
+
+        if (b.offset < offset) offset = b.offset;
+        size += b.size;
+        free_blocks[i] = free_blocks[--free_block_count];
+    }
+
+    // the merged block might reach the unused space now
+    if (offset + size == used_size) {
+        used_size = offset;
+        return;
+    }
+
+    // the table is full, keep the larger blocks, and drop the smallest one
+    int index = free_block_count;
+    if (free_block_count >= MAX_FREE_BLOCKS) {
+        index = 0;
+        for (int i = 1; i < free_block_count; ++i) {
+            if (free_blocks[i].size < free_blocks[index].size) index = i;
+        }
+
+        channel_block& b = free_blocks[index];
+        if (b.size >= size) {
+            sk_warn("too many free blocks, space<%lu:%lu> is dropped.", offset, size);
+            return;
+        }
+
+        sk_warn("too many free blocks, space<%lu:%lu> is dropped.", b.offset, b.size);
+    } else {
+        ++free_block_count;
+    }
+
+    channel_block& b = free_blocks[index];
+    b.offset = offset;
+    b.size = size;
+}
+
+int channel_mgr::add_descriptor() {
+    if (descriptor_count < MAX_DESCRIPTOR_COUNT) return descriptor_count++;
+
+    if (!extensible()) {
+        sk_error("too many descriptors, max<%d>.", MAX_DESCRIPTOR_COUNT);
+        return -ENOSPC;
+    }
+
+    if (descriptor_count >= descriptor_capacity) {
+        size_t offset = allocate(sizeof(descriptor_table));
+        if (offset <= 0) {
+            sk_error("no space for descriptor table, descriptors<%d>.", descriptor_count);
+            return -ENOMEM;
+        }
+
+        descriptor_table *table = sk::byte_offset<descriptor_table>(this, offset);
+        memset(table, 0x00, sizeof(descriptor_table));
+
+        // link the new table at the end of the list
+        size_t *next = &ext_offset;
+        while (*next != 0)
+            next = &sk::byte_offset<descriptor_table>(this, *next)->next_offset;
+
+        *next = offset;
+        descriptor_capacity += EXT_DESCRIPTOR_COUNT;
+    }
+
+    return descriptor_count++;
+}
+
+channel_descriptor *channel_mgr::descriptor(int fd) {
+    return const_cast<channel_descriptor *>(static_cast<const channel_mgr *>(this)->descriptor(fd));
+}
+
+const channel_descriptor *channel_mgr::descriptor(int fd) const {
+    assert_retval(fd >= 0, nullptr);
+    if (likely(fd < MAX_DESCRIPTOR_COUNT)) return &descriptors[fd];
+
+    assert_retval(extensible(), nullptr);
+    int index = fd - MAX_DESCRIPTOR_COUNT;
+    for (size_t offset = ext_offset; offset != 0; index -= EXT_DESCRIPTOR_COUNT) {
+        const descriptor_table *table = sk::byte_offset<descriptor_table>(this, offset);
+        if (index < EXT_DESCRIPTOR_COUNT) return &table->descriptors[index];
+        offset = table->next_offset;
+    }
+
+    return nullptr;
+}
+
+int channel_mgr::resize_locked(channel_descriptor& desc, const size_t *capacity) {
+    channel *rc = sk::byte_offset<channel>(this, __atomic_load_n(&desc.r_offset, __ATOMIC_ACQUIRE));
+    channel *wc = sk::byte_offset<channel>(this, desc.w_offset);
+    assert_retval(rc->magic == SK_MAGIC && wc->magic == SK_MAGIC, -1);
+
+    if (same_capacity(rc, capacity) && same_capacity(wc, capacity)) return 0;
+
+    if (rc->legacy() || wc->legacy()) {
+        sk_warn("channel<%x> is using legacy layout, resizing is not supported.", desc.owner);
+        return -ENOTSUP;
+    }
+
+    // the previous resize is still in progress: the read head is not
+    // switched yet, or either head has not drained its retired ring
+    if (__atomic_load_n(&rc->next_offset, __ATOMIC_ACQUIRE) != 0 ||
+        __atomic_load_n(&rc->retired_offset, __ATOMIC_ACQUIRE) != 0 ||
+        __atomic_load_n(&wc->retired_offset, __ATOMIC_ACQUIRE) != 0) {
+        sk_warn("channel<%x> is being resized.", desc.owner);
+        return -EBUSY;
+    }
+
+    size_t space = calc_lanes_space(capacity, wc->flags);
+    size_t r_offset = allocate(space);
+    size_t w_offset = r_offset > 0 ? allocate(space) : 0;
+    if (w_offset <= 0) {
+        deallocate(r_offset, space);
+        sk_error("no space to resize channel<%x>, required<%lu>.", desc.owner, space * 2);
+        return -ENOMEM;
+    }
+
+    channel *new_rc = sk::byte_offset<channel>(this, r_offset);
+    channel *new_wc = sk::byte_offset<channel>(this, w_offset);
+    // the caller owns the channel, it's the consumer of the read channel,
+    // and busd is the consumer of the write channel
+    int ret = init_lanes(new_rc, capacity, wc->flags & CHANNEL_FLAG_STATS, extensible() ? current_numa_node() : -1);
+    if (ret == 0) ret = init_lanes(new_wc, capacity, wc->flags, extensible() ? numa_node : -1);
+    if (ret != 0) {
+        deallocate(w_offset, space);
+        deallocate(r_offset, space);
+        sk_error("cannot init lanes to resize channel<%x>: %d.", desc.owner, ret);
+        return ret;
+    }
+
+    // the caller is the producer of the write channel, switch it right now
+    new_wc->retired_offset = desc.w_offset;
+    new_wc->retired_size = calc_lanes_space(wc);
+    __atomic_store_n(&desc.w_offset, w_offset, __ATOMIC_RELEASE);
+
+    // busd is the producer of the read channel, it switches by itself
+    __atomic_store_n(&rc->next_offset, r_offset, __ATOMIC_RELEASE);
+
+    sk_info("channel<%x> resized, read offset<%lu>, write offset<%lu>, lanes<%x>.",
+            desc.owner, r_offset, w_offset, new_rc->lane_mask);
+    return 0;
+}
+
+int channel_mgr::resize_channel(int fd, const size_t *capacity) {
     if (magic != SK_MAGIC) {
         sk_error("channel mgr has not been initialized.");
         return -EINVAL;
     }
 
-    if ((node_size & (node_size - 1)) != 0) {
-        sk_error("node size %lu must be 2 ^ N.", node_size);
+    int ret = check_capacity(capacity);
+    if (ret != 0) return ret;
+
+    lock_guard<spin_lock> guard(lock);
+    assert_retval(fd >= 0 && fd < descriptor_count, -EINVAL);
+
+    channel_descriptor *desc = descriptor(fd);
+    assert_retval(desc, -EINVAL);
+    if (desc->closed) {
+        sk_error("channel<%x> has been closed.", desc->owner);
+        return -EINVAL;
+    }
+
+    ret = resize_locked(*desc, capacity);
+    if (ret != 0) return ret;
+
+    // wake up busd, so the read channel is switched even if it's idle
+    ret = notify_channel_change(this->pid, fd);
+    if (ret != 0) sk_error("cannot send signal: %s", strerror(errno));
+
+    return 0;
+}
+
+channel *channel_mgr::switch_read_channel(int fd) {
+    channel_descriptor *desc = descriptor(fd);
+    assert_retval(desc, nullptr);
+
+    // the owner might be resizing the channel at the same time
+    lock_guard<spin_lock> guard(lock);
+    return switch_read_locked(*desc);
+}
+
+channel *channel_mgr::switch_read_locked(channel_descriptor& desc) {
+    size_t offset = __atomic_load_n(&desc.r_offset, __ATOMIC_ACQUIRE);
+    channel *head = sk::byte_offset<channel>(this, offset);
+    if (head->legacy()) return head;
+
+    size_t next = __atomic_load_n(&head->next_offset, __ATOMIC_ACQUIRE);
+    if (next == 0) return head;
+
+    // nothing is pushed to the old ring from now on, so once the
+    // consumer finds it empty, it's safe to release the old ring
+    channel *c = sk::byte_offset<channel>(this, next);
+    c->retired_offset = offset;
+    c->retired_size = calc_lanes_space(head);
+    __atomic_store_n(&desc.r_offset, next, __ATOMIC_RELEASE);
+
+    // the new head is published first, so whichever head is seen,
+    // it's either linked to the next ring or to the retired one
+    __atomic_store_n(&head->next_offset, 0, __ATOMIC_RELEASE);
+
+    sk_info("read channel<%x> switched, offset<%lu -> %lu>.", desc.owner, offset, next);
+    return c;
+}
+
+channel *channel_mgr::get_retired_channel(channel *head) {
+    if (!head || head->legacy()) return nullptr;
+
+    size_t offset = __atomic_load_n(&head->retired_offset, __ATOMIC_ACQUIRE);
+    if (offset == 0) return nullptr;
+
+    return sk::byte_offset<channel>(this, offset);
+}
+
+void channel_mgr::release_retired_channel(channel *head) {
+    assert_retnone(head && !head->legacy());
+
+    lock_guard<spin_lock> guard(lock);
+    release_retired_locked(head);
+}
+
+void channel_mgr::release_retired_locked(channel *head) {
+    if (head->legacy() || head->retired_offset == 0) return;
+
+    deallocate(head->retired_offset, head->retired_size);
+    __atomic_store_n(&head->retired_offset, 0, __ATOMIC_RELEASE);
+    head->retired_size = 0;
+}
+
+int channel_mgr::register_channel(int busid, pid_t pid, const size_t *capacity, u32 flags, int& fd) {
+    if (magic != SK_MAGIC) {
+        sk_error("channel mgr has not been initialized.");
         return -EINVAL;
     }
 
+    int ret = check_capacity(capacity);
+    if (ret != 0) return ret;
+
     fd = -1;
     channel_descriptor *desc = nullptr;
 
     do {
         lock_guard<spin_lock> guard(lock);
         for (int i = 0; i < descriptor_count; ++i) {
-            channel_descriptor& desc = descriptors[i];
+            channel_descriptor& desc = *descriptor(i);
             check_continue(desc.owner == busid);
 
             if (!desc.closed) {
                 sk_info("channel already exists, bus<%x>.", busid);
+                channel *wc = sk::byte_offset<channel>(this, desc.w_offset);
+                if (wc->flags != flags)
+                    sk_warn("channel flags change<%x -> %x> is not supported.", wc->flags, flags);
+
                 fd = i;
                 desc.pid = pid;
-                return 0;
+
+                // the channel is in use, resize it without losing messages
+                ret = resize_locked(desc, capacity);
+                if (ret != 0) {
+                    sk_error("cannot resize channel<%x>: %d.", busid, ret);
+                    return ret;
+                }
+
+                ret = notify_channel_change(this->pid, i);
+                if (ret != 0) sk_error("cannot send signal: %s", strerror(errno));
+
+                return ret;
             }
 
             sk_info("channel<%x> closed, reopen it.", busid);
 
+            // the previous process might exit after resizing, before busd
+            // switches the read channel, finish the switch here, then the
+            // old ring is released as a retired one below
+            switch_read_locked(desc);
+
             channel *rc = sk::byte_offset<channel>(this, desc.r_offset);
             assert_retval(rc->magic == SK_MAGIC, -1);
-            rc->clear();
-
             channel *wc = sk::byte_offset<channel>(this, desc.w_offset);
             assert_retval(wc->magic == SK_MAGIC, -1);
-            wc->clear();
+
+            // the rings retired by a resize before closing hold messages of
+            // the previous process, nobody drains them while it's closed,
+            // so they are released here rather than received as new ones
+            release_retired_locked(rc);
+            release_retired_locked(wc);
+            clear_lanes(rc, 0);
+
+            // the flags only apply to the write channel, as the process
+            // is the only producer of it, busd never drops routed messages
+            clear_lanes(wc, flags);
 
             sk_assert(rc->node_size == wc->node_size);
             sk_assert(rc->node_count == wc->node_count);
 
-            if (rc->node_size != node_size || rc->node_count != node_count)
-                sk_warn("configuration change<%d:%d -> %d:%d> is not supported.",
-                        rc->node_size, rc->node_count, node_size, node_count);
+            // the channels are empty, but resizing them works all the same,
+            // the empty retired rings are released by the first consumption
+            // the channel stays closed if it cannot get the capacity asked for
+            ret = resize_locked(desc, capacity);
+            if (ret != 0) {
+                sk_error("cannot resize channel<%x>: %d.", busid, ret);
+                return ret;
+            }
 
             desc.closed = 0;
             desc.pid = pid;
@@ -115,7 +641,7 @@ int channel_mgr::register_channel(int busid, pid_t pid, size_t node_size, size_t
             // to make sure desc.closed is set to 0 before we notify the bus
             __sync_synchronize();
 
-            int ret = notify_channel_change(this->pid, i);
+            ret = notify_channel_change(this->pid, i);
             if (ret != 0) {
                 sk_error("cannot send signal: %s", strerror(errno));
                 return ret;
@@ -124,40 +650,46 @@ int channel_mgr::register_channel(int busid, pid_t pid, size_t node_size, size_t
             return 0;
         }
 
-        size_t channel_size = channel::calc_space(node_size, node_count);
+        size_t channel_size = calc_lanes_space(capacity, flags);
         assert_retval(channel_size > 0, -1);
 
-        size_t left_size = 0;
-        if (shm_size > used_size)
-            left_size = shm_size - used_size;
-
-        // mulitple 2 here because there are two channels, one for read & another for write
-        if (left_size < channel_size * 2) {
-            sk_error("left size %lu is not enough, required: %lu.", left_size, channel_size * 2);
+        // there are two channels, one for read & another for write
+        size_t r_offset = allocate(channel_size);
+        size_t w_offset = r_offset > 0 ? allocate(channel_size) : 0;
+        if (w_offset <= 0) {
+            deallocate(r_offset, channel_size);
+            sk_error("left size %lu is not enough, required: %lu.",
+                     shm_size > used_size ? shm_size - used_size : 0, channel_size * 2);
             return -ENOMEM;
         }
 
-        fd = descriptor_count++;
-        desc = &descriptors[fd];
+        fd = add_descriptor();
+        if (fd < 0) {
+            ret = fd;
+            fd = -1;
+            deallocate(w_offset, channel_size);
+            deallocate(r_offset, channel_size);
+            return ret;
+        }
+
+        desc = descriptor(fd);
         desc->owner = busid;
         desc->closed = 0;
         desc->pid = pid;
-        desc->r_offset = used_size;
-        used_size += channel_size;
-        desc->w_offset = used_size;
-        used_size += channel_size;
-
-        int ret = 0;
+        desc->r_offset = r_offset;
+        desc->w_offset = w_offset;
 
         channel *rc = sk::byte_offset<channel>(this, desc->r_offset);
-        ret = rc->init(node_size, node_count);
+        ret = init_lanes(rc, capacity, flags & CHANNEL_FLAG_STATS, extensible() ? current_numa_node() : -1);
         if (ret != 0) {
             sk_error("failed to init read channel, bus id<%x>, ret<%d>.", busid, ret);
             return ret;
         }
 
+        // the flags except CHANNEL_FLAG_STATS only apply to the write channel,
+        // as the process is the producer of it, busd never drops messages it routes
         channel *wc = sk::byte_offset<channel>(this, desc->w_offset);
-        ret = wc->init(node_size, node_count);
+        ret = init_lanes(wc, capacity, flags, extensible() ? numa_node : -1);
         if (ret != 0) {
             sk_error("failed to init write channel, bus id<%x>, ret<%d>.", busid, ret);
             return ret;
@@ -173,8 +705,8 @@ int channel_mgr::register_channel(int busid, pid_t pid, size_t node_size, size_t
             return ret;
         }
 
-        sk_info("new channel, fd<%d>, owner<%x>, read offset<%lu>, write offset<%lu>.",
-                fd, desc->owner, desc->r_offset, desc->w_offset);
+        sk_info("new channel, fd<%d>, owner<%x>, read offset<%lu>, write offset<%lu>, lanes<%x>.",
+                fd, desc->owner, desc->r_offset, desc->w_offset, rc->lane_mask);
     } while (0);
 
     return 0;
@@ -183,7 +715,7 @@ int channel_mgr::register_channel(int busid, pid_t pid, size_t node_size, size_t
 void channel_mgr::deregister_channel(int busid) {
     lock_guard<spin_lock> guard(lock);
     for (int i = 0; i < descriptor_count; ++i) {
-        channel_descriptor& desc = descriptors[i];
+        channel_descriptor& desc = *descriptor(i);
         check_continue(desc.owner == busid);
 
         if (desc.closed) {
@@ -210,13 +742,15 @@ void channel_mgr::deregister_channel(int busid) {
 channel *channel_mgr::get_read_channel(int fd) {
     assert_retval(fd >= 0 && fd < descriptor_count, nullptr);
 
-    channel_descriptor& desc = descriptors[fd];
+    channel_descriptor& desc = *descriptor(fd);
     if (desc.closed) {
         sk_error("channel<%x> has been closed.", desc.owner);
         return nullptr;
     }
 
-    channel *rc = sk::byte_offset<channel>(this, desc.r_offset);
+    // the offset changes when the channel is resized
+    size_t offset = __atomic_load_n(&desc.r_offset, __ATOMIC_ACQUIRE);
+    channel *rc = sk::byte_offset<channel>(this, offset);
     assert_retval(rc->magic == SK_MAGIC, nullptr);
 
     return rc;
@@ -225,13 +759,15 @@ channel *channel_mgr::get_read_channel(int fd) {
 channel *channel_mgr::get_write_channel(int fd) {
     assert_retval(fd >= 0 && fd < descriptor_count, nullptr);
 
-    channel_descriptor& desc = descriptors[fd];
+    channel_descriptor& desc = *descriptor(fd);
     if (desc.closed) {
         sk_error("channel<%x> has been closed.", desc.owner);
         return nullptr;
     }
 
-    channel *wc = sk::byte_offset<channel>(this, desc.w_offset);
+    // the offset changes when the channel is resized
+    size_t offset = __atomic_load_n(&desc.w_offset, __ATOMIC_ACQUIRE);
+    channel *wc = sk::byte_offset<channel>(this, offset);
     assert_retval(wc->magic == SK_MAGIC, nullptr);
 
     return wc;
@@ -240,13 +776,15 @@ channel *channel_mgr::get_write_channel(int fd) {
 const channel *channel_mgr::get_read_channel(int fd) const {
     assert_retval(fd >= 0 && fd < descriptor_count, nullptr);
 
-    const channel_descriptor& desc = descriptors[fd];
+    const channel_descriptor& desc = *descriptor(fd);
     if (desc.closed) {
         sk_error("channel<%x> has been closed.", desc.owner);
         return nullptr;
     }
 
-    const channel *rc = sk::byte_offset<channel>(this, desc.r_offset);
+    // the offset changes when the channel is resized
+    size_t offset = __atomic_load_n(&desc.r_offset, __ATOMIC_ACQUIRE);
+    const channel *rc = sk::byte_offset<channel>(this, offset);
     assert_retval(rc->magic == SK_MAGIC, nullptr);
 
     return rc;
@@ -255,13 +793,15 @@ const channel *channel_mgr::get_read_channel(int fd) const {
 const channel *channel_mgr::get_write_channel(int fd) const {
     assert_retval(fd >= 0 && fd < descriptor_count, nullptr);
 
-    const channel_descriptor& desc = descriptors[fd];
+    const channel_descriptor& desc = *descriptor(fd);
     if (desc.closed) {
         sk_error("channel<%x> has been closed.", desc.owner);
         return nullptr;
     }
 
-    const channel *wc = sk::byte_offset<channel>(this, desc.w_offset);
+    // the offset changes when the channel is resized
+    size_t offset = __atomic_load_n(&desc.w_offset, __ATOMIC_ACQUIRE);
+    const channel *wc = sk::byte_offset<channel>(this, offset);
     assert_retval(wc->magic == SK_MAGIC, nullptr);
 
     return wc;
@@ -269,12 +809,12 @@ const channel *channel_mgr::get_write_channel(int fd) const {
 
 int channel_mgr::get_owner_busid(int fd) const {
     assert_retval(fd >= 0 && fd < descriptor_count, -1);
-    return descriptors[fd].owner;
+    return descriptor(fd)->owner;
 }
 
 channel *channel_mgr::find_read_channel(int busid, int& fd) {
     for (int i = 0; i < descriptor_count; ++i) {
-        if (descriptors[i].owner == busid) {
+        if (descriptor(i)->owner == busid) {
             fd = i;
             return get_read_channel(i);
         }
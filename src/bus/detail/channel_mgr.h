@@ -16,12 +16,51 @@ struct channel_descriptor {
     size_t w_offset;   // offset of write channel
 };
 
+/*
+ * layout version of the channel mgr:
+ *   0. the legacy layout, there are at most MAX_DESCRIPTOR_COUNT
+ *      descriptors, and the space of channels is never reused
+ *   1. the descriptor table can grow with extension tables, and the
+ *      space of the rings retired by resizing is reused
+ */
+static const u32 CHANNEL_MGR_VERSION_LEGACY     = 0;
+static const u32 CHANNEL_MGR_VERSION_EXTENSIBLE = 1;
+static const u32 CHANNEL_MGR_VERSION            = CHANNEL_MGR_VERSION_EXTENSIBLE;
+
+// a free block in the segment, left by a retired ring
+struct channel_block {
+    size_t offset;
+    size_t size;
+};
+
+/*
+ * the NUMA node a process ran on most recently, -1 if unknown, it's read
+ * from /proc & /sys, so it's slow, only use it in reports
+ */
+int numa_node_of_process(pid_t pid);
+
 struct channel_mgr {
-    static const int MAX_DESCRIPTOR_COUNT = 128;
+    static const int MAX_DESCRIPTOR_COUNT = 128; // descriptors in the header
+    static const int EXT_DESCRIPTOR_COUNT = 128; // descriptors in an extension table
+    static const int MAX_FREE_BLOCKS = 64;
+
+    /*
+     * space is allocated in pages since CHANNEL_MGR_VERSION_EXTENSIBLE, so
+     * the rings of different channels never share a page, and each ring
+     * can be placed on the NUMA node of its consumer
+     */
+    static const size_t ALLOC_ALIGNMENT = 4096;
+
+    // descriptors beyond the header are stored in linked extension tables
+    struct descriptor_table {
+        size_t next_offset; // offset of the next table, 0 if this is the last one
+        channel_descriptor descriptors[EXT_DESCRIPTOR_COUNT];
+    };
 
     u32 magic;
     int shmid;        // id of this shm segment
     pid_t pid;        // pid of the busd process
+    u32 version;      // layout version, it occupies the padding, zero in legacy segments
     size_t shm_size;  // total size of this shm segment
     size_t used_size; // allocated space size
 
@@ -29,6 +68,16 @@ struct channel_mgr {
     int descriptor_count;
     channel_descriptor descriptors[MAX_DESCRIPTOR_COUNT];
 
+    /*
+     * the fields below are only available since CHANNEL_MGR_VERSION_EXTENSIBLE,
+     * in legacy segments, the space here is occupied by the first channel
+     */
+    int descriptor_capacity;  // including the extension tables
+    int free_block_count;
+    size_t ext_offset;        // offset of the first extension table, 0 if none
+    channel_block free_blocks[MAX_FREE_BLOCKS];
+    int numa_node;            // NUMA node of busd, the consumer of all write channels, -1 if unknown
+
     /*
      * this function will be called and only be called in busd process
      */
@@ -40,9 +89,37 @@ struct channel_mgr {
      * these two functions will be called in each process,
      * thus we need to lock to ensure synchronization
      */
-    int register_channel(int busid, pid_t pid, size_t node_size, size_t node_count, int& fd);
+    /*
+     * capacity: capacity in bytes of each lane, it must have CHANNEL_LANE_COUNT
+     * elements, the default lane is mandatory, others are disabled if it's 0
+     */
+    int register_channel(int busid, pid_t pid, const size_t *capacity, u32 flags, int& fd);
     void deregister_channel(int busid);
 
+    /*
+     * resize the channels of fd online, no message is lost, it's called by
+     * the owner process, which is the producer of the write channel, so the
+     * write channel is switched immediately, the read channel is switched by
+     * busd, the producer of it, in switch_read_channel(...), a channel can
+     * not be resized again until the retired ring is drained (-EBUSY)
+     */
+    int resize_channel(int fd, const size_t *capacity);
+
+    // called by busd only, apply a pending resize of the read channel
+    channel *switch_read_channel(int fd);
+
+    /*
+     * the consumer side of a resized channel, the retired ring must be
+     * drained before the head, and released after it gets empty
+     */
+    channel *get_retired_channel(channel *head);
+    void release_retired_channel(channel *head);
+
+    bool extensible() const { return version >= CHANNEL_MGR_VERSION_EXTENSIBLE; }
+
+    channel_descriptor *descriptor(int fd);
+    const channel_descriptor *descriptor(int fd) const;
+
     channel *get_read_channel(int fd);
     channel *get_write_channel(int fd);
     const channel *get_read_channel(int fd) const;
@@ -50,7 +127,20 @@ struct channel_mgr {
     int get_owner_busid(int fd) const;
 
     channel *find_read_channel(int busid, int& fd);
+
+    /*
+     * space management of the segment, the caller must hold the lock,
+     * allocate() returns 0 if there is no enough space
+     */
+    size_t allocate(size_t size);
+    void deallocate(size_t offset, size_t size);
+    int add_descriptor();
+    int resize_locked(channel_descriptor& desc, const size_t *capacity);
+    channel *switch_read_locked(channel_descriptor& desc);
+    void release_retired_locked(channel *head);
 };
+static_assert(offsetof(channel_mgr, version) == 12, "incompatible channel mgr layout");
+static_assert(offsetof(channel_mgr, shm_size) == 16, "incompatible channel mgr layout");
 
 } // namespace detail
 } // namespace sk
@@ -0,0 +1,61 @@
+#include <string.h>
+#include <bus/detail/channel_stats.h>
+
+NS_BEGIN(sk)
+NS_BEGIN(detail)
+
+void latency_histogram::clear() {
+    memset(this, 0x00, sizeof(*this));
+}
+
+u64 latency_histogram::value_at(double percentile) const {
+    if (count <= 0) return 0;
+
+    if (percentile < 0) percentile = 0;
+    if (percentile > 100) percentile = 100;
+
+    u64 target = static_cast<u64>(count * percentile / 100);
+    if (target <= 0) target = 1;
+
+    u64 total = 0;
+    for (int i = 0; i < BUCKET_COUNT; ++i) {
+        total += buckets[i];
+        if (total >= target)
+            return lower_bound(i);
+    }
+
+    // the buckets might be updated concurrently, fall back to max
+    return max;
+}
+
+int latency_histogram::index(u64 value) {
+    if (value < static_cast<u64>(SUB_BUCKET_COUNT))
+        return static_cast<int>(value);
+
+    if (value >= (1ULL << MAX_VALUE_BITS))
+        return BUCKET_COUNT - 1;
+
+    const int msb = 63 - __builtin_clzll(value);
+    const int group = msb - SUB_BUCKET_BITS + 1;
+    const int sub = static_cast<int>(value >> (msb - SUB_BUCKET_BITS)) - SUB_BUCKET_COUNT;
+    return group * SUB_BUCKET_COUNT + sub;
+}
+
+u64 latency_histogram::lower_bound(int index) {
+    const int group = index / SUB_BUCKET_COUNT;
+    const u64 sub = static_cast<u64>(index % SUB_BUCKET_COUNT);
+    if (group == 0) return sub;
+
+    return (SUB_BUCKET_COUNT + sub) << (group - 1);
+}
+
+void channel_stats::clear() {
+    msg_count = 0;
+    byte_count = 0;
+    drop_count = 0;
+    high_water = 0;
+    latency.clear();
+}
+
+NS_END(detail)
+NS_END(sk)
@@ -0,0 +1,76 @@
+#ifndef CHANNEL_STATS_H
+#define CHANNEL_STATS_H
+
+#include <utility/types.h>
+
+NS_BEGIN(sk)
+NS_BEGIN(detail)
+
+/*
+ * a log-linear (HDR style) histogram of latencies in nanoseconds, values
+ * are grouped by their most significant bit, and each group is split into
+ * SUB_BUCKET_COUNT linear sub buckets, so the relative error of a recorded
+ * value is at most 1 / SUB_BUCKET_COUNT, values of MAX_VALUE_BITS bits or
+ * more (about 68 seconds) all fall into the last bucket, as nothing on the
+ * bus is expected to wait that long
+ *
+ * it lives in shared memory and has only one writer, the readers (e.g. an
+ * external tool) may see slightly inconsistent values, which is acceptable
+ */
+struct latency_histogram {
+    static const int SUB_BUCKET_BITS  = 3;
+    static const int SUB_BUCKET_COUNT = 1 << SUB_BUCKET_BITS;
+    static const int MAX_VALUE_BITS   = 36;
+    static const int BUCKET_COUNT     = (MAX_VALUE_BITS - SUB_BUCKET_BITS + 1) * SUB_BUCKET_COUNT;
+
+    u64 count;                 // total recorded value count
+    u64 sum;                   // sum of all recorded values
+    u64 max;                   // maximum recorded value
+    u64 buckets[BUCKET_COUNT];
+
+    void clear();
+
+    void record(u64 value) {
+        count += 1;
+        sum += value;
+        if (value > max) max = value;
+        buckets[index(value)] += 1;
+    }
+
+    /**
+     * @brief the value at the given percentile
+     * @param percentile: in range [0, 100]
+     * @return the lower bound of the bucket which the value falls in
+     */
+    u64 value_at(double percentile) const;
+
+    static int index(u64 value);
+    static u64 lower_bound(int index);
+};
+
+/*
+ * statistics of one side of a channel, the producer & the consumer keep
+ * their own statistics, so they will not write the same cache line
+ */
+struct channel_stats {
+    u64 msg_count;             // total messages pushed/popped
+    u64 byte_count;            // total bytes pushed/popped
+    u64 drop_count;            // producer only, messages given up as the channel is full
+    u64 high_water;            // producer only, the maximum bytes used in the channel
+    latency_histogram latency; // age of sampled messages when they are pushed/popped
+
+    // only one of every LATENCY_SAMPLE_RATE messages gets its latency recorded,
+    // so the clock is not read for every message on the hot path
+    static const u64 LATENCY_SAMPLE_RATE = 16;
+
+    void clear();
+
+    bool sample_latency() const {
+        return (msg_count & (LATENCY_SAMPLE_RATE - 1)) == 0;
+    }
+};
+
+NS_END(detail)
+NS_END(sk)
+
+#endif // CHANNEL_STATS_H
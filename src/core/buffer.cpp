@@ -1,11 +1,12 @@
+#include <utility>
 #include <core/buffer.h>
 
 NS_BEGIN(sk)
 
 buffer::buffer(size_t buffer_size) {
     capacity_ = buffer_size;
-    address_ = malloc(capacity_);
-    sk_assert(address_);
+    address_ = capacity_ > 0 ? malloc(capacity_) : nullptr;
+    sk_assert(address_ || capacity_ == 0);
 
     rindex_ = 0;
     windex_ = 0;
@@ -56,6 +57,13 @@ void buffer::consume(size_t n) {
     }
 }
 
+void buffer::swap(buffer& other) {
+    std::swap(address_, other.address_);
+    std::swap(capacity_, other.capacity_);
+    std::swap(rindex_, other.rindex_);
+    std::swap(windex_, other.windex_);
+}
+
 void buffer::ensure_space(size_t n) {
     sk_assert(capacity_ >= windex_);
     size_t available = capacity_ - windex_;
@@ -13,6 +13,7 @@ public:
 
     MAKE_NONCOPYABLE(buffer);
 
+    // nothing is allocated if buffer_size is 0, until prepare(...) is called
     buffer(size_t buffer_size = DEFAULT_BUFFER_SIZE);
     buffer(const void *data, size_t len);
     ~buffer();
@@ -81,6 +82,12 @@ public:
         return windex_ == rindex_;
     }
 
+    /**
+     * @brief swap: exchange the content of two buffers, no data is copied
+     * @param other: the other buffer
+     */
+    void swap(buffer& other);
+
 private:
     void ensure_space(size_t len);
 
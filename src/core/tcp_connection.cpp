@@ -2,6 +2,10 @@
 
 NS_BEGIN(sk)
 
+// the completed writes kept for reusing their space, a few are enough
+// as a caller usually has one or two writes in flight
+static const size_t MAX_SPARE_REQUESTS = 4;
+
 tcp_connection::tcp_connection(uv_loop_t *loop, const uv_tcp_handle_ptr& peer,
                                const inet_address& remote_addr, const fn_on_close& fn)
     : state_(state_connected),
@@ -36,6 +40,44 @@ int tcp_connection::send(const void *data, size_t len) {
     }
 
     write_request_ptr req(new write_request(this, data, len));
+    return write(req);
+}
+
+int tcp_connection::send(buffer *buf) {
+    if (state_ != state_connected) {
+        sk_error("invalid connection: %s", name_.c_str());
+        return EINVAL;
+    }
+
+    assert_retval(buf && !buf->empty(), EINVAL);
+
+    // the caller gets the empty space of a completed write in exchange
+    if (!spare_.empty()) {
+        write_request_ptr req(std::move(spare_.back()));
+        spare_.pop_back();
+
+        sk_assert(req->buf.empty());
+        req->buf.swap(*buf);
+
+        // nothing is written, so the content goes back to the caller,
+        // and the empty space goes back to where it comes from
+        int ret = write(req);
+        if (unlikely(ret != 0)) {
+            req->buf.swap(*buf);
+            spare_.push_back(std::move(req));
+        }
+
+        return ret;
+    }
+
+    write_request_ptr req(new write_request(this, buf));
+    int ret = write(req);
+    if (unlikely(ret != 0)) req->buf.swap(*buf);
+
+    return ret;
+}
+
+int tcp_connection::write(write_request_ptr& req) {
     uv_buf_t buf = uv_buf_init(char_ptr(const_cast<void*>(req->buf.peek())), req->buf.size());
 
     int ret = uv_write(&req->req, &handle_->stream, &buf, 1, on_write);
@@ -80,7 +122,7 @@ void tcp_connection::close() {
 
 void tcp_connection::update_name() {
     static_assert(std::is_same<int, uv_os_fd_t>::value, "fd type must be int");
-    static char buf[64];
+    char buf[64];
 
     uv_os_fd_t fd = -1;
     uv_fileno(&handle_->handle, &fd);
@@ -147,6 +189,12 @@ void tcp_connection::on_write(write_request *req, int status) {
     sk_assert(ptr.get() == req);
 
     if (status != 0) sk_error("on_write: %s", uv_err_name(status));
+
+    if (ptr->recyclable && spare_.size() < MAX_SPARE_REQUESTS) {
+        ptr->buf.consume(ptr->buf.size());
+        spare_.push_back(std::move(ptr));
+    }
+
     if (fn_on_write_) fn_on_write_(status, shared_from_this());
 }
 
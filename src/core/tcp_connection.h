@@ -3,6 +3,7 @@
 
 #include <uv.h>
 #include <list>
+#include <vector>
 #include <core/buffer.h>
 #include <core/callback.h>
 #include <core/inet_address.h>
@@ -18,6 +19,18 @@ public:
     ~tcp_connection();
 
     int send(const void *data, size_t len);
+
+    /**
+     * @brief send the whole reading area of the buffer in one write, the
+     * content is taken over by the connection without copying, and the
+     * buffer is left with an empty (but allocated) space for reusing,
+     * which is the space of a completed write if there is one, so the
+     * caller sending buffers of the same size does not allocate again,
+     * if it fails, the content is given back to the buffer untouched
+     * @param buf: the buffer to send
+     * @return 0 if succeeds, error code otherwise
+     */
+    int send(buffer *buf);
     int recv();
     void close();
 
@@ -38,9 +51,16 @@ private:
         //     write_request *r = reinterpret_cast<write_request*>(w);
         uv_write_t req;
         buffer buf;
+        bool recyclable; // the space is kept for the next send(buffer*)
 
         write_request(tcp_connection* conn, const void *data, size_t len)
-            : buf(data, len) {
+            : buf(data, len), recyclable(false) {
+            req.data = conn;
+        }
+
+        // the space of data is taken, so buf allocates nothing itself
+        write_request(tcp_connection* conn, buffer *data) : buf(0), recyclable(true) {
+            buf.swap(*data);
             req.data = conn;
         }
     };
@@ -52,6 +72,7 @@ private:
                    const inet_address& remote_addr, const fn_on_close& fn);
 
     void update_name();
+    int write(write_request_ptr& req);
 
     void on_alloc(uv_buf_t *buf, size_t size_hint);
     static void on_alloc(uv_handle_t *handle, size_t size_hint, uv_buf_t *buf);
@@ -77,6 +98,7 @@ private:
 
     buffer incoming_;
     std::list<write_request_ptr> outgoing_;
+    std::vector<write_request_ptr> spare_; // completed requests of send(buffer*)
 
     fn_on_read fn_on_read_;
     fn_on_write fn_on_write_;
@@ -1,10 +1,14 @@
 #include <log/log.h>
 #include <coroutine/coroutine.h>
 #include <coroutine/detail/coroutine_mgr.h>
+#include <coroutine/detail/worker_group.h>
+#include <coroutine/detail/watchdog.h>
 
 NS_BEGIN(sk)
 
-static detail::coroutine_mgr *mgr = nullptr;
+// the scheduler of the current thread, see coroutine_start_workers(...)
+static thread_local detail::coroutine_mgr *mgr = nullptr;
+static detail::worker_group *group = nullptr;
 
 void coroutine_init(uv_loop_t *loop) {
     if (!mgr) {
@@ -13,6 +17,8 @@ void coroutine_init(uv_loop_t *loop) {
 }
 
 void coroutine_fini() {
+    coroutine_stop_workers();
+
     if (mgr) {
         delete mgr;
         mgr = nullptr;
@@ -24,6 +30,27 @@ coroutine *coroutine_create(const std::string& name, const coroutine_function& f
     return mgr->create(name, fn, stack_size, preserve_fpu, protect_stack);
 }
 
+coroutine *coroutine_create_shared(const std::string& name,
+                                   const coroutine_function& fn, bool preserve_fpu) {
+    return mgr->create_shared(name, fn, preserve_fpu);
+}
+
+int coroutine_set_shared_stacks(size_t count, size_t size) {
+    return mgr->set_shared_stacks(count, size);
+}
+
+void coroutine_get_shared_stack_stats(coroutine_shared_stack_stats& stats) {
+    mgr->get_shared_stack_stats(stats);
+}
+
+bool coroutine_on_shared_stack() {
+    return mgr->on_shared_stack();
+}
+
+bool coroutine_can_wait() {
+    return mgr->can_wait();
+}
+
 coroutine *coroutine_self() {
     return mgr->self();
 }
@@ -32,10 +59,10 @@ const char *coroutine_name() {
     return mgr->name();
 }
 
-void coroutine_sleep(u64 ms) {
+int coroutine_sleep(u64 ms) {
     if (!coroutine_self()) {
         sk_error("coroutine_sleep() can only be called inside a coroutine.");
-        return;
+        return -EPERM;
     }
 
     return mgr->sleep(ms);
@@ -50,6 +77,28 @@ void coroutine_yield() {
     return mgr->yield();
 }
 
+bool coroutine_wait_io(u64 timeout_ms) {
+    if (!coroutine_self()) {
+        sk_error("coroutine_wait_io() can only be called inside a coroutine.");
+        return false;
+    }
+
+    return mgr->wait_io(timeout_ms);
+}
+
+bool coroutine_wait_cond(u64 timeout_ms) {
+    if (!coroutine_self()) {
+        sk_error("coroutine_wait_cond() can only be called inside a coroutine.");
+        return false;
+    }
+
+    return mgr->wait_cond(timeout_ms);
+}
+
+bool coroutine_wake_up(coroutine *c) {
+    return mgr->wake_up(c);
+}
+
 void coroutine_schedule() {
     if (coroutine_self()) {
         sk_error("coroutine_schedule() cannot be called inside a coroutine.");
@@ -59,4 +108,108 @@ void coroutine_schedule() {
     return mgr->schedule();
 }
 
+void coroutine_set_pool_watermarks(size_t low, size_t high) {
+    mgr->set_pool_watermarks(low, high);
+}
+
+void coroutine_get_pool_stats(coroutine_pool_stats& stats) {
+    mgr->get_pool_stats(stats);
+}
+
+int coroutine_start_workers(size_t count) {
+    if (!mgr || mgr->worker_index() != 0 || coroutine_self()) {
+        sk_error("coroutine_start_workers() can only be called on worker 0, outside of coroutines.");
+        return -EPERM;
+    }
+
+    if (!group) {
+        group = new detail::worker_group(mgr);
+    }
+
+    return group->start(count, [] (detail::coroutine_mgr *m) {
+        mgr = m;
+        m->schedule();
+        mgr = nullptr;
+    });
+}
+
+void coroutine_stop_workers() {
+    if (!group) return;
+
+    if (mgr->worker_index() != 0 || coroutine_self()) {
+        sk_error("coroutine_stop_workers() can only be called on worker 0, outside of coroutines.");
+        return;
+    }
+
+    delete group;
+    group = nullptr;
+}
+
+size_t coroutine_worker_count() {
+    return mgr->worker_count();
+}
+
+size_t coroutine_worker_index() {
+    return mgr->worker_index();
+}
+
+uv_loop_t *coroutine_loop() {
+    return mgr->loop();
+}
+
+int coroutine_get_worker_stats(size_t index, coroutine_worker_stats& stats) {
+    return mgr->get_worker_stats(index, stats);
+}
+
+int coroutine_pin() {
+    if (!coroutine_self()) {
+        sk_error("coroutine_pin() can only be called inside a coroutine.");
+        return -EPERM;
+    }
+
+    return mgr->pin();
+}
+
+int coroutine_unpin() {
+    if (!coroutine_self()) {
+        sk_error("coroutine_unpin() can only be called inside a coroutine.");
+        return -EPERM;
+    }
+
+    return mgr->unpin();
+}
+
+void coroutine_set_direct_switch(bool enable) {
+    mgr->set_direct_switch(enable);
+}
+
+int coroutine_set_priority(coroutine *c, coroutine_priority priority) {
+    return mgr->set_priority(c, priority);
+}
+
+void coroutine_set_budget(size_t max_count, u64 max_us) {
+    mgr->set_budget(max_count, max_us);
+}
+
+int coroutine_start_watchdog(u64 threshold_ms) {
+    return detail::watchdog::get()->start(threshold_ms);
+}
+
+void coroutine_stop_watchdog() {
+    detail::watchdog::get()->stop();
+}
+
+void coroutine_set_profiling(bool enable, u64 slow_run_us) {
+    mgr->set_profiling(enable, slow_run_us);
+}
+
+void coroutine_get_profiles(coroutine_profile_key key, size_t n,
+                            std::vector<coroutine_profile>& profiles) {
+    mgr->get_profiles(key, n, profiles);
+}
+
+void coroutine_dump_profiles(coroutine_profile_key key, size_t n) {
+    mgr->dump_profiles(key, n);
+}
+
 NS_END(sk)
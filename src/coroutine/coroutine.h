@@ -2,6 +2,8 @@
 #define COROUTINE_H
 
 #include <uv.h>
+#include <string>
+#include <vector>
 #include <functional>
 #include <utility/types.h>
 
@@ -10,6 +12,85 @@ NS_BEGIN(sk)
 struct coroutine;
 using coroutine_function = std::function<void()>;
 
+/*
+ * stacks and objects of finished coroutines are pooled and reused by the
+ * coroutines created later, hit_count/miss_count tells the hit rate
+ */
+struct coroutine_pool_stats {
+    u64 hit_count;       // stacks reused from the pool
+    u64 miss_count;      // stacks allocated as the pool is empty
+    size_t used_count;   // stacks used by live coroutines
+    size_t peak_count;   // max of used_count
+    size_t pooled_count; // stacks in the pool
+    size_t pooled_bytes; // bytes of the stacks in the pool
+    size_t free_objects; // coroutine objects to be reused
+};
+
+/*
+ * coroutines created by coroutine_create_shared(...) run on a few large
+ * run stacks shared by all of them, when one of them gets switched in,
+ * the used part of the previous owner of the run stack is copied out to
+ * a buffer of its own, and copied back when that one runs again, so a
+ * suspended coroutine only costs the stack it really uses, at the price
+ * of the copying, saved_bytes / save_count tells the cost per switch
+ */
+struct coroutine_shared_stack_stats {
+    size_t stack_count;     // count of the run stacks
+    size_t stack_size;      // size of each run stack
+    size_t coroutine_count; // live coroutines on the run stacks
+    u64 save_count;         // stacks saved on switching
+    u64 restore_count;      // stacks restored on switching
+    u64 saved_bytes;        // bytes copied out in total
+    size_t max_saved_size;  // the largest stack ever saved
+    size_t buffer_bytes;    // bytes of the save buffers held now
+};
+
+/*
+ * statistics of a worker, see coroutine_start_workers(...), the counters
+ * are updated by the worker thread, and read without synchronization
+ */
+struct coroutine_worker_stats {
+    u64 resume_count;     // coroutines resumed
+    u64 steal_count;      // coroutines stolen from the other workers
+    u64 steal_miss_count; // steals finding nothing
+    u64 stolen_count;     // coroutines stolen by the other workers
+    u64 inbox_count;      // pinned coroutines sent back to it
+    u64 idle_count;       // times it polls the loop with nothing to run
+    u64 turn_count;       // times it polls the loop as the budget runs out
+    u64 overrun_count;    // runs reported by the watchdog
+    size_t deque_size;    // migratable coroutines waiting in its deque
+};
+
+/*
+ * the profile of the coroutines of the same name, collected by a worker
+ * while profiling is on, see coroutine_set_profiling(...)
+ */
+struct coroutine_profile {
+    std::string name;
+    u64 count;         // coroutines created
+    u64 switch_count;  // times they are resumed
+    u64 run_ns;        // wall time running
+    u64 cpu_ns;        // cpu time running
+    u64 max_run_ns;    // the longest run without switching out
+    u64 runnable_ns;   // time in the runnable queues
+    u64 waiting_ns;    // time sleeping, or waiting for io or primitives
+    size_t stack_size; // stack size of them
+    size_t stack_used; // stack high-water mark of them
+};
+
+enum coroutine_profile_key {
+    profile_by_cpu,
+    profile_by_run,
+    profile_by_switch,
+    profile_by_stack
+};
+
+enum coroutine_priority {
+    priority_high,
+    priority_normal,
+    priority_low
+};
+
 void coroutine_init(uv_loop_t *loop);
 void coroutine_fini();
 
@@ -19,16 +100,183 @@ coroutine *coroutine_create(const std::string& name,
                             bool preserve_fpu = false,
                             bool protect_stack = false);
 
+/*
+ * create a coroutine on the shared stacks, it suits the large number of
+ * coroutines which use little stack while suspended
+ *
+ * NOTE: the stack of a suspended coroutine is somewhere else, so the
+ * objects on it MUST NOT be accessed by others, do not pass pointers to
+ * local buffers, channels, mutexes... to other coroutines or callbacks,
+ * allocate them on the heap instead, the io operations and primitives
+ * in coroutine_io.h and coroutine_sync.h handle their own states already
+ */
+coroutine *coroutine_create_shared(const std::string& name,
+                                   const coroutine_function& fn,
+                                   bool preserve_fpu = false);
+
+/*
+ * set count & size of the run stacks, 4 stacks of 256KB by default, it
+ * fails with -EBUSY if there are coroutines on the shared stacks already
+ */
+int coroutine_set_shared_stacks(size_t count, size_t size);
+
+void coroutine_get_shared_stack_stats(coroutine_shared_stack_stats& stats);
+
+// whether the current coroutine runs on a shared stack
+bool coroutine_on_shared_stack();
+
+/*
+ * whether the current coroutine can wait for io or the primitives, it
+ * can not outside of coroutines, in the uv coroutine, or if migratable
+ */
+bool coroutine_can_wait();
+
 coroutine *coroutine_self();
 
 const char *coroutine_name();
 
-void coroutine_sleep(u64 ms);
+/*
+ * return 0 after sleeping for ms milliseconds, or -EINTR if the sleep is
+ * cancelled by coroutine_wake_up(...)
+ */
+int coroutine_sleep(u64 ms);
 
 void coroutine_yield();
 
 void coroutine_schedule();
 
+/*
+ * the building blocks of awaitable operations: the current coroutine
+ * starts an asynchronous operation, and suspends itself by calling
+ * coroutine_wait_io(), the callback of the operation wakes it up by
+ * calling coroutine_wake_up(), see coroutine_io.h for examples
+ *
+ * timeout_ms: 0 means no timeout, false is returned if it times out,
+ * and the operation should be cancelled by the caller then
+ */
+bool coroutine_wait_io(u64 timeout_ms = 0);
+
+/*
+ * same as coroutine_wait_io(), but for the synchronization primitives,
+ * see coroutine_sync.h
+ */
+bool coroutine_wait_cond(u64 timeout_ms = 0);
+
+/*
+ * wake up a waiting or sleeping coroutine (the sleep gets cancelled),
+ * return false if it's not waiting or sleeping (timed out already, for
+ * example)
+ */
+bool coroutine_wake_up(coroutine *c);
+
+/*
+ * each size of stacks keeps at most "high" stacks in the pool, and gets
+ * trimmed to "low" stacks once it goes beyond, high == 0 disables pooling
+ */
+void coroutine_set_pool_watermarks(size_t low, size_t high);
+
+void coroutine_get_pool_stats(coroutine_pool_stats& stats);
+
+/*
+ * start "count" worker threads, each of them has its own uv loop and
+ * scheduler, the thread calling coroutine_init(...) is worker 0, it MUST
+ * be called there, outside of the coroutines
+ *
+ * a coroutine is pinned to the worker creating it by default, so it can
+ * use the uv handles of the loop, the io operations, the primitives...
+ * as before, coroutine_unpin() lets it migrate, the workers running out
+ * of coroutines steal the migratable ones from the others, it suits the
+ * cpu heavy jobs (path finding, AI...), a migratable coroutine can only
+ * yield and sleep, and MUST be pinned again to wait for io or primitives
+ */
+int coroutine_start_workers(size_t count);
+
+/*
+ * stop the worker threads after their coroutines are done, the pinned
+ * coroutines sent back to worker 0 run when it's scheduled again
+ */
+void coroutine_stop_workers();
+
+size_t coroutine_worker_count();
+
+// index of the worker running on the current thread
+size_t coroutine_worker_index();
+
+// the loop of the worker running on the current thread
+uv_loop_t *coroutine_loop();
+
+// return -EINVAL if there is no such worker
+int coroutine_get_worker_stats(size_t index, coroutine_worker_stats& stats);
+
+/*
+ * when a coroutine switches out (yields, sleeps, waits...), it switches
+ * to the next runnable coroutine of the worker directly, rather than
+ * back to coroutine_schedule() and then to the next, it halves the
+ * switches of a handoff (channel, wake up...), it's on by default, and
+ * it's off while profiling
+ */
+void coroutine_set_direct_switch(bool enable);
+
+/*
+ * turn profiling of the current worker on or off, the stacks of the
+ * coroutines created while it's on are painted, so their high-water
+ * marks can be told (a shared stack tells the deepest at switches only),
+ * and a run longer than slow_run_us gets logged, 0 means no logging
+ *
+ * NOTE: a worker profiles the coroutines running on it, a migratable
+ * coroutine is profiled by all the workers it runs on
+ */
+void coroutine_set_profiling(bool enable, u64 slow_run_us = 0);
+
+// the top n profiles of the current worker, in descending order of key
+void coroutine_get_profiles(coroutine_profile_key key, size_t n,
+                            std::vector<coroutine_profile>& profiles);
+
+// log the top n profiles of the current worker
+void coroutine_dump_profiles(coroutine_profile_key key, size_t n);
+
+/*
+ * the runnable coroutines of a worker run in the order of priority, and
+ * in FIFO order of the same priority, a coroutine is created with
+ * priority_normal, the priority is ignored while it's migratable
+ *
+ * NOTE: a higher priority always runs first, so the lower ones starve
+ * while the higher ones keep yielding, use it for the latency sensitive
+ * coroutines which run briefly, and call it on the worker creating c
+ */
+int coroutine_set_priority(coroutine *c, coroutine_priority priority);
+
+/*
+ * set the budget of a round of the current worker, once "max_count"
+ * coroutines are resumed, or "max_us" microseconds pass, the loop gets
+ * a turn to poll the io & run the timers (without blocking), even if
+ * there are coroutines still runnable, so the coroutines yielding in a
+ * loop cannot starve the io & timers, 0 means no limit, and both are 0
+ * by default, the loop only gets a turn when nothing else runs
+ */
+void coroutine_set_budget(size_t max_count, u64 max_us);
+
+/*
+ * start a thread watching all the workers, a coroutine running longer
+ * than threshold_ms without switching out is logged (once per run)
+ * while it's still running, so the one blocking a worker can be told,
+ * calling it again changes the threshold
+ */
+int coroutine_start_watchdog(u64 threshold_ms);
+void coroutine_stop_watchdog();
+
+/*
+ * pin the current coroutine to the worker creating it, if it runs on
+ * another worker now, it switches out, and returns on its home worker
+ */
+int coroutine_pin();
+
+/*
+ * let the current coroutine migrate, it switches out, and might return
+ * on another worker, a coroutine on a shared stack cannot migrate
+ */
+int coroutine_unpin();
+
 NS_END(sk)
 
 #endif // COROUTINE_H
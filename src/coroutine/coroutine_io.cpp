@@ -0,0 +1,291 @@
+#include <limits.h>
+#include <string.h>
+#include <log/log.h>
+#include <utility/assert_helper.h>
+#include <core/rest_client.h>
+#include <redis/redis_cluster.h>
+#include <coroutine/coroutine.h>
+#include <coroutine/coroutine_io.h>
+
+NS_BEGIN(sk)
+
+/*
+ * lives on the stack of the waiting coroutine (see op_state), the
+ * callback of the operation calls finish(...), which MUST be the last
+ * thing it does with the waiter, as the coroutine might run at once
+ */
+struct io_waiter {
+    coroutine *c;
+    bool done;
+    bool waiting;
+    int status;
+
+    io_waiter() : c(coroutine_self()), done(false), waiting(false), status(0) {}
+
+    /*
+     * return false if it times out, 0 means no timeout, the operation
+     * might have completed along with the timeout, it's done then, and
+     * true is returned, so the result is not lost
+     */
+    bool wait(u64 timeout_ms = 0) {
+        while (!done) {
+            waiting = true;
+            bool ok = coroutine_wait_io(timeout_ms);
+            waiting = false;
+
+            if (!ok) return done;
+        }
+
+        return true;
+    }
+
+    void finish(int status) {
+        this->status = status;
+        this->done = true;
+
+        // the callback might be called before the coroutine waits
+        if (waiting) {
+            coroutine_wake_up(c);
+        }
+    }
+};
+
+struct read_waiter : public io_waiter {
+    void *buf;
+    size_t len;
+    void *data;
+    std::string copy; // the buffer to read into on a shared stack
+};
+
+struct connect_op {
+    io_waiter w;
+    uv_connect_t req;
+};
+
+struct write_op {
+    io_waiter w;
+    uv_write_t req;
+    std::string copy; // the data to write on a shared stack
+};
+
+struct redis_op {
+    io_waiter w;
+    redisReply *reply;
+
+    redis_op() : reply(nullptr) {}
+};
+
+struct http_op {
+    io_waiter w;
+    int http_status;
+    std::string body;
+
+    http_op() : http_status(0) {}
+};
+
+/*
+ * the state of an operation is accessed by the callbacks while the
+ * coroutine is suspended, when the coroutine runs on a shared stack,
+ * the stack is saved somewhere else by then, so the state is put on
+ * the heap instead
+ */
+template<typename T>
+class op_state {
+public:
+    MAKE_NONCOPYABLE(op_state);
+
+    op_state() : ptr_(coroutine_on_shared_stack() ? new T() : &local_) {}
+    ~op_state() { if (ptr_ != &local_) delete ptr_; }
+
+    bool shared() const { return ptr_ != &local_; }
+    T *operator->() { return ptr_; }
+    T *get() { return ptr_; }
+
+private:
+    T local_;
+    T *ptr_;
+};
+
+static void on_connect(uv_connect_t *req, int status) {
+    io_waiter *w = static_cast<io_waiter*>(req->data);
+    w->finish(status);
+}
+
+static void on_alloc(uv_handle_t *handle, size_t, uv_buf_t *buf) {
+    read_waiter *w = static_cast<read_waiter*>(handle->data);
+    buf->base = char_ptr(w->buf);
+    buf->len = w->len;
+}
+
+static void on_read(uv_stream_t *stream, ssize_t nbytes, const uv_buf_t *) {
+    // EAGAIN or EWOULDBLOCK, nothing read
+    if (nbytes == 0) return;
+
+    read_waiter *w = static_cast<read_waiter*>(stream->data);
+    uv_read_stop(stream);
+    stream->data = w->data;
+
+    // nbytes fits in an int as the buffer length does
+    w->finish(static_cast<int>(nbytes));
+}
+
+static void on_write(uv_write_t *req, int status) {
+    io_waiter *w = static_cast<io_waiter*>(req->data);
+    w->finish(status);
+}
+
+int co_connect(uv_tcp_t *handle, const struct sockaddr *addr) {
+    // check it before the operation starts, it can not be undone then
+    if (!coroutine_can_wait()) {
+        sk_error("co_connect() can only be called inside a pinned coroutine.");
+        return -EPERM;
+    }
+
+    op_state<connect_op> o;
+    o->req.data = &o->w;
+
+    int ret = uv_tcp_connect(&o->req, handle, addr, on_connect);
+    if (ret != 0) {
+        sk_error("uv_tcp_connect() error: %s.", uv_strerror(ret));
+        return ret;
+    }
+
+    // never fails as the caller can wait, or the frame goes with the operation in flight
+    assert_retval(o->w.wait(), -EPERM);
+    return o->w.status;
+}
+
+ssize_t co_read(uv_stream_t *stream, void *buf, size_t len, u64 timeout_ms) {
+    // check it before the operation starts, it can not be undone then
+    if (!coroutine_can_wait()) {
+        sk_error("co_read() can only be called inside a pinned coroutine.");
+        return -EPERM;
+    }
+
+    assert_retval(len > 0 && len <= INT_MAX, -EINVAL);
+
+    op_state<read_waiter> w;
+    w->buf = buf;
+    w->len = len;
+    w->data = stream->data;
+    stream->data = w.get();
+
+    // the data is read in the uv coroutine, when the buffer is not there
+    if (w.shared()) {
+        w->copy.resize(len);
+        w->buf = &w->copy[0];
+    }
+
+    int ret = uv_read_start(stream, on_alloc, on_read);
+    if (ret != 0) {
+        stream->data = w->data;
+        sk_error("uv_read_start() error: %s.", uv_strerror(ret));
+        return ret;
+    }
+
+    if (!w->wait(timeout_ms)) {
+        uv_read_stop(stream);
+        stream->data = w->data;
+        return UV_ETIMEDOUT;
+    }
+
+    if (w.shared() && w->status > 0) {
+        memcpy(buf, w->buf, w->status);
+    }
+
+    return w->status;
+}
+
+int co_write(uv_stream_t *stream, const void *data, size_t len) {
+    // check it before the operation starts, it can not be undone then
+    if (!coroutine_can_wait()) {
+        sk_error("co_write() can only be called inside a pinned coroutine.");
+        return -EPERM;
+    }
+
+    op_state<write_op> o;
+    o->req.data = &o->w;
+
+    // the data is not copied, the coroutine is suspended until it's
+    // written, unless the data might be on a shared stack
+    char *base = static_cast<char*>(const_cast<void*>(data));
+    if (o.shared()) {
+        o->copy.assign(base, len);
+        base = &o->copy[0];
+    }
+
+    uv_buf_t buf = uv_buf_init(base, static_cast<unsigned int>(len));
+    int ret = uv_write(&o->req, stream, &buf, 1, on_write);
+    if (ret != 0) {
+        sk_error("uv_write() error: %s.", uv_strerror(ret));
+        return ret;
+    }
+
+    // never fails as the caller can wait, or the frame goes with the operation in flight
+    assert_retval(o->w.wait(), -EPERM);
+    return o->w.status;
+}
+
+int co_redis_exec(redis_cluster *cluster, const std::string& key,
+                  redisReply **reply, const char *fmt, ...) {
+    // check it before the operation starts, it can not be undone then
+    if (!coroutine_can_wait()) {
+        sk_error("co_redis_exec() can only be called inside a pinned coroutine.");
+        return -EPERM;
+    }
+
+    op_state<redis_op> o;
+    redis_op *op = o.get();
+    auto fn = [op] (int ret, const redis_command_ptr&, redisReply *reply) {
+        op->reply = reply;
+        op->w.finish(ret);
+    };
+
+    va_list ap;
+    va_start(ap, fmt);
+    redis_command_ptr cmd = redis_command::create(key, fn, nullptr, fmt, ap);
+    va_end(ap);
+
+    if (!cmd) {
+        sk_error("cannot create command, fmt: %s, key: %s", fmt, key.c_str());
+        return -EINVAL;
+    }
+
+    int ret = cluster->exec(cmd);
+    if (ret != 0) return ret;
+
+    // the cluster holds the command until the reply returns
+    cmd.reset();
+
+    assert_retval(o->w.wait(), -EPERM);
+    if (reply) *reply = o->reply;
+    return o->w.status;
+}
+
+int co_http_get(rest_client *client, const char *uri,
+                const string_map *parameters, const string_map *headers,
+                int& http_status, std::string& body) {
+    // check it before the operation starts, it can not be undone then
+    if (!coroutine_can_wait()) {
+        sk_error("co_http_get() can only be called inside a pinned coroutine.");
+        return -EPERM;
+    }
+
+    op_state<http_op> o;
+    http_op *op = o.get();
+    auto fn = [op] (int ret, int status, const string_map&, const std::string& rsp) {
+        op->http_status = status;
+        op->body = rsp;
+        op->w.finish(ret);
+    };
+
+    int ret = client->get(uri, fn, parameters, headers);
+    if (ret != 0) return ret;
+
+    assert_retval(o->w.wait(), -EPERM);
+    http_status = op->http_status;
+    body.swap(op->body);
+    return o->w.status;
+}
+
+NS_END(sk)
@@ -0,0 +1,80 @@
+#ifndef COROUTINE_IO_H
+#define COROUTINE_IO_H
+
+#include <uv.h>
+#include <core/callback.h>
+#include <redis/redis_command.h>
+
+NS_BEGIN(sk)
+
+class rest_client;
+class redis_cluster;
+
+/*
+ * awaitable io operations, each of them starts an asynchronous operation,
+ * suspends the current coroutine, and returns after it's woken up by the
+ * callback of the operation, so the business logic can be written in a
+ * sequential way, they can only be called inside a coroutine (not the uv
+ * one) which is pinned, or -EPERM is returned before anything starts, the
+ * buffers passed in must stay valid until they return, on a shared stack,
+ * the buffers are copied to & from the heap
+ */
+
+/**
+ * @brief connect to the address
+ * @param handle: an initialized tcp handle
+ * @param addr: the address to connect to
+ * @return 0 if succeeds, error code (UV_XXX) otherwise
+ */
+int co_connect(uv_tcp_t *handle, const struct sockaddr *addr);
+
+/**
+ * @brief read from the stream, the data field of the stream is borrowed
+ * during the call, and restored before it returns
+ * @param stream: the stream to read from
+ * @param buf: the buffer to store the data
+ * @param len: length of the buffer
+ * @param timeout_ms: 0 means no timeout
+ * @return bytes read, UV_EOF if the peer closes, UV_ETIMEDOUT if it
+ *         times out before anything is read, error code otherwise
+ */
+ssize_t co_read(uv_stream_t *stream, void *buf, size_t len, u64 timeout_ms = 0);
+
+/**
+ * @brief write all the data to the stream
+ * @param stream: the stream to write to
+ * @param data: the data to write, it's not copied
+ * @param len: length of the data
+ * @return 0 if succeeds, error code (UV_XXX) otherwise
+ */
+int co_write(uv_stream_t *stream, const void *data, size_t len);
+
+/**
+ * @brief execute a redis command
+ * @param cluster: the redis cluster
+ * @param key: key of the command, it decides the node to execute it
+ * @param reply: stores the reply, it's valid until the coroutine
+ *               suspends again, copy what's needed before that
+ * @param fmt: the command, see redisFormatCommand(...)
+ * @return 0 if succeeds, error code otherwise
+ */
+int co_redis_exec(redis_cluster *cluster, const std::string& key,
+                  redisReply **reply, const char *fmt, ...);
+
+/**
+ * @brief send a http GET request
+ * @param client: the rest client
+ * @param uri: the uri to request
+ * @param parameters: query parameters, can be NULL
+ * @param headers: request headers, can be NULL
+ * @param http_status: stores the http status code
+ * @param body: stores the response body
+ * @return 0 if succeeds, error code otherwise
+ */
+int co_http_get(rest_client *client, const char *uri,
+                const string_map *parameters, const string_map *headers,
+                int& http_status, std::string& body);
+
+NS_END(sk)
+
+#endif // COROUTINE_IO_H
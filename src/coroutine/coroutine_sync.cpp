@@ -0,0 +1,237 @@
+#include <errno.h>
+#include <log/log.h>
+#include <utility/time_helper.h>
+#include <coroutine/coroutine_sync.h>
+
+NS_BEGIN(sk)
+NS_BEGIN(detail)
+
+int wait_queue::wait(u64 timeout_ms) {
+    // it would return at once without being parked, see wait_cond(...)
+    if (!coroutine_can_wait()) {
+        sk_error("wait() can only be called inside a pinned coroutine.");
+        return -EPERM;
+    }
+
+    // the notifier writes the node while this coroutine is parked, and
+    // a shared stack is saved somewhere else by then
+    node local;
+    node *n = coroutine_on_shared_stack() ? new node() : &local;
+    n->c = coroutine_self();
+    n->next = nullptr;
+    n->notified = false;
+
+    if (tail_) {
+        tail_->next = n;
+    } else {
+        head_ = n;
+    }
+
+    tail_ = n;
+
+    const u64 deadline = timeout_ms > 0 ? time::monotonic_ns() / 1000000 + timeout_ms : 0;
+    bool timed_out = false;
+    while (true) {
+        timed_out = !coroutine_wait_cond(timeout_ms);
+        if (n->notified || timed_out) break;
+
+        // woken up by coroutine_wake_up(...) rather than a notification,
+        // it's still in the queue, so go on waiting for the time left
+        if (deadline > 0) {
+            const u64 now = time::monotonic_ns() / 1000000;
+            if (now >= deadline) {
+                timed_out = true;
+                break;
+            }
+
+            timeout_ms = deadline - now;
+        }
+    }
+
+    // it times out, the node MUST NOT be left in the queue
+    if (!n->notified) {
+        remove(n);
+    }
+
+    const bool notified = n->notified;
+    if (n != &local) delete n;
+
+    return notified ? 0 : -ETIMEDOUT;
+}
+
+void wait_queue::remove(node *n) {
+    node *prev = nullptr;
+    for (node *p = head_; p; prev = p, p = p->next) {
+        if (p != n) continue;
+
+        if (prev) {
+            prev->next = p->next;
+        } else {
+            head_ = p->next;
+        }
+
+        if (tail_ == p) tail_ = prev;
+        return;
+    }
+}
+
+bool wait_queue::notify_one(coroutine **owner) {
+    while (node *n = head_) {
+        head_ = n->next;
+        if (!head_) tail_ = nullptr;
+
+        // the node is gone after this, as the coroutine might run at once
+        coroutine *c = n->c;
+        n->notified = true;
+        if (owner) *owner = c;
+        if (coroutine_wake_up(c)) return true;
+
+        // it has timed out, but not run yet, so the node is still there
+        n->notified = false;
+        if (owner) *owner = nullptr;
+    }
+
+    return false;
+}
+
+void wait_queue::notify_all() {
+    node *n = head_;
+    head_ = nullptr;
+    tail_ = nullptr;
+
+    // the coroutines not woken up yet are still parked, so are their
+    // nodes (timeouts are handled in the uv coroutine, which does not
+    // run before this returns), but this queue might be gone after the
+    // first one wakes
+    while (n) {
+        node *next = n->next;
+        n->notified = true;
+        if (!coroutine_wake_up(n->c)) n->notified = false;
+        n = next;
+    }
+}
+
+NS_END(detail)
+
+int coroutine_mutex::lock() {
+    coroutine *self = coroutine_self();
+    assert_retval(self && owner_ != self, -EINVAL);
+
+    if (!owner_) {
+        owner_ = self;
+        return 0;
+    }
+
+    // the owner is set to this coroutine by unlock() before it wakes up
+    int ret = waiters_.wait();
+    if (ret != 0) return ret;
+
+    assert_retval(owner_ == self, -EINVAL);
+    return 0;
+}
+
+bool coroutine_mutex::try_lock() {
+    if (owner_) return false;
+
+    owner_ = coroutine_self();
+    assert_retval(owner_, false);
+    return true;
+}
+
+void coroutine_mutex::unlock() {
+    assert_retnone(owner_);
+
+    // handed over to the coroutine really woken up, or released
+    owner_ = nullptr;
+    waiters_.notify_one(&owner_);
+}
+
+int coroutine_cond::wait(coroutine_mutex& m) {
+    assert_retval(m.locked(), -EINVAL);
+
+    // check it before unlocking, or the mutex cannot be locked again
+    if (!coroutine_can_wait()) {
+        sk_error("wait() can only be called inside a pinned coroutine.");
+        return -EPERM;
+    }
+
+    m.unlock();
+    int ret = waiters_.wait();
+    int err = m.lock();
+
+    return ret != 0 ? ret : err;
+}
+
+bool coroutine_cond::wait_for(coroutine_mutex& m, u64 timeout_ms) {
+    assert_retval(m.locked(), false);
+
+    if (!coroutine_can_wait()) {
+        sk_error("wait() can only be called inside a pinned coroutine.");
+        return false;
+    }
+
+    m.unlock();
+    int ret = waiters_.wait(timeout_ms);
+    m.lock();
+
+    return ret == 0;
+}
+
+int coroutine_semaphore::acquire() {
+    if (count_ > 0) {
+        --count_;
+        return 0;
+    }
+
+    // the count is handed over by release() before it wakes up
+    return waiters_.wait();
+}
+
+bool coroutine_semaphore::try_acquire() {
+    if (count_ <= 0) return false;
+
+    --count_;
+    return true;
+}
+
+bool coroutine_semaphore::acquire_for(u64 timeout_ms) {
+    if (count_ > 0) {
+        --count_;
+        return true;
+    }
+
+    return waiters_.wait(timeout_ms) == 0;
+}
+
+void coroutine_semaphore::release() {
+    if (!waiters_.notify_one()) {
+        ++count_;
+    }
+}
+
+void coroutine_wait_group::done() {
+    assert_retnone(count_ > 0);
+
+    if (--count_ <= 0) {
+        waiters_.notify_all();
+    }
+}
+
+int coroutine_wait_group::wait() {
+    while (count_ > 0) {
+        int ret = waiters_.wait();
+        if (ret != 0) return ret;
+    }
+
+    return 0;
+}
+
+bool coroutine_wait_group::wait_for(u64 timeout_ms) {
+    if (count_ > 0) {
+        waiters_.wait(timeout_ms);
+    }
+
+    return count_ <= 0;
+}
+
+NS_END(sk)
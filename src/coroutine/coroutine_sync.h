@@ -0,0 +1,254 @@
+#ifndef COROUTINE_SYNC_H
+#define COROUTINE_SYNC_H
+
+#include <vector>
+#include <utility>
+#include <utility/assert_helper.h>
+#include <coroutine/coroutine.h>
+
+NS_BEGIN(sk)
+
+/*
+ * synchronization primitives between the coroutines of the same loop, a
+ * blocked coroutine is parked in a wait queue, and pushed back to the
+ * runnable queue when it's notified, the queue nodes live on the stacks
+ * of the waiting coroutines, so waiting allocates nothing (except for
+ * the coroutines on the shared stacks, whose nodes are on the heap)
+ *
+ * NOTE: the blocking operations can only be called inside a coroutine
+ * which can wait (see coroutine_can_wait()), or they fail at once with
+ * -EPERM (false for those returning bool), the non-blocking ones (unlock,
+ * notify, release, done, try_push...) can be called anywhere, io callbacks
+ * included, a coroutine blocked here and woken up by coroutine_wake_up(...)
+ * goes on waiting
+ */
+
+NS_BEGIN(detail)
+
+class wait_queue {
+public:
+    MAKE_NONCOPYABLE(wait_queue);
+
+    wait_queue() : head_(nullptr), tail_(nullptr) {}
+    ~wait_queue() { sk_assert(empty()); }
+
+    bool empty() const { return !head_; }
+
+    /*
+     * park the current coroutine until it's notified, or the timeout
+     * expires (0 means no timeout), return 0 if it's notified, -ETIMEDOUT
+     * if it times out, or -EPERM if the current coroutine cannot wait
+     */
+    int wait(u64 timeout_ms = 0);
+
+    /*
+     * return false if there is no coroutine waiting, owner is set to the
+     * coroutine notified before it's woken up, NULL if none, so a lock
+     * can be handed over to the coroutine actually woken up
+     */
+    bool notify_one(coroutine **owner = nullptr);
+    void notify_all();
+
+    void swap(wait_queue& q) {
+        std::swap(head_, q.head_);
+        std::swap(tail_, q.tail_);
+    }
+
+private:
+    struct node {
+        coroutine *c;
+        node *next;
+        bool notified;
+    };
+
+    void remove(node *n);
+
+    node *head_;
+    node *tail_;
+};
+
+NS_END(detail)
+
+class coroutine_mutex {
+public:
+    MAKE_NONCOPYABLE(coroutine_mutex);
+
+    coroutine_mutex() : owner_(nullptr) {}
+
+    // return 0 if it's locked, error code otherwise
+    int lock();
+    bool try_lock();
+
+    // the mutex is handed over to the first waiting coroutine directly
+    void unlock();
+
+    bool locked() const { return !!owner_; }
+
+private:
+    coroutine *owner_;
+    detail::wait_queue waiters_;
+};
+
+class coroutine_cond {
+public:
+    MAKE_NONCOPYABLE(coroutine_cond);
+
+    coroutine_cond() = default;
+
+    /*
+     * the mutex MUST be locked by the current coroutine, return 0 if it's
+     * notified, error code otherwise, the mutex is kept locked either way
+     */
+    int wait(coroutine_mutex& m);
+
+    // return false if it times out, the mutex is locked again anyway
+    bool wait_for(coroutine_mutex& m, u64 timeout_ms);
+
+    template<typename Pred>
+    int wait(coroutine_mutex& m, Pred pred) {
+        while (!pred()) {
+            int ret = wait(m);
+            if (ret != 0) return ret;
+        }
+
+        return 0;
+    }
+
+    void notify_one() { waiters_.notify_one(); }
+    void notify_all() { waiters_.notify_all(); }
+
+private:
+    detail::wait_queue waiters_;
+};
+
+class coroutine_semaphore {
+public:
+    MAKE_NONCOPYABLE(coroutine_semaphore);
+
+    explicit coroutine_semaphore(size_t count) : count_(count) {}
+
+    // return 0 if a permit is acquired, error code otherwise
+    int acquire();
+    bool try_acquire();
+    bool acquire_for(u64 timeout_ms);
+    void release();
+
+    size_t count() const { return count_; }
+
+private:
+    size_t count_;
+    detail::wait_queue waiters_;
+};
+
+/*
+ * wait for a group of coroutines (or operations) to finish, add(n)
+ * before starting them, done() when each of them finishes, and wait()
+ * returns after all of them are done
+ */
+class coroutine_wait_group {
+public:
+    MAKE_NONCOPYABLE(coroutine_wait_group);
+
+    coroutine_wait_group() : count_(0) {}
+
+    void add(size_t n) { count_ += n; }
+    void done();
+
+    // return 0 after all of them are done, error code otherwise
+    int wait();
+
+    // return false if it times out before all of them are done
+    bool wait_for(u64 timeout_ms);
+
+    size_t count() const { return count_; }
+
+private:
+    size_t count_;
+    detail::wait_queue waiters_;
+};
+
+/*
+ * a bounded FIFO channel, push(...) blocks while it's full, and pop(...)
+ * blocks while it's empty, the elements are stored in a ring allocated
+ * at construction, after close(), push(...) fails, and pop(...) fails
+ * after all the pending elements are popped, both of them fail as well
+ * if they would block, but the current coroutine cannot wait
+ */
+template<typename T>
+class coroutine_channel {
+public:
+    MAKE_NONCOPYABLE(coroutine_channel);
+
+    explicit coroutine_channel(size_t capacity)
+        : head_(0), size_(0), closed_(false), ring_(capacity > 0 ? capacity : 1) {}
+
+    bool push(const T& v) {
+        while (full() && !closed_) {
+            if (senders_.wait() != 0) return false;
+        }
+
+        return try_push(v);
+    }
+
+    bool try_push(const T& v) {
+        if (closed_ || full()) return false;
+
+        ring_[(head_ + size_) % ring_.size()] = v;
+        ++size_;
+
+        // MUST be the last, the receiver might run at once
+        receivers_.notify_one();
+        return true;
+    }
+
+    bool pop(T& v) {
+        while (empty() && !closed_) {
+            if (receivers_.wait() != 0) return false;
+        }
+
+        return try_pop(v);
+    }
+
+    bool try_pop(T& v) {
+        if (empty()) return false;
+
+        v = std::move(ring_[head_]);
+        head_ = (head_ + 1) % ring_.size();
+        --size_;
+
+        // MUST be the last, the sender might run at once
+        senders_.notify_one();
+        return true;
+    }
+
+    void close() {
+        closed_ = true;
+
+        // the channel might be gone once a coroutine gets notified,
+        // so take all the waiting coroutines out before that
+        detail::wait_queue senders, receivers;
+        senders.swap(senders_);
+        receivers.swap(receivers_);
+
+        senders.notify_all();
+        receivers.notify_all();
+    }
+
+    bool closed() const { return closed_; }
+    bool empty() const { return size_ <= 0; }
+    bool full() const { return size_ >= ring_.size(); }
+    size_t size() const { return size_; }
+    size_t capacity() const { return ring_.size(); }
+
+private:
+    size_t head_;
+    size_t size_;
+    bool closed_;
+    std::vector<T> ring_;
+    detail::wait_queue senders_;
+    detail::wait_queue receivers_;
+};
+
+NS_END(sk)
+
+#endif // COROUTINE_SYNC_H
@@ -43,6 +43,37 @@ __asm(
 ".section .note.GNU-stack,\"\",%progbits\n"
 );
 
+// the slot of the fpu control words is kept, but left untouched
+__asm(
+".text\n"
+".globl jump_context_fast\n"
+".type jump_context_fast,@function\n"
+".align 16\n"
+"jump_context_fast:\n"
+"    pushq  %rbp  \n"
+"    pushq  %rbx  \n"
+"    pushq  %r15  \n"
+"    pushq  %r14  \n"
+"    pushq  %r13  \n"
+"    pushq  %r12  \n"
+"    leaq  -0x8(%rsp), %rsp\n"
+"    movq  %rsp, (%rdi)\n"
+"    movq  %rsi, %rsp\n"
+"    leaq  0x8(%rsp), %rsp\n"
+"    popq  %r12  \n"
+"    popq  %r13  \n"
+"    popq  %r14  \n"
+"    popq  %r15  \n"
+"    popq  %rbx  \n"
+"    popq  %rbp  \n"
+"    popq  %r8\n"
+"    movq  %rdx, %rax\n"
+"    movq  %rdx, %rdi\n"
+"    jmp  *%r8\n"
+".size jump_context_fast,.-jump_context_fast\n"
+".section .note.GNU-stack,\"\",%progbits\n"
+);
+
 __asm(
 ".text\n"
 ".globl make_context\n"
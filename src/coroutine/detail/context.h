@@ -9,6 +9,12 @@ NS_BEGIN(detail)
 void *make_context(void *sp, size_t stack_size, void(*fn)(intptr_t)) asm("make_context");
 intptr_t jump_context(void **ofc, void *nfc, intptr_t p, bool preserve_fpu) asm("jump_context");
 
+/*
+ * same as jump_context(ofc, nfc, p, false), but without the branches on
+ * preserve_fpu, the contexts of both are interchangeable
+ */
+intptr_t jump_context_fast(void **ofc, void *nfc, intptr_t p) asm("jump_context_fast");
+
 NS_END(detail)
 NS_END(sk)
 
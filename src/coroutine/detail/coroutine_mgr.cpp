@@ -1,6 +1,9 @@
-#include <sys/mman.h>
+#include <string.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <utility/math_helper.h>
+#include <utility/time_helper.h>
 #include <utility/assert_helper.h>
-#include <utility/system_helper.h>
 #include <coroutine/detail/context.h>
 #include <coroutine/detail/coroutine_mgr.h>
 
@@ -9,15 +12,17 @@ NS_BEGIN(sk)
 static const int FLAG_PRESERVE_FPU  = 0x1;
 static const int FLAG_PROTECT_STACK = 0x2;
 static const int FLAG_TIMEOUT       = 0x4;
+static const int FLAG_MIGRATABLE    = 0x8;
+static const int FLAG_WOKEN         = 0x10; // woken up in an io callback, not run yet
 
-static size_t get_page_size() {
-    static size_t page_size = 0;
-    if (unlikely(page_size == 0)) {
-        page_size = sk::get_sys_page_size();
-    }
+static const size_t UV_STACK_SIZE = 64 * 1024;
 
-    return page_size;
-}
+static const size_t DEFAULT_SHARED_STACK_COUNT = 4;
+static const size_t DEFAULT_SHARED_STACK_SIZE  = 256 * 1024;
+static const size_t SAVED_STACK_ALIGNMENT      = 256;
+
+// what the stacks are painted with when profiling
+static const u64 STACK_PAINT = 0xCDCDCDCDCDCDCDCDULL;
 
 enum coroutine_state {
     state_running,
@@ -28,17 +33,45 @@ enum coroutine_state {
     state_done
 };
 
+/*
+ * coroutine objects are recycled by coroutine_mgr, so the constructor
+ * only makes an empty one, and reset(...) prepares it for a new run
+ */
 struct coroutine {
-    coroutine(const std::string& name, const coroutine_function& fn,
-              size_t stack_size, bool preserve_fpu, bool protect_stack) {
-        sk_trace("coroutine::coroutine(%s)", name.c_str());
-
-        this->flag       = 0;
-        this->state      = state_runnable;
-        this->ctx        = nullptr;
-        this->stack      = nullptr;
-        this->stack_size = stack_size;
-        this->fn         = fn;
+    coroutine() : flag(0), state(state_done), priority(priority_normal), ctx(nullptr), home(nullptr),
+                  shared(nullptr), saved(nullptr), saved_size(0), saved_capacity(0) {
+        timer.data    = this;
+        name[0]       = '\0';
+        stack.memory  = nullptr;
+        stack.size    = 0;
+        stack.protect = false;
+    }
+
+    ~coroutine() {
+        sk_trace("coroutine::~coroutine(%s -> %d)", name, state);
+
+        if (state != state_done) {
+            sk_warn("coroutine(%s -> %d) is not done!", name, state);
+        }
+
+        sk_assert(!stack.memory);
+        sk_assert(!timer.linked());
+        sk_assert(!saved);
+    }
+
+    void reset(const std::string& name, const coroutine_function& fn,
+               bool preserve_fpu, bool protect_stack) {
+        sk_trace("coroutine::reset(%s)", name.c_str());
+
+        this->flag  = 0;
+        this->state = state_runnable;
+        this->priority  = priority_normal;
+        this->ctx   = nullptr;
+        this->fn    = fn;
+        this->profile   = nullptr;
+        this->profiler  = nullptr;
+        this->mark_ns   = 0;
+        this->stack_low = nullptr;
         snprintf(this->name, sizeof(this->name), "%s", name.c_str());
 
         if (preserve_fpu) {
@@ -50,104 +83,143 @@ struct coroutine {
         }
     }
 
-    ~coroutine() {
-        sk_trace("coroutine::~coroutine(%s -> %d)", name, state);
+    int flag;
+    int state;
+    int priority;
+    void *ctx;
+    char name[32];
+    detail::coroutine_stack stack;
+    detail::timer_wheel::node timer; // linked in the wheel when it sleeps or waits
+    coroutine_function fn;
+    detail::coroutine_mgr *home; // the worker creating it
 
-        if (state != state_done) {
-            sk_warn("coroutine(%s -> %d) is not done!", name, state);
-        }
+    // the run stack it shares with others, the used part of the stack
+    // is saved in "saved" when another coroutine takes the run stack
+    detail::shared_stack *shared;
+    char *saved;
+    size_t saved_size;
+    size_t saved_capacity;
 
-        if (stack) {
-            if ((flag & FLAG_PROTECT_STACK) != 0) {
-                const size_t page_size = get_page_size();
-                const size_t mmap_size = stack_size + page_size * 2;
-                munmap(stack, mmap_size);
-            } else {
-                free(stack);
-            }
+    // profiling only, the entry of its name, in the profiles of the
+    // worker "profiler", when it switches out or becomes runnable, and
+    // the lowest word of the stack it has written
+    coroutine_profile *profile;
+    detail::coroutine_mgr *profiler;
+    u64 mark_ns;
+    u64 *stack_low;
+};
 
-            stack = nullptr;
-            stack_size = 0;
+// check & clear the timeout flag after a coroutine wakes up
+static bool timed_out(coroutine *c) {
+    const bool ret = (c->flag & FLAG_TIMEOUT) != 0;
+    c->flag &= ~FLAG_TIMEOUT;
+    return ret;
+}
 
-            // ctx actually points to an object on stack, so just reset it here
-            ctx = nullptr;
-        }
-    }
+NS_BEGIN(detail)
 
-    bool init() {
-        void *top = nullptr;
+static thread_local void *main_ctx = nullptr;
 
-        if ((flag & FLAG_PROTECT_STACK) != 0) {
-            const size_t page_size = get_page_size();
+/*
+ * a migratable coroutine might yield on a thread, and be resumed on
+ * another one, so the address of main_ctx MUST NOT be cached by the
+ * compiler across a switch, it's always got by a real call
+ */
+__attribute__((noinline)) static void *&main_context() {
+    return main_ctx;
+}
 
-            if ((stack_size & (page_size - 1)) > 0) {
-                stack_size = (stack_size & ~(page_size - 1)) + page_size;
-                sk_assert((stack_size & (page_size - 1)) == 0);
-            }
+void run_queue::push(coroutine *c) {
+    queues_[c->priority].push_back(c);
+    ++size_;
+}
 
-            const size_t mmap_size = stack_size + page_size * 2;
-            const int prot = PROT_READ | PROT_WRITE | PROT_EXEC;
-            const int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+bool run_queue::remove(coroutine *c) {
+    std::deque<coroutine*>& q = queues_[c->priority];
+    auto it = std::find(q.begin(), q.end(), c);
+    if (it == q.end()) return false;
 
-            stack = char_ptr(mmap(nullptr, mmap_size, prot, flags, -1, 0));
-            if (stack == MAP_FAILED) {
-                sk_error("mmap() error: %s.", strerror(errno));
-                stack = nullptr; // MAP_FAILED is -1, we need to reset to null here
-                return false;
-            }
+    q.erase(it);
+    --size_;
+    return true;
+}
 
-            uintptr_t ptr = reinterpret_cast<uintptr_t>(stack);
-            sk_assert((ptr & (page_size - 1)) == 0);
-            sk_assert(((ptr + mmap_size) & (page_size - 1)) == 0);
+coroutine *run_queue::front() {
+    for (const auto& q : queues_) {
+        if (!q.empty()) return q.front();
+    }
 
-            if (mprotect(stack, page_size, PROT_NONE) == -1) {
-                sk_error("mprotect() error: %s.", strerror(errno));
-                munmap(stack, mmap_size);
-                return false;
-            }
+    return nullptr;
+}
 
-            if (mprotect(stack + page_size + stack_size, page_size, PROT_NONE) == -1) {
-                sk_error("mprotect() error: %s.", strerror(errno));
-                munmap(stack, mmap_size);
-                return false;
-            }
+coroutine *run_queue::pop() {
+    for (auto& q : queues_) {
+        if (!q.empty()) {
+            coroutine *c = q.front();
+            q.pop_front();
+            --size_;
+            return c;
+        }
+    }
 
-            top = stack + page_size + stack_size;
-        } else {
-            stack = char_ptr(malloc(stack_size));
-            if (!stack) {
-                return false;
-            }
+    return nullptr;
+}
 
-            top = stack + stack_size;
-        }
+coroutine_mgr::coroutine_mgr(uv_loop_t *loop)
+    : loop_(loop), uv_(nullptr), current_(nullptr),
+      cond_waiting_(0), sleeping_(0), timer_(nullptr), timer_due_(0), next_shared_stack_(0),
+      group_(nullptr), index_(0), async_(nullptr), idle_(false), migratable_(0), steal_seed_(0),
+      budget_count_(0), budget_ns_(0), round_count_(0), round_start_ns_(0), woken_(0),
+      idle_handle_(nullptr), check_handle_(nullptr), watchdog_(watchdog::get()),
+      run_seq_(0), run_start_ns_(0), reported_seq_(0),
+      resume_count_(0), steal_count_(0), steal_miss_count_(0),
+      stolen_count_(0), inbox_count_(0), idle_count_(0), turn_count_(0), overrun_count_(0),
+      profiling_(false), slow_run_ns_(0), direct_switch_(true) {
+    memset(&shared_stats_, 0x00, sizeof(shared_stats_));
+    shared_stats_.stack_count = DEFAULT_SHARED_STACK_COUNT;
+    shared_stats_.stack_size = DEFAULT_SHARED_STACK_SIZE;
 
-        ctx = detail::make_context(top, stack_size, detail::coroutine_mgr::context_main);
-        return !!ctx;
+    for (auto& w : run_name_) {
+        w.store(0, std::memory_order_relaxed);
     }
 
-    int flag;
-    int state;
-    void *ctx;
-    char *stack;
-    char name[32];
-    size_t stack_size;
-    coroutine_function fn;
-};
+    timer_ = new heap_timer(loop_, [this] (heap_timer *) {
+        on_timeout();
+    });
 
-NS_BEGIN(detail)
+    // neither of them keeps the loop alive
+    idle_handle_ = new uv_idle_t;
+    uv_idle_init(loop_, idle_handle_);
+    uv_unref(reinterpret_cast<uv_handle_t*>(idle_handle_));
+
+    check_handle_ = new uv_check_t;
+    uv_check_init(loop_, check_handle_);
+    check_handle_->data = this;
+    uv_check_start(check_handle_, [] (uv_check_t *handle) {
+        static_cast<coroutine_mgr*>(handle->data)->on_check();
+    });
 
-static void *main_ctx = nullptr;
+    uv_unref(reinterpret_cast<uv_handle_t*>(check_handle_));
 
-coroutine_mgr::coroutine_mgr(uv_loop_t *loop) : loop_(loop), uv_(nullptr), current_(nullptr) {
+    // uv__io_poll(...) alone takes 12KB of stack for the epoll events,
+    // and all io callbacks (which wake up coroutines) run on this stack
     uv_ = create("uv", [this] () {
         uv_run(loop_, UV_RUN_DEFAULT);
-    }, 16 * 1024, false, true);
+
+        // the loop has nothing to do in a turn given by the budget,
+        // but there are coroutines still runnable
+        while (has_runnable()) {
+            switch_out(uv_);
+            uv_run(loop_, UV_RUN_DEFAULT);
+        }
+    }, UV_STACK_SIZE, false, true);
 
     // create(...) will push coroutine into the runnable_ queue, but
     // the uv_ coroutine should not be there, so we remove it manually
     sk_assert(runnable_.size() == 1);
     runnable_.pop();
+
+    watchdog_->add(this);
 }
 
 coroutine_mgr::~coroutine_mgr() {
@@ -159,16 +231,60 @@ coroutine_mgr::~coroutine_mgr() {
         sk_warn("uv_ is active!");
     }
 
-    if (!runnable_.empty() || !io_waiting_.empty() || !cond_waiting_.empty() || !sleeping_.empty()) {
+    if (!runnable_.empty() || !deque_.empty() || !io_waiting_.empty() || cond_waiting_ > 0 || sleeping_ > 0) {
         sk_warn("there are still active coroutines!");
     }
+
+    if (!inbox_.empty()) {
+        sk_warn("%lu coroutines are sent to a stopped worker!", inbox_.size());
+    }
+
+    detach();
+    watchdog_->remove(this);
+
+    uv_close(reinterpret_cast<uv_handle_t*>(idle_handle_), [] (uv_handle_t *handle) {
+        delete reinterpret_cast<uv_idle_t*>(handle);
+    });
+
+    uv_close(reinterpret_cast<uv_handle_t*>(check_handle_), [] (uv_handle_t *handle) {
+        delete reinterpret_cast<uv_check_t*>(handle);
+    });
+
+    // the timer cannot be deleted before the handle gets closed
+    if (!timer_->stopped()) timer_->stop();
+    timer_->close([] (heap_timer *t) {
+        delete t;
+    });
+
+    for (auto c : free_list_) {
+        delete c;
+    }
+
+    free_list_.clear();
+
+    if (shared_stats_.coroutine_count <= 0) {
+        fini_shared_stacks();
+    }
 }
 
 coroutine *coroutine_mgr::create(const std::string& name, const coroutine_function& fn,
                                  size_t stack_size, bool preserve_fpu, bool protect_stack) {
-    coroutine *c = new coroutine(name, fn, stack_size, preserve_fpu, protect_stack);
-    if (!c->init()) {
-        delete c;
+    coroutine *c = alloc_coroutine();
+    c->reset(name, fn, preserve_fpu, protect_stack);
+    c->home = this;
+    if (!stack_pool_.alloc(stack_size, protect_stack, c->stack)) {
+        c->state = state_done;
+        release(c);
+        return nullptr;
+    }
+
+    // before the context is made on the stack
+    if (profiling_) profile_created(c);
+
+    c->ctx = make_context(c->stack.top(), c->stack.size, context_main);
+    if (!c->ctx) {
+        c->state = state_done;
+        release(c);
         return nullptr;
     }
 
@@ -176,6 +292,77 @@ coroutine *coroutine_mgr::create(const std::string& name, const coroutine_functi
     return c;
 }
 
+coroutine *coroutine_mgr::create_shared(const std::string& name,
+                                        const coroutine_function& fn, bool preserve_fpu) {
+    if (shared_stacks_.empty()) {
+        int ret = init_shared_stacks();
+        if (ret != 0) return nullptr;
+    }
+
+    coroutine *c = alloc_coroutine();
+    c->reset(name, fn, preserve_fpu, false);
+    c->home = this;
+
+    // the context is made when it runs for the first time, as the
+    // run stack might be used by another coroutine now
+    c->shared = &shared_stacks_[next_shared_stack_++ % shared_stacks_.size()];
+    ++shared_stats_.coroutine_count;
+
+    if (profiling_) profile_created(c);
+
+    runnable_.push(c);
+    return c;
+}
+
+bool coroutine_mgr::on_shared_stack() const {
+    return current_ && current_->shared;
+}
+
+bool coroutine_mgr::can_wait() const {
+    // the same as wait_io(...) & wait_cond(...)
+    return current_ && current_ != uv_ && !(current_->flag & FLAG_MIGRATABLE);
+}
+
+int coroutine_mgr::set_shared_stacks(size_t count, size_t size) {
+    if (count <= 0 || size <= 0) {
+        sk_error("invalid shared stacks, count<%lu>, size<%lu>.", count, size);
+        return -EINVAL;
+    }
+
+    if (shared_stats_.coroutine_count > 0) {
+        sk_error("shared stacks are in use, count<%lu>.", shared_stats_.coroutine_count);
+        return -EBUSY;
+    }
+
+    fini_shared_stacks();
+    shared_stats_.stack_count = count;
+    shared_stats_.stack_size = size;
+    return 0;
+}
+
+void coroutine_mgr::get_shared_stack_stats(coroutine_shared_stack_stats& stats) const {
+    stats = shared_stats_;
+}
+
+void coroutine_mgr::set_pool_watermarks(size_t low, size_t high) {
+    stack_pool_.set_watermarks(low, high);
+
+    while (free_list_.size() > stack_pool_.high_watermark()) {
+        delete free_list_.back();
+        free_list_.pop_back();
+    }
+}
+
+void coroutine_mgr::get_pool_stats(coroutine_pool_stats& stats) const {
+    stats.hit_count    = stack_pool_.hit_count();
+    stats.miss_count   = stack_pool_.miss_count();
+    stats.used_count   = stack_pool_.used_count();
+    stats.peak_count   = stack_pool_.peak_count();
+    stats.pooled_count = stack_pool_.pooled_count();
+    stats.pooled_bytes = stack_pool_.pooled_bytes();
+    stats.free_objects = free_list_.size();
+}
+
 uv_loop_t *coroutine_mgr::loop(){
     return loop_;
 }
@@ -188,31 +375,21 @@ const char *coroutine_mgr::name() {
     return current_ ? current_->name : nullptr;
 }
 
-void coroutine_mgr::sleep(u64 ms) {
+int coroutine_mgr::sleep(u64 ms) {
     sk_assert(current_ && current_->state == state_running);
 
-    heap_timer *t = new heap_timer(loop_, [this] (heap_timer *t) {
-        auto it = sleeping_.find(t);
-        assert_ensure(it != sleeping_.end()) {
-            coroutine *c = it->second;
-            sleeping_.erase(it);
-
-            c->state = state_runnable;
-            runnable_.push(c);
+    // the uv coroutine drives the timer, it can never sleep
+    assert_retval(current_ != uv_, -EPERM);
 
-            sk_assert(current_ == uv_);
-            yield(current_);
-        }
+    // a migratable one might be woken up on another worker, so "this"
+    // MUST NOT be used after the switch
+    coroutine *self = current_;
+    arm_timer(ms);
+    self->state = state_sleeping;
+    ++sleeping_;
+    switch_out(self);
 
-        t->close([] (heap_timer *t) {
-            delete t;
-        });
-    });
-
-    t->start_once(ms);
-    current_->state = state_sleeping;
-    sleeping_.insert(std::make_pair(t, current_));
-    yield(current_);
+    return timed_out(self) ? 0 : -EINTR;
 }
 
 void coroutine_mgr::yield() {
@@ -220,18 +397,18 @@ void coroutine_mgr::yield() {
 
     // if current coroutine is the uv coroutine, just skip it
     if (unlikely(current_ == uv_)) {
-        yield(current_);
+        switch_out(current_);
         return;
     }
 
+    // it's pushed to the runnable queue by schedule() after switching
+    // out, as another worker might take it from the deque at once
     switch (current_->state) {
         case state_running:
             sk_debug("coroutine(%s) yields under running state.", current_->name);
             current_->state = state_runnable;
-            runnable_.push(current_);
             break;
         case state_runnable:
-            runnable_.push(current_);
             break;
         case state_sleeping:
         case state_io_waiting:
@@ -241,19 +418,129 @@ void coroutine_mgr::yield() {
             break;
     }
 
-    yield(current_);
+    switch_out(current_);
+}
+
+bool coroutine_mgr::wait_io(u64 timeout_ms) {
+    sk_assert(current_ && current_->state == state_running);
+
+    // the uv coroutine drives all the io, it can never wait for one
+    assert_retval(current_ != uv_, false);
+
+    // the callback might run on the worker it migrates from
+    if (current_->flag & FLAG_MIGRATABLE) {
+        sk_error("coroutine(%s) is migratable, it MUST be pinned to wait.", current_->name);
+        return false;
+    }
+
+    if (timeout_ms > 0) arm_timer(timeout_ms);
+    current_->state = state_io_waiting;
+    io_waiting_.insert(current_);
+    switch_out(current_);
+
+    return !timed_out(current_);
+}
+
+bool coroutine_mgr::wait_cond(u64 timeout_ms) {
+    sk_assert(current_ && current_->state == state_running);
+
+    // the uv coroutine runs all the callbacks, it can never be blocked
+    assert_retval(current_ != uv_, false);
+
+    // the primitives are not thread safe
+    if (current_->flag & FLAG_MIGRATABLE) {
+        sk_error("coroutine(%s) is migratable, it MUST be pinned to wait.", current_->name);
+        return false;
+    }
+
+    if (timeout_ms > 0) arm_timer(timeout_ms);
+    current_->state = state_cond_waiting;
+    ++cond_waiting_;
+    switch_out(current_);
+
+    return !timed_out(current_);
+}
+
+bool coroutine_mgr::wake_up(coroutine *c) {
+    // it might have timed out, and been woken up by the timer already
+    if (!make_runnable(c)) {
+        sk_debug("coroutine(%s -> %d) is not waiting.", c->name, c->state);
+        return false;
+    }
+
+    // if it's woken up in an io callback, switch out of the uv coroutine
+    // so it runs at once, the data passed to the callback (a redis reply
+    // for example) stays valid until the coroutine suspends again, so the
+    // loop never gets a turn before it runs, see budget_exhausted()
+    if (current_ == uv_) {
+        if (c->home == this && !(c->flag & FLAG_WOKEN)) {
+            c->flag |= FLAG_WOKEN;
+            ++woken_;
+        }
+
+        switch_out(current_);
+    }
+
+    return true;
 }
 
 void coroutine_mgr::schedule() {
+    begin_round();
+
     while (true) {
-        if (runnable_.empty()) {
+        // the loop gets a turn once the budget runs out, even if there
+        // are coroutines still runnable
+        const bool exhausted = budget_exhausted();
+        coroutine *c = exhausted ? nullptr : pop_runnable();
+
+        bool idle = false;
+        if (!c && !exhausted && group_) {
+            // go idle before the last try, a coroutine pushed to a deque
+            // after this wakes this worker up, see wake_idle(...)
+            idle_.store(true, std::memory_order_seq_cst);
+            group_->enter_idle();
+            idle = true;
+
+            c = steal();
+            if (c) {
+                idle_.store(false, std::memory_order_relaxed);
+                group_->leave_idle();
+                idle = false;
+            }
+        }
+
+        if (!c) {
+            if (has_runnable()) {
+                // an active idle handle makes the loop poll without
+                // blocking, it's stopped by on_check()
+                uv_idle_start(idle_handle_, [] (uv_idle_t *) {});
+                turn_count_.store(turn_count_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            } else {
+                idle_count_.store(idle_count_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            }
+
+            begin_round();
+
             uv_->state = state_running;
             current_ = uv_;
-            resume(current_);
+            coroutine *back = resume(current_);
             current_ = nullptr;
+            clear_run();
+
+            if (idle) {
+                idle_.store(false, std::memory_order_relaxed);
+                group_->leave_idle();
+            }
+
+            // it has switched to a woken coroutine directly, which
+            // switches back here
+            if (back != uv_) {
+                switched_out(back);
+                continue;
+            }
 
             if (uv_->state == state_done) {
-                delete uv_;
+                release(uv_);
                 uv_ = nullptr;
                 break;
             }
@@ -261,21 +548,415 @@ void coroutine_mgr::schedule() {
             continue;
         }
 
-        coroutine *c = runnable_.front();
-        runnable_.pop();
+        if (c->shared && c->shared->owner != c) {
+            switch_shared_stack(c);
+        }
+
+        resume_count_.store(resume_count_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        ++round_count_;
+        mark_run(c);
+
+        const bool profiling = profiling_;
+        u64 start_ns = 0, start_cpu_ns = 0;
+        if (profiling) {
+            start_ns = time::monotonic_ns();
+            start_cpu_ns = time::thread_cpu_ns();
+            if (c->mark_ns > 0) profile_of(c)->runnable_ns += start_ns - c->mark_ns;
+        }
 
         c->state = state_running;
         current_ = c;
-        resume(c);
+        coroutine *back = resume(c);
         current_ = nullptr;
+        clear_run();
+
+        if (profiling && back == c) profile_switched(c, start_ns, start_cpu_ns);
+
+        switched_out(back);
+    }
+}
+
+void coroutine_mgr::switched_out(coroutine *c) {
+    if (c == uv_) {
+        // a coroutine switches to the uv coroutine only if it has been
+        // running, and it's resumed again when nothing else runs
+        return;
+    }
+
+    if (c->state == state_done) {
+        sk_trace("coroutine(%s) done.", c->name);
+        release(c);
+    } else if (c->state == state_runnable) {
+        push_runnable(c);
+    }
+}
+
+void coroutine_mgr::set_direct_switch(bool enable) {
+    direct_switch_ = enable;
+}
+
+void coroutine_mgr::set_budget(size_t max_count, u64 max_us) {
+    budget_count_ = max_count;
+    budget_ns_ = max_us * 1000;
+    sk_info("budget of worker<%lu>, count<%lu>, time<%lu us>.", index_, max_count, max_us);
+}
+
+int coroutine_mgr::set_priority(coroutine *c, coroutine_priority priority) {
+    if (priority < priority_high || priority > priority_low) {
+        sk_error("invalid priority<%d>.", priority);
+        return -EINVAL;
+    }
+
+    if (c->priority == priority) return 0;
+
+    // move it to the queue of its new priority, it's never in the queue
+    // of another worker, as a pinned one runs on its home worker only
+    const bool queued = c->state == state_runnable && c->home == this &&
+                        !(c->flag & FLAG_MIGRATABLE) && runnable_.remove(c);
+
+    c->priority = priority;
+    if (queued) runnable_.push(c);
+    return 0;
+}
+
+void coroutine_mgr::switch_out(coroutine *c) {
+    if (!direct_switch_ || profiling_) {
+        yield(c);
+        return;
+    }
+
+    // pushed to the deque or sent home by schedule() after switching
+    // out, a done one is released there, and a shared stack is saved
+    // & restored there, so they all go back to schedule()
+    if (c->state == state_done || c->shared || (c->flag & FLAG_MIGRATABLE) ||
+        (c != uv_ && c->home != this)) {
+        yield(c);
+        return;
+    }
+
+    // schedule() gives the loop a turn
+    if (budget_exhausted()) {
+        yield(c);
+        return;
+    }
+
+    // schedule() would push it and pop it again at once
+    coroutine *next = runnable_.front();
+    if (c->state == state_runnable && (!next || c->priority < next->priority)) {
+        ++round_count_;
+        mark_run(c);
+        c->state = state_running;
+        return;
+    }
+
+    if (!next) {
+        yield(c);
+        return;
+    }
+
+    // both sides MUST save & restore the fpu control words or neither
+    if (next->shared || ((next->flag ^ c->flag) & FLAG_PRESERVE_FPU)) {
+        yield(c);
+        return;
+    }
+
+    runnable_.pop();
+    if (c->state == state_runnable) {
+        runnable_.push(c);
+    }
+
+    resume_count_.store(resume_count_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    ++round_count_;
+    mark_run(next);
+
+    next->state = state_running;
+    current_ = next;
+    switch_context(&c->ctx, next->ctx, reinterpret_cast<intptr_t>(next), (c->flag & FLAG_PRESERVE_FPU) != 0);
+}
+
+void coroutine_mgr::attach(worker_group *group, size_t index) {
+    group_ = group;
+    index_ = index;
+    steal_seed_ = static_cast<u32>(index * 2654435761u) | 1;
+
+    async_ = new uv_async_t;
+    uv_async_init(loop_, async_, [] (uv_async_t *handle) {
+        static_cast<coroutine_mgr*>(handle->data)->on_async();
+    });
+
+    async_->data = this;
+
+    // the loop of worker 0 exits as it used to, the others run
+    // until the group stops
+    if (index_ == 0) {
+        uv_unref(reinterpret_cast<uv_handle_t*>(async_));
+    }
+}
+
+void coroutine_mgr::detach() {
+    if (!async_) return;
+
+    uv_close(reinterpret_cast<uv_handle_t*>(async_), [] (uv_handle_t *handle) {
+        delete reinterpret_cast<uv_async_t*>(handle);
+    });
+
+    async_ = nullptr;
+    group_ = nullptr;
+    index_ = 0;
+}
 
-        if (c->state == state_done) {
-            sk_trace("coroutine(%s) done.", c->name);
-            delete c;
+int coroutine_mgr::get_worker_stats(size_t index, coroutine_worker_stats& stats) const {
+    const coroutine_mgr *m = group_ ? group_->worker(index) : (index == 0 ? this : nullptr);
+    if (!m) {
+        sk_error("invalid worker index<%lu>.", index);
+        return -EINVAL;
+    }
+
+    stats.resume_count     = m->resume_count_.load(std::memory_order_relaxed);
+    stats.steal_count      = m->steal_count_.load(std::memory_order_relaxed);
+    stats.steal_miss_count = m->steal_miss_count_.load(std::memory_order_relaxed);
+    stats.stolen_count     = m->stolen_count_.load(std::memory_order_relaxed);
+    stats.inbox_count      = m->inbox_count_.load(std::memory_order_relaxed);
+    stats.idle_count       = m->idle_count_.load(std::memory_order_relaxed);
+    stats.turn_count       = m->turn_count_.load(std::memory_order_relaxed);
+    stats.overrun_count    = m->overrun_count_.load(std::memory_order_relaxed);
+    stats.deque_size       = m->deque_.size();
+    return 0;
+}
+
+int coroutine_mgr::pin() {
+    coroutine *self = current_;
+    sk_assert(self && self->state == state_running);
+    assert_retval(self != uv_, -EPERM);
+
+    if (self->flag & FLAG_MIGRATABLE) {
+        self->flag &= ~FLAG_MIGRATABLE;
+        self->home->on_pinned();
+    }
+
+    if (self->home == this) return 0;
+
+    // schedule() sends it home after it switches out, and it returns
+    // on the home worker
+    self->state = state_runnable;
+    yield(self);
+    return 0;
+}
+
+int coroutine_mgr::unpin() {
+    coroutine *self = current_;
+    sk_assert(self && self->state == state_running);
+    assert_retval(self != uv_, -EPERM);
+
+    // the run stack belongs to this worker
+    if (self->shared) {
+        sk_error("coroutine(%s) is on a shared stack, it cannot migrate.", self->name);
+        return -EINVAL;
+    }
+
+    // a pinned one always runs on its home worker, which is this, and
+    // the loop is kept alive until it's pinned again or done, so it
+    // can always get back
+    if (!(self->flag & FLAG_MIGRATABLE)) {
+        sk_assert(self->home == this);
+        if (migratable_.fetch_add(1, std::memory_order_relaxed) == 0 && async_) {
+            uv_ref(reinterpret_cast<uv_handle_t*>(async_));
+        }
+    }
+
+    // switch out, so the idle workers can take it at once
+    self->flag |= FLAG_MIGRATABLE;
+    self->state = state_runnable;
+    yield(self);
+    return 0;
+}
+
+coroutine *coroutine_mgr::give_away() {
+    coroutine *c = deque_.steal();
+    if (c) {
+        stack_pool_.disown();
+        stolen_count_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    return c;
+}
+
+void coroutine_mgr::post(coroutine *c) {
+    {
+        std::lock_guard<std::mutex> lock(inbox_mutex_);
+        inbox_.push_back(c);
+    }
+
+    notify();
+}
+
+void coroutine_mgr::notify() {
+    assert_retnone(async_);
+    uv_async_send(async_);
+}
+
+void coroutine_mgr::on_pinned() {
+    sk_assert(migratable_.load(std::memory_order_relaxed) > 0);
+    if (migratable_.fetch_sub(1, std::memory_order_acq_rel) == 1 && async_) {
+        notify();
+    }
+}
+
+void coroutine_mgr::set_profiling(bool enable, u64 slow_run_us) {
+    profiling_ = enable;
+    slow_run_ns_ = slow_run_us * 1000;
+    sk_info("profiling of worker<%lu> %s, slow run<%lu us>.", index_, enable ? "on" : "off", slow_run_us);
+}
+
+void coroutine_mgr::get_profiles(coroutine_profile_key key, size_t n,
+                                 std::vector<coroutine_profile>& profiles) const {
+    profiles.clear();
+    profiles.reserve(profiles_.size());
+    for (const auto& it : profiles_) {
+        profiles.push_back(it.second);
+    }
+
+    auto value = [key] (const coroutine_profile& p) -> u64 {
+        switch (key) {
+            case profile_by_cpu:    return p.cpu_ns;
+            case profile_by_run:    return p.run_ns;
+            case profile_by_switch: return p.switch_count;
+            case profile_by_stack:  return p.stack_used;
+            default:                return 0;
         }
+    };
+
+    n = std::min(n, profiles.size());
+    std::partial_sort(profiles.begin(), profiles.begin() + n, profiles.end(),
+                      [&value] (const coroutine_profile& a, const coroutine_profile& b) {
+        return value(a) > value(b);
+    });
+
+    profiles.resize(n);
+}
+
+void coroutine_mgr::dump_profiles(coroutine_profile_key key, size_t n) const {
+    static const char *key_names[] = {"cpu", "run", "switch", "stack"};
+
+    std::vector<coroutine_profile> profiles;
+    get_profiles(key, n, profiles);
+
+    sk_info("top %lu coroutines of worker<%lu> by %s:", profiles.size(), index_,
+            key < array_len(key_names) ? key_names[key] : "unknown");
+
+    for (const auto& p : profiles) {
+        sk_info("%s: count<%lu>, switch<%lu>, run<%lu us>, cpu<%lu us>, max run<%lu us>, "
+                "runnable<%lu us>, waiting<%lu us>, stack<%lu/%lu>.",
+                p.name.c_str(), p.count, p.switch_count, p.run_ns / 1000, p.cpu_ns / 1000,
+                p.max_run_ns / 1000, p.runnable_ns / 1000, p.waiting_ns / 1000,
+                p.stack_used, p.stack_size);
+    }
+}
+
+coroutine_profile *coroutine_mgr::profile_of(coroutine *c) {
+    if (c->profiler == this) return c->profile;
+
+    // the nodes of an unordered_map stay where they are
+    coroutine_profile& p = profiles_[c->name];
+    if (p.name.empty()) {
+        p.name = c->name;
+        p.count = p.switch_count = 0;
+        p.run_ns = p.cpu_ns = p.max_run_ns = 0;
+        p.runnable_ns = p.waiting_ns = 0;
+        p.stack_size = p.stack_used = 0;
+    }
+
+    c->profile = &p;
+    c->profiler = this;
+    return c->profile;
+}
+
+void coroutine_mgr::profile_created(coroutine *c) {
+    coroutine_profile *p = profile_of(c);
+    ++p->count;
+    c->mark_ns = time::monotonic_ns();
+
+    if (c->shared) {
+        p->stack_size = c->shared->stack.size;
+        return;
+    }
+
+    p->stack_size = c->stack.size;
+
+    char *top = c->stack.top();
+    u64 *bottom = cast_ptr(u64, top - c->stack.size);
+    std::fill(bottom, cast_ptr(u64, top), STACK_PAINT);
+    c->stack_low = cast_ptr(u64, top);
+}
+
+void coroutine_mgr::profile_switched(coroutine *c, u64 start_ns, u64 start_cpu_ns) {
+    const u64 now = time::monotonic_ns();
+    const u64 run_ns = now - start_ns;
+
+    coroutine_profile *p = profile_of(c);
+    ++p->switch_count;
+    p->run_ns += run_ns;
+    p->cpu_ns += time::thread_cpu_ns() - start_cpu_ns;
+    if (run_ns > p->max_run_ns) p->max_run_ns = run_ns;
+
+    c->mark_ns = now;
+
+    // find the lowest word written, from the bottom, as the frames
+    // might have painted holes (arrays not written, for example), the
+    // mark never goes up, so only the words below it are checked
+    size_t used = 0;
+    if (c->stack_low) {
+        u64 *low = cast_ptr(u64, c->stack.top() - c->stack.size);
+        while (low < c->stack_low && *low == STACK_PAINT) ++low;
+
+        c->stack_low = low;
+        used = c->stack.top() - char_ptr(low);
+    } else if (c->shared && c->state != state_done) {
+        used = c->shared->stack.top() - char_ptr(c->ctx);
+    }
+
+    if (used > p->stack_used) p->stack_used = used;
+
+    if (slow_run_ns_ > 0 && run_ns >= slow_run_ns_) {
+        sk_warn("coroutine(%s) ran %lu us without switching out.", c->name, run_ns / 1000);
     }
 }
 
+bool coroutine_mgr::wake_if_idle() {
+    if (!idle_.load(std::memory_order_relaxed)) return false;
+    if (!idle_.exchange(false, std::memory_order_acq_rel)) return false;
+
+    notify();
+    return true;
+}
+
+bool coroutine_mgr::check_overrun(u64 now, u64 threshold_ns) {
+    const u64 seq = run_seq_.load(std::memory_order_acquire);
+    if ((seq & 1) || seq == reported_seq_) return false;
+
+    const u64 start = run_start_ns_.load(std::memory_order_relaxed);
+    u64 words[array_len(run_name_)];
+    for (size_t i = 0; i < array_len(run_name_); ++i) {
+        words[i] = run_name_[i].load(std::memory_order_relaxed);
+    }
+
+    // another coroutine is switched in while reading
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (run_seq_.load(std::memory_order_relaxed) != seq) return false;
+
+    if (start <= 0 || now < start || now - start < threshold_ns) return false;
+
+    char name[sizeof(words)];
+    memcpy(name, words, sizeof(words));
+    name[sizeof(name) - 1] = '\0';
+
+    reported_seq_ = seq;
+    overrun_count_.fetch_add(1, std::memory_order_relaxed);
+    sk_warn("coroutine(%s) of worker<%lu> has been running for %lu ms without switching out.",
+            name, index_, (now - start) / 1000000);
+    return true;
+}
+
 void coroutine_mgr::context_main(intptr_t arg) {
     coroutine *c = reinterpret_cast<coroutine*>(arg);
     c->fn();
@@ -284,12 +965,348 @@ void coroutine_mgr::context_main(intptr_t arg) {
     yield(c);
 }
 
+void coroutine_mgr::release(coroutine *c) {
+    sk_assert(c->state == state_done);
+
+    // captures of the function might hold resources, release them now
+    // rather than when the object gets reused
+    c->fn = nullptr;
+
+    if (c->flag & FLAG_MIGRATABLE) {
+        c->flag &= ~FLAG_MIGRATABLE;
+        c->home->on_pinned();
+    }
+
+    // ctx actually points to an object on stack, so just reset it here
+    c->ctx = nullptr;
+    stack_pool_.free(c->stack);
+
+    if (c->shared) {
+        if (c->shared->owner == c) {
+            c->shared->owner = nullptr;
+        }
+
+        sk_assert(shared_stats_.coroutine_count > 0);
+        --shared_stats_.coroutine_count;
+        shared_stats_.buffer_bytes -= c->saved_capacity;
+
+        free(c->saved);
+        c->saved = nullptr;
+        c->saved_size = 0;
+        c->saved_capacity = 0;
+        c->shared = nullptr;
+    }
+
+    if (free_list_.size() < stack_pool_.high_watermark()) {
+        free_list_.push_back(c);
+        return;
+    }
+
+    delete c;
+}
+
+coroutine *coroutine_mgr::alloc_coroutine() {
+    if (free_list_.empty()) {
+        return new coroutine();
+    }
+
+    coroutine *c = free_list_.back();
+    free_list_.pop_back();
+    return c;
+}
+
+int coroutine_mgr::init_shared_stacks() {
+    sk_assert(shared_stacks_.empty());
+    shared_stacks_.resize(shared_stats_.stack_count);
+
+    for (auto& s : shared_stacks_) {
+        s.owner = nullptr;
+        if (!stack_pool_.alloc(shared_stats_.stack_size, true, s.stack)) {
+            sk_error("cannot allocate shared stack, size<%lu>.", shared_stats_.stack_size);
+            fini_shared_stacks();
+            return -ENOMEM;
+        }
+    }
+
+    sk_info("shared stacks allocated, count<%lu>, size<%lu>.",
+            shared_stats_.stack_count, shared_stats_.stack_size);
+    return 0;
+}
+
+void coroutine_mgr::fini_shared_stacks() {
+    for (auto& s : shared_stacks_) {
+        sk_assert(!s.owner);
+        stack_pool_.free(s.stack);
+    }
+
+    shared_stacks_.clear();
+    next_shared_stack_ = 0;
+}
+
+void coroutine_mgr::switch_shared_stack(coroutine *c) {
+    shared_stack *s = c->shared;
+    char *top = s->stack.top();
+
+    // save the used part of the current owner, which is suspended, the
+    // part below its stack pointer is not used
+    coroutine *o = s->owner;
+    if (o) {
+        char *sp = char_ptr(o->ctx);
+        const size_t used = top - sp;
+        sk_assert(sp >= top - s->stack.size && sp < top);
+
+        if (used > o->saved_capacity) {
+            const size_t capacity = sk::align_up(used, SAVED_STACK_ALIGNMENT);
+            char *saved = char_ptr(realloc(o->saved, capacity));
+            sk_assert(saved);
+
+            shared_stats_.buffer_bytes += capacity - o->saved_capacity;
+            o->saved = saved;
+            o->saved_capacity = capacity;
+        }
+
+        memcpy(o->saved, sp, used);
+        o->saved_size = used;
+
+        ++shared_stats_.save_count;
+        shared_stats_.saved_bytes += used;
+        if (used > shared_stats_.max_saved_size) {
+            shared_stats_.max_saved_size = used;
+        }
+    }
+
+    s->owner = c;
+
+    // runs for the first time
+    if (!c->ctx) {
+        c->ctx = make_context(top, s->stack.size, context_main);
+        sk_assert(c->ctx);
+        return;
+    }
+
+    sk_assert(c->saved && char_ptr(c->ctx) == top - c->saved_size);
+    memcpy(top - c->saved_size, c->saved, c->saved_size);
+    ++shared_stats_.restore_count;
+}
+
+bool coroutine_mgr::make_runnable(coroutine *c) {
+    switch (c->state) {
+        case state_sleeping:
+            sk_assert(sleeping_ > 0);
+            --sleeping_;
+            break;
+        case state_io_waiting:
+            io_waiting_.erase(c);
+            break;
+        case state_cond_waiting:
+            sk_assert(cond_waiting_ > 0);
+            --cond_waiting_;
+            break;
+        default:
+            return false;
+    }
+
+    // the uv timer is left as it is, firing early for nothing costs
+    // less than restarting it on every wake up
+    wheel_.remove(&c->timer);
+
+    if (profiling_ && c->mark_ns > 0) {
+        const u64 now = time::monotonic_ns();
+        profile_of(c)->waiting_ns += now - c->mark_ns;
+        c->mark_ns = now;
+    }
+
+    c->state = state_runnable;
+    push_runnable(c);
+    return true;
+}
+
+void coroutine_mgr::push_runnable(coroutine *c) {
+    if (c->flag & FLAG_MIGRATABLE) {
+        deque_.push(c);
+        if (group_) group_->wake_idle(this);
+        return;
+    }
+
+    if (c->home == this) {
+        runnable_.push(c);
+        return;
+    }
+
+    // pinned, but it runs on another worker, send it home
+    stack_pool_.disown();
+    c->home->post(c);
+}
+
+coroutine *coroutine_mgr::pop_runnable() {
+    if (!runnable_.empty()) {
+        return runnable_.pop();
+    }
+
+    // the owner takes from the top as well, so a coroutine yielding
+    // in a loop does not starve the others in the deque
+    return deque_.steal();
+}
+
+coroutine *coroutine_mgr::steal() {
+    coroutine *c = group_->steal(this, steal_seed_);
+    if (!c) {
+        steal_miss_count_.store(steal_miss_count_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        return nullptr;
+    }
+
+    stack_pool_.adopt();
+    steal_count_.store(steal_count_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    return c;
+}
+
+void coroutine_mgr::on_async() {
+    std::vector<coroutine*> inbox;
+    {
+        std::lock_guard<std::mutex> lock(inbox_mutex_);
+        inbox.swap(inbox_);
+    }
+
+    for (auto c : inbox) {
+        sk_assert(c->home == this && c->state == state_runnable);
+        stack_pool_.adopt();
+        runnable_.push(c);
+    }
+
+    inbox_count_.store(inbox_count_.load(std::memory_order_relaxed) + inbox.size(), std::memory_order_relaxed);
+
+    // let the loop exit once it has nothing else to do, but not before
+    // its migratable coroutines get back, see unpin()
+    const bool may_exit = index_ == 0 || (group_ && group_->stopping());
+    if (may_exit && migratable_.load(std::memory_order_acquire) <= 0) {
+        uv_unref(reinterpret_cast<uv_handle_t*>(async_));
+    }
+
+    // switch out of the uv coroutine, to run what's received or stolen
+    if (current_ == uv_) {
+        switch_out(current_);
+    }
+}
+
+void coroutine_mgr::on_check() {
+    if (uv_is_active(reinterpret_cast<uv_handle_t*>(idle_handle_))) {
+        uv_idle_stop(idle_handle_);
+    }
+
+    // the turn given by the budget is over, back to the runnable ones
+    if (current_ == uv_ && has_runnable()) {
+        switch_out(current_);
+    }
+}
+
+void coroutine_mgr::begin_round() {
+    round_count_ = 0;
+    round_start_ns_ = 0;
+}
+
+bool coroutine_mgr::budget_exhausted() {
+    // the data of the callbacks waking them up is gone after the loop resumes
+    if (woken_ > 0) return false;
+
+    if (budget_count_ > 0 && round_count_ >= budget_count_) return true;
+    if (budget_ns_ <= 0) return false;
+
+    const u64 now = time::monotonic_ns();
+    if (round_start_ns_ <= 0) {
+        round_start_ns_ = now;
+        return false;
+    }
+
+    return now - round_start_ns_ >= budget_ns_;
+}
+
+void coroutine_mgr::mark_run(coroutine *c) {
+    if (unlikely(c->flag & FLAG_WOKEN)) {
+        c->flag &= ~FLAG_WOKEN;
+        --woken_;
+    }
+
+    if (!watchdog_->running()) return;
+
+    u64 words[array_len(run_name_)];
+    static_assert(sizeof(words) == sizeof(c->name), "name MUST fit in run_name_");
+    memcpy(words, c->name, sizeof(words));
+
+    const u64 seq = run_seq_.load(std::memory_order_relaxed);
+    run_seq_.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    for (size_t i = 0; i < array_len(run_name_); ++i) {
+        run_name_[i].store(words[i], std::memory_order_relaxed);
+    }
+
+    run_start_ns_.store(time::monotonic_ns(), std::memory_order_relaxed);
+    run_seq_.store(seq + 2, std::memory_order_release);
+}
+
+void coroutine_mgr::clear_run() {
+    if (run_start_ns_.load(std::memory_order_relaxed) > 0) {
+        run_start_ns_.store(0, std::memory_order_relaxed);
+    }
+}
+
+void coroutine_mgr::arm_timer(u64 timeout_ms) {
+    const u64 now = uv_now(loop_);
+    wheel_.add(&current_->timer, now, timeout_ms);
+
+    const u64 due = current_->timer.expire;
+    if (timer_due_ != 0 && timer_due_ <= due) return;
+
+    if (!timer_->stopped()) timer_->stop();
+    timer_due_ = due;
+    timer_->start_once(due > now ? due - now : 0);
+}
+
+void coroutine_mgr::restart_timer() {
+    if (!timer_->stopped()) timer_->stop();
+
+    if (wheel_.empty()) {
+        timer_due_ = 0;
+        return;
+    }
+
+    const u64 timeout = wheel_.next_timeout();
+    timer_due_ = uv_now(loop_) + timeout;
+    timer_->start_once(timeout);
+}
+
+void coroutine_mgr::on_timeout() {
+    timer_wheel::node expired;
+    timer_wheel::init_list(&expired);
+    wheel_.advance(uv_now(loop_), &expired);
+
+    bool woken = false;
+    while (timer_wheel::node *n = timer_wheel::pop_front(&expired)) {
+        coroutine *c = static_cast<coroutine*>(n->data);
+        c->flag |= FLAG_TIMEOUT;
+        woken = make_runnable(c) || woken;
+    }
+
+    restart_timer();
+
+    // switch out of the uv coroutine, as wake_up(...) does
+    if (woken && current_ == uv_) {
+        switch_out(current_);
+    }
+}
+
+intptr_t coroutine_mgr::switch_context(void **from, void *to, intptr_t p, bool preserve_fpu) {
+    return preserve_fpu ? jump_context(from, to, p, true) : jump_context_fast(from, to, p);
+}
+
 void coroutine_mgr::yield(coroutine *c) {
-    jump_context(&c->ctx, main_ctx, reinterpret_cast<intptr_t>(c), (c->flag & FLAG_PRESERVE_FPU) != 0);
+    switch_context(&c->ctx, main_context(), reinterpret_cast<intptr_t>(c), (c->flag & FLAG_PRESERVE_FPU) != 0);
 }
 
-void coroutine_mgr::resume(coroutine *c) {
-    jump_context(&main_ctx, c->ctx, reinterpret_cast<intptr_t>(c), (c->flag & FLAG_PRESERVE_FPU) != 0);
+coroutine *coroutine_mgr::resume(coroutine *c) {
+    // what's passed by the coroutine switching back, see yield(...)
+    intptr_t p = switch_context(&main_context(), c->ctx, reinterpret_cast<intptr_t>(c), (c->flag & FLAG_PRESERVE_FPU) != 0);
+    return reinterpret_cast<coroutine*>(p);
 }
 
 NS_END(detail)
@@ -2,15 +2,61 @@
 #define COROUTINE_MGR_H
 
 #include <uv.h>
-#include <queue>
-#include <unordered_set>
+#include <mutex>
+#include <deque>
+#include <atomic>
+#include <vector>
 #include <unordered_map>
+#include <unordered_set>
 #include <time/heap_timer.h>
 #include <coroutine/coroutine.h>
+#include <coroutine/detail/stack_pool.h>
+#include <coroutine/detail/work_deque.h>
+#include <coroutine/detail/timer_wheel.h>
+#include <coroutine/detail/worker_group.h>
+#include <coroutine/detail/watchdog.h>
 
 NS_BEGIN(sk)
 NS_BEGIN(detail)
 
+struct shared_stack {
+    coroutine_stack stack;
+    coroutine *owner; // whose content is on the stack now
+};
+
+/*
+ * the runnable coroutines of a worker, a FIFO queue for each priority,
+ * the higher ones always run first
+ */
+class run_queue {
+public:
+    MAKE_NONCOPYABLE(run_queue);
+
+    run_queue() : size_(0) {}
+
+    bool empty() const { return size_ <= 0; }
+    size_t size() const { return size_; }
+
+    void push(coroutine *c);
+
+    // take it out of its queue, O(n), return false if it's not queued
+    bool remove(coroutine *c);
+
+    // the one to run next, NULL if it's empty
+    coroutine *front();
+    coroutine *pop();
+
+private:
+    std::deque<coroutine*> queues_[priority_low + 1];
+    size_t size_;
+};
+
+/*
+ * the scheduler of a thread, each worker of a worker_group has one, the
+ * coroutines are pinned to the worker creating them by default, and run
+ * in its runnable_ queue, the migratable ones are pushed to its deque_
+ * instead, and might be stolen by the other workers
+ */
 class coroutine_mgr {
 public:
     explicit coroutine_mgr(uv_loop_t *loop);
@@ -19,29 +65,194 @@ public:
     coroutine *create(const std::string& name, const coroutine_function& fn,
                       size_t stack_size, bool preserve_fpu, bool protect_stack);
 
+    coroutine *create_shared(const std::string& name,
+                             const coroutine_function& fn, bool preserve_fpu);
+
+    void set_pool_watermarks(size_t low, size_t high);
+    void get_pool_stats(coroutine_pool_stats& stats) const;
+
+    bool on_shared_stack() const;
+    bool can_wait() const;
+    int set_shared_stacks(size_t count, size_t size);
+    void get_shared_stack_stats(coroutine_shared_stack_stats& stats) const;
+
     uv_loop_t *loop();
 
     coroutine *self();
     const char *name();
 
-    void sleep(u64 ms);
+    int sleep(u64 ms);
     void yield();
+    bool wait_io(u64 timeout_ms);
+    bool wait_cond(u64 timeout_ms);
+    bool wake_up(coroutine *c);
     void schedule();
 
+    // join a worker group, or leave it
+    void attach(worker_group *group, size_t index);
+    void detach();
+
+    size_t worker_index() const { return index_; }
+    size_t worker_count() const { return group_ ? group_->size() : 1; }
+    int get_worker_stats(size_t index, coroutine_worker_stats& stats) const;
+
+    int pin();
+    int unpin();
+
+    void set_direct_switch(bool enable);
+    void set_budget(size_t max_count, u64 max_us);
+    int set_priority(coroutine *c, coroutine_priority priority);
+    void set_profiling(bool enable, u64 slow_run_us);
+    void get_profiles(coroutine_profile_key key, size_t n, std::vector<coroutine_profile>& profiles) const;
+    void dump_profiles(coroutine_profile_key key, size_t n) const;
+
+    /*
+     * called by the other workers: give_away() takes a migratable
+     * coroutine from the deque, post(...) sends a pinned coroutine back
+     * to this worker, notify() wakes up its loop
+     */
+    coroutine *give_away();
+    void post(coroutine *c);
+    void notify();
+
+    // wake up the worker if it's idle, return false if it's not
+    bool wake_if_idle();
+
+    // called by the watchdog, report the running coroutine if it has
+    // run longer than threshold_ns, return true if it's reported
+    bool check_overrun(u64 now, u64 threshold_ns);
+
     static void context_main(intptr_t arg);
 
 private:
+    coroutine *alloc_coroutine();
+
+    // put a finished coroutine back to the pools
+    void release(coroutine *c);
+
+    int init_shared_stacks();
+    void fini_shared_stacks();
+
+    // save the owner of the run stack, and restore c onto it
+    void switch_shared_stack(coroutine *c);
+
+    // move a sleeping or waiting coroutine to the runnable queue
+    bool make_runnable(coroutine *c);
+
+    // the runnable queue, the deque, or the inbox of its home worker
+    void push_runnable(coroutine *c);
+    coroutine *pop_runnable();
+    coroutine *steal();
+
+    void on_async();
+    void on_check();
+
+    bool has_runnable() const { return !runnable_.empty() || !deque_.empty(); }
+
+    // the loop gets a turn once the budget of a round runs out
+    void begin_round();
+    bool budget_exhausted();
+
+    // stamp the coroutine switched in for the watchdog, or clear it,
+    // every run of a coroutine starts with mark_run(...)
+    void mark_run(coroutine *c);
+    void clear_run();
+
+    // one of its coroutines is pinned again, or done
+    void on_pinned();
+
+    // the entry of its name in profiles_
+    coroutine_profile *profile_of(coroutine *c);
+    void profile_created(coroutine *c);
+    void profile_switched(coroutine *c, u64 start_ns, u64 start_cpu_ns);
+
+    // arm the timer of the current coroutine
+    void arm_timer(u64 timeout_ms);
+    void restart_timer();
+    void on_timeout();
+
+    /*
+     * switch out of coroutine c, to the coroutine at the front of the
+     * runnable queue directly if it can, or back to schedule()
+     */
+    void switch_out(coroutine *c);
+
+    // what schedule() does after coroutine c switches back to it
+    void switched_out(coroutine *c);
+
+    static intptr_t switch_context(void **from, void *to, intptr_t p, bool preserve_fpu);
+
+    // switch between the coroutine and schedule()
     static void yield(coroutine *c);
-    static void resume(coroutine *c);
+    static coroutine *resume(coroutine *c);
 
 private:
     uv_loop_t *loop_;
     coroutine *uv_;
     coroutine *current_;
-    std::queue<coroutine*> runnable_;
+    run_queue runnable_;
     std::unordered_set<coroutine*> io_waiting_;
-    std::unordered_set<coroutine*> cond_waiting_;
-    std::unordered_map<heap_timer*, coroutine*> sleeping_;
+    size_t cond_waiting_; // the waiting coroutines are linked by the primitives
+    size_t sleeping_;     // the sleeping coroutines are linked in the wheel
+
+    // all the sleeps & timed waits are in the wheel, and one uv timer
+    // is started for the earliest expiration of the wheel
+    timer_wheel wheel_;
+    heap_timer *timer_;
+    u64 timer_due_;       // when the timer expires, 0 if it's stopped
+
+    stack_pool stack_pool_;
+    std::vector<coroutine*> free_list_; // finished coroutine objects, to be reused
+
+    std::vector<shared_stack> shared_stacks_; // allocated on the first use
+    size_t next_shared_stack_;                // the coroutines take them in turn
+    coroutine_shared_stack_stats shared_stats_;
+
+    worker_group *group_;
+    size_t index_;
+    uv_async_t *async_;                  // wakes up the loop from the other workers
+    work_deque<coroutine> deque_;        // the migratable runnable coroutines
+    std::atomic<bool> idle_;             // polling the loop with nothing to run
+    std::atomic<size_t> migratable_;     // its coroutines free to migrate, they keep the loop alive
+    u32 steal_seed_;
+
+    // the budget of a round, 0 means no limit, a round starts when the
+    // first coroutine runs after a turn of the loop
+    size_t budget_count_;
+    u64 budget_ns_;
+    size_t round_count_;       // coroutines resumed in this round
+    u64 round_start_ns_;       // 0 before the round starts
+    size_t woken_;             // coroutines woken up in io callbacks, not run yet
+    uv_idle_t *idle_handle_;   // started for a turn, so the loop polls without blocking
+    uv_check_t *check_handle_; // switches out of the uv coroutine after a turn
+
+    // the running coroutine, written by this worker, and read by the
+    // watchdog like a seqlock: run_seq_ is odd while it's written
+    watchdog *watchdog_;
+    std::atomic<u64> run_seq_;
+    std::atomic<u64> run_start_ns_; // 0 if no coroutine runs
+    std::atomic<u64> run_name_[4];  // name of the coroutine
+    u64 reported_seq_;              // the last run reported, watchdog only
+
+    std::mutex inbox_mutex_;
+    std::vector<coroutine*> inbox_;      // pinned coroutines sent back to it
+
+    // written by this worker only, except stolen_count_, and
+    // overrun_count_ which is written by the watchdog
+    std::atomic<u64> resume_count_;
+    std::atomic<u64> steal_count_;
+    std::atomic<u64> steal_miss_count_;
+    std::atomic<u64> stolen_count_;
+    std::atomic<u64> inbox_count_;
+    std::atomic<u64> idle_count_;
+    std::atomic<u64> turn_count_;
+    std::atomic<u64> overrun_count_;
+
+    bool profiling_;
+    u64 slow_run_ns_; // runs longer than this get logged, 0 means never
+    std::unordered_map<std::string, coroutine_profile> profiles_; // key: name
+
+    bool direct_switch_; // switch between coroutines without schedule() in between
 };
 
 NS_END(detail)
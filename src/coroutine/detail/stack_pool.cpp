@@ -0,0 +1,188 @@
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <log/log.h>
+#include <utility/math_helper.h>
+#include <utility/assert_helper.h>
+#include <utility/system_helper.h>
+#include <coroutine/detail/stack_pool.h>
+
+NS_BEGIN(sk)
+NS_BEGIN(detail)
+
+static size_t page_size() {
+    static size_t size = 0;
+    if (unlikely(size == 0)) {
+        size = sk::get_sys_page_size();
+    }
+
+    return size;
+}
+
+char *coroutine_stack::top() const {
+    return protect ? memory + page_size() + size : memory + size;
+}
+
+stack_pool::stack_pool()
+    : low_watermark_(DEFAULT_LOW_WATERMARK),
+      high_watermark_(DEFAULT_HIGH_WATERMARK),
+      hit_count_(0),
+      miss_count_(0),
+      used_count_(0),
+      peak_count_(0),
+      pooled_count_(0),
+      pooled_bytes_(0),
+      moved_out_(0) {}
+
+stack_pool::~stack_pool() {
+    if (used_count() > 0) {
+        sk_warn("there are still %lu stacks in use.", used_count());
+    }
+
+    for (auto& it : buckets_) {
+        trim(it.second, 0);
+    }
+
+    buckets_.clear();
+}
+
+void stack_pool::set_watermarks(size_t low, size_t high) {
+    if (low > high) {
+        sk_warn("low watermark %lu is larger than high watermark %lu.", low, high);
+        low = high;
+    }
+
+    low_watermark_ = low;
+    high_watermark_ = high;
+
+    for (auto& it : buckets_) {
+        if (it.second.size() > high_watermark_) {
+            trim(it.second, low_watermark_);
+        }
+    }
+}
+
+bool stack_pool::alloc(size_t size, bool protect, coroutine_stack& s) {
+    size = sk::align_up(size, page_size());
+
+    auto it = buckets_.find(size << 1 | (protect ? 1 : 0));
+    if (it != buckets_.end() && !it->second.empty()) {
+        s = it->second.back();
+        it->second.pop_back();
+
+        --pooled_count_;
+        pooled_bytes_ -= s.size;
+        ++hit_count_;
+    } else {
+        if (!create(size, protect, s)) {
+            return false;
+        }
+
+        ++miss_count_;
+    }
+
+    if (++used_count_ > peak_count_) {
+        peak_count_ = used_count_;
+    }
+
+    return true;
+}
+
+void stack_pool::adopt() {
+    if (++used_count_ > peak_count_) {
+        peak_count_ = used_count_;
+    }
+}
+
+void stack_pool::free(coroutine_stack& s) {
+    if (!s.memory) {
+        return;
+    }
+
+    sk_assert(used_count_ > 0);
+    --used_count_;
+
+    if (high_watermark_ <= 0) {
+        destroy(s);
+        return;
+    }
+
+    std::vector<coroutine_stack>& bucket = buckets_[s.size << 1 | (s.protect ? 1 : 0)];
+    bucket.push_back(s);
+    ++pooled_count_;
+    pooled_bytes_ += s.size;
+
+    s.memory = nullptr;
+    s.size = 0;
+
+    if (bucket.size() > high_watermark_) {
+        trim(bucket, low_watermark_);
+    }
+}
+
+void stack_pool::trim(std::vector<coroutine_stack>& bucket, size_t count) {
+    while (bucket.size() > count) {
+        coroutine_stack& s = bucket.back();
+        --pooled_count_;
+        pooled_bytes_ -= s.size;
+
+        destroy(s);
+        bucket.pop_back();
+    }
+}
+
+bool stack_pool::create(size_t size, bool protect, coroutine_stack& s) {
+    s.memory = nullptr;
+    s.size = size;
+    s.protect = protect;
+
+    if (!protect) {
+        s.memory = char_ptr(malloc(size));
+        return !!s.memory;
+    }
+
+    const size_t guard_size = page_size();
+    const size_t mmap_size = size + guard_size * 2;
+    const int prot = PROT_READ | PROT_WRITE | PROT_EXEC;
+    const int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+
+    char *memory = char_ptr(mmap(nullptr, mmap_size, prot, flags, -1, 0));
+    if (memory == MAP_FAILED) {
+        sk_error("mmap() error: %s.", strerror(errno));
+        return false;
+    }
+
+    if (mprotect(memory, guard_size, PROT_NONE) == -1) {
+        sk_error("mprotect() error: %s.", strerror(errno));
+        munmap(memory, mmap_size);
+        return false;
+    }
+
+    if (mprotect(memory + guard_size + size, guard_size, PROT_NONE) == -1) {
+        sk_error("mprotect() error: %s.", strerror(errno));
+        munmap(memory, mmap_size);
+        return false;
+    }
+
+    s.memory = memory;
+    return true;
+}
+
+void stack_pool::destroy(coroutine_stack& s) {
+    if (!s.memory) {
+        return;
+    }
+
+    if (s.protect) {
+        munmap(s.memory, s.size + page_size() * 2);
+    } else {
+        ::free(s.memory);
+    }
+
+    s.memory = nullptr;
+    s.size = 0;
+}
+
+NS_END(detail)
+NS_END(sk)
@@ -0,0 +1,96 @@
+#ifndef STACK_POOL_H
+#define STACK_POOL_H
+
+#include <map>
+#include <atomic>
+#include <vector>
+#include <utility/types.h>
+
+NS_BEGIN(sk)
+NS_BEGIN(detail)
+
+/*
+ * the stack of a coroutine, if it's protected, there is a guard page at
+ * both ends of it, and memory points to the lower guard page
+ */
+struct coroutine_stack {
+    char *memory;  // what's returned by malloc() or mmap(), NULL if none
+    size_t size;   // usable size of the stack, the guard pages excluded
+    bool protect;  // if there are guard pages
+
+    char *top() const;
+};
+
+/*
+ * stacks of finished coroutines are kept in buckets by their size and
+ * protection, and reused by the coroutines created later, so creating
+ * a short-lived coroutine costs no mmap()/mprotect()/munmap(), if there
+ * are more than the high watermark stacks in a bucket, the bucket gets
+ * trimmed to the low watermark, so memory does not stay at the peak
+ */
+class stack_pool {
+public:
+    static const size_t DEFAULT_LOW_WATERMARK  = 16;
+    static const size_t DEFAULT_HIGH_WATERMARK = 64;
+
+    MAKE_NONCOPYABLE(stack_pool);
+
+    stack_pool();
+    ~stack_pool();
+
+    // a high watermark of 0 disables pooling
+    void set_watermarks(size_t low, size_t high);
+    size_t high_watermark() const { return high_watermark_; }
+
+    /**
+     * @brief get a stack from the pool, or allocate one
+     * @param size: the size required, it's rounded up to pages
+     * @param protect: if guard pages are required
+     * @param s: stores the stack
+     * @return true if succeeds
+     */
+    bool alloc(size_t size, bool protect, coroutine_stack& s);
+    void free(coroutine_stack& s);
+
+    /*
+     * a stack moves between pools with its coroutine, which migrates to
+     * another thread, the new pool adopts it on its own thread, and the
+     * old pool disowns it, which can be called on any thread
+     */
+    void adopt();
+    void disown() { moved_out_.fetch_add(1, std::memory_order_relaxed); }
+
+    u64 hit_count() const { return hit_count_; }
+    u64 miss_count() const { return miss_count_; }
+    size_t used_count() const { return used_count_ - moved_out_.load(std::memory_order_relaxed); }
+    size_t peak_count() const { return peak_count_; }
+    size_t pooled_count() const { return pooled_count_; }
+    size_t pooled_bytes() const { return pooled_bytes_; }
+
+private:
+    static bool create(size_t size, bool protect, coroutine_stack& s);
+    static void destroy(coroutine_stack& s);
+
+    void trim(std::vector<coroutine_stack>& bucket, size_t count);
+
+private:
+    size_t low_watermark_;
+    size_t high_watermark_;
+
+    u64 hit_count_;        // stacks reused from the pool
+    u64 miss_count_;       // stacks allocated as the pool is empty
+    size_t used_count_;    // stacks used by coroutines
+    size_t peak_count_;    // max of used_count_
+    size_t pooled_count_;  // stacks in the pool
+    size_t pooled_bytes_;  // bytes of the stacks in the pool
+
+    std::atomic<size_t> moved_out_; // stacks moved to other pools
+
+    // key: size << 1 | protect
+    std::map<size_t, std::vector<coroutine_stack>> buckets_;
+};
+
+NS_END(detail)
+NS_END(sk)
+
+#endif // STACK_POOL_H
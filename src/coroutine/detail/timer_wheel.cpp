@@ -0,0 +1,142 @@
+#include <utility/assert_helper.h>
+#include <coroutine/detail/timer_wheel.h>
+
+NS_BEGIN(sk)
+NS_BEGIN(detail)
+
+timer_wheel::timer_wheel() : now_(0), size_(0) {
+    for (int l = 0; l < LEVEL_COUNT; ++l) {
+        for (int s = 0; s < SLOT_COUNT; ++s) {
+            init_list(&slots_[l][s]);
+        }
+    }
+}
+
+void timer_wheel::add(node *n, u64 now, u64 timeout) {
+    assert_retnone(!n->linked());
+
+    // nothing to cascade in an empty wheel, just jump to now
+    if (size_ <= 0 && now > now_) {
+        now_ = now;
+    }
+
+    if (timeout > MAX_TIMEOUT) {
+        timeout = MAX_TIMEOUT;
+    }
+
+    // the slot of now_ has been processed, it expires in the next one
+    n->expire = now + timeout;
+    if (n->expire <= now_) {
+        n->expire = now_ + 1;
+    }
+
+    link(n);
+    ++size_;
+}
+
+void timer_wheel::remove(node *n) {
+    if (!n->linked()) return;
+
+    sk_assert(size_ > 0);
+    unlink(n);
+    --size_;
+}
+
+void timer_wheel::advance(u64 now, node *expired) {
+    if (size_ <= 0) {
+        if (now > now_) now_ = now;
+        return;
+    }
+
+    while (now_ < now) {
+        ++now_;
+
+        // cascade the upper levels when the lower one wraps around
+        if ((now_ & SLOT_MASK) == 0) {
+            cascade(1);
+        }
+
+        node *head = &slots_[0][now_ & SLOT_MASK];
+        while (head->next != head) {
+            node *n = head->next;
+            unlink(n);
+            --size_;
+            append(expired, n);
+        }
+
+        if (size_ <= 0) {
+            now_ = now;
+            break;
+        }
+    }
+}
+
+u64 timer_wheel::next_timeout() const {
+    if (size_ <= 0) return u64(-1);
+
+    // the nodes in the upper levels might fall into the slots before the
+    // earliest one in level 0 at the next cascade, so never wait beyond it
+    const u64 cascade = SLOT_COUNT - (now_ & SLOT_MASK);
+    for (u64 i = 1; i < cascade; ++i) {
+        const node *head = &slots_[0][(now_ + i) & SLOT_MASK];
+        if (head->next != head) return i;
+    }
+
+    return cascade;
+}
+
+void timer_wheel::link(node *n) {
+    u64 delta = n->expire - now_;
+
+    int level = 0;
+    while (level < LEVEL_COUNT - 1 && delta >= (1ULL << (LEVEL_BITS * (level + 1)))) {
+        ++level;
+    }
+
+    u64 slot = (n->expire >> (LEVEL_BITS * level)) & SLOT_MASK;
+    append(&slots_[level][slot], n);
+}
+
+void timer_wheel::cascade(int level) {
+    if (level >= LEVEL_COUNT) return;
+
+    u64 slot = (now_ >> (LEVEL_BITS * level)) & SLOT_MASK;
+
+    // the upper level goes first, its nodes might fall into this slot
+    if (slot == 0) {
+        cascade(level + 1);
+    }
+
+    node head;
+    init_list(&head);
+
+    node *s = &slots_[level][slot];
+    while (s->next != s) {
+        node *n = s->next;
+        unlink(n);
+        append(&head, n);
+    }
+
+    while (head.next != &head) {
+        node *n = head.next;
+        unlink(n);
+        link(n);
+    }
+}
+
+void timer_wheel::unlink(node *n) {
+    n->prev->next = n->next;
+    n->next->prev = n->prev;
+    n->prev = nullptr;
+    n->next = nullptr;
+}
+
+void timer_wheel::append(node *head, node *n) {
+    n->prev = head->prev;
+    n->next = head;
+    head->prev->next = n;
+    head->prev = n;
+}
+
+NS_END(detail)
+NS_END(sk)
@@ -0,0 +1,98 @@
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include <utility/types.h>
+
+NS_BEGIN(sk)
+NS_BEGIN(detail)
+
+/*
+ * a hierarchical timing wheel of millisecond resolution, 4 levels of 256
+ * slots cover 2^32 ms (~49 days), longer timeouts are clamped, the nodes
+ * are intrusive (embedded in the owners) and linked in the slots, so
+ * adding and removing a node is O(1) and allocates nothing, a slot of an
+ * upper level gets cascaded to the lower ones when the wheel reaches it
+ */
+class timer_wheel {
+public:
+    struct node {
+        node *prev;
+        node *next;
+        u64 expire; // when it expires, in milliseconds
+        void *data; // the owner
+
+        node() : prev(nullptr), next(nullptr), expire(0), data(nullptr) {}
+        bool linked() const { return !!prev; }
+    };
+
+    MAKE_NONCOPYABLE(timer_wheel);
+
+    timer_wheel();
+
+    bool empty() const { return size_ <= 0; }
+    size_t size() const { return size_; }
+
+    /**
+     * @brief add a node to the wheel, the node MUST NOT be linked
+     * @param n: the node to add
+     * @param now: the current time, in milliseconds
+     * @param timeout: expires after this, in milliseconds
+     */
+    void add(node *n, u64 now, u64 timeout);
+
+    // remove a node from the wheel if it's linked
+    void remove(node *n);
+
+    /**
+     * @brief move the wheel forward to now
+     * @param now: the current time, in milliseconds
+     * @param expired: a list head, the expired nodes are moved to it
+     */
+    void advance(u64 now, node *expired);
+
+    /*
+     * milliseconds from the current time of the wheel to the earliest
+     * expiration, or to the next cascade if it comes first, as the nodes
+     * in the upper levels are only sorted out then, it's at least 1, and
+     * u64(-1) if the wheel is empty
+     */
+    u64 next_timeout() const;
+
+    // initialize an empty list head
+    static void init_list(node *head) {
+        head->prev = head;
+        head->next = head;
+    }
+
+    // take the first node out of a list, NULL if it's empty
+    static node *pop_front(node *head) {
+        if (head->next == head) return nullptr;
+
+        node *n = head->next;
+        unlink(n);
+        return n;
+    }
+
+private:
+    static const int LEVEL_BITS  = 8;
+    static const int LEVEL_COUNT = 4;
+    static const int SLOT_COUNT  = 1 << LEVEL_BITS;
+    static const u64 SLOT_MASK   = SLOT_COUNT - 1;
+    static const u64 MAX_TIMEOUT = (1ULL << (LEVEL_BITS * LEVEL_COUNT)) - 1;
+
+    void link(node *n);
+    void cascade(int level);
+
+    static void unlink(node *n);
+    static void append(node *head, node *n);
+
+private:
+    u64 now_;     // the wheel has processed all the nodes expire <= now_
+    size_t size_; // count of nodes in the wheel
+    node slots_[LEVEL_COUNT][SLOT_COUNT];
+};
+
+NS_END(detail)
+NS_END(sk)
+
+#endif // TIMER_WHEEL_H
@@ -0,0 +1,82 @@
+#include <errno.h>
+#include <chrono>
+#include <algorithm>
+#include <log/log.h>
+#include <utility/time_helper.h>
+#include <coroutine/detail/watchdog.h>
+#include <coroutine/detail/coroutine_mgr.h>
+
+NS_BEGIN(sk)
+NS_BEGIN(detail)
+
+watchdog::~watchdog() {
+    stop();
+}
+
+int watchdog::start(u64 threshold_ms) {
+    if (threshold_ms <= 0) {
+        sk_error("invalid watchdog threshold<%lu ms>.", threshold_ms);
+        return -EINVAL;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        threshold_ns_ = threshold_ms * 1000000;
+    }
+
+    if (thread_.joinable()) {
+        cond_.notify_one();
+        sk_info("watchdog threshold<%lu ms>.", threshold_ms);
+        return 0;
+    }
+
+    stopping_ = false;
+    running_.store(true, std::memory_order_relaxed);
+    thread_ = std::thread(&watchdog::run, this);
+
+    sk_info("watchdog started, threshold<%lu ms>.", threshold_ms);
+    return 0;
+}
+
+void watchdog::stop() {
+    if (!thread_.joinable()) return;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+
+    cond_.notify_one();
+    thread_.join();
+    running_.store(false, std::memory_order_relaxed);
+
+    sk_info("watchdog stopped.");
+}
+
+void watchdog::add(coroutine_mgr *m) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    workers_.push_back(m);
+}
+
+void watchdog::remove(coroutine_mgr *m) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    workers_.erase(std::remove(workers_.begin(), workers_.end(), m), workers_.end());
+}
+
+void watchdog::run() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (!stopping_) {
+        // a run is reported at most half a threshold late
+        const u64 period_ns = std::max<u64>(threshold_ns_ / 2, 1000000);
+        cond_.wait_for(lock, std::chrono::nanoseconds(period_ns));
+        if (stopping_) break;
+
+        const u64 now = time::monotonic_ns();
+        for (auto w : workers_) {
+            w->check_overrun(now, threshold_ns_);
+        }
+    }
+}
+
+NS_END(detail)
+NS_END(sk)
@@ -0,0 +1,64 @@
+#ifndef WATCHDOG_H
+#define WATCHDOG_H
+
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <condition_variable>
+#include <utility/types.h>
+#include <utility/singleton.h>
+
+NS_BEGIN(sk)
+NS_BEGIN(detail)
+
+class coroutine_mgr;
+
+/*
+ * a thread checking the coroutine running on each worker periodically,
+ * a run longer than the threshold is reported while it's still running,
+ * so a coroutine blocking its worker (an endless loop, a blocking call)
+ * can be told, the workers register themselves on creation, and stamp
+ * the coroutine they switch in only while the watchdog is running
+ *
+ * NOTE: the workers are created & destroyed on worker 0 only, so the
+ * singleton is never created concurrently
+ */
+class watchdog {
+    DECLARE_SINGLETON(watchdog);
+
+public:
+    ~watchdog();
+
+    /**
+     * @brief start the thread, or change the threshold if it's running
+     * @param threshold_ms: runs longer than this get reported
+     * @return 0 if succeeds, error code otherwise
+     */
+    int start(u64 threshold_ms);
+    void stop();
+
+    bool running() const { return running_.load(std::memory_order_relaxed); }
+
+    void add(coroutine_mgr *m);
+    void remove(coroutine_mgr *m);
+
+private:
+    watchdog() : threshold_ns_(0), stopping_(false), running_(false) {}
+
+    void run();
+
+private:
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    std::thread thread_;
+    std::vector<coroutine_mgr*> workers_;
+    u64 threshold_ns_;
+    bool stopping_;
+    std::atomic<bool> running_;
+};
+
+NS_END(detail)
+NS_END(sk)
+
+#endif // WATCHDOG_H
@@ -0,0 +1,113 @@
+#ifndef WORK_DEQUE_H
+#define WORK_DEQUE_H
+
+#include <atomic>
+#include <vector>
+#include <sys/types.h>
+#include <utility/types.h>
+
+NS_BEGIN(sk)
+NS_BEGIN(detail)
+
+/*
+ * a Chase-Lev work-stealing deque of pointers, only the owner thread can
+ * push(...) at the bottom, and any thread (the owner included) can take
+ * from the top by steal(...), the ring grows when it's full, the old ones
+ * are kept until the deque is destroyed, as a thief might still read them
+ */
+template<typename T>
+class work_deque {
+public:
+    MAKE_NONCOPYABLE(work_deque);
+
+    explicit work_deque(size_t capacity = 64) : top_(0), bottom_(0) {
+        size_t n = 1;
+        while (n < capacity) n <<= 1;
+
+        ring *r = new ring(n);
+        ring_.store(r, std::memory_order_relaxed);
+        rings_.push_back(r);
+    }
+
+    ~work_deque() {
+        for (auto r : rings_) {
+            delete r;
+        }
+    }
+
+    // approximate when called by the other threads
+    size_t size() const {
+        const ssize_t b = bottom_.load(std::memory_order_relaxed);
+        const ssize_t t = top_.load(std::memory_order_relaxed);
+        return b > t ? static_cast<size_t>(b - t) : 0;
+    }
+
+    bool empty() const { return size() <= 0; }
+
+    // owner only
+    void push(T *x) {
+        const ssize_t b = bottom_.load(std::memory_order_relaxed);
+        const ssize_t t = top_.load(std::memory_order_acquire);
+
+        ring *r = ring_.load(std::memory_order_relaxed);
+        if (b - t >= static_cast<ssize_t>(r->capacity)) {
+            r = grow(r, t, b);
+        }
+
+        r->put(b, x);
+        std::atomic_thread_fence(std::memory_order_release);
+        bottom_.store(b + 1, std::memory_order_relaxed);
+    }
+
+    // NULL if it's empty, or another thread takes the top one first
+    T *steal() {
+        ssize_t t = top_.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        const ssize_t b = bottom_.load(std::memory_order_acquire);
+        if (t >= b) return nullptr;
+
+        ring *r = ring_.load(std::memory_order_acquire);
+        T *x = r->get(t);
+        if (!top_.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                          std::memory_order_relaxed)) {
+            return nullptr;
+        }
+
+        return x;
+    }
+
+private:
+    struct ring {
+        size_t capacity;
+        size_t mask;
+        std::atomic<T*> *slots;
+
+        explicit ring(size_t n) : capacity(n), mask(n - 1), slots(new std::atomic<T*>[n]) {}
+        ~ring() { delete [] slots; }
+
+        T *get(ssize_t i) const { return slots[i & mask].load(std::memory_order_relaxed); }
+        void put(ssize_t i, T *x) { slots[i & mask].store(x, std::memory_order_relaxed); }
+    };
+
+    ring *grow(ring *old, ssize_t t, ssize_t b) {
+        ring *r = new ring(old->capacity << 1);
+        for (ssize_t i = t; i < b; ++i) {
+            r->put(i, old->get(i));
+        }
+
+        rings_.push_back(r);
+        ring_.store(r, std::memory_order_release);
+        return r;
+    }
+
+private:
+    std::atomic<ssize_t> top_;
+    std::atomic<ssize_t> bottom_;
+    std::atomic<ring*> ring_;
+    std::vector<ring*> rings_; // all the rings, owner only
+};
+
+NS_END(detail)
+NS_END(sk)
+
+#endif // WORK_DEQUE_H
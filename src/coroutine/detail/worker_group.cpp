@@ -0,0 +1,138 @@
+#include <errno.h>
+#include <log/log.h>
+#include <utility/assert_helper.h>
+#include <coroutine/detail/coroutine_mgr.h>
+#include <coroutine/detail/worker_group.h>
+
+NS_BEGIN(sk)
+NS_BEGIN(detail)
+
+worker_group::worker_group(coroutine_mgr *main) : idle_count_(0), stopping_(false) {
+    workers_.push_back(main);
+    main->attach(this, 0);
+}
+
+worker_group::~worker_group() {
+    stop();
+    workers_[0]->detach();
+}
+
+int worker_group::start(size_t count, const worker_function& fn) {
+    if (count <= 0) {
+        sk_error("invalid worker count<%lu>.", count);
+        return -EINVAL;
+    }
+
+    if (!threads_.empty()) {
+        sk_error("workers are running, count<%lu>.", threads_.size());
+        return -EBUSY;
+    }
+
+    // all the workers are ready before any thread starts, as the
+    // threads steal from each other once they start
+    for (size_t i = 1; i <= count; ++i) {
+        uv_loop_t *loop = new uv_loop_t;
+        int ret = uv_loop_init(loop);
+        if (ret != 0) {
+            sk_error("uv_loop_init() error: %s.", uv_strerror(ret));
+            delete loop;
+            break;
+        }
+
+        coroutine_mgr *m = new coroutine_mgr(loop);
+        m->attach(this, i);
+
+        loops_.push_back(loop);
+        workers_.push_back(m);
+    }
+
+    if (loops_.size() != count) {
+        // no thread runs yet, so it just cleans up
+        stop_loops();
+        return -ENOMEM;
+    }
+
+    for (size_t i = 1; i < workers_.size(); ++i) {
+        threads_.emplace_back(fn, workers_[i]);
+    }
+
+    sk_info("%lu workers started.", count);
+    return 0;
+}
+
+void worker_group::stop() {
+    if (threads_.empty()) return;
+
+    stopping_.store(true, std::memory_order_release);
+    for (size_t i = 1; i < workers_.size(); ++i) {
+        workers_[i]->notify();
+    }
+
+    for (auto& t : threads_) {
+        t.join();
+    }
+
+    threads_.clear();
+    stop_loops();
+    stopping_.store(false, std::memory_order_release);
+
+    sk_info("workers stopped.");
+}
+
+void worker_group::stop_loops() {
+    for (size_t i = 1; i < workers_.size(); ++i) {
+        delete workers_[i];
+    }
+
+    workers_.resize(1);
+
+    for (auto loop : loops_) {
+        // run the close callbacks of the handles
+        uv_run(loop, UV_RUN_DEFAULT);
+
+        int ret = uv_loop_close(loop);
+        if (ret != 0) {
+            sk_warn("uv_loop_close() error: %s.", uv_strerror(ret));
+            continue;
+        }
+
+        delete loop;
+    }
+
+    loops_.clear();
+}
+
+coroutine *worker_group::steal(coroutine_mgr *thief, u32& seed) {
+    const size_t n = workers_.size();
+    if (n <= 1) return nullptr;
+
+    // xorshift, so the thieves do not all rush to the same victim
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+
+    const size_t start = seed % n;
+    for (size_t i = 0; i < n; ++i) {
+        coroutine_mgr *victim = workers_[(start + i) % n];
+        if (victim == thief) continue;
+
+        coroutine *c = victim->give_away();
+        if (c) return c;
+    }
+
+    return nullptr;
+}
+
+void worker_group::wake_idle(coroutine_mgr *self) {
+    // pairs with the fence in work_deque::steal(), either the idle worker
+    // sees the coroutine pushed, or this sees the idle worker
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (idle_count_.load(std::memory_order_seq_cst) <= 0) return;
+
+    for (auto w : workers_) {
+        if (w != self && w->wake_if_idle()) return;
+    }
+}
+
+NS_END(detail)
+NS_END(sk)
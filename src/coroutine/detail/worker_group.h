@@ -0,0 +1,75 @@
+#ifndef WORKER_GROUP_H
+#define WORKER_GROUP_H
+
+#include <uv.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <functional>
+#include <utility/types.h>
+
+NS_BEGIN(sk)
+
+struct coroutine;
+
+NS_BEGIN(detail)
+
+class coroutine_mgr;
+
+/*
+ * a group of workers, each of them is a thread with its own uv loop and
+ * coroutine_mgr, worker 0 is the thread calling coroutine_init(...), the
+ * others are started by start(...), a worker runs out of coroutines
+ * steals the migratable ones from the others, and it sleeps in its loop
+ * if there is nothing to steal, until another worker wakes it up
+ */
+class worker_group {
+public:
+    using worker_function = std::function<void(coroutine_mgr*)>;
+
+    MAKE_NONCOPYABLE(worker_group);
+
+    explicit worker_group(coroutine_mgr *main);
+    ~worker_group();
+
+    /**
+     * @brief start the worker threads
+     * @param count: count of the threads, worker 0 excluded
+     * @param fn: the thread body, it schedules the coroutine_mgr passed in
+     * @return 0 if succeeds, error code otherwise
+     */
+    int start(size_t count, const worker_function& fn);
+
+    // wait for the threads to finish their coroutines, and join them
+    void stop();
+
+    bool stopping() const { return stopping_.load(std::memory_order_acquire); }
+
+    size_t size() const { return workers_.size(); }
+    coroutine_mgr *worker(size_t index) const { return index < workers_.size() ? workers_[index] : nullptr; }
+
+    // try the other workers once, from a random one, NULL if nothing
+    coroutine *steal(coroutine_mgr *thief, u32& seed);
+
+    // wake up an idle worker after a coroutine is pushed to a deque
+    void wake_idle(coroutine_mgr *self);
+
+    void enter_idle() { idle_count_.fetch_add(1, std::memory_order_seq_cst); }
+    void leave_idle() { idle_count_.fetch_sub(1, std::memory_order_seq_cst); }
+
+private:
+    // delete the workers other than worker 0, and close their loops
+    void stop_loops();
+
+private:
+    std::vector<coroutine_mgr*> workers_;
+    std::vector<uv_loop_t*> loops_; // loops of the threads, indexed by worker - 1
+    std::vector<std::thread> threads_;
+    std::atomic<size_t> idle_count_;
+    std::atomic<bool> stopping_;
+};
+
+NS_END(detail)
+NS_END(sk)
+
+#endif // WORKER_GROUP_H
@@ -0,0 +1,237 @@
+#include <shm/shm.h>
+#include <log/log.h>
+#include <coroutine/shm_task.h>
+#include <coroutine/coroutine.h>
+
+NS_BEGIN(sk)
+
+// the steps of the tasks might wait for io, so they are not too small
+static const size_t TASK_STACK_SIZE = 64 * 1024;
+
+/*
+ * a step interrupted this many times is taken as the one crashing the
+ * process, rather than one interrupted by restarts, the task is dropped
+ */
+static const int MAX_STEP_ATTEMPTS = 3;
+
+class shm_task_mgr {
+public:
+    shm_task_mgr() : count_(0) {
+        shm_task_ptr ptr = shm_task::construct(0);
+        assert_retnone(ptr);
+
+        // the dummy head
+        head_ = ptr;
+        ptr->self_ = ptr;
+        ptr->prev_ = ptr;
+        ptr->next_ = ptr;
+    }
+
+    ~shm_task_mgr() {
+        if (!head_) return;
+
+        while (!empty()) {
+            shm_task_ptr ptr = head_->next_;
+            sk_warn("task dropped, type<%d>, state<%d>.", ptr->type(), ptr->state());
+
+            remove(ptr);
+            shm_task::destruct(ptr);
+        }
+
+        head_->prev_ = nullptr;
+        head_->next_ = nullptr;
+        shm_task::destruct(head_);
+        head_ = nullptr;
+    }
+
+    bool empty() const { return count_ <= 0; }
+    size_t count() const { return count_; }
+
+    void add(shm_task_ptr ptr) {
+        shm_task *task = ptr.get();
+        shm_task_ptr prev = head_->prev_;
+        assert_retnone(!task->prev_ && !task->next_);
+
+        task->prev_ = prev;
+        task->next_ = head_;
+        prev->next_ = ptr;
+        head_->prev_ = ptr;
+        ++count_;
+    }
+
+    void remove(shm_task_ptr ptr) {
+        shm_task *task = ptr.get();
+        shm_task_ptr prev = task->prev_;
+        shm_task_ptr next = task->next_;
+
+        prev->next_ = next;
+        next->prev_ = prev;
+        task->prev_ = nullptr;
+        task->next_ = nullptr;
+        --count_;
+    }
+
+    // put the tasks left by the previous process into coroutines again
+    int resume() {
+        int ret = 0;
+        shm_task_ptr ptr = head_->next_;
+        while (ptr != head_) {
+            shm_task *task = ptr.get();
+            shm_task_ptr next = task->next_;
+            sk_assert(task->self_ == ptr);
+
+            if (!shm_task_dispatcher::get()->has_callback(task->type())) {
+                sk_error("task callback<%d> not registered, dropped, state<%d>.", task->type(), task->state());
+                remove(ptr);
+                shm_task::destruct(ptr);
+                ptr = next;
+                continue;
+            }
+
+            int err = shm_task::spawn(ptr);
+            if (err != 0) ret = err;
+
+            sk_info("task resumed, type<%d>, state<%d>, attempts<%d>.", task->type(), task->state(), task->attempts_);
+            ptr = next;
+        }
+
+        return ret;
+    }
+
+private:
+    shm_task_ptr head_; // dummy head of the pending tasks
+    size_t count_;
+};
+static_assert(std::is_standard_layout<shm_task_mgr>::value, "invalid shm_task_mgr");
+static shm_task_mgr *mgr = nullptr;
+
+// bumped by shm_task_fini(), the coroutines spawned before that are stale
+static u64 epoch = 0;
+
+shm_task_ptr shm_task::start(int task_type, const void *data, size_t len) {
+    assert_retval(mgr, nullptr);
+
+    // the task list is only touched by worker 0, see shm_task.h
+    assert_retval(coroutine_worker_index() == 0, nullptr);
+
+    if (!shm_task_dispatcher::get()->has_callback(task_type)) {
+        sk_error("task callback<%d> not registered.", task_type);
+        return nullptr;
+    }
+
+    size_t data_len = (data && len > 0) ? len : 0;
+    shm_task_ptr ptr = construct(data_len);
+    assert_retval(ptr, nullptr);
+
+    shm_task *task = ptr.get();
+    task->task_type_ = task_type;
+    task->data_len_  = data_len;
+
+    task->self_ = ptr;
+    if (data_len > 0) memcpy(task->data_, data, data_len);
+
+    mgr->add(ptr);
+    if (spawn(ptr) != 0) {
+        mgr->remove(ptr);
+        destruct(ptr);
+        return nullptr;
+    }
+
+    return ptr;
+}
+
+shm_task_ptr shm_task::construct(size_t extra_len) {
+    size_t mem_len  = sizeof(shm_task) + extra_len;
+    shm_task_ptr ptr = shm_malloc(mem_len);
+    if (ptr) new (ptr.get()) shm_task();
+
+    return ptr;
+}
+
+void shm_task::destruct(shm_task_ptr ptr) {
+    ptr->~shm_task();
+    shm_free(ptr);
+}
+
+int shm_task::spawn(shm_task_ptr ptr) {
+    const u64 e = epoch;
+    coroutine *c = coroutine_create("shm_task", [ptr, e] () {
+        run(ptr, e);
+    }, TASK_STACK_SIZE);
+
+    if (!c) {
+        sk_error("cannot create coroutine for task, type<%d>.", ptr->type());
+        return -ENOMEM;
+    }
+
+    return 0;
+}
+
+void shm_task::run(shm_task_ptr ptr, u64 e) {
+    while (true) {
+        // the task has been freed along with the task system
+        if (e != epoch) {
+            sk_warn("task system destroyed, coroutine of the task exits.");
+            return;
+        }
+
+        shm_task *task = ptr.get();
+        if (task->cancelled_) {
+            sk_info("task cancelled, type<%d>, state<%d>.", task->type(), task->state());
+            finish(ptr);
+            return;
+        }
+
+        if (task->state_ < 0) {
+            sk_info("task finished, type<%d>.", task->type());
+            finish(ptr);
+            return;
+        }
+
+        // the step is "running" before calling the registered callback,
+        // the attempts count the times the process goes down in the step
+        if (task->attempts_ >= MAX_STEP_ATTEMPTS) {
+            sk_fatal("task step crashed %d times, type<%d>, state<%d>.",
+                     task->attempts_, task->type(), task->state());
+            finish(ptr);
+            return;
+        }
+
+        ++task->attempts_;
+        const int state = shm_task_dispatcher::get()->on_step(ptr, task->state_, task->data(), task->data_length());
+        if (e != epoch) continue;
+
+        task->state_ = state;
+        task->attempts_ = 0;
+    }
+}
+
+void shm_task::finish(shm_task_ptr ptr) {
+    mgr->remove(ptr);
+    destruct(ptr);
+}
+
+int shm_task_init() {
+    assert_retval(coroutine_worker_index() == 0, -EINVAL);
+
+    shm_ptr<shm_task_mgr> ptr = detail::shm_get_reserved_singleton<shm_task_mgr>(SHM_SINGLETON_SHM_TASK_MGR);
+    assert_retval(ptr, -ENOMEM);
+
+    mgr = ptr.get();
+    return mgr->resume();
+}
+
+void shm_task_fini() {
+    assert_retnone(coroutine_worker_index() == 0);
+
+    // the coroutines still holding the tasks must not touch them anymore
+    ++epoch;
+    detail::shm_delete_reserved_singleton<shm_task_mgr>(SHM_SINGLETON_SHM_TASK_MGR);
+    mgr = nullptr;
+}
+
+size_t shm_task_count() {
+    return mgr ? mgr->count() : 0;
+}
+
+NS_END(sk)
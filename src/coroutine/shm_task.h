@@ -0,0 +1,187 @@
+#ifndef SHM_TASK_H
+#define SHM_TASK_H
+
+#include <memory>
+#include <unordered_map>
+#include <shm/shm_ptr.h>
+#include <utility/singleton.h>
+#include <utility/assert_helper.h>
+
+NS_BEGIN(sk)
+
+class shm_task;
+using shm_task_ptr = shm_ptr<shm_task>;
+
+/*
+ * a task surviving the restarts of the process, it's a state machine
+ * whose frame (the state, and the data "t" as its locals) lives in shm,
+ * each step runs in a coroutine, so it can wait for io (co_redis_exec
+ * for example), and returns the state of the next step, which is saved
+ * in shm before the next step runs, after a restart in resume mode,
+ * shm_task_init() puts the pending tasks into coroutines again, and
+ * they go on from the steps they are in
+ *
+ * NOTE: the stack of the coroutine is NOT in shm, so a step interrupted
+ * by a restart runs again from its beginning, the steps MUST be safe
+ * to run again, and everything to be kept across the steps MUST be in
+ * "t" rather than on the stack, a step interrupted 3 times in a row is
+ * taken as the one crashing the process, and the task gets dropped
+ */
+class shm_task {
+public:
+    MAKE_NONCOPYABLE(shm_task);
+
+    // returned by a step to finish the task
+    static const int DONE = -1;
+
+    /*
+     * start a task of the type, it runs from state 0 when the coroutines
+     * are scheduled, the callback of the type MUST be registered first,
+     * the task list is not locked, so it MUST be called on worker 0,
+     * like shm_task_init(), and the coroutines of the tasks are pinned
+     * there, returns NULL on any other worker
+     */
+    template<typename T>
+    static shm_task_ptr start(int task_type, const T& t) {
+        // the task data is copied into shm byte by byte, and it's
+        // read back by a resumed process, so it MUST be a POD type
+        static_assert(std::is_pod<T>::value, "T must be a POD type.");
+        return start(task_type, &t, sizeof(t));
+    }
+
+    int type() const { return task_type_; }
+    int state() const { return state_; }
+    bool running() const { return attempts_ > 0; }
+    bool cancelled() const { return cancelled_; }
+
+    /*
+     * the task gets freed by its coroutine before the next step, do
+     * NOT use this task anymore after this function gets called
+     */
+    void cancel() { cancelled_ = true; }
+
+private:
+    shm_task()
+        : self_(nullptr), prev_(nullptr), next_(nullptr),
+          state_(0), attempts_(0), cancelled_(false), task_type_(-1), data_len_(0) {}
+
+    // the task is freed by its coroutine after it's done or cancelled
+    ~shm_task() { sk_assert(!prev_ && !next_); }
+
+private:
+    void *data() { return data_; }
+    size_t data_length() const { return data_len_; }
+
+    static shm_task_ptr start(int task_type, const void *data, size_t len);
+
+    static shm_task_ptr construct(size_t extra_len);
+    static void destruct(shm_task_ptr ptr);
+
+    // create the coroutine running the task
+    static int spawn(shm_task_ptr ptr);
+
+    /*
+     * run the steps of the task, inside its coroutine, it stops without
+     * touching the task once the task system of the epoch is destroyed
+     */
+    static void run(shm_task_ptr ptr, u64 epoch);
+
+    // unlink the task, and free it
+    static void finish(shm_task_ptr ptr);
+
+private:
+    shm_task_ptr self_; // this task
+    shm_task_ptr prev_; // prev task
+    shm_task_ptr next_; // next task
+    int state_;         // state of the step to run
+    int attempts_;      // times the step starts, 0 between the steps
+    bool cancelled_;    // cancelled, freed before the next step
+    int task_type_;     // callback id
+    size_t data_len_;   // task data length
+    char data_[0];      // task data
+
+    friend class shm_task_mgr;
+};
+
+class shm_task_callback_base {
+public:
+    virtual ~shm_task_callback_base() = default;
+    virtual int on_step(shm_task_ptr task, int state, void *data, size_t len) = 0;
+};
+
+template<typename T>
+class shm_task_callback : public shm_task_callback_base {
+public:
+    // returns the state of the next step, or shm_task::DONE
+    using fn_callback = int(*)(shm_task_ptr task, int state, T *t);
+
+    explicit shm_task_callback(fn_callback fn) : fn_(fn) { sk_assert(fn_); }
+    virtual ~shm_task_callback() = default;
+
+    virtual int on_step(shm_task_ptr task, int state, void *data, size_t len) {
+        assert_retval((data && len == sizeof(T)) || (!data && len == 0), shm_task::DONE);
+        T *t = data ? static_cast<T*>(data) : nullptr;
+        return fn_(task, state, t);
+    }
+
+private:
+    fn_callback fn_;
+};
+
+class shm_task_dispatcher {
+DECLARE_SINGLETON(shm_task_dispatcher);
+public:
+    template<typename T>
+    void register_callback(int task_type, typename shm_task_callback<T>::fn_callback fn) {
+        auto it = type2callbacks_.find(task_type);
+        assert_retnone(it == type2callbacks_.end());
+
+        auto cb = new shm_task_callback<T>(fn);
+        assert_retnone(cb);
+
+        type2callbacks_[task_type] = callback_ptr(cb);
+    }
+
+    bool has_callback(int task_type) const {
+        return type2callbacks_.find(task_type) != type2callbacks_.end();
+    }
+
+    int on_step(shm_task_ptr task, int state, void *data, size_t len) {
+        auto it = type2callbacks_.find(task->type());
+        assert_retval(it != type2callbacks_.end(), shm_task::DONE);
+
+        return it->second->on_step(task, state, data, len);
+    }
+
+private:
+    shm_task_dispatcher() = default;
+
+private:
+    using callback_ptr = std::unique_ptr<shm_task_callback_base>;
+    std::unordered_map<int, callback_ptr> type2callbacks_;
+};
+
+/*
+ * setup the task system in shm, in resume mode, the tasks left by the
+ * previous process are put into coroutines again, nothing runs before
+ * the coroutines get scheduled, so it does not block the startup, call
+ * it on worker 0, after shm_init(...), coroutine_init(...), and the
+ * callbacks of all the task types are registered
+ * returns 0 if succeeded, error code otherwise
+ */
+int shm_task_init();
+
+/*
+ * destroy the task system on worker 0, the pending tasks are dropped,
+ * do NOT call it before a restart, or there is nothing to resume, the
+ * coroutines of the tasks exit after their current steps, which MUST
+ * NOT touch their tasks ("t" included) after waking up from then on
+ */
+void shm_task_fini();
+
+// count of the pending tasks
+size_t shm_task_count();
+
+NS_END(sk)
+
+#endif // SHM_TASK_H
@@ -46,6 +46,7 @@
 #include <utility/error_info.h>
 #include <container/shm_hash.h>
 #include <container/shm_list.h>
+#include <coroutine/shm_task.h>
 #include <core/consul_client.h>
 #include <redis/redis_command.h>
 #include <redis/redis_cluster.h>
@@ -61,7 +62,10 @@
 #include <utility/assert_helper.h>
 #include <utility/string_helper.h>
 #include <container/fixed_stack.h>
+#include <coroutine/coroutine_io.h>
+#include <coroutine/coroutine_sync.h>
 #include <redis/redis_connection.h>
+#include <utility/compress_helper.h>
 #include <container/fixed_bitmap.h>
 #include <container/fixed_vector.h>
 #include <container/fixed_string.h>
@@ -104,11 +104,13 @@ private:
     }
 
     static std::string base_path(const std::string& path_pattern) {
+        // the sinks are used by multiple threads, localtime() is not reentrant
         std::time_t now = std::time(NULL);
-        std::tm *tm = std::localtime(&now);
+        std::tm tm;
+        localtime_r(&now, &tm);
 
         char buf[256] = {0};
-        strftime(buf, sizeof(buf), path_pattern.c_str(), tm);
+        strftime(buf, sizeof(buf), path_pattern.c_str(), &tm);
 
         return std::string(buf);
     }
@@ -7,15 +7,24 @@ const char *logger::DEFAULT_LOGGER = "default";
 logger logger::_;
 
 int logger::init(const std::string& conf_file) {
+    log_config conf;
+    std::shared_ptr<logger_map> name2logger(new logger_map());
+
+    int ret = load(conf_file, conf, *name2logger);
+    if (ret != 0) return ret;
+
     _.conf_file_ = conf_file;
-    _.conf_.categories.clear();
-    _.name2logger_.clear();
+    _.conf_ = conf;
+    std::atomic_store(&_.name2logger_, logger_map_ptr(name2logger));
+    return 0;
+}
 
-    int ret = _.conf_.load_from_xml_file(conf_file.c_str());
+int logger::load(const std::string& conf_file, log_config& conf, logger_map& name2logger) {
+    int ret = conf.load_from_xml_file(conf_file.c_str());
     if (ret != 0) return ret;
 
     bool found = false;
-    for (const auto& it : _.conf_.categories) {
+    for (const auto& it : conf.categories) {
         if (it.name == DEFAULT_LOGGER) {
             found = true;
             break;
@@ -34,18 +43,18 @@ int logger::init(const std::string& conf_file) {
         dev.max_rotation = 100;
 
         cat.fdev_list.push_back(dev);
-        _.conf_.categories.push_back(cat);
+        conf.categories.push_back(cat);
     }
 
     int count = 0;
 
     try {
-        for (const auto& it : _.conf_.categories) {
+        for (const auto& it : conf.categories) {
             auto ptr = make_logger(it);
             if (ptr) {
                 count += 1;
                 std::unique_ptr<formatter> f(new formatter(it.pattern));
-                _.name2logger_[it.name] = std::move(std::make_pair<std::unique_ptr<formatter>,
+                name2logger[it.name] = std::move(std::make_pair<std::unique_ptr<formatter>,
                                                                    std::shared_ptr<spdlog::logger>>(std::move(f),
                                                                                                     std::move(ptr)));
             }
@@ -60,8 +69,8 @@ int logger::init(const std::string& conf_file) {
         return -EINVAL;
     }
 
-    auto it = _.name2logger_.find(DEFAULT_LOGGER);
-    if (it == _.name2logger_.end()) {
+    auto it = name2logger.find(DEFAULT_LOGGER);
+    if (it == name2logger.end()) {
         fprintf(stderr, "a logger with name \"%s\" is required.\n", DEFAULT_LOGGER);
         return -EINVAL;
     }
@@ -70,40 +79,31 @@ int logger::init(const std::string& conf_file) {
 }
 
 int logger::reload() {
-    std::string conf_file = _.conf_file_;
-    log_config conf = _.conf_;
-    std::map<std::string,
-             std::pair<std::unique_ptr<formatter>,
-                       std::shared_ptr<spdlog::logger>>> name2logger;
-    for (auto& it : _.name2logger_)
-        name2logger[it.first] = std::move(it.second);
-
-    int ret = init(conf_file);
-    if (ret == 0)
-        return ret;
-
-    _.conf_file_ = conf_file;
-    _.conf_ = conf;
-    for (auto& it : name2logger)
-        _.name2logger_[it.first] = std::move(it.second);
-
-    return ret;
+    // the loggers in use are kept if the new config is invalid
+    return init(_.conf_file_);
 }
 
 bool logger::level_enabled(const std::string& name, spdlog::level::level_enum level) {
-    auto it = _.name2logger_.find(name);
-    return it != _.name2logger_.end() && it->second.second->should_log(level);
+    logger_map_ptr name2logger = loggers();
+    if (!name2logger) return false;
+
+    auto it = name2logger->find(name);
+    return it != name2logger->end() && it->second.second->should_log(level);
 }
 
 void logger::log(const std::string& name, spdlog::level::level_enum level,
                  const char *file, int line, const char *function, const char *fmt, ...) {
-    static char buffer[40960]; // 40KB
-    static fmt::MemoryWriter writer;
+    // the buffers are per thread, as logs might be written by multiple threads
+    static thread_local char buffer[40960]; // 40KB
+    static thread_local fmt::MemoryWriter writer;
+
+    logger_map_ptr name2logger = loggers();
+    if (!name2logger) return;
 
-    auto it = _.name2logger_.find(name);
-    if (it == _.name2logger_.end()) {
-        it = _.name2logger_.find(DEFAULT_LOGGER);
-        if (it != _.name2logger_.end())
+    auto it = name2logger->find(name);
+    if (it == name2logger->end()) {
+        it = name2logger->find(DEFAULT_LOGGER);
+        if (it != name2logger->end())
             log(DEFAULT_LOGGER, spdlog::level::warn, file, line, function, "logger %s not found.", name.c_str());
 
         return;
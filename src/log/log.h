@@ -2,6 +2,8 @@
 #define LOG_H
 
 #include <stdarg.h>
+#include <map>
+#include <memory>
 #include "log_config.h"
 #include "spdlog/spdlog.h"
 #include "formatter.h"
@@ -26,14 +28,14 @@ private:
     static logger _;
 
     static spdlog::sink_ptr make_sink(const log_config::file_device& dev) {
-        auto ptr = std::make_shared<file_sink_st>(dev.path, dev.max_size, dev.max_rotation, true);
+        auto ptr = std::make_shared<file_sink_mt>(dev.path, dev.max_size, dev.max_rotation, true);
         return ptr;
     }
 
     static spdlog::sink_ptr make_sink(const log_config::net_device& dev) {
         // TODO: make a proper sink according to device here
         (void) dev;
-        auto ptr = std::make_shared<spdlog::sinks::stdout_sink_st>();
+        auto ptr = std::make_shared<spdlog::sinks::stdout_sink_mt>();
         return ptr;
     }
 
@@ -41,12 +43,28 @@ private:
 
     static spdlog::level::level_enum string2level(const std::string& level);
 
+private:
+    using logger_map = std::map<std::string,
+                                std::pair<std::unique_ptr<formatter>,
+                                          std::shared_ptr<spdlog::logger>>>;
+    using logger_map_ptr = std::shared_ptr<const logger_map>;
+
+    static int load(const std::string& conf_file, log_config& conf, logger_map& name2logger);
+
+    // the loggers in use, the other threads might be logging with them
+    static logger_map_ptr loggers() { return std::atomic_load(&_.name2logger_); }
+
 private:
     std::string conf_file_;
     log_config conf_;
-    std::map<std::string,
-             std::pair<std::unique_ptr<formatter>,
-                       std::shared_ptr<spdlog::logger>>> name2logger_;
+
+    /*
+     * logs are written by multiple threads (bus workers, coroutine workers
+     * and the watchdog), while init() & reload() run on the main thread,
+     * so the map is never modified, a new one is built and published as a
+     * whole, the threads logging with the old one keep it alive until then
+     */
+    logger_map_ptr name2logger_;
 };
 
 #define sk_trace_enabled() sk::logger::level_enabled(sk::logger::DEFAULT_LOGGER, spdlog::level::trace)
@@ -11,6 +11,7 @@
 #include <spdlog/spdlog.h>
 #include <time/shm_timer.h>
 #include <time/heap_timer.h>
+#include <utility/time_helper.h>
 #include <core/signal_watcher.h>
 #include <server/option_parser.h>
 
@@ -47,6 +48,12 @@ struct server_context {
     bool disable_bus;            // disable bus explicitly
     size_t bus_node_size;        // bus node size, is useless if disable_bus is true
     size_t bus_node_count;       // bus node count, is useless if disable_bus is true
+    bool bus_drop_oldest;        // drop the oldest messages if the bus write channel is full
+    s32 bus_send_timeout;        // how long bus::send(...) waits if the channel is full, in ms
+    size_t bus_control_size;     // capacity of bus control lane, the lane is disabled if it's 0
+    size_t bus_bulk_size;        // capacity of bus bulk lane, the lane is disabled if it's 0
+    std::string bus_weights;     // "control,normal,bulk" weights of bus lanes, strict priority if empty
+    s32 bus_busy_poll;           // keep polling the bus for this long(us) after a message, 0 disables
 
     // do NOT touch the following fields unless you know what you are doing
 
@@ -61,6 +68,11 @@ struct server_context {
         disable_bus(false),
         bus_node_size(0),
         bus_node_count(0),
+        bus_drop_oldest(false),
+        bus_send_timeout(0),
+        bus_control_size(0),
+        bus_bulk_size(0),
+        bus_busy_poll(0),
         hotfixing(false)
     {}
 };
@@ -158,6 +170,9 @@ private:
         ret = watch_signal();
         if (ret != 0) return ret;
 
+        ret = init_busy_poll();
+        if (ret != 0) return ret;
+
         ret = on_init();
         if (ret != 0) return ret;
 
@@ -223,6 +238,7 @@ private:
         sk_assert(!stop_timer_);
 
         sig_watcher_->stop();
+        fini_busy_poll();
 
         stop_timer_ = std::unique_ptr<heap_timer>(new heap_timer(loop_,
                                                                  std::bind(&this_type::on_stop_timeout,
@@ -294,8 +310,57 @@ protected:
     virtual void on_signal(const signalfd_siginfo *info) {}
 
 private:
-    void recv_bus_msg() {
-        assert_retnone(!ctx_.disable_bus);
+    /*
+     * in busy poll mode, the bus is polled in every loop iteration by an
+     * idle handle, which also keeps the loop from blocking, so messages
+     * are handled without waiting for the signal, if there is no message
+     * for ctx_.bus_busy_poll microseconds, it falls back to signal mode
+     * until the next message arrives, it trades a core for lower latency
+     */
+    static void on_busy_poll(uv_idle_t *handle) {
+        this_type *self = static_cast<this_type *>(handle->data);
+        self->busy_poll();
+    }
+
+    void busy_poll() {
+        u64 now = time::monotonic_ns();
+        if (recv_bus_msg() > 0) {
+            last_msg_ns_ = now;
+            return;
+        }
+
+        if (now - last_msg_ns_ >= static_cast<u64>(ctx_.bus_busy_poll) * 1000)
+            stop_busy_poll();
+    }
+
+    void start_busy_poll() {
+        if (polling_ || !poll_handle_.data) return;
+
+        int ret = uv_idle_start(&poll_handle_, on_busy_poll);
+        if (ret != 0) {
+            sk_error("cannot start busy poll: %s", uv_strerror(ret));
+            return;
+        }
+
+        polling_ = true;
+        last_msg_ns_ = time::monotonic_ns();
+        bus::set_busy_poll(true);
+    }
+
+    void stop_busy_poll() {
+        if (!polling_) return;
+
+        uv_idle_stop(&poll_handle_);
+        polling_ = false;
+        bus::set_busy_poll(false);
+
+        // messages pushed before busd sees the flag cleared are not
+        // notified, so check the channel once more after clearing it
+        if (recv_bus_msg() > 0) start_busy_poll();
+    }
+
+    size_t recv_bus_msg() {
+        assert_retval(!ctx_.disable_bus, 0);
 
         int ret = 0;
         size_t total = 0;
@@ -332,6 +397,8 @@ private:
             on_msg(src_busid, buf_, len);
             ++total;
         }
+
+        return total;
     }
 
     void handle_signal(const signalfd_siginfo *info) {
@@ -352,7 +419,12 @@ private:
             break;
         default:
             if (signal == bus::BUS_INCOMING_SIGNO) {
-                recv_bus_msg();
+                if (recv_bus_msg() > 0) start_busy_poll();
+                break;
+            }
+
+            if (signal == bus::BUS_WRITABLE_SIGNO) {
+                bus::on_writable();
                 break;
             }
 
@@ -413,6 +485,24 @@ private:
         ret = p.register_option(0, "bus-node-count", "bus node count of bus, 102400 by default", "COUNT", false, &ctx_.bus_node_count);
         if (ret != 0) return ret;
 
+        ret = p.register_option(0, "bus-drop-oldest", "drop the oldest messages if bus is full", nullptr, false, &ctx_.bus_drop_oldest);
+        if (ret != 0) return ret;
+
+        ret = p.register_option(0, "bus-send-timeout", "wait time(ms) if bus is full, 0 by default", "MS", false, &ctx_.bus_send_timeout);
+        if (ret != 0) return ret;
+
+        ret = p.register_option(0, "bus-control-size", "capacity of bus control lane, disabled by default", "SIZE", false, &ctx_.bus_control_size);
+        if (ret != 0) return ret;
+
+        ret = p.register_option(0, "bus-bulk-size", "capacity of bus bulk lane, disabled by default", "SIZE", false, &ctx_.bus_bulk_size);
+        if (ret != 0) return ret;
+
+        ret = p.register_option(0, "bus-weights", "weights of bus lanes, strict priority by default", "C,N,B", false, &ctx_.bus_weights);
+        if (ret != 0) return ret;
+
+        ret = p.register_option(0, "bus-busy-poll", "poll bus for a while(us) after a message, disabled by default", "US", false, &ctx_.bus_busy_poll);
+        if (ret != 0) return ret;
+
         return 0;
     }
 
@@ -534,7 +624,21 @@ private:
 
     int register_bus() {
         if (ctx_.disable_bus) return 0;
-        return bus::register_bus(ctx_.bus_shm_path.c_str(), ctx_.id, ctx_.bus_node_size, ctx_.bus_node_count);
+        if (!ctx_.bus_weights.empty()) {
+            int weights[bus::BUS_PRIORITY_COUNT] = {0};
+            int ret = sscanf(ctx_.bus_weights.c_str(), "%d,%d,%d", &weights[0], &weights[1], &weights[2]);
+            if (ret != bus::BUS_PRIORITY_COUNT) {
+                sk_error("invalid bus recv weights: %s", ctx_.bus_weights.c_str());
+                return -EINVAL;
+            }
+
+            bus::set_recv_weights(weights);
+        }
+
+        bus::set_send_timeout(ctx_.bus_send_timeout);
+        return bus::register_bus(ctx_.bus_shm_path.c_str(), ctx_.id, ctx_.bus_node_size,
+                                 ctx_.bus_node_count, ctx_.bus_drop_oldest,
+                                 ctx_.bus_control_size, ctx_.bus_bulk_size);
     }
 
     int create_loop() {
@@ -579,9 +683,41 @@ private:
         ret = sig_watcher_->watch(bus::BUS_INCOMING_SIGNO);
         if (ret != 0) return ret;
 
+        sk_info("signal: BUS_WRITABLE(%d), action: writable", bus::BUS_WRITABLE_SIGNO);
+        ret = sig_watcher_->watch(bus::BUS_WRITABLE_SIGNO);
+        if (ret != 0) return ret;
+
         return sig_watcher_->start();
     }
 
+    int init_busy_poll() {
+        poll_handle_.data = nullptr;
+        if (ctx_.disable_bus || ctx_.bus_busy_poll <= 0) return 0;
+
+        int ret = uv_idle_init(loop_, &poll_handle_);
+        if (ret != 0) {
+            sk_error("cannot init busy poll: %s", uv_strerror(ret));
+            return ret;
+        }
+
+        poll_handle_.data = this;
+        sk_info("bus busy poll enabled, idle time<%dus>.", ctx_.bus_busy_poll);
+        return 0;
+    }
+
+    void fini_busy_poll() {
+        if (!poll_handle_.data) return;
+
+        if (polling_) {
+            uv_idle_stop(&poll_handle_);
+            polling_ = false;
+            bus::set_busy_poll(false);
+        }
+
+        poll_handle_.data = nullptr;
+        uv_close(reinterpret_cast<uv_handle_t *>(&poll_handle_), nullptr);
+    }
+
 private:
     static Derived *instance_;
 
@@ -592,6 +728,9 @@ private:
     uv_loop_t *loop_;
     class signal_watcher *sig_watcher_;
     std::unique_ptr<heap_timer> stop_timer_;
+    uv_idle_t poll_handle_;   // polls the bus in busy poll mode, data is NULL if disabled
+    bool polling_ = false;    // if poll_handle_ is active
+    u64 last_msg_ns_ = 0;     // when the last message is received in busy poll mode
 };
 
 template<typename C, typename D>
@@ -1,4 +1,5 @@
 #include <sys/sysinfo.h>
+#include <shm/shm.h>
 #include <shm/shm_config.h>
 #include <shm/detail/shm_mgr.h>
 #include <shm/detail/size_map.h>
@@ -210,6 +211,8 @@ bool shm_mgr::has_singleton(int id) {
 }
 
 shm_ptr<void> shm_mgr::get_singleton(int id, size_t bytes, bool *first_call) {
+    static_assert(SHM_SINGLETON_USER_MAX < MAX_SINGLETON_COUNT, "invalid singleton id");
+    static_assert(SHM_SINGLETON_SHM_TASK_MGR < MAX_SINGLETON_COUNT, "invalid singleton id");
     assert_retval(id >= 0 && id < MAX_SINGLETON_COUNT, nullptr);
 
     if (first_call) *first_call = false;
@@ -22,15 +22,41 @@ void sk::shm_free(const shm_ptr<void>& ptr) {
     ctx->mgr->free(ptr);
 }
 
+static bool reserved_singleton(int id) {
+    return id < SHM_SINGLETON_RESERVED_MAX || id >= SHM_SINGLETON_USER_MAX;
+}
+
 bool sk::shm_has_singleton(int id) {
+    assert_retval(!reserved_singleton(id), false);
     return ctx->mgr->has_singleton(id);
 }
 
 shm_ptr<void> sk::shm_get_singleton(int id, size_t bytes, bool *first_call) {
+    if (unlikely(reserved_singleton(id))) {
+        sk_error("singleton id<%d> is reserved.", id);
+        return nullptr;
+    }
+
     return ctx->mgr->get_singleton(id, bytes, first_call);
 }
 
 void sk::shm_free_singleton(int id) {
+    assert_retnone(!reserved_singleton(id));
+    return ctx->mgr->free_singleton(id);
+}
+
+bool sk::detail::shm_has_reserved_singleton(int id) {
+    assert_retval(reserved_singleton(id), false);
+    return ctx->mgr->has_singleton(id);
+}
+
+shm_ptr<void> sk::detail::shm_get_reserved_singleton(int id, size_t bytes, bool *first_call) {
+    assert_retval(reserved_singleton(id), nullptr);
+    return ctx->mgr->get_singleton(id, bytes, first_call);
+}
+
+void sk::detail::shm_free_reserved_singleton(int id) {
+    assert_retnone(reserved_singleton(id));
     return ctx->mgr->free_singleton(id);
 }
 
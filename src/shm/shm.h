@@ -10,11 +10,18 @@ class page_heap;
 NS_END(detail)
 
 /*
- * the reserved shm singletons
+ * the reserved shm singletons, user ids are in range [SHM_SINGLETON_RESERVED_MAX,
+ * SHM_SINGLETON_USER_MAX), SHM_SINGLETON_RESERVED_MAX MUST NOT change, or the
+ * singletons of a process resumed from an old version are mapped to other ids,
+ * so the ones added later are taken from the top of the id range downwards,
+ * the ids out of the user range are rejected by the functions below
  */
 enum shm_singleton_id {
     SHM_SINGLETON_SHM_TIMER_MGR = 0,
-    SHM_SINGLETON_RESERVED_MAX
+    SHM_SINGLETON_RESERVED_MAX,
+
+    SHM_SINGLETON_USER_MAX      = 240,
+    SHM_SINGLETON_SHM_TASK_MGR  = 255
 };
 
 shm_ptr<void> shm_malloc(size_t bytes);
@@ -70,9 +77,9 @@ void shm_array_delete(shm_ptr<T> ptr, size_t n) {
  * @param args: constructor arguments for type T
  * @return the instance
  *
- * NOTE: for user level singletons, the id should be bigger than
- * SHM_SINGLETON_RESERVED_MAX, as there are some ids are reserved
- * for internal usage
+ * NOTE: for user level singletons, the id must be in range
+ * [SHM_SINGLETON_RESERVED_MAX, SHM_SINGLETON_USER_MAX), the ids
+ * out of it are reserved for internal usage, NULL is returned
  */
 template<typename T, typename... Args>
 shm_ptr<T> shm_get_singleton(int id, Args&&... args) {
@@ -94,6 +101,38 @@ void shm_delete_singleton(int id) {
     shm_free_singleton(id);
 }
 
+NS_BEGIN(detail)
+
+/*
+ * the same as the functions above, but for the reserved singletons
+ * only, which are used by libsk itself, see shm_singleton_id
+ */
+bool shm_has_reserved_singleton(int id);
+shm_ptr<void> shm_get_reserved_singleton(int id, size_t bytes, bool *first_call);
+void shm_free_reserved_singleton(int id);
+
+template<typename T, typename... Args>
+shm_ptr<T> shm_get_reserved_singleton(int id, Args&&... args) {
+    bool first_call = false;
+    shm_ptr<T> ptr = shm_get_reserved_singleton(id, sizeof(T), &first_call);
+    if (ptr && first_call) new (ptr.get()) T(std::forward<Args>(args)...);
+
+    return ptr;
+}
+
+template<typename T>
+void shm_delete_reserved_singleton(int id) {
+    check_retnone(shm_has_reserved_singleton(id));
+
+    shm_ptr<T> ptr = shm_get_reserved_singleton(id, sizeof(T), nullptr);
+    assert_retnone(ptr);
+
+    ptr->~T();
+    shm_free_reserved_singleton(id);
+}
+
+NS_END(detail)
+
 detail::size_map  *shm_size_map();
 detail::page_heap *shm_page_heap();
 
@@ -346,7 +346,7 @@ void shm_timer::destruct(shm_timer_ptr ptr) {
 }
 
 int init(uv_loop_t *loop, int time_offset_sec) {
-    shm_ptr<shm_timer_mgr> ptr = shm_get_singleton<shm_timer_mgr>(SHM_SINGLETON_SHM_TIMER_MGR, time_offset_sec);
+    shm_ptr<shm_timer_mgr> ptr = detail::shm_get_reserved_singleton<shm_timer_mgr>(SHM_SINGLETON_SHM_TIMER_MGR, time_offset_sec);
     assert_retval(ptr, -ENOMEM);
 
     mgr = ptr.get();
@@ -358,7 +358,7 @@ void stop() {
 }
 
 void fini() {
-    shm_delete_singleton<shm_timer_mgr>(SHM_SINGLETON_SHM_TIMER_MGR);
+    detail::shm_delete_reserved_singleton<shm_timer_mgr>(SHM_SINGLETON_SHM_TIMER_MGR);
 }
 
 int now() {
@@ -0,0 +1,184 @@
+#include <errno.h>
+#include <string.h>
+#include <utility/compress_helper.h>
+
+NS_BEGIN(sk)
+
+static const int LZ4_HASH_LOG          = 12;
+static const size_t LZ4_MIN_MATCH     = 4;
+static const size_t LZ4_MAX_OFFSET    = 65535;
+static const size_t LZ4_LAST_LITERALS = 5;  // the last bytes are always literals
+static const size_t LZ4_MF_LIMIT      = 12; // the last match starts before this
+static const size_t LZ4_RUN_MASK      = 15;
+
+static inline u32 lz4_read32(const u8 *p) {
+    u32 v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline u32 lz4_hash(u32 v) {
+    return (v * 2654435761u) >> (32 - LZ4_HASH_LOG);
+}
+
+static inline size_t lz4_length_size(size_t length) {
+    return length < LZ4_RUN_MASK ? 0 : (length - LZ4_RUN_MASK) / 255 + 1;
+}
+
+static inline u8 *lz4_write_length(u8 *op, size_t length) {
+    length -= LZ4_RUN_MASK;
+    while (length >= 255) {
+        *op++ = 255;
+        length -= 255;
+    }
+
+    *op++ = static_cast<u8>(length);
+    return op;
+}
+
+static inline bool lz4_read_length(const u8 *&ip, const u8 *end, size_t& length) {
+    u8 b = 0;
+    do {
+        if (ip >= end) return false;
+        b = *ip++;
+        length += b;
+    } while (b == 255);
+
+    return true;
+}
+
+/*
+ * emit a sequence: literals [anchor, anchor + literals), and then a match of
+ * match_length bytes at offset, if match_length is 0, no match is emitted,
+ * which is the last sequence of a block
+ */
+static u8 *lz4_write_sequence(u8 *op, u8 *end, const u8 *anchor, size_t literals,
+                              size_t offset, size_t match_length) {
+    size_t required = 1 + lz4_length_size(literals) + literals;
+    if (match_length > 0) required += 2 + lz4_length_size(match_length - LZ4_MIN_MATCH);
+    if (static_cast<size_t>(end - op) < required) return nullptr;
+
+    u8 *token = op++;
+    *token = static_cast<u8>((literals < LZ4_RUN_MASK ? literals : LZ4_RUN_MASK) << 4);
+    if (literals >= LZ4_RUN_MASK) op = lz4_write_length(op, literals);
+
+    memcpy(op, anchor, literals);
+    op += literals;
+
+    if (match_length <= 0) return op;
+
+    *op++ = static_cast<u8>(offset & 0xFF);
+    *op++ = static_cast<u8>(offset >> 8);
+
+    size_t length = match_length - LZ4_MIN_MATCH;
+    *token |= static_cast<u8>(length < LZ4_RUN_MASK ? length : LZ4_RUN_MASK);
+    if (length >= LZ4_RUN_MASK) op = lz4_write_length(op, length);
+
+    return op;
+}
+
+int lz4_compress(const void *src, size_t length, void *dst, size_t capacity) {
+    if (length > LZ4_MAX_INPUT_SIZE) return -EINVAL;
+
+    const u8 *base = static_cast<const u8 *>(src);
+    const u8 *end = base + length;
+    const u8 *ip = base;
+    const u8 *anchor = base;
+    u8 *op = static_cast<u8 *>(dst);
+    u8 *oend = op + capacity;
+
+    if (length > LZ4_MF_LIMIT) {
+        // positions of the last seen 4-byte sequences, the entries which are
+        // never set point to the beginning, which is still a valid position
+        u32 table[1 << LZ4_HASH_LOG];
+        memset(table, 0x00, sizeof(table));
+
+        const u8 *mf_limit = end - LZ4_MF_LIMIT;
+        const u8 *match_limit = end - LZ4_LAST_LITERALS;
+
+        while (ip <= mf_limit) {
+            u32 seq = lz4_read32(ip);
+            u32 h = lz4_hash(seq);
+            const u8 *ref = base + table[h];
+            table[h] = static_cast<u32>(ip - base);
+
+            if (ref >= ip || static_cast<size_t>(ip - ref) > LZ4_MAX_OFFSET || lz4_read32(ref) != seq) {
+                ++ip;
+                continue;
+            }
+
+            const u8 *m = ip + LZ4_MIN_MATCH;
+            const u8 *r = ref + LZ4_MIN_MATCH;
+            while (m < match_limit && *m == *r) {
+                ++m;
+                ++r;
+            }
+
+            // the match might also extend backwards into the literals
+            while (ip > anchor && ref > base && ip[-1] == ref[-1]) {
+                --ip;
+                --ref;
+            }
+
+            op = lz4_write_sequence(op, oend, anchor, ip - anchor, ip - ref, m - ip);
+            if (!op) return -ENOSPC;
+
+            ip = m;
+            anchor = m;
+        }
+    }
+
+    op = lz4_write_sequence(op, oend, anchor, end - anchor, 0, 0);
+    if (!op) return -ENOSPC;
+
+    return static_cast<int>(op - static_cast<u8 *>(dst));
+}
+
+int lz4_decompress(const void *src, size_t length, void *dst, size_t capacity) {
+    const u8 *ip = static_cast<const u8 *>(src);
+    const u8 *iend = ip + length;
+    u8 *base = static_cast<u8 *>(dst);
+    u8 *op = base;
+    u8 *oend = base + capacity;
+
+    while (ip < iend) {
+        u8 token = *ip++;
+
+        size_t literals = token >> 4;
+        if (literals == LZ4_RUN_MASK && !lz4_read_length(ip, iend, literals)) return -EINVAL;
+        if (literals > static_cast<size_t>(iend - ip)) return -EINVAL;
+        if (literals > static_cast<size_t>(oend - op)) return -EINVAL;
+
+        memcpy(op, ip, literals);
+        op += literals;
+        ip += literals;
+
+        // the last sequence has literals only
+        if (ip >= iend) break;
+
+        if (iend - ip < 2) return -EINVAL;
+        size_t offset = ip[0] | (static_cast<size_t>(ip[1]) << 8);
+        ip += 2;
+        if (offset <= 0 || offset > static_cast<size_t>(op - base)) return -EINVAL;
+
+        size_t match_length = token & LZ4_RUN_MASK;
+        if (match_length == LZ4_RUN_MASK && !lz4_read_length(ip, iend, match_length)) return -EINVAL;
+        match_length += LZ4_MIN_MATCH;
+        if (match_length > static_cast<size_t>(oend - op)) return -EINVAL;
+
+        // the match can overlap with the output, copy byte by byte then
+        const u8 *ref = op - offset;
+        if (offset >= match_length) {
+            memcpy(op, ref, match_length);
+        } else {
+            for (size_t i = 0; i < match_length; ++i)
+                op[i] = ref[i];
+        }
+
+        op += match_length;
+    }
+
+    return static_cast<int>(op - base);
+}
+
+NS_END(sk)
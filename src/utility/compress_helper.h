@@ -0,0 +1,45 @@
+#ifndef COMPRESS_HELPER_H
+#define COMPRESS_HELPER_H
+
+#include <utility/types.h>
+
+NS_BEGIN(sk)
+
+/*
+ * a compressor & decompressor of the LZ4 block format, the compressor
+ * is a simple greedy one, which trades ratio for speed, the output can
+ * be decompressed by any standard LZ4 block decoder, and vice versa
+ */
+static const size_t LZ4_MAX_INPUT_SIZE = 0x7E000000;
+
+/*
+ * the max size of the compressed data, for buffer allocation
+ */
+inline size_t lz4_compress_bound(size_t length) {
+    return length + length / 255 + 16;
+}
+
+/**
+ * @brief compress data into the LZ4 block format
+ * @param src: the data to compress
+ * @param length: length of the data, no more than LZ4_MAX_INPUT_SIZE
+ * @param dst: where the compressed data is stored
+ * @param capacity: capacity of dst, lz4_compress_bound(length) is always enough
+ * @return size of the compressed data, or -ENOSPC if dst is not large enough
+ */
+int lz4_compress(const void *src, size_t length, void *dst, size_t capacity);
+
+/**
+ * @brief decompress a LZ4 block
+ * @param src: the compressed data
+ * @param length: length of the compressed data
+ * @param dst: where the decompressed data is stored
+ * @param capacity: capacity of dst
+ * @return size of the decompressed data, or -EINVAL if the data is
+ *         corrupted or the decompressed data cannot fit into dst
+ */
+int lz4_decompress(const void *src, size_t length, void *dst, size_t capacity);
+
+NS_END(sk)
+
+#endif // COMPRESS_HELPER_H
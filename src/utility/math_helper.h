@@ -54,6 +54,13 @@ u64  intrev64(u64 v);
 
 u16 crc16(const void *buf, size_t len);
 
+/*
+ * round n up to a multiple of alignment, alignment must be 2 ^ N
+ */
+inline size_t align_up(size_t n, size_t alignment) {
+    return (n + alignment - 1) & ~(alignment - 1);
+}
+
 template<typename T, typename B>
 inline typename sk::if_<std::is_const<B>::value,
                         typename std::add_const<T>::type*,
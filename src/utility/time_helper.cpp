@@ -76,6 +76,27 @@ bool is_same_week(time_t t1, time_t t2, int offset_hour) {
     return week1 == week2;
 }
 
+u64 realtime_ns() {
+    struct timespec t;
+    int ret = clock_gettime(CLOCK_REALTIME, &t);
+    if (unlikely(ret != 0)) return 0;
+    return static_cast<u64>(t.tv_sec) * 1000000000 + static_cast<u64>(t.tv_nsec);
+}
+
+u64 monotonic_ns() {
+    struct timespec t;
+    int ret = clock_gettime(CLOCK_MONOTONIC, &t);
+    if (unlikely(ret != 0)) return 0;
+    return static_cast<u64>(t.tv_sec) * 1000000000 + static_cast<u64>(t.tv_nsec);
+}
+
+u64 thread_cpu_ns() {
+    struct timespec t;
+    int ret = clock_gettime(CLOCK_THREAD_CPUTIME_ID, &t);
+    if (unlikely(ret != 0)) return 0;
+    return static_cast<u64>(t.tv_sec) * 1000000000 + static_cast<u64>(t.tv_nsec);
+}
+
 void timeval_add(const timeval& tv1, const timeval& tv2, timeval *out) {
     if (unlikely(!out)) return;
 
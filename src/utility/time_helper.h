@@ -12,6 +12,24 @@ int day_start_time(time_t t);
 bool is_same_day(time_t t1, time_t t2, int offset_hour);
 bool is_same_week(time_t t1, time_t t2, int offset_hour);
 
+/*
+ * return the number of nanoseconds since the Epoch, it's based on
+ * CLOCK_REALTIME, so it's comparable between (synchronized) hosts
+ */
+u64 realtime_ns();
+
+/*
+ * return the number of nanoseconds since an unspecified point, it's
+ * based on CLOCK_MONOTONIC, so it's suitable for measuring intervals
+ */
+u64 monotonic_ns();
+
+/*
+ * return the cpu time consumed by the calling thread, in nanoseconds,
+ * it's based on CLOCK_THREAD_CPUTIME_ID
+ */
+u64 thread_cpu_ns();
+
 void timeval_add(const timeval& tv1, const timeval& tv2, timeval *out);
 void timeval_sub(const timeval& tv1, const timeval& tv2, timeval *out);
 
@@ -0,0 +1,164 @@
+#include <gtest/gtest.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <string.h>
+#include <libsk.h>
+#include <bus/bus.h>
+#include <shm/detail/shm_object.h>
+#include <bus/detail/channel_mgr.h>
+
+#define BUS_SHM_PATH "/libsk-test-bus.mmap"
+
+using namespace sk;
+using namespace sk::detail;
+using namespace sk::bus;
+
+static const size_t BUS_SHM_SIZE = 1024 * 1024;
+static const size_t LANE_CAPACITY = 4096;
+
+/*
+ * the process plays busd as well, the bus segment is created & initialized
+ * here, the notifications sent to busd, i.e. the process itself, are ignored
+ */
+static channel_mgr *create_bus_segment() {
+    signal(sk::bus::BUS_OUTGOING_SIGNO, SIG_IGN);
+    signal(sk::bus::BUS_REGISTRATION_SIGNO, SIG_IGN);
+
+    // left by a crashed run, if any
+    shm_unlink(BUS_SHM_PATH);
+
+    size_t size = BUS_SHM_SIZE;
+    int shmfd = shm_object_create(BUS_SHM_PATH, &size);
+    if (shmfd == -1) return nullptr;
+
+    void *addr = shm_object_map(shmfd, &size, 0);
+    close(shmfd);
+    if (!addr) return nullptr;
+
+    channel_mgr *mgr = static_cast<channel_mgr *>(addr);
+    if (mgr->init(0, size, false) != 0) return nullptr;
+
+    return mgr;
+}
+
+TEST(bus, lanes) {
+    channel_mgr *mgr = create_bus_segment();
+    ASSERT_TRUE(mgr != nullptr);
+
+    // no control lane
+    const int busid = sk::bus::from_subid(1, 1, 1, 1);
+    int ret = sk::bus::register_bus(BUS_SHM_PATH, busid, 1, LANE_CAPACITY, false, 0, LANE_CAPACITY);
+    ASSERT_TRUE(ret == 0);
+
+    int fd = -1;
+    channel *rc = mgr->find_read_channel(busid, fd);
+    ASSERT_TRUE(rc != nullptr);
+    channel *wc = mgr->get_write_channel(fd);
+    ASSERT_TRUE(wc != nullptr);
+
+    // the missing lanes & the out of range ones fall back to the default lane
+    ASSERT_TRUE(!wc->has_lane(BUS_PRIORITY_CONTROL));
+    ASSERT_TRUE(wc->has_lane(BUS_PRIORITY_NORMAL) && wc->has_lane(BUS_PRIORITY_BULK));
+    ASSERT_TRUE(wc->lane(BUS_PRIORITY_CONTROL) == wc);
+    ASSERT_TRUE(wc->lane(BUS_PRIORITY_NORMAL) == wc);
+    ASSERT_TRUE(wc->lane(BUS_PRIORITY_BULK) != wc);
+    ASSERT_TRUE(wc->lane(-1) == wc);
+    ASSERT_TRUE(wc->lane(BUS_PRIORITY_COUNT) == wc);
+    ASSERT_TRUE(wc->lane(BUS_PRIORITY_BULK)->capacity() == LANE_CAPACITY);
+
+    // a message goes to the lane of its priority, if the lane exists
+    const int dst_busid = sk::bus::from_subid(1, 1, 1, 2);
+    ASSERT_TRUE(sk::bus::send(dst_busid, "c", 1, 0, BUS_PRIORITY_CONTROL) == 0);
+    ASSERT_TRUE(sk::bus::send(dst_busid, "b", 1, 0, BUS_PRIORITY_BULK) == 0);
+    ASSERT_TRUE(sk::bus::send(dst_busid, "n", 1, 0, -1) == -EINVAL);
+    ASSERT_TRUE(sk::bus::send(dst_busid, "n", 1, 0, BUS_PRIORITY_COUNT) == -EINVAL);
+    ASSERT_TRUE(wc->message_count() == 1);
+    ASSERT_TRUE(wc->lane(BUS_PRIORITY_BULK)->message_count() == 1);
+
+    char buf[16];
+    size_t len = sizeof(buf);
+    ASSERT_TRUE(wc->pop(buf, len, nullptr, nullptr, nullptr) == 1);
+    ASSERT_TRUE(len == 1 && buf[0] == 'c');
+
+    // busd routes the messages into the lanes of the read channel, the
+    // higher priority lanes are drained first, whatever the arrival order
+    ASSERT_TRUE(rc->lane(BUS_PRIORITY_BULK)->push(dst_busid, busid, 0, "b1", 2) == 0);
+    ASSERT_TRUE(rc->lane(BUS_PRIORITY_NORMAL)->push(dst_busid, busid, 0, "n1", 2) == 0);
+    ASSERT_TRUE(rc->lane(BUS_PRIORITY_BULK)->push(dst_busid, busid, 0, "b2", 2) == 0);
+    // there is no control lane, it lands in the default lane after "n1"
+    ASSERT_TRUE(rc->lane(BUS_PRIORITY_CONTROL)->push(dst_busid, busid, 0, "n2", 2) == 0);
+
+    const char *expected[] = { "n1", "n2", "b1", "b2" };
+    for (int i = 0; i < 4; ++i) {
+        int src_busid = 0;
+        len = sizeof(buf);
+        ASSERT_TRUE(sk::bus::recv(src_busid, buf, len) == 1);
+        ASSERT_TRUE(src_busid == dst_busid);
+        ASSERT_TRUE(len == 2 && memcmp(buf, expected[i], 2) == 0);
+    }
+
+    int src_busid = 0;
+    len = sizeof(buf);
+    ASSERT_TRUE(sk::bus::recv(src_busid, buf, len) == 0);
+
+    // weighted round-robin gives the lower lanes a share as well
+    int weights[BUS_PRIORITY_COUNT] = { 1, 2, 1 };
+    sk::bus::set_recv_weights(weights);
+    for (int i = 0; i < 4; ++i) {
+        char n[2] = { 'n', static_cast<char>('0' + i) };
+        char b[2] = { 'b', static_cast<char>('0' + i) };
+        ASSERT_TRUE(rc->lane(BUS_PRIORITY_NORMAL)->push(dst_busid, busid, 0, n, 2) == 0);
+        ASSERT_TRUE(rc->lane(BUS_PRIORITY_BULK)->push(dst_busid, busid, 0, b, 2) == 0);
+    }
+
+    const char *weighted[] = { "n0", "n1", "b0", "n2", "n3", "b1", "b2", "b3" };
+    for (int i = 0; i < 8; ++i) {
+        len = sizeof(buf);
+        ASSERT_TRUE(sk::bus::recv(src_busid, buf, len) == 1);
+        ASSERT_TRUE(len == 2 && memcmp(buf, weighted[i], 2) == 0);
+    }
+
+    sk::bus::set_recv_weights(nullptr);
+    sk::bus::deregister_bus();
+    shm_object_unmap(mgr, BUS_SHM_SIZE);
+    shm_object_unlink(BUS_SHM_PATH);
+}
+
+TEST(bus, lane_order) {
+    channel_mgr *mgr = create_bus_segment();
+    ASSERT_TRUE(mgr != nullptr);
+
+    const int busid = sk::bus::from_subid(1, 1, 2, 1);
+    int ret = sk::bus::register_bus(BUS_SHM_PATH, busid, 1, LANE_CAPACITY, false,
+                                    LANE_CAPACITY, LANE_CAPACITY);
+    ASSERT_TRUE(ret == 0);
+
+    int fd = -1;
+    channel *rc = mgr->find_read_channel(busid, fd);
+    ASSERT_TRUE(rc != nullptr);
+    for (int i = 0; i < BUS_PRIORITY_COUNT; ++i)
+        ASSERT_TRUE(rc->has_lane(i));
+
+    // pushed from the lowest priority to the highest, popped reversely
+    const int src_busid = sk::bus::from_subid(1, 1, 2, 2);
+    for (int k = 0; k < 2; ++k) {
+        for (int i = BUS_PRIORITY_COUNT - 1; i >= 0; --i) {
+            char data[2] = { static_cast<char>('0' + i), static_cast<char>('0' + k) };
+            ASSERT_TRUE(rc->lane(i)->push(src_busid, busid, 0, data, 2) == 0);
+        }
+    }
+
+    for (int i = 0; i < BUS_PRIORITY_COUNT; ++i) {
+        for (int k = 0; k < 2; ++k) {
+            char buf[16];
+            size_t len = sizeof(buf);
+            int src = 0;
+            ASSERT_TRUE(sk::bus::recv(src, buf, len) == 1);
+            ASSERT_TRUE(len == 2 && buf[0] == '0' + i && buf[1] == '0' + k);
+        }
+    }
+
+    sk::bus::deregister_bus();
+    shm_object_unmap(mgr, BUS_SHM_SIZE);
+    shm_object_unlink(BUS_SHM_PATH);
+}
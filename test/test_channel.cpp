@@ -0,0 +1,358 @@
+#include <gtest/gtest.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <libsk.h>
+#include <bus/detail/channel.h>
+
+using namespace sk;
+using namespace sk::detail;
+
+// the producer & consumer parts must not share a cache line, so the
+// channel is aligned like it is in the shm segment
+static channel *create_channel(size_t capacity, u32 flags = 0) {
+    void *addr = nullptr;
+    if (posix_memalign(&addr, CACHELINE_SIZE, channel::calc_space(1, capacity, flags)) != 0)
+        return nullptr;
+
+    channel *c = static_cast<channel *>(addr);
+    if (c->init(1, capacity, flags) != 0) {
+        free(addr);
+        return nullptr;
+    }
+
+    return c;
+}
+
+static void fill(std::vector<char>& data, int seed) {
+    for (size_t i = 0; i < data.size(); ++i)
+        data[i] = static_cast<char>((seed + i) & 0xFF);
+}
+
+TEST(channel, record) {
+    char buf[channel_record::MAX_HEADER_SIZE];
+    const size_t lengths[] = { 1, 127, 128, 16383, 16384, size_t(1) << 40 };
+
+    for (size_t i = 0; i < sizeof(lengths) / sizeof(lengths[0]); ++i) {
+        channel_record r;
+        r.src_busid = 0x01020304;
+        r.dst_busid = -1;
+        r.ctime = 0x1122334455667788ULL;
+        r.length = lengths[i];
+        r.hash = 0xDEADBEEF;
+
+        size_t len = r.encode(buf);
+        ASSERT_TRUE(len > 0 && len <= sizeof(buf));
+
+        channel_record d;
+        ASSERT_TRUE(d.decode(buf, len) == len);
+        ASSERT_TRUE(d.src_busid == r.src_busid && d.dst_busid == r.dst_busid);
+        ASSERT_TRUE(d.ctime == r.ctime && d.length == r.length && d.hash == r.hash);
+
+        // a truncated header is rejected
+        ASSERT_TRUE(d.decode(buf, len - 1) == 0);
+    }
+
+    // zero fields are omitted
+    channel_record r;
+    r.src_busid = 0;
+    r.dst_busid = 0;
+    r.ctime = 0;
+    r.length = 100;
+    r.hash = 1;
+    ASSERT_TRUE(r.encode(buf) == 1 + 1 + sizeof(u32));
+
+    channel_record d;
+    d.src_busid = d.dst_busid = 1;
+    d.ctime = 1;
+    ASSERT_TRUE(d.decode(buf, sizeof(buf)) == 1 + 1 + sizeof(u32));
+    ASSERT_TRUE(d.src_busid == 0 && d.dst_busid == 0 && d.ctime == 0 && d.length == 100);
+
+    // not a record
+    buf[0] = 0;
+    ASSERT_TRUE(d.decode(buf, sizeof(buf)) == 0);
+}
+
+TEST(channel, round_trip) {
+    channel *c = create_channel(64 * 1024);
+    ASSERT_TRUE(c != nullptr);
+    ASSERT_TRUE(c->compact());
+
+    const size_t lengths[] = { 1, 7, 8, 9, 127, 128, 1000, 16384 };
+    const int count = sizeof(lengths) / sizeof(lengths[0]);
+    for (int i = 0; i < count; ++i) {
+        std::vector<char> data(lengths[i]);
+        fill(data, i);
+        ASSERT_TRUE(c->push(i, i * 2, i * 3, &data[0], data.size()) == 0);
+    }
+
+    ASSERT_TRUE(c->message_count() == static_cast<size_t>(count));
+
+    std::vector<char> buf(32 * 1024);
+    for (int i = 0; i < count; ++i) {
+        std::vector<char> data(lengths[i]);
+        fill(data, i);
+
+        size_t len = buf.size();
+        int src = -1, dst = -1;
+        u64 ctime = 1;
+        ASSERT_TRUE(c->pop(&buf[0], len, &src, &dst, &ctime) == 1);
+        ASSERT_TRUE(len == data.size() && memcmp(&buf[0], &data[0], len) == 0);
+        ASSERT_TRUE(src == i && dst == i * 2 && ctime == static_cast<u64>(i * 3));
+    }
+
+    size_t len = buf.size();
+    ASSERT_TRUE(c->pop(&buf[0], len, nullptr, nullptr, nullptr) == 0);
+    ASSERT_TRUE(c->message_count() == 0);
+
+    // nothing is pushed for empty messages
+    ASSERT_TRUE(c->push(1, 1, 1, &buf[0], 0) == 0);
+    ASSERT_TRUE(c->message_count() == 0);
+
+    // the message is kept if the buffer is too small
+    ASSERT_TRUE(c->push(1, 1, 1, &buf[0], 100) == 0);
+    len = 99;
+    ASSERT_TRUE(c->pop(&buf[0], len, nullptr, nullptr, nullptr) == -E2BIG);
+    ASSERT_TRUE(len == 100);
+    ASSERT_TRUE(c->pop(&buf[0], len, nullptr, nullptr, nullptr) == 1);
+
+    // the message is dropped if no buffer is given
+    ASSERT_TRUE(c->push(1, 1, 1, &buf[0], 100) == 0);
+    ASSERT_TRUE(c->pop(nullptr, len, nullptr, nullptr, nullptr) == 1);
+    ASSERT_TRUE(c->message_count() == 0);
+
+    free(c);
+}
+
+TEST(channel, wrap_around) {
+    // the sizes are co-prime with the capacity, so the records and
+    // their headers are split at every possible offset of the ring
+    const size_t capacity = 1024;
+    channel *c = create_channel(capacity);
+    ASSERT_TRUE(c != nullptr);
+
+    std::vector<char> buf(capacity);
+    for (int i = 0; i < 2000; ++i) {
+        std::vector<char> data(1 + (i * 37) % 300);
+        fill(data, i);
+        ASSERT_TRUE(c->push(i + 1, i + 2, i + 3, &data[0], data.size()) == 0);
+
+        size_t len = buf.size();
+        int src = 0, dst = 0;
+        u64 ctime = 0;
+        ASSERT_TRUE(c->pop(&buf[0], len, &src, &dst, &ctime) == 1);
+        ASSERT_TRUE(len == data.size() && memcmp(&buf[0], &data[0], len) == 0);
+        ASSERT_TRUE(src == i + 1 && dst == i + 2 && ctime == static_cast<u64>(i + 3));
+    }
+
+    // the same with several records in the ring at the same time
+    int pushed = 0, popped = 0;
+    while (popped < 2000) {
+        while (true) {
+            std::vector<char> data(1 + (pushed * 53) % 200);
+            fill(data, pushed);
+            int ret = c->push(pushed, 0, 0, &data[0], data.size());
+            if (ret == -ENOMEM) break;
+
+            ASSERT_TRUE(ret == 0);
+            ++pushed;
+        }
+
+        for (int k = 0; k < 3 && popped < pushed; ++k, ++popped) {
+            std::vector<char> data(1 + (popped * 53) % 200);
+            fill(data, popped);
+
+            size_t len = buf.size();
+            int src = -1;
+            ASSERT_TRUE(c->pop(&buf[0], len, &src, nullptr, nullptr) == 1);
+            ASSERT_TRUE(src == popped);
+            ASSERT_TRUE(len == data.size() && memcmp(&buf[0], &data[0], len) == 0);
+        }
+    }
+
+    free(c);
+}
+
+TEST(channel, max_size) {
+    const size_t capacity = 1024;
+    channel *c = create_channel(capacity);
+    ASSERT_TRUE(c != nullptr);
+
+    // a node is kept empty to tell a full ring from an empty one, and the
+    // header is 1 byte tag, 2 bytes length and 4 bytes hash without ids
+    const size_t max_size = capacity - CHANNEL_ALIGNMENT - (1 + 2 + sizeof(u32));
+    std::vector<char> data(max_size + 1);
+    fill(data, 7);
+
+    ASSERT_TRUE(c->push(0, 0, 0, &data[0], max_size + 1) == -ENOMEM);
+
+    // the record wraps around if the ring does not start at offset 0
+    for (int i = 0; i < 3; ++i) {
+        ASSERT_TRUE(c->push(0, 0, 0, &data[0], max_size) == 0);
+        ASSERT_TRUE(c->push(0, 0, 0, &data[0], 1) == -ENOMEM);
+
+        std::vector<char> buf(capacity);
+        size_t len = buf.size();
+        ASSERT_TRUE(c->pop(&buf[0], len, nullptr, nullptr, nullptr) == 1);
+        ASSERT_TRUE(len == max_size && memcmp(&buf[0], &data[0], len) == 0);
+
+        ASSERT_TRUE(c->push(0, 0, 0, &data[0], 100 + i * 8) == 0);
+        len = buf.size();
+        ASSERT_TRUE(c->pop(&buf[0], len, nullptr, nullptr, nullptr) == 1);
+    }
+
+    // the ids & the time take space in the header
+    const size_t id_size = 2 * sizeof(s32) + sizeof(u64);
+    ASSERT_TRUE(c->push(1, 2, 3, &data[0], max_size - id_size + 1) == -ENOMEM);
+    ASSERT_TRUE(c->push(1, 2, 3, &data[0], max_size - id_size) == 0);
+
+    free(c);
+}
+
+TEST(channel, stats) {
+    const size_t capacity = 1024;
+
+    // no space is taken by statistics unless they are asked for
+    channel *c = create_channel(capacity);
+    ASSERT_TRUE(c != nullptr);
+    ASSERT_TRUE(!c->has_stats());
+    ASSERT_TRUE(c->node_offset == sizeof(channel));
+    ASSERT_TRUE(channel::calc_space(1, capacity) == sizeof(channel) + capacity);
+    free(c);
+
+    c = create_channel(capacity, CHANNEL_FLAG_STATS);
+    ASSERT_TRUE(c != nullptr);
+    ASSERT_TRUE(c->has_stats() && !c->lossy());
+    ASSERT_TRUE(c->node_offset == sizeof(channel) + channel::calc_stats_space(CHANNEL_FLAG_STATS));
+    ASSERT_TRUE(channel::calc_space(1, capacity, CHANNEL_FLAG_STATS) == c->node_offset + capacity);
+
+    // the producer's & the consumer's statistics do not share cache lines
+    const char *producer = reinterpret_cast<const char *>(&c->producer_stats());
+    const char *consumer = reinterpret_cast<const char *>(&c->consumer_stats());
+    ASSERT_TRUE(producer >= reinterpret_cast<const char *>(c) + sizeof(channel));
+    ASSERT_TRUE(consumer >= producer + sizeof(channel_stats));
+    ASSERT_TRUE(reinterpret_cast<size_t>(consumer) % CACHELINE_SIZE == 0);
+    ASSERT_TRUE(consumer + sizeof(channel_stats) <= reinterpret_cast<const char *>(c) + c->node_offset);
+
+    char buf[16];
+    ASSERT_TRUE(c->push(1, 2, 0, "hello", 5) == 0);
+    ASSERT_TRUE(c->push(1, 2, 0, "world!", 6) == 0);
+    size_t len = sizeof(buf);
+    ASSERT_TRUE(c->pop(buf, len, nullptr, nullptr, nullptr) == 1);
+    ASSERT_TRUE(len == 5 && memcmp(buf, "hello", 5) == 0);
+
+    ASSERT_TRUE(c->producer_stats().msg_count == 2 && c->producer_stats().byte_count == 11);
+    ASSERT_TRUE(c->producer_stats().high_water > 0 && c->producer_stats().high_water <= capacity);
+    ASSERT_TRUE(c->consumer_stats().msg_count == 1 && c->consumer_stats().byte_count == 5);
+
+    // the first message of every LATENCY_SAMPLE_RATE ones is sampled
+    ASSERT_TRUE(c->producer_stats().latency.count == 1);
+    ASSERT_TRUE(c->consumer_stats().latency.count == 1);
+
+    free(c);
+}
+
+TEST(channel, drop_oldest) {
+    const size_t capacity = 1024;
+    channel *c = create_channel(capacity, CHANNEL_FLAG_DROP_OLDEST | CHANNEL_FLAG_STATS);
+    ASSERT_TRUE(c != nullptr);
+    ASSERT_TRUE(c->lossy() && c->has_stats());
+
+    // every record takes 13 nodes with the 100 bytes data, so the ring
+    // holds 127 / 13 = 9 of them, the older ones are dropped
+    const int count = 100;
+    const int kept = 9;
+    std::vector<char> data(100);
+    for (int i = 0; i < count; ++i) {
+        fill(data, i);
+        ASSERT_TRUE(c->push(i, 0, 0, &data[0], data.size()) == 0);
+    }
+
+    ASSERT_TRUE(c->message_count() == static_cast<size_t>(kept));
+    ASSERT_TRUE(c->producer_stats().msg_count == static_cast<size_t>(count));
+    ASSERT_TRUE(c->producer_stats().drop_count == static_cast<size_t>(count - kept));
+
+    // the newest ones are kept in order
+    std::vector<char> buf(capacity);
+    for (int i = count - kept; i < count; ++i) {
+        fill(data, i);
+
+        size_t len = buf.size();
+        int src = -1;
+        ASSERT_TRUE(c->pop(&buf[0], len, &src, nullptr, nullptr) == 1);
+        ASSERT_TRUE(src == i);
+        ASSERT_TRUE(len == data.size() && memcmp(&buf[0], &data[0], len) == 0);
+    }
+
+    size_t len = buf.size();
+    ASSERT_TRUE(c->pop(&buf[0], len, nullptr, nullptr, nullptr) == 0);
+    ASSERT_TRUE(c->consumer_stats().msg_count == static_cast<size_t>(kept));
+
+    // a record larger than the ring is never pushed, nothing is dropped for it
+    std::vector<char> big(capacity);
+    ASSERT_TRUE(c->push(1, 0, 0, &data[0], data.size()) == 0);
+    ASSERT_TRUE(c->push(1, 0, 0, &big[0], big.size()) == -ENOMEM);
+    ASSERT_TRUE(c->message_count() == 1);
+    ASSERT_TRUE(c->producer_stats().drop_count == static_cast<size_t>(count - kept));
+
+    free(c);
+}
+
+TEST(channel, drop_oldest_racing_pop) {
+    // a small ring, so the producer laps the consumer all the time
+    const size_t capacity = 512;
+    channel *c = create_channel(capacity, CHANNEL_FLAG_DROP_OLDEST | CHANNEL_FLAG_STATS);
+    ASSERT_TRUE(c != nullptr);
+
+    const int count = 200000;
+    std::atomic<bool> done(false);
+    std::thread producer([c, count, &done]() {
+        std::vector<char> data(64);
+        for (int i = 0; i < count; ++i) {
+            data.resize(1 + i % 64);
+            fill(data, i);
+            EXPECT_TRUE(c->push(i, 0, 0, &data[0], data.size()) == 0);
+        }
+
+        done.store(true, std::memory_order_release);
+    });
+
+    // every record popped is one that has been pushed, with the data of
+    // it, a record dropped while it's being read is never returned
+    int popped = 0, last = -1;
+    std::vector<char> buf(capacity);
+    std::vector<char> data(64);
+    while (true) {
+        bool finished = done.load(std::memory_order_acquire);
+
+        size_t len = buf.size();
+        int src = -1;
+        int ret = c->pop(&buf[0], len, &src, nullptr, nullptr);
+        ASSERT_TRUE(ret == 0 || ret == 1);
+        if (ret == 0) {
+            if (finished) break;
+            continue;
+        }
+
+        ASSERT_TRUE(src > last && src < count);
+        data.resize(1 + src % 64);
+        fill(data, src);
+        ASSERT_TRUE(len == data.size() && memcmp(&buf[0], &data[0], len) == 0);
+
+        last = src;
+        ++popped;
+    }
+
+    producer.join();
+
+    // the last one is never dropped, and each one is either popped or dropped
+    ASSERT_TRUE(last == count - 1);
+    ASSERT_TRUE(c->producer_stats().msg_count == static_cast<size_t>(count));
+    ASSERT_TRUE(c->consumer_stats().msg_count == static_cast<size_t>(popped));
+    ASSERT_TRUE(c->producer_stats().drop_count + popped == static_cast<size_t>(count));
+    ASSERT_TRUE(c->message_count() == 0);
+
+    free(c);
+}
@@ -0,0 +1,133 @@
+#include <gtest/gtest.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <libsk.h>
+#include <bus/bus.h>
+#include <bus/detail/channel_mgr.h>
+
+using namespace sk;
+using namespace sk::detail;
+
+static const size_t SEGMENT_SIZE = 1024 * 1024;
+
+// the segment lives in heap memory, and the notifications to busd, which
+// is the process itself here, are ignored
+static channel_mgr *create_mgr() {
+    signal(sk::bus::BUS_REGISTRATION_SIGNO, SIG_IGN);
+
+    void *addr = nullptr;
+    if (posix_memalign(&addr, channel_mgr::ALLOC_ALIGNMENT, SEGMENT_SIZE) != 0) return nullptr;
+
+    memset(addr, 0x00, SEGMENT_SIZE);
+    channel_mgr *mgr = static_cast<channel_mgr *>(addr);
+    if (mgr->init(0, SEGMENT_SIZE, false) != 0) {
+        free(addr);
+        return nullptr;
+    }
+
+    return mgr;
+}
+
+// the space taken by the rings, free blocks excluded
+static size_t used_space(const channel_mgr *mgr) {
+    size_t size = mgr->used_size;
+    for (int i = 0; i < mgr->free_block_count; ++i)
+        size -= mgr->free_blocks[i].size;
+
+    return size;
+}
+
+static size_t ring_space(size_t capacity) {
+    return sk::align_up(channel::calc_space(1, capacity), channel_mgr::ALLOC_ALIGNMENT);
+}
+
+TEST(channel_mgr, resize) {
+    channel_mgr *mgr = create_mgr();
+    ASSERT_TRUE(mgr != nullptr);
+
+    const int busid = 0x01010101;
+    size_t capacity[CHANNEL_LANE_COUNT] = { 0, 4096, 0 };
+    int fd = -1;
+    ASSERT_TRUE(mgr->register_channel(busid, getpid(), capacity, 0, fd) == 0);
+    ASSERT_TRUE(fd == 0);
+
+    channel *wc = mgr->get_write_channel(fd);
+    ASSERT_TRUE(wc->push(busid, 0, 0, "hello", 5) == 0);
+
+    capacity[CHANNEL_LANE_DEFAULT] = 8192;
+    ASSERT_TRUE(mgr->resize_channel(fd, capacity) == 0);
+
+    // the read channel is not switched yet, so it cannot be resized again
+    capacity[CHANNEL_LANE_DEFAULT] = 16384;
+    ASSERT_TRUE(mgr->resize_channel(fd, capacity) == -EBUSY);
+
+    // the write channel is switched already, the old ring is drained first
+    channel *new_wc = mgr->get_write_channel(fd);
+    ASSERT_TRUE(new_wc != wc && new_wc->capacity() == 8192);
+    ASSERT_TRUE(mgr->get_retired_channel(new_wc) == wc);
+
+    char buf[16];
+    size_t len = sizeof(buf);
+    ASSERT_TRUE(wc->pop(buf, len, nullptr, nullptr, nullptr) == 1);
+    ASSERT_TRUE(len == 5 && memcmp(buf, "hello", 5) == 0);
+    mgr->release_retired_channel(new_wc);
+    ASSERT_TRUE(mgr->get_retired_channel(new_wc) == nullptr);
+
+    channel *rc = mgr->get_read_channel(fd);
+    channel *new_rc = mgr->switch_read_channel(fd);
+    ASSERT_TRUE(new_rc != rc && new_rc->capacity() == 8192);
+    ASSERT_TRUE(rc->next_offset == 0);
+    ASSERT_TRUE(mgr->get_read_channel(fd) == new_rc);
+    ASSERT_TRUE(mgr->get_retired_channel(new_rc) == rc);
+    mgr->release_retired_channel(new_rc);
+
+    ASSERT_TRUE(mgr->resize_channel(fd, capacity) == 0);
+
+    free(mgr);
+}
+
+TEST(channel_mgr, reopen_after_resize) {
+    channel_mgr *mgr = create_mgr();
+    ASSERT_TRUE(mgr != nullptr);
+
+    const int busid = 0x01010101;
+    size_t capacity[CHANNEL_LANE_COUNT] = { 0, 4096, 0 };
+    int fd = -1;
+    ASSERT_TRUE(mgr->register_channel(busid, getpid(), capacity, 0, fd) == 0);
+
+    // the process exits right after resizing, busd never switches
+    capacity[CHANNEL_LANE_DEFAULT] = 8192;
+    ASSERT_TRUE(mgr->resize_channel(fd, capacity) == 0);
+    ASSERT_TRUE(mgr->get_read_channel(fd)->next_offset != 0);
+    mgr->deregister_channel(busid);
+
+    // the old write ring is retired, the new read ring is pending
+    size_t space = used_space(mgr);
+    // the pending switch is finished, and the channel gets a new capacity
+    capacity[CHANNEL_LANE_DEFAULT] = 16384;
+    int new_fd = -1;
+    ASSERT_TRUE(mgr->register_channel(busid, getpid(), capacity, 0, new_fd) == 0);
+    ASSERT_TRUE(new_fd == fd);
+
+    // the 4096 rings of the previous process are released, not leaked, the
+    // 8192 rings stay until busd switches to the 16384 ones
+    ASSERT_TRUE(used_space(mgr) + 2 * ring_space(4096) == space + 2 * ring_space(16384));
+
+    channel *wc = mgr->get_write_channel(fd);
+    ASSERT_TRUE(wc->capacity() == 16384);
+
+    // busd switches the read channel as usual
+    channel *rc = mgr->get_read_channel(fd);
+    ASSERT_TRUE(rc->capacity() == 8192 && rc->next_offset != 0);
+    channel *new_rc = mgr->switch_read_channel(fd);
+    ASSERT_TRUE(new_rc->capacity() == 16384);
+
+    // and it can be resized again once the retired rings are drained
+    mgr->release_retired_channel(new_rc);
+    mgr->release_retired_channel(wc);
+    capacity[CHANNEL_LANE_DEFAULT] = 4096;
+    ASSERT_TRUE(mgr->resize_channel(fd, capacity) == 0);
+
+    free(mgr);
+}
@@ -0,0 +1,82 @@
+#include <gtest/gtest.h>
+#include <string.h>
+#include <libsk.h>
+#include <bus/detail/channel_stats.h>
+
+using namespace sk;
+using namespace sk::detail;
+
+typedef latency_histogram histogram;
+
+TEST(channel_stats, bucket_index) {
+    // the values below SUB_BUCKET_COUNT have their own buckets
+    for (int i = 0; i < histogram::SUB_BUCKET_COUNT; ++i) {
+        ASSERT_TRUE(histogram::index(i) == i);
+        ASSERT_TRUE(histogram::lower_bound(i) == static_cast<u64>(i));
+    }
+
+    // [8, 16) is still exact, then every group is split into 8 sub buckets
+    ASSERT_TRUE(histogram::index(8) == 8);
+    ASSERT_TRUE(histogram::index(15) == 15);
+    ASSERT_TRUE(histogram::index(16) == 16);
+    ASSERT_TRUE(histogram::index(17) == 16);
+    ASSERT_TRUE(histogram::index(18) == 17);
+    ASSERT_TRUE(histogram::index(31) == 23);
+    ASSERT_TRUE(histogram::index(32) == 24);
+    ASSERT_TRUE(histogram::index(35) == 24);
+    ASSERT_TRUE(histogram::index(36) == 25);
+    ASSERT_TRUE(histogram::lower_bound(17) == 18);
+    ASSERT_TRUE(histogram::lower_bound(25) == 36);
+
+    // the too large values fall into the last bucket
+    const u64 max_value = (1ULL << histogram::MAX_VALUE_BITS) - 1;
+    ASSERT_TRUE(histogram::index(max_value) == histogram::BUCKET_COUNT - 1);
+    ASSERT_TRUE(histogram::index(max_value + 1) == histogram::BUCKET_COUNT - 1);
+    ASSERT_TRUE(histogram::index(~0ULL) == histogram::BUCKET_COUNT - 1);
+    ASSERT_TRUE(histogram::index(max_value >> 1) == histogram::BUCKET_COUNT - 1 - histogram::SUB_BUCKET_COUNT);
+}
+
+TEST(channel_stats, bucket_bounds) {
+    // a bucket holds the values in [lower_bound(i), lower_bound(i + 1)),
+    // and its width is at most 1 / SUB_BUCKET_COUNT of the lower bound
+    for (int i = 0; i < histogram::BUCKET_COUNT - 1; ++i) {
+        const u64 lower = histogram::lower_bound(i);
+        const u64 upper = histogram::lower_bound(i + 1);
+        ASSERT_TRUE(lower < upper);
+        ASSERT_TRUE(histogram::index(lower) == i);
+        ASSERT_TRUE(histogram::index(upper - 1) == i);
+        ASSERT_TRUE(histogram::index(upper) == i + 1);
+
+        if (lower >= static_cast<u64>(histogram::SUB_BUCKET_COUNT)) {
+            ASSERT_TRUE((upper - lower) * histogram::SUB_BUCKET_COUNT <= lower);
+        }
+    }
+
+    ASSERT_TRUE(histogram::lower_bound(histogram::BUCKET_COUNT - 1) <
+                (1ULL << histogram::MAX_VALUE_BITS));
+}
+
+TEST(channel_stats, value_at) {
+    histogram h;
+    h.clear();
+    ASSERT_TRUE(h.value_at(50) == 0);
+
+    for (u64 v = 1; v <= 100; ++v)
+        h.record(v * 1000);
+
+    ASSERT_TRUE(h.count == 100 && h.max == 100000);
+    ASSERT_TRUE(h.sum == 5050 * 1000);
+
+    // the value reported is the lower bound of its bucket, so it's at
+    // most 1 / SUB_BUCKET_COUNT smaller than the real one
+    const double percentiles[] = { 1, 50, 90, 99, 100 };
+    for (size_t i = 0; i < sizeof(percentiles) / sizeof(percentiles[0]); ++i) {
+        const u64 expected = static_cast<u64>(percentiles[i]) * 1000;
+        const u64 value = h.value_at(percentiles[i]);
+        ASSERT_TRUE(value <= expected);
+        ASSERT_TRUE((expected - value) * histogram::SUB_BUCKET_COUNT <= expected);
+    }
+
+    ASSERT_TRUE(h.value_at(-1) == h.value_at(0));
+    ASSERT_TRUE(h.value_at(200) == h.value_at(100));
+}
@@ -0,0 +1,82 @@
+#include <string>
+#include <vector>
+#include <gtest/gtest.h>
+#include "libsk.h"
+
+using namespace sk;
+
+static std::string round_trip(const std::string& data, int *compressed_size) {
+    std::vector<char> compressed(lz4_compress_bound(data.length()));
+    int ret = lz4_compress(data.data(), data.length(), compressed.data(), compressed.size());
+    if (compressed_size) *compressed_size = ret;
+    if (ret < 0) return std::string();
+
+    std::vector<char> decompressed(data.length() + 1);
+    int len = lz4_decompress(compressed.data(), ret, decompressed.data(), decompressed.size());
+    if (len < 0) return std::string();
+
+    return std::string(decompressed.data(), len);
+}
+
+TEST(compress_helper, normal) {
+    int size = 0;
+    ASSERT_TRUE(round_trip("", &size) == "");
+    ASSERT_TRUE(size == 1);
+
+    ASSERT_TRUE(round_trip("abc", &size) == "abc");
+    ASSERT_TRUE(size == 4);
+
+    std::string repeated;
+    for (int i = 0; i < 10000; ++i)
+        repeated.append("{\"id\":").append(std::to_string(i % 100)).append(",\"name\":\"abc\"},");
+    ASSERT_TRUE(round_trip(repeated, &size) == repeated);
+    ASSERT_TRUE(size > 0 && static_cast<size_t>(size) < repeated.length() / 10);
+
+    std::string run(100000, 'x');
+    ASSERT_TRUE(round_trip(run, &size) == run);
+    ASSERT_TRUE(size > 0 && static_cast<size_t>(size) < 1000);
+
+    std::string random;
+    srand(1);
+    for (int i = 0; i < 70000; ++i)
+        random.push_back(static_cast<char>(rand()));
+    ASSERT_TRUE(round_trip(random, &size) == random);
+    ASSERT_TRUE(size > 0 && static_cast<size_t>(size) <= lz4_compress_bound(random.length()));
+
+    for (size_t len = 0; len < 300; ++len) {
+        std::string str;
+        for (size_t i = 0; i < len; ++i)
+            str.push_back("ab"[rand() % 2]);
+        ASSERT_TRUE(round_trip(str, nullptr) == str);
+    }
+}
+
+TEST(compress_helper, error) {
+    std::string data;
+    for (int i = 0; i < 1000; ++i)
+        data.append("hello world ");
+
+    std::vector<char> compressed(lz4_compress_bound(data.length()));
+    int size = lz4_compress(data.data(), data.length(), compressed.data(), compressed.size());
+    ASSERT_TRUE(size > 0);
+
+    // not enough space for the compressed data
+    int ret = lz4_compress(data.data(), data.length(), compressed.data(), size - 1);
+    ASSERT_TRUE(ret == -ENOSPC);
+
+    // not enough space for the decompressed data
+    std::vector<char> decompressed(data.length());
+    ret = lz4_decompress(compressed.data(), size, decompressed.data(), data.length() - 1);
+    ASSERT_TRUE(ret == -EINVAL);
+
+    // truncated data never overflows the output
+    for (int len = 0; len < size; ++len) {
+        ret = lz4_decompress(compressed.data(), len, decompressed.data(), decompressed.size());
+        ASSERT_TRUE(ret <= static_cast<int>(data.length()));
+    }
+
+    // an offset pointing before the output
+    const char bad[] = {0x10, 'a', 0x02, 0x00};
+    ret = lz4_decompress(bad, sizeof(bad), decompressed.data(), decompressed.size());
+    ASSERT_TRUE(ret == -EINVAL);
+}
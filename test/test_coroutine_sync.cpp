@@ -0,0 +1,162 @@
+#include <gtest/gtest.h>
+#include <libsk.h>
+#include <coroutine/coroutine.h>
+#include <coroutine/coroutine_sync.h>
+
+using namespace sk;
+using namespace sk::detail;
+
+// the coroutines printing logs need a larger stack than the default one
+static const size_t STACK_SIZE = 64 * 1024;
+
+// run fn in a coroutine, returns after the loop is stopped, the checks
+// inside use EXPECT_* as a failed ASSERT_* returns without stopping it
+static void run(const coroutine_function& fn) {
+    coroutine_init(uv_default_loop());
+    coroutine_create("main", [&fn]() {
+        fn();
+        uv_stop(uv_default_loop());
+    }, STACK_SIZE);
+
+    coroutine_schedule();
+    coroutine_fini();
+}
+
+TEST(coroutine_sync, wait_queue_notify) {
+    run([]() {
+        wait_queue q;
+        int ret1 = 1, ret2 = 1;
+        coroutine_create("w1", [&]() { ret1 = q.wait(); }, STACK_SIZE);
+        coroutine_create("w2", [&]() { ret2 = q.wait(1000); }, STACK_SIZE);
+        coroutine_yield();
+        EXPECT_TRUE(!q.empty());
+
+        // notified in the order they wait
+        EXPECT_TRUE(q.notify_one());
+        coroutine_yield();
+        EXPECT_TRUE(ret1 == 0 && ret2 == 1);
+
+        EXPECT_TRUE(q.notify_one());
+        coroutine_yield();
+        EXPECT_TRUE(ret2 == 0);
+
+        EXPECT_TRUE(q.empty());
+        EXPECT_TRUE(!q.notify_one());
+    });
+}
+
+TEST(coroutine_sync, wait_queue_timeout) {
+    run([]() {
+        wait_queue q;
+        int ret1 = 1, ret2 = 1;
+        coroutine_create("w1", [&]() { ret1 = q.wait(10); }, STACK_SIZE);
+        coroutine_create("w2", [&]() { ret2 = q.wait(); }, STACK_SIZE);
+        coroutine_sleep(50);
+
+        // the one timed out is removed from the queue, and never notified
+        EXPECT_TRUE(ret1 == -ETIMEDOUT);
+        EXPECT_TRUE(!q.empty());
+
+        EXPECT_TRUE(q.notify_one());
+        coroutine_yield();
+        EXPECT_TRUE(ret2 == 0);
+        EXPECT_TRUE(q.empty());
+    });
+}
+
+TEST(coroutine_sync, wait_queue_wake_up) {
+    run([]() {
+        wait_queue q;
+        int ret = 1;
+        coroutine *c = coroutine_create("w", [&]() { ret = q.wait(); }, STACK_SIZE);
+        coroutine_yield();
+
+        // woken up without a notification, it goes on waiting
+        coroutine_wake_up(c);
+        coroutine_yield();
+        coroutine_yield();
+        EXPECT_TRUE(ret == 1);
+        EXPECT_TRUE(!q.empty());
+
+        q.notify_all();
+        coroutine_yield();
+        EXPECT_TRUE(ret == 0);
+        EXPECT_TRUE(q.empty());
+    });
+}
+
+TEST(coroutine_sync, mutex_handoff) {
+    run([]() {
+        coroutine_mutex m;
+        int order = 0, first = 0, second = 0;
+        EXPECT_TRUE(m.lock() == 0);
+
+        coroutine_create("l1", [&]() {
+            EXPECT_TRUE(m.lock() == 0);
+            first = ++order;
+            m.unlock();
+        }, STACK_SIZE);
+        coroutine_create("l2", [&]() {
+            EXPECT_TRUE(m.lock() == 0);
+            second = ++order;
+            m.unlock();
+        }, STACK_SIZE);
+        coroutine_yield();
+
+        // handed over to the waiters in order, never left locked
+        m.unlock();
+        coroutine_sleep(10);
+        EXPECT_TRUE(first == 1 && second == 2);
+        EXPECT_TRUE(!m.locked());
+        EXPECT_TRUE(m.try_lock());
+        m.unlock();
+    });
+}
+
+struct uv_wait_result {
+    coroutine_wait_group *wg;
+    coroutine_mutex *m;
+    int wg_ret;
+    int mutex_ret;
+};
+
+TEST(coroutine_sync, cannot_wait) {
+    coroutine_init(uv_default_loop());
+
+    // outside any coroutine, nothing blocks
+    coroutine_wait_group wg;
+    wg.add(1);
+    EXPECT_TRUE(wg.wait() == -EPERM);
+
+    coroutine_semaphore sem(0);
+    EXPECT_TRUE(sem.acquire() == -EPERM);
+    EXPECT_TRUE(!sem.acquire_for(10));
+
+    coroutine_create("main", [&wg]() {
+        coroutine_mutex m;
+        EXPECT_TRUE(m.lock() == 0);
+
+        // the callbacks run in the uv coroutine, which cannot wait
+        uv_wait_result r = { &wg, &m, 1, 1 };
+        uv_timer_t timer;
+        uv_timer_init(uv_default_loop(), &timer);
+        timer.data = &r;
+        uv_timer_start(&timer, [](uv_timer_t *t) {
+            uv_wait_result *r = static_cast<uv_wait_result *>(t->data);
+            r->wg_ret = r->wg->wait();
+            r->mutex_ret = r->m->lock();
+        }, 1, 0);
+
+        coroutine_sleep(20);
+        uv_close(reinterpret_cast<uv_handle_t *>(&timer), nullptr);
+        coroutine_sleep(10);
+
+        EXPECT_TRUE(r.wg_ret == -EPERM);
+        EXPECT_TRUE(r.mutex_ret == -EPERM);
+        m.unlock();
+        uv_stop(uv_default_loop());
+    }, STACK_SIZE);
+
+    coroutine_schedule();
+    coroutine_fini();
+}
@@ -0,0 +1,147 @@
+#include <gtest/gtest.h>
+#include <string.h>
+#include <vector>
+#include "message_queue.h"
+
+TEST(message_queue, normal) {
+    message_pool pool(4);
+    message_queue q(&pool, 1024, false);
+
+    size_t len = 0;
+    ASSERT_TRUE(q.empty());
+    ASSERT_TRUE(q.front(len) == nullptr);
+
+    const char *msgs[] = { "a", "hello", "hello world" };
+    for (size_t i = 0; i < 3; ++i) {
+        ASSERT_TRUE(q.push(msgs[i], strlen(msgs[i]), i) == 0);
+    }
+
+    ASSERT_TRUE(q.count() == 3);
+    ASSERT_TRUE(q.size() == 1 + 5 + 11);
+
+    for (size_t i = 0; i < 3; ++i) {
+        void *data = q.front(len);
+        ASSERT_TRUE(data != nullptr);
+        ASSERT_TRUE(len == strlen(msgs[i]));
+        ASSERT_TRUE(memcmp(data, msgs[i], len) == 0);
+        q.pop();
+    }
+
+    ASSERT_TRUE(q.empty());
+    ASSERT_TRUE(q.size() == 0);
+    ASSERT_TRUE(q.drop_count() == 0);
+}
+
+TEST(message_queue, chunked_pool) {
+    message_pool pool(2);
+
+    {
+        message_queue q(&pool, size_t(-1), false);
+
+        // a few chunks are filled, and the order is kept across them
+        std::vector<char> msg(1000);
+        const int count = 3 * message_pool::CHUNK_SIZE / msg.size();
+        for (int i = 0; i < count; ++i) {
+            memset(&msg[0], i & 0xFF, msg.size());
+            ASSERT_TRUE(q.push(&msg[0], msg.size(), i) == 0);
+        }
+
+        ASSERT_TRUE(pool.used_count() >= 3);
+
+        // a message larger than a chunk gets a chunk of its own
+        std::vector<char> big(message_pool::CHUNK_SIZE * 2, 'x');
+        size_t used = pool.used_count();
+        ASSERT_TRUE(q.push(&big[0], big.size(), count) == 0);
+        ASSERT_TRUE(pool.used_count() == used + 1);
+
+        size_t len = 0;
+        for (int i = 0; i < count; ++i) {
+            char *data = static_cast<char *>(q.front(len));
+            ASSERT_TRUE(data && len == msg.size());
+            ASSERT_TRUE(data[0] == static_cast<char>(i & 0xFF));
+            ASSERT_TRUE(data[len - 1] == static_cast<char>(i & 0xFF));
+            q.pop();
+        }
+
+        char *data = static_cast<char *>(q.front(len));
+        ASSERT_TRUE(data && len == big.size() && data[len - 1] == 'x');
+        q.pop();
+
+        // the consumed chunks are recycled, the pool keeps 2 of them at most
+        ASSERT_TRUE(q.empty());
+        ASSERT_TRUE(pool.used_count() == 0);
+        ASSERT_TRUE(pool.free_count() == 2);
+    }
+
+    // the pooled chunks are reused by another queue
+    message_queue q(&pool, 1024, false);
+    ASSERT_TRUE(q.push("hello", 5, 0) == 0);
+    ASSERT_TRUE(pool.free_count() == 1);
+    ASSERT_TRUE(pool.used_count() == 1);
+}
+
+TEST(message_queue, drop_new) {
+    message_pool pool(1);
+    message_queue q(&pool, 10, false);
+
+    ASSERT_TRUE(q.push("12345", 5, 0) == 0);
+    ASSERT_TRUE(q.push("67890", 5, 1) == 0);
+    ASSERT_TRUE(q.push("x", 1, 2) == -ENOSPC);
+
+    // a message larger than the limit is never cached
+    ASSERT_TRUE(q.push("12345678901", 11, 3) == -ENOSPC);
+
+    ASSERT_TRUE(q.count() == 2);
+    ASSERT_TRUE(q.drop_count() == 2);
+
+    size_t len = 0;
+    void *data = q.front(len);
+    ASSERT_TRUE(len == 5 && memcmp(data, "12345", 5) == 0);
+}
+
+TEST(message_queue, drop_oldest) {
+    message_pool pool(1);
+    message_queue q(&pool, 10, true);
+
+    ASSERT_TRUE(q.push("12345", 5, 0) == 0);
+    ASSERT_TRUE(q.push("67890", 5, 1) == 0);
+
+    // the oldest ones are dropped until the new one fits
+    ASSERT_TRUE(q.push("abcdefg", 7, 2) == 0);
+    ASSERT_TRUE(q.count() == 1);
+    ASSERT_TRUE(q.size() == 7);
+    ASSERT_TRUE(q.drop_count() == 2);
+
+    size_t len = 0;
+    void *data = q.front(len);
+    ASSERT_TRUE(len == 7 && memcmp(data, "abcdefg", 7) == 0);
+
+    // it's still dropped if it cannot fit in an empty queue
+    ASSERT_TRUE(q.push("12345678901", 11, 3) == -ENOSPC);
+    ASSERT_TRUE(q.count() == 1);
+    ASSERT_TRUE(q.drop_count() == 3);
+}
+
+TEST(message_queue, expire) {
+    message_pool pool(1);
+    message_queue q(&pool, 1024, false);
+
+    for (u64 ctime = 10; ctime <= 50; ctime += 10) {
+        ASSERT_TRUE(q.push(&ctime, sizeof(ctime), ctime) == 0);
+    }
+
+    ASSERT_TRUE(q.expire(5) == 0);
+
+    // the ones created before the deadline are dropped, the deadline itself is kept
+    ASSERT_TRUE(q.expire(30) == 2);
+    ASSERT_TRUE(q.count() == 3);
+    ASSERT_TRUE(q.drop_count() == 2);
+
+    size_t len = 0;
+    u64 *ctime = static_cast<u64 *>(q.front(len));
+    ASSERT_TRUE(ctime && len == sizeof(u64) && *ctime == 30);
+
+    ASSERT_TRUE(q.expire(u64(-1)) == 3);
+    ASSERT_TRUE(q.empty());
+    ASSERT_TRUE(pool.used_count() == 0);
+}
@@ -84,6 +84,25 @@ TEST(shm_mgr, metadata_allocator) {
     shm_fini();
 }
 
+TEST(shm_mgr, singleton) {
+    int ret = shm_init(SHM_PATH_PREFIX, false);
+    ASSERT_TRUE(ret == 0);
+
+    shm_ptr<int> ptr = shm_get_singleton<int>(SHM_SINGLETON_RESERVED_MAX, 77);
+    ASSERT_TRUE(ptr && *ptr == 77);
+    ASSERT_TRUE(shm_has_singleton(SHM_SINGLETON_RESERVED_MAX));
+
+    // the reserved ids are not available to users
+    ASSERT_TRUE(!shm_get_singleton<int>(SHM_SINGLETON_SHM_TIMER_MGR, 77));
+    ASSERT_TRUE(!shm_get_singleton<int>(SHM_SINGLETON_USER_MAX, 77));
+    ASSERT_TRUE(!shm_get_singleton<int>(SHM_SINGLETON_SHM_TASK_MGR, 77));
+    ASSERT_TRUE(!detail::shm_has_reserved_singleton(SHM_SINGLETON_SHM_TASK_MGR));
+
+    shm_delete_singleton<int>(SHM_SINGLETON_RESERVED_MAX);
+    ASSERT_TRUE(!shm_has_singleton(SHM_SINGLETON_RESERVED_MAX));
+    shm_fini();
+}
+
 TEST(shm_mgr, size_map) {
     // TODO: add test here
 }
@@ -0,0 +1,127 @@
+#include <gtest/gtest.h>
+#include <iostream>
+#include <libsk.h>
+#include <coroutine/detail/timer_wheel.h>
+
+using namespace sk;
+using namespace sk::detail;
+
+// move the wheel forward ms by ms like the loop does, returns when the first node expires
+static u64 run_until_expired(timer_wheel& w, u64 now, u64 end, timer_wheel::node *expired) {
+    while (now < end) {
+        u64 timeout = w.next_timeout();
+        if (timeout == u64(-1)) break;
+
+        now += timeout;
+        w.advance(now, expired);
+        if (expired->next != expired) break;
+    }
+
+    return now;
+}
+
+TEST(timer_wheel, normal) {
+    timer_wheel w;
+    timer_wheel::node expired;
+    timer_wheel::init_list(&expired);
+
+    ASSERT_TRUE(w.empty());
+    ASSERT_TRUE(w.size() == 0);
+    ASSERT_TRUE(w.next_timeout() == u64(-1));
+
+    timer_wheel::node n1, n2, n3;
+    w.add(&n1, 0, 10);
+    w.add(&n2, 0, 20);
+    w.add(&n3, 0, 20);
+    ASSERT_TRUE(w.size() == 3);
+    ASSERT_TRUE(n1.linked() && n2.linked() && n3.linked());
+    ASSERT_TRUE(w.next_timeout() == 10);
+
+    w.advance(9, &expired);
+    ASSERT_TRUE(timer_wheel::pop_front(&expired) == nullptr);
+    ASSERT_TRUE(w.next_timeout() == 1);
+
+    w.advance(10, &expired);
+    ASSERT_TRUE(timer_wheel::pop_front(&expired) == &n1);
+    ASSERT_TRUE(timer_wheel::pop_front(&expired) == nullptr);
+    ASSERT_TRUE(!n1.linked());
+    ASSERT_TRUE(w.size() == 2);
+
+    w.remove(&n2);
+    ASSERT_TRUE(!n2.linked());
+    ASSERT_TRUE(w.size() == 1);
+    ASSERT_TRUE(w.next_timeout() == 10);
+
+    // removing an unlinked node is harmless
+    w.remove(&n2);
+    ASSERT_TRUE(w.size() == 1);
+
+    w.advance(100, &expired);
+    ASSERT_TRUE(timer_wheel::pop_front(&expired) == &n3);
+    ASSERT_TRUE(w.empty());
+    ASSERT_TRUE(w.next_timeout() == u64(-1));
+}
+
+TEST(timer_wheel, expired_at_once) {
+    timer_wheel w;
+    timer_wheel::node expired;
+    timer_wheel::init_list(&expired);
+
+    // a node never expires in the slot being processed
+    timer_wheel::node n;
+    w.add(&n, 5, 0);
+    ASSERT_TRUE(n.expire == 6);
+    ASSERT_TRUE(w.next_timeout() == 1);
+
+    w.advance(6, &expired);
+    ASSERT_TRUE(timer_wheel::pop_front(&expired) == &n);
+}
+
+TEST(timer_wheel, cascade) {
+    timer_wheel w;
+    timer_wheel::node expired;
+    timer_wheel::init_list(&expired);
+
+    const u64 timeouts[] = { 255, 256, 257, 1000, 65535, 65536, 70000, 20000000 };
+    const size_t count = sizeof(timeouts) / sizeof(timeouts[0]);
+
+    timer_wheel::node nodes[count];
+    for (size_t i = 0; i < count; ++i) {
+        w.add(&nodes[i], 0, timeouts[i]);
+    }
+
+    // every node expires exactly at its deadline
+    u64 now = 0;
+    for (size_t i = 0; i < count; ++i) {
+        now = run_until_expired(w, now, u64(-1), &expired);
+        ASSERT_TRUE(now == timeouts[i]);
+        ASSERT_TRUE(timer_wheel::pop_front(&expired) == &nodes[i]);
+        ASSERT_TRUE(timer_wheel::pop_front(&expired) == nullptr);
+    }
+
+    ASSERT_TRUE(w.empty());
+}
+
+TEST(timer_wheel, upper_level_first) {
+    timer_wheel w;
+    timer_wheel::node expired;
+    timer_wheel::init_list(&expired);
+
+    // n1 is put in level 1, and n2, which expires later, in level 0
+    timer_wheel::node n1, n2;
+    w.add(&n1, 10, 290);
+    w.advance(100, &expired);
+    w.add(&n2, 100, 250);
+
+    // the cascade at 256 comes before n2
+    ASSERT_TRUE(w.next_timeout() == 156);
+
+    u64 now = run_until_expired(w, 100, u64(-1), &expired);
+    ASSERT_TRUE(now == 300);
+    ASSERT_TRUE(timer_wheel::pop_front(&expired) == &n1);
+
+    now = run_until_expired(w, now, u64(-1), &expired);
+    ASSERT_TRUE(now == 350);
+    ASSERT_TRUE(timer_wheel::pop_front(&expired) == &n2);
+    ASSERT_TRUE(w.empty());
+}
@@ -0,0 +1,114 @@
+#include <gtest/gtest.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <libsk.h>
+#include <coroutine/detail/work_deque.h>
+
+using namespace sk;
+using namespace sk::detail;
+
+TEST(work_deque, normal) {
+    work_deque<int> q(4);
+    ASSERT_TRUE(q.empty());
+    ASSERT_TRUE(q.steal() == nullptr);
+
+    int values[3] = { 1, 2, 3 };
+    for (int i = 0; i < 3; ++i) {
+        q.push(&values[i]);
+    }
+
+    ASSERT_TRUE(q.size() == 3);
+
+    // taken from the top, in the order they are pushed
+    for (int i = 0; i < 3; ++i) {
+        ASSERT_TRUE(q.steal() == &values[i]);
+    }
+
+    ASSERT_TRUE(q.empty());
+    ASSERT_TRUE(q.steal() == nullptr);
+}
+
+TEST(work_deque, grow) {
+    work_deque<int> q(2);
+
+    // the ring grows a few times, the elements are kept in order
+    const int count = 100;
+    std::vector<int> values(count);
+    for (int i = 0; i < count; ++i) {
+        values[i] = i;
+        q.push(&values[i]);
+
+        // the top moves, so the elements wrap around the ring
+        if (i % 3 == 0) {
+            ASSERT_TRUE(q.steal() == &values[i / 3]);
+        }
+    }
+
+    int expected = (count - 1) / 3 + 1;
+    ASSERT_TRUE(q.size() == static_cast<size_t>(count - expected));
+
+    while (int *x = q.steal()) {
+        ASSERT_TRUE(*x == expected);
+        ++expected;
+    }
+
+    ASSERT_TRUE(expected == count);
+    ASSERT_TRUE(q.empty());
+}
+
+TEST(work_deque, steal_racing_push) {
+    work_deque<int> q(2);
+
+    const int count = 200000;
+    const int thieves = 4;
+    std::vector<int> values(count);
+    std::vector<std::atomic<int>> taken(count);
+    for (int i = 0; i < count; ++i) {
+        values[i] = i;
+        taken[i].store(0);
+    }
+
+    std::atomic<bool> done(false);
+    std::atomic<int> total(0);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < thieves; ++t) {
+        threads.push_back(std::thread([&]() {
+            int last = -1;
+            while (true) {
+                int *x = q.steal();
+                if (!x) {
+                    if (done.load() && q.empty()) break;
+                    continue;
+                }
+
+                // a thief sees the elements in the order they are pushed
+                EXPECT_TRUE(*x > last);
+                last = *x;
+
+                taken[*x].fetch_add(1);
+                total.fetch_add(1);
+            }
+        }));
+    }
+
+    // the owner pushes while the ring grows, and steals too
+    for (int i = 0; i < count; ++i) {
+        q.push(&values[i]);
+        if (i % 7 == 0) {
+            if (int *x = q.steal()) {
+                taken[*x].fetch_add(1);
+                total.fetch_add(1);
+            }
+        }
+    }
+
+    done.store(true);
+    for (auto& t : threads) t.join();
+
+    // every element is taken exactly once
+    ASSERT_TRUE(total.load() == count);
+    for (int i = 0; i < count; ++i) {
+        ASSERT_TRUE(taken[i].load() == 1);
+    }
+}
@@ -49,6 +49,9 @@ class FieldInfo:
         self._def  = None        # which def this field belongs
         self._type = None
         self.name  = None
+        # the field is optional if it has a default value, which is given
+        # in the definition like "int count = 1;", it's used as it is
+        self.default = None
         # will be set only if _type is vector of customized type
         # if the field is std::vector, real_type is the type in vector, if it is scalar
         # type, real_type is a string, otherwise, real_type referenced to ConfigDef instance
@@ -60,6 +63,8 @@ class FieldInfo:
 
     def info(self, indent):
         ret = '%stype: %s, name: %s' % (' ' * indent, self._type, self.name)
+        if self.default is not None:
+            ret += ', default: %s' % (self.default)
         if self._type['type'] in ('vector', 'custom'):
             assert self.real_type
             if isinstance(self.real_type, str):
@@ -101,11 +106,12 @@ def build_config_def(root_defs, namespace, parent, name):
 
     return _def
 
-def build_field_info(root_defs, sup_def, type_str, name):
+def build_field_info(root_defs, sup_def, type_str, name, default):
     assert sup_def
     field = FieldInfo()
     field._def = sup_def
     field.name = name
+    field.default = default
 
     if type_str == 'int':
         type_str = 's32'
@@ -135,6 +141,11 @@ def build_field_info(root_defs, sup_def, type_str, name):
             print 'cannot find type: %s' % (type_str)
             sys.exit(-1)
 
+    # vectors are optional already, and customized types have no defaults
+    if default is not None and field._type['type'] in ('vector', 'custom'):
+        print 'default value not supported: %s' % (name)
+        sys.exit(-1)
+
     return field
 
 def read_content(filename):
@@ -216,12 +227,13 @@ def parse_content(content):
             curr_def.load_func = True
             continue
 
-        # the field line
-        ret = re.search('^ *([_a-zA-Z0-9<>:]+) +([_a-zA-Z0-9]+);$', line)
+        # the field line, with an optional default value
+        ret = re.search('^ *([_a-zA-Z0-9<>:]+) +([_a-zA-Z0-9]+)(?: *= *(.+?))? *;$', line)
         if ret:
             type_str = ret.group(1)
             name = ret.group(2)
-            field = build_field_info(def_list, curr_def, type_str, name)
+            default = ret.group(3)
+            field = build_field_info(def_list, curr_def, type_str, name, default)
             curr_def.fields.append(field)
             continue
 
@@ -323,8 +335,23 @@ $fields_src
         return ret;
 '''
 
+    # the default value is taken if the node is missing
+    optional_field_template = '''
+    if (node.child("$field_name")) {
+        ret = load_from_xml_node(value.$field_name, node.child("$field_name"), "$field_name");
+        if (ret != 0)
+            return ret;
+    } else {
+        value.$field_name = $default;
+    }
+'''
+
     fields_src = ''
     for field in _def.fields:
+        if field.default is not None:
+            fields_src += string.Template(optional_field_template).substitute(field_name = field.name, default = field.default)
+            continue
+
         node_arg = 'node.child("%s")' % (field.name)
         if field._type['type'] == 'vector':
             node_arg = 'node.children("%s")' % (field.name)